@@ -0,0 +1,21 @@
+# Converts INPUT_FILE into the C header OUTPUT_FILE, which defines the zero terminated
+# char array VARIABLE_NAME containing the file contents.
+# A byte array is used instead of a string literal, because MSVC limits the length of string literals.
+#
+# Usage: cmake -DINPUT_FILE=... -DOUTPUT_FILE=... -DVARIABLE_NAME=... -P EmbedFile.cmake
+
+file(READ "${INPUT_FILE}" content HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+# break the array into lines of 16 bytes, cmake regexes don't support {n} quantifiers
+set(line "")
+foreach(i RANGE 15)
+	set(line "${line}0x[0-9a-f][0-9a-f],")
+endforeach()
+string(REGEX REPLACE "(${line})" "\\1\n\t" bytes "${bytes}")
+get_filename_component(inputName "${INPUT_FILE}" NAME)
+file(WRITE "${OUTPUT_FILE}.tmp"
+	"// generated from ${inputName} by EmbedFile.cmake, do not edit\n"
+	"static const char ${VARIABLE_NAME}[] = {\n\t${bytes}0x00\n};\n")
+# only touch the header if the content changed to avoid needless recompilation
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT_FILE}.tmp" "${OUTPUT_FILE}")
+file(REMOVE "${OUTPUT_FILE}.tmp")
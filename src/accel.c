@@ -0,0 +1,478 @@
+#include "accel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "octree.h"
+#include "bvh.h"
+#include "grid.h"
+#include "memstats.h"
+#include "utils/math.h"
+#include "utils/simd.h"
+
+static const char* accelNames[ACCEL_TYPE_COUNT] = { "octree", "bvh", "grid" };
+
+BoundingBox accel_getSceneBoundingBox(Scene* scene) {
+	BoundingBox boundingBox = { 0 };
+	for (uint32_t i = 0; i < scene->sphereCount; i++) {
+		Sphere* sphere = &scene->spheres[i];
+		Vec3 extremePoints[6] = {
+			vec3_add(sphere->position, (Vec3) { { 0.0f, 0.0f, sphere->radius } }), // FRONT
+			vec3_add(sphere->position, (Vec3) { { 0.0f, 0.0f, -sphere->radius } }), // BACK
+			vec3_add(sphere->position, (Vec3) { { 0.0f, sphere->radius, 0.0f } }), // TOP
+			vec3_add(sphere->position, (Vec3) { { 0.0f, -sphere->radius, 0.0f } }), // BOTTOM
+			vec3_add(sphere->position, (Vec3) { { -sphere->radius, 0.0f, 0.0f } }), // LEFT
+			vec3_add(sphere->position, (Vec3) { { sphere->radius, 0.0f, 0.0f } }) // RIGHT
+		};
+		for (uint32_t x = 0; x < 6; x++) {
+			Vec3* v = &extremePoints[x];
+			if (v->x < boundingBox.bottomLeftFrontCorner.x) {
+				boundingBox.bottomLeftFrontCorner.x = v->x;
+			}
+			if (v->y < boundingBox.bottomLeftFrontCorner.y) {
+				boundingBox.bottomLeftFrontCorner.y = v->y;
+			}
+			if (v->z < boundingBox.bottomLeftFrontCorner.z) {
+				boundingBox.bottomLeftFrontCorner.z = v->z;
+			}
+
+			if (v->x > boundingBox.topRightBackCorner.x) {
+				boundingBox.topRightBackCorner.x = v->x;
+			}
+			if (v->y > boundingBox.topRightBackCorner.y) {
+				boundingBox.topRightBackCorner.y = v->y;
+			}
+			if (v->z > boundingBox.topRightBackCorner.z) {
+				boundingBox.topRightBackCorner.z = v->z;
+			}
+		}
+	}
+	for (uint32_t i = 0; i < scene->triangleCount; i++) {
+		Triangle* triangle = &scene->triangles[i];
+		Vec3 vertices[3] = { triangle->v0, triangle->v1, triangle->v2 };
+		for (uint32_t x = 0; x < 3; x++) {
+			Vec3* v = &vertices[x];
+			if (v->x < boundingBox.bottomLeftFrontCorner.x) {
+				boundingBox.bottomLeftFrontCorner.x = v->x;
+			}
+			if (v->y < boundingBox.bottomLeftFrontCorner.y) {
+				boundingBox.bottomLeftFrontCorner.y = v->y;
+			}
+			if (v->z < boundingBox.bottomLeftFrontCorner.z) {
+				boundingBox.bottomLeftFrontCorner.z = v->z;
+			}
+
+			if (v->x > boundingBox.topRightBackCorner.x) {
+				boundingBox.topRightBackCorner.x = v->x;
+			}
+			if (v->y > boundingBox.topRightBackCorner.y) {
+				boundingBox.topRightBackCorner.y = v->y;
+			}
+			if (v->z > boundingBox.topRightBackCorner.z) {
+				boundingBox.topRightBackCorner.z = v->z;
+			}
+		}
+	}
+	return boundingBox;
+}
+
+static void accel_shrinkToFit(Accel* accel) {
+	if (accel->nodeCapacity > accel->nodeCount) {
+		accel->nodes = realloc(accel->nodes, sizeof(AccelNode) * accel->nodeCount);
+		memstats_reallocate(MEMSTATS_ACCEL, sizeof(AccelNode) * accel->nodeCapacity, sizeof(AccelNode) * accel->nodeCount);
+		accel->nodeCapacity = accel->nodeCount;
+	}
+	if (accel->indexCapacity > accel->indexCount) {
+		accel->indexes = realloc(accel->indexes, sizeof(uint32_t) * accel->indexCount);
+		memstats_reallocate(MEMSTATS_ACCEL, sizeof(uint32_t) * accel->indexCapacity, sizeof(uint32_t) * accel->indexCount);
+		accel->indexCapacity = accel->indexCount;
+	}
+}
+
+bool accel_intersectSphere(Sphere* sphere, BoundingBox boundingBox) {
+	float distSquared = sphere->radius * sphere->radius;
+	if (sphere->position.x < boundingBox.bottomLeftFrontCorner.x) {
+		distSquared -= (sphere->position.x - boundingBox.bottomLeftFrontCorner.x) * (sphere->position.x - boundingBox.bottomLeftFrontCorner.x);
+	}
+	else if (sphere->position.x > boundingBox.topRightBackCorner.x) {
+		distSquared -= (sphere->position.x - boundingBox.topRightBackCorner.x) * (sphere->position.x - boundingBox.topRightBackCorner.x);
+	}
+
+	if (sphere->position.y < boundingBox.bottomLeftFrontCorner.y) {
+		distSquared -= (sphere->position.y - boundingBox.bottomLeftFrontCorner.y) * (sphere->position.y - boundingBox.bottomLeftFrontCorner.y);
+	}
+	else if (sphere->position.y > boundingBox.topRightBackCorner.y) {
+		distSquared -= (sphere->position.y - boundingBox.topRightBackCorner.y) * (sphere->position.y - boundingBox.topRightBackCorner.y);
+	}
+
+	// @POSSIBLE BUG: i think i may have to swap the condition here
+	if (sphere->position.z < boundingBox.bottomLeftFrontCorner.z) {
+		distSquared -= (sphere->position.z - boundingBox.bottomLeftFrontCorner.z) * (sphere->position.z - boundingBox.bottomLeftFrontCorner.z);
+	}
+	else if (sphere->position.z > boundingBox.topRightBackCorner.z) {
+		distSquared -= (sphere->position.z - boundingBox.topRightBackCorner.z) * (sphere->position.z - boundingBox.topRightBackCorner.z);
+	}
+
+	return distSquared > 0;
+}
+
+static void accel_project(Vec3* points, uint32_t pointCount, Vec3 axis, float* min, float* max) {
+	*min = INFINITY;
+	*max = -INFINITY;
+	for (uint32_t i = 0; i < pointCount; i++) {
+		Vec3 point = points[i];
+		float val = vec3_dot(axis, point);
+		if (val < *min) {
+			*min = val;
+		}
+		if (val > *max) {
+			*max = val;
+		}
+	}
+}
+
+bool accel_intersectTriangle(Triangle* triangle, BoundingBox boundingBox) {
+	float triangleMin;
+	float triangleMax;
+	float boxMin;
+	float boxMax;
+
+	Vec3 boxNormals[3] = {
+		(Vec3) { { 1.0f, 0.0f, 0.0f } },
+		(Vec3) { { 0.0f, 1.0f, 0.0f } },
+		(Vec3) { { 0.0f, 0.0f, 1.0f } }
+	};
+
+	Vec3 triangleVertices[3] = {
+		triangle->v0,
+		triangle->v1,
+		triangle->v2
+	};
+
+	float boundingBoxV0[3] = {
+		boundingBox.bottomLeftFrontCorner.x,
+		boundingBox.bottomLeftFrontCorner.y,
+		boundingBox.bottomLeftFrontCorner.z
+	};
+
+	float boundingBoxV1[3] = {
+		boundingBox.topRightBackCorner.x,
+		boundingBox.topRightBackCorner.y,
+		boundingBox.topRightBackCorner.z
+	};
+
+	for (uint32_t i = 0; i < 3; i++) {
+		Vec3 n = boxNormals[i];
+		accel_project(triangleVertices, 3, n, &triangleMin, &triangleMax);
+		if (triangleMax < boundingBoxV0[i] || triangleMin > boundingBoxV1[i]) {
+			return false;
+		}
+	}
+
+	Vec3 boxCorners[8] = {
+		boundingBox.bottomLeftFrontCorner, // bottom left front
+		(Vec3) { { boundingBox.topRightBackCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.bottomLeftFrontCorner.z } }, // bottom right front
+		(Vec3) { { boundingBox.bottomLeftFrontCorner.x, boundingBox.topRightBackCorner.y, boundingBox.bottomLeftFrontCorner.z } }, // top left front
+		(Vec3) { { boundingBox.topRightBackCorner.x, boundingBox.topRightBackCorner.y, boundingBox.bottomLeftFrontCorner.z } }, // top right front
+		(Vec3) { { boundingBox.bottomLeftFrontCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.topRightBackCorner.z } }, // bottom left back
+		(Vec3) { { boundingBox.topRightBackCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.topRightBackCorner.z } }, // bottom right back
+		(Vec3) { { boundingBox.bottomLeftFrontCorner.x, boundingBox.topRightBackCorner.y, boundingBox.topRightBackCorner.z } }, // top left back
+		boundingBox.topRightBackCorner // top right back
+	};
+	// the corners are projected onto the 10 remaining axes together
+	Vec3x8 boxVertices = vec3x8_fromVec3(boxCorners);
+
+	Vec3 v0v1 = vec3_sub(triangle->v1, triangle->v0);
+	Vec3 v0v2 = vec3_sub(triangle->v2, triangle->v0);
+	Vec3 triangleNormal = vec3_norm(vec3_cross(v0v1, v0v2));
+	float triangleOffset = vec3_dot(triangleNormal, triangle->v0);
+
+	vec8_getRange(vec3x8_dot(&boxVertices, triangleNormal), &boxMin, &boxMax);
+	if (boxMax < triangleOffset || boxMin > triangleOffset) {
+		return false;
+	}
+
+	Vec3 triangleEdges[3] = {
+		vec3_sub(triangle->v0, triangle->v1),
+		vec3_sub(triangle->v1, triangle->v2),
+		vec3_sub(triangle->v2, triangle->v0)
+	};
+
+	for (uint32_t i = 0; i < 3; i++) {
+		for (uint32_t j = 0; j < 3; j++) {
+			Vec3 axis = vec3_cross(triangleEdges[i], boxNormals[j]);
+			vec8_getRange(vec3x8_dot(&boxVertices, axis), &boxMin, &boxMax);
+			accel_project(triangleVertices, 3, axis, &triangleMin, &triangleMax);
+			if (boxMax < triangleMin || boxMin > triangleMax) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Links every node to the one, that a stack traversal pops after its subtree.
+ * The stack pushes the children in order and pops the last one first, so the last child is entered first,
+ * every child skips to the one before it and the first child to the skip node of its parent.
+ * Parents are created before their children, so a parent is always linked before its children.
+ */
+static void accel_linkSkipNodes(Accel* accel) {
+	accel->nodes[0].skipNodeIndex = NODE_INDEX_UNDEF;
+	for (uint32_t i = 0; i < accel->nodeCount; i++) {
+		AccelNode* node = &accel->nodes[i];
+		int32_t skipNodeIndex = node->skipNodeIndex;
+		for (uint32_t j = 0; j < 8; j++) {
+			if (node->childNodeIndexes[j] != NODE_INDEX_UNDEF) {
+				accel->nodes[node->childNodeIndexes[j]].skipNodeIndex = skipNodeIndex;
+				skipNodeIndex = node->childNodeIndexes[j];
+			}
+		}
+	}
+}
+
+Accel* accel_create(void) {
+	Accel* accel = malloc(sizeof(Accel));
+	if (!accel) {
+		return NULL;
+	}
+
+	accel->nodeCapacity = 1;
+	accel->nodeCount = 0;
+	accel->nodes = malloc(sizeof(AccelNode) * accel->nodeCapacity);
+	accel->indexCapacity = 2000;
+	accel->indexCount= 0;
+	accel->indexes = malloc(sizeof(uint32_t) * accel->indexCapacity);
+	memstats_allocate(MEMSTATS_ACCEL, sizeof(AccelNode) * accel->nodeCapacity + sizeof(uint32_t) * accel->indexCapacity);
+	return accel;
+}
+
+int32_t accel_addNodes(Accel* accel, uint32_t count) {
+	if (accel->nodeCount + count > accel->nodeCapacity) {
+		size_t oldBytes = sizeof(AccelNode) * accel->nodeCapacity;
+		uint32_t nodeCapacity = accel->nodeCapacity;
+		while (accel->nodeCount + count > nodeCapacity) {
+			nodeCapacity *= 2;
+		}
+		AccelNode* nodes = realloc(accel->nodes, sizeof(AccelNode) * nodeCapacity);
+		if (!nodes) {
+			return NODE_INDEX_UNDEF;
+		}
+		accel->nodes = nodes;
+		accel->nodeCapacity = nodeCapacity;
+		memstats_reallocate(MEMSTATS_ACCEL, oldBytes, sizeof(AccelNode) * accel->nodeCapacity);
+	}
+	int32_t firstNodeId = (int32_t) accel->nodeCount;
+	for (uint32_t i = 0; i < count; i++) {
+		AccelNode* node = &accel->nodes[accel->nodeCount++];
+		*node = (AccelNode) { 0 };
+		for (uint32_t j = 0; j < 8; j++) {
+			node->childNodeIndexes[j] = NODE_INDEX_UNDEF;
+		}
+	}
+	return firstNodeId;
+}
+
+void accel_setLeaf(Accel* accel, int32_t nodeId, const uint32_t* indexes, uint32_t sphereIndexCount, uint32_t triangleIndexCount) {
+	// realloc index array, if too small
+	uint32_t referenceCount = sphereIndexCount + triangleIndexCount;
+	if (accel->indexCount + referenceCount > accel->indexCapacity) {
+		size_t oldBytes = sizeof(uint32_t) * accel->indexCapacity;
+		accel->indexCapacity = accel->indexCapacity + accel->indexCount + referenceCount;
+		accel->indexes = realloc(accel->indexes, sizeof(uint32_t) * accel->indexCapacity);
+		memstats_reallocate(MEMSTATS_ACCEL, oldBytes, sizeof(uint32_t) * accel->indexCapacity);
+	}
+
+	AccelNode* node = &accel->nodes[nodeId];
+	for (uint32_t i = 0; i < 8; i++) {
+		node->childNodeIndexes[i] = NODE_INDEX_UNDEF;
+	}
+	node->sphereIndexOffset = accel->indexCount;
+	node->sphereIndexCount = sphereIndexCount;
+	node->triangleIndexOffset = accel->indexCount + sphereIndexCount;
+	node->triangleIndexCount = triangleIndexCount;
+	memcpy(&accel->indexes[accel->indexCount], indexes, sizeof(uint32_t) * referenceCount);
+	accel->indexCount += referenceCount;
+}
+
+void accel_finish(Accel* accel) {
+	accel_shrinkToFit(accel);
+	accel_linkSkipNodes(accel);
+}
+
+float accel_getReferencesPerPrimitive(Accel* accel, Scene* scene) {
+	uint32_t primitiveCount = scene->sphereCount + scene->triangleCount;
+	if (primitiveCount == 0) {
+		return 0.0f;
+	}
+	return (float) accel->indexCount / (float) primitiveCount;
+}
+
+static float accel_getSurfaceArea(BoundingBox boundingBox) {
+	Vec3 size = vec3_sub(boundingBox.topRightBackCorner, boundingBox.bottomLeftFrontCorner);
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// adds the subtree to the report, the cost is weighted by the probability, that a ray through the root reaches the node
+static void accel_addToReport(Accel* accel, uint32_t nodeIndex, uint32_t depth, uint32_t maxDepth, float rootArea,
+	AccelReport* report) {
+	AccelNode* node = &accel->nodes[nodeIndex];
+	float probability = rootArea > 0.0f ? accel_getSurfaceArea(node->boundingBox) / rootArea : 1.0f;
+	report->depth = MAX(report->depth, depth);
+	if (node->childNodeIndexes[7] != NODE_INDEX_UNDEF) {
+		// the box of every child is tested
+		for (uint32_t i = 0; i < 8; i++) {
+			if (node->childNodeIndexes[i] != NODE_INDEX_UNDEF) {
+				report->estimatedCost += probability * ACCEL_BOX_COST;
+				accel_addToReport(accel, (uint32_t) node->childNodeIndexes[i], depth + 1, maxDepth, rootArea, report);
+			}
+		}
+		return;
+	}
+	uint32_t referenceCount = node->sphereIndexCount + node->triangleIndexCount;
+	report->estimatedCost += probability
+		* (ACCEL_SPHERE_COST * (float) node->sphereIndexCount + ACCEL_TRIANGLE_COST * (float) node->triangleIndexCount);
+	report->leafCount++;
+	if (referenceCount == 0) {
+		report->emptyLeafCount++;
+	}
+	if (depth >= maxDepth) {
+		report->leavesAtMaxDepth++;
+	}
+	uint32_t bucket = 0;
+	while (referenceCount > 0 && bucket + 1 < ACCEL_OCCUPANCY_BUCKETS) {
+		referenceCount >>= 1;
+		bucket++;
+	}
+	report->occupancy[bucket]++;
+}
+
+void accel_getReport(Accel* accel, Scene* scene, uint32_t maxDepth, AccelReport* report) {
+	*report = (AccelReport) { 0 };
+	float rootArea = accel_getSurfaceArea(accel->nodes[0].boundingBox);
+	// the box of the root is tested by every ray
+	report->estimatedCost = ACCEL_BOX_COST;
+	accel_addToReport(accel, 0, 0, maxDepth, rootArea, report);
+	report->referencesPerPrimitive = accel_getReferencesPerPrimitive(accel, scene);
+}
+
+void accel_printReport(Accel* accel, Scene* scene, AccelType type, uint32_t maxDepth, FILE* file) {
+	const char* name = accel_getName(type);
+	AccelReport report;
+	accel_getReport(accel, scene, maxDepth, &report);
+	fprintf(file, "%s: %u nodes, %u leaves (%u empty), depth %u", name, accel->nodeCount, report.leafCount, report.emptyLeafCount,
+		report.depth);
+	if (maxDepth != ACCEL_NO_DEPTH_LIMIT) {
+		fprintf(file, " (%u leaves at the limit of %u)", report.leavesAtMaxDepth, maxDepth);
+	}
+	fprintf(file, "\n");
+	fprintf(file, "%s: estimated cost %.2f box tests per ray, %.2f references per primitive\n", name,
+		(double) report.estimatedCost, (double) report.referencesPerPrimitive);
+	fprintf(file, "%s: references per leaf", name);
+	for (uint32_t i = 0; i < ACCEL_OCCUPANCY_BUCKETS; i++) {
+		uint32_t first = i == 0 ? 0 : 1u << (i - 1);
+		if (i + 1 == ACCEL_OCCUPANCY_BUCKETS) {
+			fprintf(file, " %u+: %u", first, report.occupancy[i]);
+		} else if (i < 2) {
+			fprintf(file, " %u: %u", first, report.occupancy[i]);
+		} else {
+			fprintf(file, " %u-%u: %u", first, (1u << i) - 1, report.occupancy[i]);
+		}
+	}
+	fprintf(file, "\n");
+}
+
+void accel_destroy(Accel* accel) {
+	if (accel) {
+		memstats_free(MEMSTATS_ACCEL, sizeof(AccelNode) * accel->nodeCapacity + sizeof(uint32_t) * accel->indexCapacity);
+		free(accel->nodes);
+		free(accel->indexes);
+		free(accel);
+	}
+}
+
+void accel_getSceneStats(Scene* scene, AccelSceneStats* stats) {
+	memset(stats, 0, sizeof(AccelSceneStats));
+	stats->sphereCount = scene->sphereCount;
+	stats->triangleCount = scene->triangleCount;
+	double areaSum = 0.0;
+	double diagonalSum = 0.0;
+	double squaredDiagonalSum = 0.0;
+	for (uint32_t i = 0; i < scene->sphereCount; i++) {
+		// the diagonal of the box around the sphere
+		double diagonal = 2.0 * sqrt(3.0) * scene->spheres[i].radius;
+		diagonalSum += diagonal;
+		squaredDiagonalSum += diagonal * diagonal;
+	}
+	for (uint32_t i = 0; i < scene->triangleCount; i++) {
+		Triangle* triangle = &scene->triangles[i];
+		BoundingBox boundingBox = {
+			{ { MIN(MIN(triangle->v0.x, triangle->v1.x), triangle->v2.x), MIN(MIN(triangle->v0.y, triangle->v1.y), triangle->v2.y),
+				MIN(MIN(triangle->v0.z, triangle->v1.z), triangle->v2.z) } },
+			{ { MAX(MAX(triangle->v0.x, triangle->v1.x), triangle->v2.x), MAX(MAX(triangle->v0.y, triangle->v1.y), triangle->v2.y),
+				MAX(MAX(triangle->v0.z, triangle->v1.z), triangle->v2.z) } }
+		};
+		areaSum += accel_getSurfaceArea(boundingBox);
+		double diagonal = vec3_length(vec3_sub(boundingBox.topRightBackCorner, boundingBox.bottomLeftFrontCorner));
+		diagonalSum += diagonal;
+		squaredDiagonalSum += diagonal * diagonal;
+	}
+	uint32_t primitiveCount = scene->sphereCount + scene->triangleCount;
+	if (primitiveCount > 0 && diagonalSum > 0.0) {
+		double mean = diagonalSum / primitiveCount;
+		double variance = MAX(squaredDiagonalSum / primitiveCount - mean * mean, 0.0);
+		stats->sizeVariation = (float) (sqrt(variance) / mean);
+	}
+	float sceneArea = accel_getSurfaceArea(accel_getSceneBoundingBox(scene));
+	stats->triangleBoxOverlap = sceneArea > 0.0f ? (float) (areaSum / sceneArea) : 0.0f;
+}
+
+AccelType accel_selectType(AccelSceneStats* stats) {
+	uint32_t primitiveCount = stats->sphereCount + stats->triangleCount;
+	if (primitiveCount < ACCEL_GRID_MIN_PRIMITIVE_COUNT
+		|| (float) stats->triangleCount < ACCEL_GRID_MIN_TRIANGLE_SHARE * (float) primitiveCount) {
+		return ACCEL_BVH;
+	}
+	float minBoxOverlap = ACCEL_GRID_MIN_BOX_OVERLAP * (1.0f + ACCEL_GRID_SIZE_VARIATION_WEIGHT * stats->sizeVariation);
+	return stats->triangleBoxOverlap >= minBoxOverlap ? ACCEL_GRID : ACCEL_BVH;
+}
+
+AccelType accel_getType(Scene* scene) {
+	AccelType type;
+	const char* name = getenv("RAYTRACER_ACCEL");
+	if (name && accel_parseType(name, &type)) {
+		return type;
+	}
+	if (name) {
+		printf("Unknown acceleration structure %s, selecting one for the scene.\n", name);
+	}
+	AccelSceneStats stats;
+	accel_getSceneStats(scene, &stats);
+	return accel_selectType(&stats);
+}
+
+const char* accel_getName(AccelType type) {
+	return type < ACCEL_TYPE_COUNT ? accelNames[type] : "unknown";
+}
+
+bool accel_parseType(const char* name, AccelType* type) {
+	for (uint32_t i = 0; i < ACCEL_TYPE_COUNT; i++) {
+		if (strcmp(name, accelNames[i]) == 0) {
+			*type = (AccelType) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+Accel* accel_build(Scene* scene, AccelType type) {
+	switch (type) {
+		case ACCEL_BVH:
+			return bvh_buildFromScene(scene);
+		case ACCEL_GRID:
+			return grid_buildFromScene(scene);
+		default:
+			return octree_buildFromScene(scene);
+	}
+}
@@ -0,0 +1,136 @@
+#ifndef RAYTRACER_ACCEL_H
+#define RAYTRACER_ACCEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scene.h"
+#include "utils/vec3.h"
+
+/*
+ * The acceleration structures of the scene. Every structure is built into the skip linked box hierarchy below,
+ * so the upload (scenesync.c), the serialization (sceneserial.c) and the traversals of the CPU tracer and the kernel
+ * are the same for all of them, only the builders differ:
+ * - ACCEL_OCTREE splits the space at the node centers within a reference budget (octree.h)
+ * - ACCEL_BVH partitions the primitives (bvh.h), its boxes are tight and no primitive is duplicated
+ * - ACCEL_GRID puts the primitives into uniform cells (grid.h), so long and large primitives are split up
+ * RAYTRACER_ACCEL=octree|bvh|grid overrides the selection from the scene statistics.
+ */
+
+#define NODE_INDEX_UNDEF -1
+
+// the cost model of the builders, the times of a ray against a box, a sphere and a triangle relative to the box test
+#define ACCEL_BOX_COST 1.0f
+#define ACCEL_SPHERE_COST 4.0f
+#define ACCEL_TRIANGLE_COST 8.0f
+// the maxDepth of a report of a hierarchy without a depth limit
+#define ACCEL_NO_DEPTH_LIMIT UINT32_MAX
+// leaves with 0, 1, 2 to 3, 4 to 7 ... references, the last bucket counts all larger leaves
+#define ACCEL_OCCUPANCY_BUCKETS 10
+
+typedef enum {
+	ACCEL_OCTREE,
+	ACCEL_BVH,
+	ACCEL_GRID,
+	ACCEL_TYPE_COUNT
+} AccelType;
+
+typedef struct {
+	// the primitive count and the mix of spheres and triangles
+	uint32_t sphereCount;
+	uint32_t triangleCount;
+	// the standard deviation of the box diagonals of the primitives over their mean, 0 if all have the same size
+	float sizeVariation;
+	// the surface areas of the triangle boxes relative to the scene box, the number of triangle boxes, that a ray
+	// through the scene crosses on average, the BVH has to test all of them. The box of a long or slanted triangle is
+	// mostly empty, the grid splits it up, while a sphere fills its box and is left out.
+	float triangleBoxOverlap;
+} AccelSceneStats;
+
+// the grid is only selected with at least this many primitives and this share of triangles, the BVH was faster
+// in the test scenes with 300 long triangles and in the scenes of spheres only
+#define ACCEL_GRID_MIN_PRIMITIVE_COUNT 400
+#define ACCEL_GRID_MIN_TRIANGLE_SHARE 0.1f
+// from this overlap on the grid was faster than the BVH in the test scenes, with 500 long triangles at an overlap of 12.2
+#define ACCEL_GRID_MIN_BOX_OVERLAP 10.0f
+// the grid cells are sized for the average primitive, so the large ones of a scene with a wide spread of sizes fill
+// many cells, the minimum overlap grows by this factor per unit of the size variation
+#define ACCEL_GRID_SIZE_VARIATION_WEIGHT 0.1f
+
+typedef struct {
+	Vec3 bottomLeftFrontCorner;
+	Vec3 topRightBackCorner;
+} BoundingBox;
+
+typedef struct {
+	BoundingBox boundingBox;
+
+	uint32_t sphereIndexOffset;
+	uint32_t sphereIndexCount;
+
+	uint32_t triangleIndexOffset;
+	uint32_t triangleIndexCount;
+
+	// the children of an inner node fill the last slots, a node with fewer than 8 children leaves the first ones
+	// NODE_INDEX_UNDEF, so every inner node has childNodeIndexes[7]
+	int32_t childNodeIndexes[8];
+	// the node after the subtree of this one in the traversal order, NODE_INDEX_UNDEF after the last node,
+	// the traversal continues here when the box is missed or the leaf is done, so it needs no stack
+	int32_t skipNodeIndex;
+} AccelNode;
+
+typedef struct {
+	AccelNode* nodes;
+	uint32_t nodeCount;
+	uint32_t nodeCapacity;
+	uint32_t* indexes;
+	uint32_t indexCount;
+	uint32_t indexCapacity;
+} Accel;
+
+typedef struct {
+	uint32_t leafCount;
+	uint32_t emptyLeafCount;
+	uint32_t depth;
+	// leaves, that may have been split further without the depth limit
+	uint32_t leavesAtMaxDepth;
+	// the expected cost of a ray through the root box in the units of the cost model
+	float estimatedCost;
+	float referencesPerPrimitive;
+	uint32_t occupancy[ACCEL_OCCUPANCY_BUCKETS];
+} AccelReport;
+
+/*
+ * The builders create their nodes with these functions. A parent has to be created before its children.
+ */
+Accel* accel_create(void);
+// appends empty leaves, returns the index of the first one or NODE_INDEX_UNDEF, if the memory is missing
+int32_t accel_addNodes(Accel* accel, uint32_t count);
+// the indexes are the spheres followed by the triangles of the leaf
+void accel_setLeaf(Accel* accel, int32_t nodeId, const uint32_t* indexes, uint32_t sphereIndexCount, uint32_t triangleIndexCount);
+// links the skip nodes for the traversal, after all nodes are created
+void accel_finish(Accel* accel);
+void accel_destroy(Accel* accel);
+// the box around all spheres and triangles and the origin
+BoundingBox accel_getSceneBoundingBox(Scene* scene);
+// conservative overlap tests of a primitive with a box
+bool accel_intersectSphere(Sphere* sphere, BoundingBox boundingBox);
+bool accel_intersectTriangle(Triangle* triangle, BoundingBox boundingBox);
+
+void accel_getSceneStats(Scene* scene, AccelSceneStats* stats);
+// the BVH, or the grid for a large triangle box overlap in a scene, that is large enough and has enough triangles
+AccelType accel_selectType(AccelSceneStats* stats);
+// the type from RAYTRACER_ACCEL or else the selection for the scene
+AccelType accel_getType(Scene* scene);
+const char* accel_getName(AccelType type);
+// returns false for an unknown name
+bool accel_parseType(const char* name, AccelType* type);
+Accel* accel_build(Scene* scene, AccelType type);
+
+// average number of leaves, that reference a sphere or triangle, large primitives are duplicated into many leaves
+float accel_getReferencesPerPrimitive(Accel* accel, Scene* scene);
+void accel_getReport(Accel* accel, Scene* scene, uint32_t maxDepth, AccelReport* report);
+void accel_printReport(Accel* accel, Scene* scene, AccelType type, uint32_t maxDepth, FILE* file);
+
+#endif //RAYTRACER_ACCEL_H
@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utils/file.h"
+#include "utils/image.h"
+#include "utils/math.h"
+#include "scene.h"
+#include "scenegen.h"
+#include "accel.h"
+#include "raytracer.h"
+#include "raystream.h"
+#include "gpu.h"
+#include "camerapath.h"
+#include "denoiser.h"
+
+/*
+ * Renders the frames of a camera path into numbered bitmaps without a window.
+ * The scene, its acceleration structure and the kernel are set up once, every frame only uploads the camera.
+ * While a frame renders, the previous ones are written by encoder threads, each frame in flight has its own image.
+ * The frames are written to a temporary file and renamed, so with --resume an interrupted run
+ * continues with the first frame, that has no file yet.
+ * Run with --help for the options.
+ */
+
+#define ANIMATION_PATH_SIZE 1024
+#define ANIMATION_MAX_FRAMES_IN_FLIGHT 16
+
+typedef struct {
+	const char* cameraPath;
+	float framesPerSecond;
+	uint32_t firstFrame;
+	// UINT32_MAX renders until the end of the path
+	uint32_t lastFrame;
+	uint32_t width;
+	uint32_t height;
+	uint32_t raysPerPixel;
+	uint32_t maxRayDepth;
+	uint32_t shadowRayCount;
+	const char* outputPattern;
+	uint32_t framesInFlight;
+	bool resume;
+	// 0 renders the scene of scene.c
+	uint32_t sphereCount;
+	uint32_t seed;
+	bool useCpu;
+	// how the CPU tracer finds the primary hits
+	RaytracerPrimaryMode primaryMode;
+	// traces the CPU frames in coherence-sorted waves per tile, see src/raystream.h
+	bool isStreaming;
+	uint32_t deviceIndex;
+	bool denoise;
+	bool isFresnelSampling;
+	bool useRoulette;
+} AnimationOptions;
+
+typedef struct {
+	Image* image;
+	uint32_t frame;
+	// posted, when the image was written and can be rendered into again
+	SDL_sem* isFree;
+} AnimationSlot;
+
+typedef struct {
+	AnimationSlot slots[ANIMATION_MAX_FRAMES_IN_FLIGHT];
+	uint32_t slotCount;
+	SDL_Thread* encoders[ANIMATION_MAX_FRAMES_IN_FLIGHT];
+	uint32_t encoderCount;
+	// posted for every rendered frame and once per encoder at the end
+	SDL_sem* framesRendered;
+	// the encoders take the rendered frames in this order, the slot of the n-th one is n % slotCount
+	SDL_atomic_t nextEncodedFrame;
+	SDL_atomic_t failedFrameCount;
+	// the number of rendered frames, set before the encoders are stopped
+	SDL_atomic_t renderedFrameCount;
+	const char* outputPattern;
+} AnimationPipeline;
+
+static double animation_now(void) {
+	return (double) SDL_GetPerformanceCounter() * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+// the pattern has to contain a single integer conversion, e.g. frame_%05d.bmp
+static bool animation_isValidPattern(const char* pattern) {
+	uint32_t conversionCount = 0;
+	for (const char* c = pattern; *c; c++) {
+		if (*c != '%') {
+			continue;
+		}
+		c++;
+		if (*c == '%') {
+			continue;
+		}
+		while (*c >= '0' && *c <= '9') {
+			c++;
+		}
+		if (*c != 'd' && *c != 'u') {
+			return false;
+		}
+		conversionCount++;
+	}
+	return conversionCount == 1;
+}
+
+static void animation_getFramePath(const char* pattern, uint32_t frame, char* path, size_t pathSize) {
+	// the pattern was checked by animation_isValidPattern
+	snprintf(path, pathSize, pattern, frame);
+}
+
+static bool animation_fileExists(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file) {
+		fclose(file);
+	}
+	return file != NULL;
+}
+
+// file_writeFile renames a temporary file per process, so that an existing frame is always complete
+static bool animation_writeFrame(const char* path, Image* image) {
+	size_t size;
+	uint8_t* data = bitmap_encode_image(image, &size);
+	if (!data) {
+		return false;
+	}
+	bool success = file_writeFile(path, data, size);
+	free(data);
+	return success;
+}
+
+static int animation_encode(void* data) {
+	AnimationPipeline* pipeline = data;
+	while (true) {
+		SDL_SemWait(pipeline->framesRendered);
+		// every wait belongs to a rendered frame or to the end, so the n-th taken frame is always rendered
+		uint32_t index = (uint32_t) SDL_AtomicAdd(&pipeline->nextEncodedFrame, 1);
+		if (index >= (uint32_t) SDL_AtomicGet(&pipeline->renderedFrameCount)) {
+			return 0;
+		}
+		AnimationSlot* slot = &pipeline->slots[index % pipeline->slotCount];
+		char path[ANIMATION_PATH_SIZE];
+		animation_getFramePath(pipeline->outputPattern, slot->frame, path, sizeof(path));
+		if (!animation_writeFrame(path, slot->image)) {
+			printf("Couldn't write %s.\n", path);
+			SDL_AtomicAdd(&pipeline->failedFrameCount, 1);
+		}
+		SDL_SemPost(slot->isFree);
+	}
+}
+
+static void animation_destroyPipeline(AnimationPipeline* pipeline) {
+	// the encoders stop, once all rendered frames are written
+	for (uint32_t i = 0; i < pipeline->encoderCount; i++) {
+		SDL_SemPost(pipeline->framesRendered);
+	}
+	for (uint32_t i = 0; i < pipeline->encoderCount; i++) {
+		SDL_WaitThread(pipeline->encoders[i], NULL);
+	}
+	for (uint32_t i = 0; i < pipeline->slotCount; i++) {
+		if (pipeline->slots[i].image) {
+			image_destroy(pipeline->slots[i].image);
+		}
+		if (pipeline->slots[i].isFree) {
+			SDL_DestroySemaphore(pipeline->slots[i].isFree);
+		}
+	}
+	if (pipeline->framesRendered) {
+		SDL_DestroySemaphore(pipeline->framesRendered);
+	}
+}
+
+static bool animation_createPipeline(AnimationPipeline* pipeline, AnimationOptions* options) {
+	memset(pipeline, 0, sizeof(AnimationPipeline));
+	pipeline->outputPattern = options->outputPattern;
+	pipeline->slotCount = options->framesInFlight;
+	// the running count has to be larger than every index, until the rendering is done
+	SDL_AtomicSet(&pipeline->renderedFrameCount, INT32_MAX);
+	pipeline->framesRendered = SDL_CreateSemaphore(0);
+	bool success = pipeline->framesRendered != NULL;
+	for (uint32_t i = 0; i < pipeline->slotCount; i++) {
+		pipeline->slots[i].image = image_create(options->width, options->height);
+		pipeline->slots[i].isFree = SDL_CreateSemaphore(1);
+		success = success && pipeline->slots[i].image && pipeline->slots[i].isFree;
+	}
+	// one frame renders, while the others are written
+	uint32_t encoderCount = MAX(pipeline->slotCount - 1, 1);
+	for (uint32_t i = 0; success && i < encoderCount; i++) {
+		pipeline->encoders[i] = SDL_CreateThread(animation_encode, "animation encoder", pipeline);
+		success = pipeline->encoders[i] != NULL;
+		pipeline->encoderCount += success ? 1 : 0;
+	}
+	if (!success) {
+		SDL_AtomicSet(&pipeline->renderedFrameCount, 0);
+		animation_destroyPipeline(pipeline);
+	}
+	return success;
+}
+
+static Scene* animation_createScene(AnimationOptions* options) {
+	if (options->sphereCount == 0) {
+		return scene_init(options->width, options->height);
+	}
+	Scene* scene = scenegen_createBase(options->width, options->height);
+	scenegen_addRandomSpheres(scene, options->sphereCount, 20.0f, options->seed);
+	scenegen_addLights(scene, 4, 20.0f, options->seed);
+	scene_shrinkToFit(scene);
+	return scene;
+}
+
+static GPUContext* animation_createContext(Scene* scene, Accel* accel, AnimationOptions* options) {
+	cl_platform_id platformId;
+	cl_device_id deviceId;
+	if (!gpu_getDevice(options->deviceIndex, &platformId, &deviceId)) {
+		printf("There is no OpenCL device %u.\n", options->deviceIndex);
+		return NULL;
+	}
+	GPUContext* context = gpu_initHeadlessContext(scene, accel, options->raysPerPixel, platformId, deviceId);
+	if (context && (!gpu_setRayLimits(context, scene, accel, options->maxRayDepth, options->shadowRayCount) ||
+		!gpu_setDenoising(context, options->denoise))) {
+		gpu_destroyContext(context);
+		return NULL;
+	}
+	if (context) {
+		gpu_setRayTermination(context, options->useRoulette ? RAYTRACER_ROULETTE_THRESHOLD : 0.0f, options->isFresnelSampling);
+	}
+	return context;
+}
+
+// draws the seeds from rand() like gpu_resetSeeds, the frame is only denoised with the guides buffer.
+// A stream frame, whose ray buffers couldn't be allocated, is traced depth first instead.
+static void animation_renderCpuFrame(Scene* scene, Accel* accel, RaytracerSampling* sampling, RaytracerPrimaryMode primaryMode,
+	bool isStreaming, seed128bit* seeds, Vec3* colors, DenoiserGuide* guides, Image* image) {
+	for (uint32_t i = 0; i < image->width * image->height; i++) {
+		seeds[i].x = (uint64_t) rand();
+		seeds[i].y = (uint64_t) rand();
+	}
+	if (!isStreaming || !raystream_render(scene, accel, sampling, seeds, colors, NULL)) {
+		raytracer_render(scene, accel, sampling, primaryMode, seeds, colors, NULL);
+	}
+	if (guides) {
+		for (uint32_t y = 0; y < image->height; y++) {
+			for (uint32_t x = 0; x < image->width; x++) {
+				denoiser_traceGuide(scene, accel, sampling, x, y, &guides[y * image->width + x]);
+			}
+		}
+		if (!denoiser_apply(colors, guides, image->width, image->height)) {
+			printf("Couldn't denoise the frame.\n");
+		}
+	}
+	for (uint32_t i = 0; i < image->width * image->height; i++) {
+		image->buffer[i] = raytracer_packColor(colors[i]);
+	}
+}
+
+static int animation_run(AnimationOptions* options) {
+	CameraPath* path = camerapath_load(options->cameraPath);
+	if (!path) {
+		return 2;
+	}
+	uint32_t frameCount = (uint32_t) (camerapath_getDuration(path) * options->framesPerSecond) + 1;
+	uint32_t lastFrame = MIN(options->lastFrame, frameCount - 1);
+	if (options->firstFrame > lastFrame) {
+		printf("The path has only %u frames.\n", frameCount);
+		camerapath_destroy(path);
+		return 1;
+	}
+
+	// everything, that a process per frame would repeat
+	double setupStart = animation_now();
+	Scene* scene = animation_createScene(options);
+	Accel* accel = accel_build(scene, accel_getType(scene));
+	GPUContext* context = NULL;
+	seed128bit* seeds = NULL;
+	Vec3* colors = NULL;
+	DenoiserGuide* guides = NULL;
+	RaytracerSampling sampling;
+	// a missing acceleration structure fails the setup
+	bool success = accel != NULL;
+	if (success && options->useCpu) {
+		raytracer_initSampling(&sampling, scene->camera, options->raysPerPixel, options->maxRayDepth, options->shadowRayCount);
+		sampling.isFresnelSampling = options->isFresnelSampling;
+		sampling.rouletteThreshold = options->useRoulette ? RAYTRACER_ROULETTE_THRESHOLD : 0.0f;
+		seeds = malloc(sizeof(seed128bit) * options->width * options->height);
+		colors = malloc(sizeof(Vec3) * options->width * options->height);
+		success = seeds && colors;
+		if (options->denoise) {
+			guides = malloc(sizeof(DenoiserGuide) * options->width * options->height);
+			success = success && guides;
+		}
+	} else if (success) {
+		context = animation_createContext(scene, accel, options);
+		success = context != NULL;
+	}
+	AnimationPipeline pipeline;
+	success = success && animation_createPipeline(&pipeline, options);
+	double setupTime = animation_now() - setupStart;
+	if (!success) {
+		printf("Couldn't set up the renderer.\n");
+		free(seeds);
+		free(colors);
+		free(guides);
+		gpu_destroyContext(context);
+		accel_destroy(accel);
+		scene_destroy(scene);
+		camerapath_destroy(path);
+		return 2;
+	}
+	printf("Set up in %.1f ms, rendering the frames %u to %u of %u.\n", setupTime, options->firstFrame, lastFrame, frameCount);
+
+	double renderStart = animation_now();
+	double renderTime = 0.0;
+	uint32_t renderedFrameCount = 0;
+	uint32_t skippedFrameCount = 0;
+	float startTime = path->keyframes[0].time;
+	for (uint32_t frame = options->firstFrame; frame <= lastFrame; frame++) {
+		if (options->resume) {
+			char framePath[ANIMATION_PATH_SIZE];
+			animation_getFramePath(options->outputPattern, frame, framePath, sizeof(framePath));
+			if (animation_fileExists(framePath)) {
+				skippedFrameCount++;
+				continue;
+			}
+		}
+		AnimationSlot* slot = &pipeline.slots[renderedFrameCount % pipeline.slotCount];
+		// waits, until the encoder is done with the frame rendered slotCount frames ago
+		SDL_SemWait(slot->isFree);
+		slot->frame = frame;
+
+		double frameStart = animation_now();
+		camerapath_apply(path, startTime + (float) frame / options->framesPerSecond, scene->camera);
+		// the noise of a frame only depends on its index, so a resumed run renders the same frames
+		srand(options->seed + frame);
+		if (context) {
+			gpu_resetSeeds(context, scene);
+			gpu_renderScene(context, scene, accel, slot->image);
+		} else {
+			animation_renderCpuFrame(scene, accel, &sampling, options->primaryMode, options->isStreaming, seeds, colors, guides,
+				slot->image);
+		}
+		renderTime += animation_now() - frameStart;
+		renderedFrameCount++;
+		SDL_SemPost(pipeline.framesRendered);
+	}
+	SDL_AtomicSet(&pipeline.renderedFrameCount, (int) renderedFrameCount);
+	animation_destroyPipeline(&pipeline);
+	uint32_t failedFrameCount = (uint32_t) SDL_AtomicGet(&pipeline.failedFrameCount);
+	double totalTime = animation_now() - renderStart;
+
+	printf("Rendered %u frames in %.1f ms, %.1f ms per frame on the renderer, %u frames existed already.\n",
+		renderedFrameCount, totalTime, renderedFrameCount > 0 ? renderTime / renderedFrameCount : 0.0, skippedFrameCount);
+	if (failedFrameCount > 0) {
+		printf("%u frames couldn't be written.\n", failedFrameCount);
+	}
+
+	free(seeds);
+	free(colors);
+	free(guides);
+	gpu_destroyContext(context);
+	accel_destroy(accel);
+	scene_destroy(scene);
+	camerapath_destroy(path);
+	return failedFrameCount == 0 ? 0 : 3;
+}
+
+static void animation_printUsage(const char* program) {
+	printf("Usage: %s --path <file> [options]\n"
+		"  --path <file>              camera keyframes, see src/camerapath.h\n"
+		"  --fps <rate>               frames per second of the path (default 30)\n"
+		"  --first <frame>            first frame to render (default 0)\n"
+		"  --last <frame>             last frame to render (default the end of the path)\n"
+		"  --width <pixels>           render width (default 1280)\n"
+		"  --height <pixels>          render height (default 720)\n"
+		"  --rays <count>             rays per pixel (default 4)\n"
+		"  --depth <count>            maximum ray depth, 1 to 8 (default 5)\n"
+		"  --shadow-rays <count>      shadow rays per light (default 4)\n"
+		"  --output <pattern>         bitmap path with one %%d for the frame (default frame_%%05d.bmp)\n"
+		"  --frames-in-flight <count> frames written while the next one renders, plus one (default 3)\n"
+		"  --resume                   skip the frames, whose bitmap exists\n"
+		"  --spheres <count>          render random spheres instead of the scene of scene.c\n"
+		"  --seed <seed>              seed of the spheres and the pixels (default 1)\n"
+		"  --cpu                      render with the CPU tracer instead of an OpenCL device\n"
+		"  --visibility-buffer        rasterize the primary hits of the CPU tracer, see src/visibility.h\n"
+		"  --stream                   trace the CPU frames in sorted waves per tile, see src/raystream.h\n"
+		"  --denoise                  filter the noise of low ray counts, see src/denoiser.h\n"
+		"  --fresnel-sampling         trace either the reflected or the refracted ray of glass, not both\n"
+		"  --roulette                 drop secondary rays, that add little to a pixel, by Russian roulette\n"
+		"  --device <index>           OpenCL device, counted over all platforms (default 0)\n", program);
+}
+
+static bool animation_parseOptions(int argc, char* argv[], AnimationOptions* options) {
+	options->cameraPath = NULL;
+	options->framesPerSecond = 30.0f;
+	options->firstFrame = 0;
+	options->lastFrame = UINT32_MAX;
+	options->width = 1280;
+	options->height = 720;
+	options->raysPerPixel = 4;
+	options->maxRayDepth = 5;
+	options->shadowRayCount = 4;
+	options->outputPattern = "frame_%05d.bmp";
+	options->framesInFlight = 3;
+	options->resume = false;
+	options->sphereCount = 0;
+	options->seed = 1;
+	options->useCpu = false;
+	options->primaryMode = RAYTRACER_PRIMARY_TRACE;
+	options->isStreaming = false;
+	options->deviceIndex = 0;
+	options->denoise = false;
+	options->isFresnelSampling = false;
+	options->useRoulette = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (strcmp(arg, "--resume") == 0) {
+			options->resume = true;
+			continue;
+		}
+		if (strcmp(arg, "--cpu") == 0) {
+			options->useCpu = true;
+			continue;
+		}
+		if (strcmp(arg, "--visibility-buffer") == 0) {
+			options->primaryMode = RAYTRACER_PRIMARY_VISIBILITY;
+			continue;
+		}
+		if (strcmp(arg, "--stream") == 0) {
+			options->isStreaming = true;
+			continue;
+		}
+		if (strcmp(arg, "--denoise") == 0) {
+			options->denoise = true;
+			continue;
+		}
+		if (strcmp(arg, "--fresnel-sampling") == 0) {
+			options->isFresnelSampling = true;
+			continue;
+		}
+		if (strcmp(arg, "--roulette") == 0) {
+			options->useRoulette = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const char* value = argv[++i];
+		uint32_t number = (uint32_t) strtoul(value, NULL, 10);
+		if (strcmp(arg, "--path") == 0) {
+			options->cameraPath = value;
+		} else if (strcmp(arg, "--fps") == 0) {
+			options->framesPerSecond = strtof(value, NULL);
+		} else if (strcmp(arg, "--first") == 0) {
+			options->firstFrame = number;
+		} else if (strcmp(arg, "--last") == 0) {
+			options->lastFrame = number;
+		} else if (strcmp(arg, "--width") == 0) {
+			options->width = number;
+		} else if (strcmp(arg, "--height") == 0) {
+			options->height = number;
+		} else if (strcmp(arg, "--rays") == 0) {
+			options->raysPerPixel = number;
+		} else if (strcmp(arg, "--depth") == 0) {
+			options->maxRayDepth = number;
+		} else if (strcmp(arg, "--shadow-rays") == 0) {
+			options->shadowRayCount = number;
+		} else if (strcmp(arg, "--output") == 0) {
+			options->outputPattern = value;
+		} else if (strcmp(arg, "--frames-in-flight") == 0) {
+			options->framesInFlight = number;
+		} else if (strcmp(arg, "--spheres") == 0) {
+			options->sphereCount = number;
+		} else if (strcmp(arg, "--seed") == 0) {
+			options->seed = number;
+		} else if (strcmp(arg, "--device") == 0) {
+			options->deviceIndex = number;
+		} else {
+			return false;
+		}
+	}
+	if (!animation_isValidPattern(options->outputPattern)) {
+		printf("The output needs exactly one %%d for the frame number.\n");
+		return false;
+	}
+	return options->cameraPath && options->framesPerSecond > 0.0f && options->width > 0 && options->height > 0
+		&& options->raysPerPixel > 0 && options->maxRayDepth >= 1 && options->maxRayDepth <= RAYTRACER_MAX_RAY_DEPTH
+		&& options->framesInFlight >= 1 && options->framesInFlight <= ANIMATION_MAX_FRAMES_IN_FLIGHT;
+}
+
+int main(int argc, char* argv[]) {
+	AnimationOptions options;
+	if (!animation_parseOptions(argc, argv, &options)) {
+		animation_printUsage(argv[0]);
+		return 1;
+	}
+	return animation_run(&options);
+}
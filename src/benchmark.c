@@ -0,0 +1,737 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utils/image.h"
+#include "utils/math.h"
+#include "scene.h"
+#include "scenegen.h"
+#include "octree.h"
+#include "accel.h"
+#include "raytracer.h"
+#include "raystream.h"
+#include "gpu.h"
+#include "memstats.h"
+#include "multidevice.h"
+#include "traversalstats.h"
+
+/*
+ * Renders procedural scenes without a window and writes the results as JSON.
+ * Run with --help for the options.
+ */
+
+// the kernel defaults, so that the CPU and OpenCL numbers describe the same work
+#define BENCHMARK_MAX_RAY_DEPTH 5
+#define BENCHMARK_SHADOW_RAY_COUNT 4
+#define BENCHMARK_SCENE_SIZE 20.0f
+#define BENCHMARK_MAX_PLATFORMS 16
+#define BENCHMARK_MAX_DEVICES 16
+#define BENCHMARK_NAME_SIZE 256
+#define BENCHMARK_PATH_SIZE 1024
+
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t frames;
+	uint32_t sphereCount;
+	uint32_t subdivisions;
+	uint32_t terrainResolution;
+	uint32_t lightCount;
+	uint64_t seed;
+	const char* outputPath;
+	// NULL, if no heatmaps are written
+	const char* heatmapPrefix;
+	bool runCpu;
+	bool runGpu;
+	// renders every frame with all devices together
+	bool runMultiDevice;
+	// 0, if the devices aren't partitioned for the multi device run
+	uint32_t subDeviceCount;
+	// ACCEL_TYPE_COUNT selects the structure for every scene
+	AccelType accel;
+	OctreeBuildOptions octree;
+} BenchmarkOptions;
+
+typedef struct {
+	Ray ray;
+	float hitDistance;
+	Vec3 intersectionNormal;
+	uint32_t hitMaterialIndex;
+} BenchmarkHit;
+
+typedef struct {
+	uint64_t primaryRays;
+	uint64_t shadowRays;
+	uint64_t secondaryRays;
+	// in ms
+	double primaryTime;
+	double shadowTime;
+	double secondaryTime;
+	double timeToFirstPixel;
+} BenchmarkResult;
+
+static double benchmark_now(void) {
+	return (double) SDL_GetPerformanceCounter() * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+static void benchmark_writeString(FILE* file, const char* string) {
+	fputc('"', file);
+	for (const char* c = string; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(file, "\\%c", *c);
+		} else if ((unsigned char) *c < 0x20) {
+			fprintf(file, "\\u%04x", (unsigned int) (unsigned char) *c);
+		} else {
+			fputc(*c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// JSON has no infinity, so phases without rays are written as null
+static void benchmark_writeRate(FILE* file, const char* name, uint64_t rays, double time) {
+	if (rays == 0 || time <= 0.0) {
+		fprintf(file, "\"%s\": null", name);
+	} else {
+		fprintf(file, "\"%s\": %.3f", name, (double) rays / (time * 1000.0));
+	}
+}
+
+static void benchmark_writeResult(FILE* file, BenchmarkResult* result) {
+	fprintf(file, "\"primaryRays\": %llu, \"shadowRays\": %llu, \"secondaryRays\": %llu, ",
+		(unsigned long long) result->primaryRays, (unsigned long long) result->shadowRays, (unsigned long long) result->secondaryRays);
+	benchmark_writeRate(file, "primaryMraysPerSecond", result->primaryRays, result->primaryTime);
+	fprintf(file, ", ");
+	benchmark_writeRate(file, "shadowMraysPerSecond", result->shadowRays, result->shadowTime);
+	fprintf(file, ", ");
+	benchmark_writeRate(file, "secondaryMraysPerSecond", result->secondaryRays, result->secondaryTime);
+	fprintf(file, ", \"timeToFirstPixelMs\": %.3f", result->timeToFirstPixel);
+}
+
+static void benchmark_writePeakMemory(FILE* file) {
+	fprintf(file, "      \"peakBytes\": { ");
+	for (uint32_t i = 0; i < MEMSTATS_SUBSYSTEM_COUNT; i++) {
+		MemStatsSubsystem subsystem = (MemStatsSubsystem) i;
+		fprintf(file, "%s\"%s\": %llu", i == 0 ? "" : ", ", memstats_getName(subsystem),
+			(unsigned long long) memstats_getPeakBytes(subsystem));
+	}
+	fprintf(file, " }");
+}
+
+static bool benchmark_appendHit(BenchmarkHit** hits, uint32_t* hitCount, uint32_t* hitCapacity, BenchmarkHit hit) {
+	if (*hitCount == *hitCapacity) {
+		uint32_t capacity = *hitCapacity ? *hitCapacity * 2 : 1024;
+		BenchmarkHit* newHits = realloc(*hits, sizeof(BenchmarkHit) * capacity);
+		if (!newHits) {
+			return false;
+		}
+		*hits = newHits;
+		*hitCapacity = capacity;
+	}
+	(*hits)[(*hitCount)++] = hit;
+	return true;
+}
+
+/*
+ * Traces one ray type after the other over the whole image, so that each can be timed on its own.
+ * The rays follow raytracer_raycast, but every hit gets one unjittered shadow ray per light.
+ */
+static bool benchmark_traceCpuWavefronts(Scene* scene, Accel* accel, BenchmarkResult* result) {
+	Camera* camera = scene->camera;
+	uint32_t hitCount = 0;
+	uint32_t hitCapacity = 0;
+	BenchmarkHit* hits = NULL;
+
+	double start = benchmark_now();
+	for (uint32_t y = 0; y < camera->height; y++) {
+		for (uint32_t x = 0; x < camera->width; x++) {
+			BenchmarkHit hit;
+			hit.ray = raytracer_createPrimaryRay(camera, x, y);
+			if (raytracer_intersectScene(scene, accel, &hit.ray, &hit.hitDistance, &hit.intersectionNormal, &hit.hitMaterialIndex, NULL)) {
+				if (!benchmark_appendHit(&hits, &hitCount, &hitCapacity, hit)) {
+					free(hits);
+					return false;
+				}
+			}
+		}
+	}
+	result->primaryTime = benchmark_now() - start;
+	result->primaryRays = (uint64_t) camera->width * camera->height;
+
+	start = benchmark_now();
+	for (uint32_t i = 0; i < hitCount; i++) {
+		BenchmarkHit* hit = &hits[i];
+		Vec3 hitPoint = vec3_add(hit->ray.origin, vec3_mul(hit->ray.direction, hit->hitDistance));
+		for (uint32_t j = 0; j < scene->pointLightCount; j++) {
+			Vec3 hitToLight = vec3_sub(scene->pointLights[j].position, hitPoint);
+			Ray shadowRay;
+			shadowRay.direction = vec3_norm(hitToLight);
+			shadowRay.origin = vec3_add(hitPoint, vec3_mul(shadowRay.direction, 1.0f / 1000.0f));
+			raytracer_isOccluded(scene, accel, &shadowRay, vec3_length(hitToLight), NULL);
+		}
+	}
+	result->shadowTime = benchmark_now() - start;
+	result->shadowRays = (uint64_t) hitCount * scene->pointLightCount;
+
+	uint32_t nextHitCount = 0;
+	uint32_t nextHitCapacity = 0;
+	BenchmarkHit* nextHits = NULL;
+	result->secondaryRays = 0;
+	start = benchmark_now();
+	for (uint32_t depth = 1; depth < BENCHMARK_MAX_RAY_DEPTH && hitCount > 0; depth++) {
+		nextHitCount = 0;
+		for (uint32_t i = 0; i < hitCount; i++) {
+			BenchmarkHit* hit = &hits[i];
+			Ray secondaryRays[2];
+			uint32_t rayCount = raytracer_createSecondaryRays(scene, &hit->ray, hit->hitDistance, hit->intersectionNormal,
+				hit->hitMaterialIndex, secondaryRays);
+			for (uint32_t j = 0; j < rayCount; j++) {
+				BenchmarkHit nextHit;
+				nextHit.ray = secondaryRays[j];
+				if (raytracer_intersectScene(scene, accel, &nextHit.ray, &nextHit.hitDistance, &nextHit.intersectionNormal, &nextHit.hitMaterialIndex, NULL)) {
+					if (!benchmark_appendHit(&nextHits, &nextHitCount, &nextHitCapacity, nextHit)) {
+						free(hits);
+						free(nextHits);
+						return false;
+					}
+				}
+			}
+			result->secondaryRays += rayCount;
+		}
+		BenchmarkHit* tmpHits = hits;
+		uint32_t tmpHitCapacity = hitCapacity;
+		hits = nextHits;
+		hitCount = nextHitCount;
+		hitCapacity = nextHitCapacity;
+		nextHits = tmpHits;
+		nextHitCapacity = tmpHitCapacity;
+	}
+	result->secondaryTime = benchmark_now() - start;
+	free(hits);
+	free(nextHits);
+	return true;
+}
+
+// a complete frame with shading, which is what a user waits for on the CPU, the visibility mode includes the rasterization.
+// Returns a negative time, if the buffers couldn't be allocated or the mode fell back to tracing, stats may be NULL.
+static double benchmark_renderCpuFrame(Scene* scene, Accel* accel, RaytracerPrimaryMode mode, Image* image, TraversalStats* stats) {
+	Camera* camera = scene->camera;
+	RaytracerSampling sampling;
+	raytracer_initSampling(&sampling, camera, 1, BENCHMARK_MAX_RAY_DEPTH, BENCHMARK_SHADOW_RAY_COUNT);
+	uint32_t pixelCount = camera->width * camera->height;
+	seed128bit* seeds = malloc(sizeof(seed128bit) * pixelCount);
+	Vec3* colors = malloc(sizeof(Vec3) * pixelCount);
+	double time = -1.0;
+	if (seeds && colors) {
+		// seeded like the random seed buffer of the kernel
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			seeds[i] = (seed128bit) { (uint64_t) rand(), (uint64_t) rand() };
+		}
+		double start = benchmark_now();
+		bool isRendered = raytracer_render(scene, accel, &sampling, mode, seeds, colors, stats) == mode;
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			image->buffer[i] = raytracer_packColor(colors[i]);
+		}
+		if (isRendered) {
+			time = benchmark_now() - start;
+		}
+	}
+	free(colors);
+	free(seeds);
+	return time;
+}
+
+// the same frame traced in coherence-sorted waves per tile, returns a negative time if the ray buffers couldn't be allocated
+static double benchmark_renderCpuStreamFrame(Scene* scene, Accel* accel, Image* image) {
+	Camera* camera = scene->camera;
+	RaytracerSampling sampling;
+	raytracer_initSampling(&sampling, camera, 1, BENCHMARK_MAX_RAY_DEPTH, BENCHMARK_SHADOW_RAY_COUNT);
+	uint32_t pixelCount = camera->width * camera->height;
+	seed128bit* seeds = malloc(sizeof(seed128bit) * pixelCount);
+	Vec3* colors = malloc(sizeof(Vec3) * pixelCount);
+	double time = -1.0;
+	if (seeds && colors) {
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			seeds[i] = (seed128bit) { (uint64_t) rand(), (uint64_t) rand() };
+		}
+		double start = benchmark_now();
+		if (raystream_render(scene, accel, &sampling, seeds, colors, NULL)) {
+			time = benchmark_now() - start;
+			for (uint32_t i = 0; i < pixelCount; i++) {
+				image->buffer[i] = raytracer_packColor(colors[i]);
+			}
+		}
+	}
+	free(colors);
+	free(seeds);
+	return time;
+}
+
+// JSON null for a negative time
+static void benchmark_writeTime(FILE* file, double time) {
+	if (time < 0.0) {
+		fprintf(file, "null");
+	} else {
+		fprintf(file, "%.3f", time);
+	}
+}
+
+// reads the counters of the last OpenCL frame of the context, or renders an extra CPU frame with counters without a context
+static void benchmark_writeHeatmaps(const char* prefix, GPUContext* context, Accel* accel, Scene* scene) {
+#ifdef ENABLE_TRAVERSAL_STATS
+	Camera* camera = scene->camera;
+	TraversalStats* stats = calloc((size_t) camera->width * camera->height, sizeof(TraversalStats));
+	Image* image = image_create(camera->width, camera->height);
+	if (stats && image) {
+		bool success = true;
+		if (context) {
+			success = gpu_readTraversalStats(context, scene, stats);
+		} else {
+			benchmark_renderCpuFrame(scene, accel, RAYTRACER_PRIMARY_TRACE, image, stats);
+		}
+		if (success) {
+			traversalstats_writeReport(prefix, stats, camera->width, camera->height);
+		}
+	}
+	free(stats);
+	if (image) {
+		image_destroy(image);
+	}
+#else
+	(void) prefix;
+	(void) context;
+	(void) accel;
+	(void) scene;
+#endif
+}
+
+static double benchmark_averageKernelTime(GPUContext* context, Scene* scene, Accel* accel, uint32_t maxRayDepth, uint32_t shadowRayCount,
+	uint32_t frames) {
+	if (!gpu_setRayLimits(context, scene, accel, maxRayDepth, shadowRayCount)) {
+		return -1.0;
+	}
+	// the first frame may include lazy driver work
+	gpu_renderScene(context, scene, accel, NULL);
+	double kernelTime = 0.0;
+	for (uint32_t i = 0; i < frames; i++) {
+		gpu_renderScene(context, scene, accel, NULL);
+		kernelTime += context->cl.kernelTime;
+	}
+	return kernelTime / (double) frames;
+}
+
+// the octree gets the build options of the benchmark
+static Accel* benchmark_buildAccel(Scene* scene, BenchmarkOptions* options, AccelType* type) {
+	*type = options->accel < ACCEL_TYPE_COUNT ? options->accel : accel_getType(scene);
+	if (*type == ACCEL_OCTREE) {
+		return octree_buildFromSceneWithOptions(scene, &options->octree);
+	}
+	return accel_build(scene, *type);
+}
+
+/*
+ * The kernel traces all ray types in one launch, so the time of each type is the difference
+ * between kernels with more and more of them enabled. The ray counts come from the CPU wavefronts.
+ */
+static bool benchmark_runDevice(Scene* scene, BenchmarkOptions* options, const char* heatmapPrefix, cl_platform_id platformId,
+	cl_device_id deviceId, BenchmarkResult* cpuResult, BenchmarkResult* result) {
+	Image* image = image_create(scene->camera->width, scene->camera->height);
+	double start = benchmark_now();
+	AccelType accelType;
+	Accel* accel = benchmark_buildAccel(scene, options, &accelType);
+	if (!accel) {
+		image_destroy(image);
+		return false;
+	}
+	GPUContext* context = gpu_initHeadlessContext(scene, accel, 1, platformId, deviceId);
+	if (!context) {
+		accel_destroy(accel);
+		image_destroy(image);
+		return false;
+	}
+	if (!gpu_setRayLimits(context, scene, accel, BENCHMARK_MAX_RAY_DEPTH, BENCHMARK_SHADOW_RAY_COUNT)) {
+		gpu_destroyContext(context);
+		accel_destroy(accel);
+		image_destroy(image);
+		return false;
+	}
+	gpu_renderScene(context, scene, accel, image);
+	// includes the acceleration structure build, the upload and the kernel compilation
+	result->timeToFirstPixel = benchmark_now() - start;
+	if (heatmapPrefix) {
+		benchmark_writeHeatmaps(heatmapPrefix, context, NULL, scene);
+	}
+
+	// every shadow and secondary ray is traced, so that the rays of the CPU wavefronts match the traced ones
+	gpu_setRayTermination(context, 0.0f, false);
+	if (!gpu_setShadowProbeCount(context, scene, accel, BENCHMARK_SHADOW_RAY_COUNT)) {
+		gpu_destroyContext(context);
+		accel_destroy(accel);
+		image_destroy(image);
+		return false;
+	}
+	double primaryTime = benchmark_averageKernelTime(context, scene, accel, 1, 0, options->frames);
+	double shadowTime = benchmark_averageKernelTime(context, scene, accel, 1, BENCHMARK_SHADOW_RAY_COUNT, options->frames);
+	double secondaryTime = benchmark_averageKernelTime(context, scene, accel, BENCHMARK_MAX_RAY_DEPTH, 0, options->frames);
+	gpu_destroyContext(context);
+	accel_destroy(accel);
+	image_destroy(image);
+	if (primaryTime < 0.0 || shadowTime < 0.0 || secondaryTime < 0.0) {
+		return false;
+	}
+	result->primaryRays = cpuResult->primaryRays;
+	result->shadowRays = cpuResult->shadowRays * BENCHMARK_SHADOW_RAY_COUNT;
+	result->secondaryRays = cpuResult->secondaryRays;
+	result->primaryTime = primaryTime;
+	result->shadowTime = MAX(shadowTime - primaryTime, 0.0);
+	result->secondaryTime = MAX(secondaryTime - primaryTime, 0.0);
+	return true;
+}
+
+// all devices of all platforms, the platform of each device is at the same index
+static uint32_t benchmark_getDevices(cl_platform_id* devicePlatformIds, cl_device_id* deviceIds, uint32_t maxDeviceCount) {
+	cl_platform_id platformIds[BENCHMARK_MAX_PLATFORMS];
+	cl_uint platformCount = 0;
+	if (clGetPlatformIDs(BENCHMARK_MAX_PLATFORMS, platformIds, &platformCount) != CL_SUCCESS) {
+		platformCount = 0;
+	}
+	platformCount = MIN(platformCount, BENCHMARK_MAX_PLATFORMS);
+
+	uint32_t deviceCount = 0;
+	for (cl_uint i = 0; i < platformCount && deviceCount < maxDeviceCount; i++) {
+		cl_uint platformDeviceCount = 0;
+		if (clGetDeviceIDs(platformIds[i], CL_DEVICE_TYPE_ALL, maxDeviceCount - deviceCount, &deviceIds[deviceCount], &platformDeviceCount) != CL_SUCCESS) {
+			continue;
+		}
+		platformDeviceCount = MIN(platformDeviceCount, maxDeviceCount - deviceCount);
+		for (cl_uint j = 0; j < platformDeviceCount; j++) {
+			devicePlatformIds[deviceCount++] = platformIds[i];
+		}
+	}
+	return deviceCount;
+}
+
+static void benchmark_runDevices(FILE* file, const char* sceneName, Scene* scene, BenchmarkOptions* options, BenchmarkResult* cpuResult) {
+	cl_platform_id platformIds[BENCHMARK_MAX_DEVICES];
+	cl_device_id deviceIds[BENCHMARK_MAX_DEVICES];
+	uint32_t deviceCount = benchmark_getDevices(platformIds, deviceIds, BENCHMARK_MAX_DEVICES);
+
+	for (uint32_t i = 0; i < deviceCount; i++) {
+		char platformName[BENCHMARK_NAME_SIZE] = { 0 };
+		clGetPlatformInfo(platformIds[i], CL_PLATFORM_NAME, sizeof(platformName) - 1, platformName, NULL);
+		char deviceName[BENCHMARK_NAME_SIZE] = { 0 };
+		clGetDeviceInfo(deviceIds[i], CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, NULL);
+		printf("  %s: %s\n", platformName, deviceName);
+
+		char heatmapPrefix[BENCHMARK_PATH_SIZE];
+		snprintf(heatmapPrefix, sizeof(heatmapPrefix), "%s_%s_device%u", options->heatmapPrefix, sceneName, i);
+		BenchmarkResult result = { 0 };
+		bool success = benchmark_runDevice(scene, options, options->heatmapPrefix ? heatmapPrefix : NULL, platformIds[i], deviceIds[i],
+			cpuResult, &result);
+		fprintf(file, "%s\n        { \"platform\": ", i == 0 ? "" : ",");
+		benchmark_writeString(file, platformName);
+		fprintf(file, ", \"device\": ");
+		benchmark_writeString(file, deviceName);
+		if (success) {
+			fprintf(file, ", ");
+			benchmark_writeResult(file, &result);
+		} else {
+			fprintf(file, ", \"error\": \"couldn't render the scene\"");
+		}
+		fprintf(file, " }");
+	}
+	fprintf(file, "%s", deviceCount == 0 ? "" : "\n      ");
+}
+
+// renders the frames with all devices at once, with their sub devices instead, if the options ask for them
+static void benchmark_runMultiDevice(FILE* file, Scene* scene, Accel* accel, BenchmarkOptions* options) {
+	cl_platform_id platformIds[BENCHMARK_MAX_DEVICES];
+	cl_device_id deviceIds[BENCHMARK_MAX_DEVICES];
+	uint32_t deviceCount = benchmark_getDevices(platformIds, deviceIds, BENCHMARK_MAX_DEVICES);
+
+	cl_platform_id renderPlatformIds[BENCHMARK_MAX_DEVICES];
+	cl_device_id renderDeviceIds[BENCHMARK_MAX_DEVICES];
+	// sub devices are created here, so they have to be released here as well
+	bool isSubDevice[BENCHMARK_MAX_DEVICES];
+	uint32_t renderDeviceCount = 0;
+	uint32_t subDeviceCount = 0;
+	for (uint32_t i = 0; i < deviceCount && renderDeviceCount < BENCHMARK_MAX_DEVICES; i++) {
+		uint32_t count = 0;
+		if (options->subDeviceCount > 0) {
+			count = multidevice_createSubDevices(deviceIds[i], MIN(options->subDeviceCount, BENCHMARK_MAX_DEVICES - renderDeviceCount),
+				&renderDeviceIds[renderDeviceCount]);
+			subDeviceCount += count;
+		}
+		bool isPartitioned = count > 0;
+		if (!isPartitioned) {
+			// devices without partitioning are used as a whole
+			renderDeviceIds[renderDeviceCount] = deviceIds[i];
+			count = 1;
+		}
+		for (uint32_t j = 0; j < count; j++) {
+			isSubDevice[renderDeviceCount] = isPartitioned;
+			renderPlatformIds[renderDeviceCount++] = platformIds[i];
+		}
+	}
+	printf("  %u devices (%u sub devices)\n", renderDeviceCount, subDeviceCount);
+
+	fprintf(file, "      \"multiDevice\": { \"devices\": %u, \"subDevices\": %u", renderDeviceCount, subDeviceCount);
+	Image* image = image_create(scene->camera->width, scene->camera->height);
+	MultiDevice* multiDevice = multidevice_create(scene, accel, 1, renderPlatformIds, renderDeviceIds, renderDeviceCount);
+	bool success = image && multiDevice
+		&& multidevice_setRayLimits(multiDevice, scene, accel, BENCHMARK_MAX_RAY_DEPTH, BENCHMARK_SHADOW_RAY_COUNT)
+		// the first frame splits the rows evenly and may include lazy driver work
+		&& multidevice_renderScene(multiDevice, scene, accel, image);
+	double frameTime = 0.0;
+	double kernelTime = 0.0;
+	for (uint32_t i = 0; success && i < options->frames; i++) {
+		double start = benchmark_now();
+		success = multidevice_renderScene(multiDevice, scene, accel, image);
+		frameTime += benchmark_now() - start;
+		kernelTime += multiDevice->kernelTime;
+	}
+	if (success) {
+		fprintf(file, ", \"frameMs\": %.3f, \"kernelMs\": %.3f, \"rows\": [",
+			frameTime / (double) options->frames, kernelTime / (double) options->frames);
+		for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+			fprintf(file, "%s%u", i == 0 ? "" : ", ", multiDevice->bands[i].rowCount);
+		}
+		fprintf(file, "]");
+	} else {
+		fprintf(file, ", \"error\": \"couldn't render the scene\"");
+	}
+	fprintf(file, " },\n");
+	multidevice_destroy(multiDevice);
+	if (image) {
+		image_destroy(image);
+	}
+	for (uint32_t i = 0; i < renderDeviceCount; i++) {
+		if (isSubDevice[i]) {
+			clReleaseDevice(renderDeviceIds[i]);
+		}
+	}
+}
+
+// isWritten tells, if a scene is in the file already, and is set, when this one is written
+static bool benchmark_runScene(FILE* file, const char* name, Scene* scene, BenchmarkOptions* options, bool* isWritten) {
+	scene_shrinkToFit(scene);
+	// the peaks of the previous scene shouldn't hide the ones of this scene
+	memstats_resetPeaks();
+	printf("Scene %s: %u spheres, %u triangles, %u lights\n", name, scene->sphereCount, scene->triangleCount, scene->pointLightCount);
+
+	double start = benchmark_now();
+	AccelType accelType;
+	Accel* accel = benchmark_buildAccel(scene, options, &accelType);
+	double accelBuildTime = benchmark_now() - start;
+	if (!accel) {
+		return false;
+	}
+	uint32_t maxDepth = accelType == ACCEL_OCTREE ? options->octree.maxDepth : ACCEL_NO_DEPTH_LIMIT;
+	accel_printReport(accel, scene, accelType, maxDepth, stdout);
+	AccelReport accelReport;
+	accel_getReport(accel, scene, maxDepth, &accelReport);
+
+	// the ray counts are needed for the OpenCL rates as well
+	BenchmarkResult cpuResult = { 0 };
+	if (!benchmark_traceCpuWavefronts(scene, accel, &cpuResult)) {
+		printf("Couldn't allocate the ray buffers.\n");
+		accel_destroy(accel);
+		return false;
+	}
+
+	fprintf(file, "%s\n    {\n      \"name\": ", *isWritten ? "," : "");
+	*isWritten = true;
+	benchmark_writeString(file, name);
+	fprintf(file, ",\n      \"spheres\": %u, \"triangles\": %u, \"lights\": %u, \"accel\": \"%s\",\n",
+		scene->sphereCount, scene->triangleCount, scene->pointLightCount, accel_getName(accelType));
+	fprintf(file, "      \"accelBuildMs\": %.3f, \"accelNodes\": %u, \"accelReferencesPerPrimitive\": %.3f,\n",
+		accelBuildTime, accel->nodeCount, (double) accelReport.referencesPerPrimitive);
+	fprintf(file, "      \"accelDepth\": %u, \"accelLeaves\": %u, \"accelEmptyLeaves\": %u, \"accelEstimatedCost\": %.3f,\n",
+		accelReport.depth, accelReport.leafCount, accelReport.emptyLeafCount, (double) accelReport.estimatedCost);
+	if (options->runCpu) {
+		Image* image = image_create(scene->camera->width, scene->camera->height);
+		double frameTime = benchmark_renderCpuFrame(scene, accel, RAYTRACER_PRIMARY_TRACE, image, NULL);
+		cpuResult.timeToFirstPixel = accelBuildTime + frameTime;
+		double streamFrameTime = benchmark_renderCpuStreamFrame(scene, accel, image);
+		double visibilityFrameTime = benchmark_renderCpuFrame(scene, accel, RAYTRACER_PRIMARY_VISIBILITY, image, NULL);
+		image_destroy(image);
+		if (options->heatmapPrefix) {
+			char heatmapPrefix[BENCHMARK_PATH_SIZE];
+			snprintf(heatmapPrefix, sizeof(heatmapPrefix), "%s_%s_cpu", options->heatmapPrefix, name);
+			benchmark_writeHeatmaps(heatmapPrefix, NULL, accel, scene);
+		}
+		fprintf(file, "      \"cpu\": { ");
+		benchmark_writeResult(file, &cpuResult);
+		fprintf(file, ", \"frameMs\": ");
+		benchmark_writeTime(file, frameTime);
+		fprintf(file, ", \"streamFrameMs\": ");
+		benchmark_writeTime(file, streamFrameTime);
+		fprintf(file, ", \"visibilityFrameMs\": ");
+		benchmark_writeTime(file, visibilityFrameTime);
+		fprintf(file, " },\n");
+	}
+	fprintf(file, "      \"devices\": [");
+	if (options->runGpu) {
+		benchmark_runDevices(file, name, scene, options, &cpuResult);
+	}
+	fprintf(file, "],\n");
+	if (options->runMultiDevice) {
+		benchmark_runMultiDevice(file, scene, accel, options);
+	}
+	benchmark_writePeakMemory(file);
+	fprintf(file, "\n    }");
+	accel_destroy(accel);
+	return true;
+}
+
+static void benchmark_printUsage(const char* program) {
+	printf("Usage: %s [options]\n"
+		"  --width <pixels>        render width (default 480)\n"
+		"  --height <pixels>       render height (default 270)\n"
+		"  --frames <count>        OpenCL frames averaged per measurement (default 10)\n"
+		"  --spheres <count>       random spheres (default 64)\n"
+		"  --subdivisions <count>  icosphere subdivisions, 20 * 4^n triangles (default 3)\n"
+		"  --terrain <resolution>  terrain grid, 2 * n^2 triangles (default 32)\n"
+		"  --lights <count>        point lights in every scene (default 4)\n"
+		"  --seed <seed>           seed of the scene generators (default 1)\n"
+		"  --output <path>         JSON output (default benchmark.json)\n"
+		"  --heatmaps <prefix>     write traversal heatmaps, needs ENABLE_TRAVERSAL_STATS\n"
+		"  --no-cpu                skip the CPU tracer\n"
+		"  --no-gpu                skip the OpenCL devices\n"
+		"  --multi-device          also render every frame with all OpenCL devices together\n"
+		"  --sub-devices <count>   partition every device for the multi device run, e.g. a pocl CPU device\n"
+		"  --accel <name>          octree, bvh or grid (default: selected per scene)\n"
+		"  --octree-depth <depth>  maximum octree depth (default %u)\n"
+		"  --octree-references <n> references per primitive, that the octree may hold (default %.1f)\n",
+		program, OCTREE_MAX_DEPTH, (double) OCTREE_MAX_REFERENCES_PER_PRIMITIVE);
+}
+
+static bool benchmark_parseOptions(int argc, char* argv[], BenchmarkOptions* options) {
+	options->width = 480;
+	options->height = 270;
+	options->frames = 10;
+	options->sphereCount = 64;
+	options->subdivisions = 3;
+	options->terrainResolution = 32;
+	options->lightCount = 4;
+	options->seed = 1;
+	options->outputPath = "benchmark.json";
+	options->heatmapPrefix = NULL;
+	options->runCpu = true;
+	options->runGpu = true;
+	options->runMultiDevice = false;
+	options->subDeviceCount = 0;
+	options->accel = ACCEL_TYPE_COUNT;
+	octree_initBuildOptions(&options->octree);
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (strcmp(arg, "--no-cpu") == 0) {
+			options->runCpu = false;
+			continue;
+		}
+		if (strcmp(arg, "--no-gpu") == 0) {
+			options->runGpu = false;
+			continue;
+		}
+		if (strcmp(arg, "--multi-device") == 0) {
+			options->runMultiDevice = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const char* value = argv[++i];
+		uint32_t number = (uint32_t) strtoul(value, NULL, 10);
+		if (strcmp(arg, "--width") == 0) {
+			options->width = number;
+		} else if (strcmp(arg, "--height") == 0) {
+			options->height = number;
+		} else if (strcmp(arg, "--frames") == 0) {
+			options->frames = number;
+		} else if (strcmp(arg, "--spheres") == 0) {
+			options->sphereCount = number;
+		} else if (strcmp(arg, "--subdivisions") == 0) {
+			options->subdivisions = number;
+		} else if (strcmp(arg, "--terrain") == 0) {
+			options->terrainResolution = number;
+		} else if (strcmp(arg, "--lights") == 0) {
+			options->lightCount = number;
+		} else if (strcmp(arg, "--seed") == 0) {
+			options->seed = strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--output") == 0) {
+			options->outputPath = value;
+		} else if (strcmp(arg, "--heatmaps") == 0) {
+			options->heatmapPrefix = value;
+		} else if (strcmp(arg, "--sub-devices") == 0) {
+			// partitioning is only used by the multi device run
+			options->subDeviceCount = number;
+			options->runMultiDevice = true;
+		} else if (strcmp(arg, "--accel") == 0) {
+			if (!accel_parseType(value, &options->accel)) {
+				return false;
+			}
+		} else if (strcmp(arg, "--octree-depth") == 0) {
+			options->octree.maxDepth = number;
+		} else if (strcmp(arg, "--octree-references") == 0) {
+			options->octree.maxReferencesPerPrimitive = strtof(value, NULL);
+		} else {
+			return false;
+		}
+	}
+	return options->width > 0 && options->height > 0 && options->frames > 0 && options->subdivisions <= 8
+		&& options->octree.maxReferencesPerPrimitive >= 1.0f;
+}
+
+int main(int argc, char* argv[]) {
+	BenchmarkOptions options;
+	if (!benchmark_parseOptions(argc, argv, &options)) {
+		benchmark_printUsage(argv[0]);
+		return 1;
+	}
+	// the pixel seeds of the CPU tracer come from rand()
+	srand(1);
+
+	FILE* file = fopen(options.outputPath, "w");
+	if (!file) {
+		printf("Couldn't open %s.\n", options.outputPath);
+		return 2;
+	}
+	fprintf(file, "{\n  \"width\": %u, \"height\": %u, \"frames\": %u, \"seed\": %llu,\n  \"scenes\": [",
+		options.width, options.height, options.frames, (unsigned long long) options.seed);
+
+#ifndef ENABLE_TRAVERSAL_STATS
+	if (options.heatmapPrefix) {
+		printf("The heatmaps need a build with ENABLE_TRAVERSAL_STATS.\n");
+		options.heatmapPrefix = NULL;
+	}
+#endif
+
+	// a failed scene doesn't stop the others
+	bool success = true;
+	bool isWritten = false;
+	Scene* spheres = scenegen_createBase(options.width, options.height);
+	scenegen_addRandomSpheres(spheres, options.sphereCount, BENCHMARK_SCENE_SIZE, options.seed);
+	scenegen_addLights(spheres, options.lightCount, BENCHMARK_SCENE_SIZE, options.seed);
+	success = benchmark_runScene(file, "spheres", spheres, &options, &isWritten) && success;
+	scene_destroy(spheres);
+
+	Scene* icosphere = scenegen_createBase(options.width, options.height);
+	scenegen_addIcosphere(icosphere, (Vec3) { { 0.0f, 5.0f, 0.0f } }, 5.0f, options.subdivisions, SCENEGEN_MATERIAL_METAL);
+	scenegen_addLights(icosphere, options.lightCount, BENCHMARK_SCENE_SIZE, options.seed);
+	success = benchmark_runScene(file, "icosphere", icosphere, &options, &isWritten) && success;
+	scene_destroy(icosphere);
+
+	Scene* terrain = scenegen_createBase(options.width, options.height);
+	scenegen_addTerrain(terrain, options.terrainResolution, BENCHMARK_SCENE_SIZE * 2.0f, 4.0f, options.seed, SCENEGEN_MATERIAL_DIFFUSE);
+	scenegen_addLights(terrain, options.lightCount, BENCHMARK_SCENE_SIZE, options.seed);
+	success = benchmark_runScene(file, "terrain", terrain, &options, &isWritten) && success;
+	scene_destroy(terrain);
+
+	fprintf(file, "\n  ]\n}\n");
+	fclose(file);
+	printf("Wrote the results to %s.\n", options.outputPath);
+	return success ? 0 : 3;
+}
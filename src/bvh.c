@@ -0,0 +1,263 @@
+#include "bvh.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memstats.h"
+#include "utils/math.h"
+
+typedef struct {
+	BoundingBox boundingBox;
+	Vec3 center;
+	// the index in the spheres or the triangles of the scene
+	uint32_t index;
+	bool isTriangle;
+} BvhPrimitive;
+
+// a node and the range of the primitives, that it holds
+typedef struct {
+	int32_t nodeId;
+	uint32_t begin;
+	uint32_t end;
+} BvhPendingNode;
+
+static BoundingBox bvh_getEmptyBox(void) {
+	return (BoundingBox) { { { FLT_MAX, FLT_MAX, FLT_MAX } }, { { -FLT_MAX, -FLT_MAX, -FLT_MAX } } };
+}
+
+static BoundingBox bvh_addPoint(BoundingBox boundingBox, Vec3 point) {
+	boundingBox.bottomLeftFrontCorner.x = MIN(boundingBox.bottomLeftFrontCorner.x, point.x);
+	boundingBox.bottomLeftFrontCorner.y = MIN(boundingBox.bottomLeftFrontCorner.y, point.y);
+	boundingBox.bottomLeftFrontCorner.z = MIN(boundingBox.bottomLeftFrontCorner.z, point.z);
+	boundingBox.topRightBackCorner.x = MAX(boundingBox.topRightBackCorner.x, point.x);
+	boundingBox.topRightBackCorner.y = MAX(boundingBox.topRightBackCorner.y, point.y);
+	boundingBox.topRightBackCorner.z = MAX(boundingBox.topRightBackCorner.z, point.z);
+	return boundingBox;
+}
+
+// the empty box of bvh_getEmptyBox doesn't change the other box
+static BoundingBox bvh_addBox(BoundingBox boundingBox, BoundingBox other) {
+	boundingBox.bottomLeftFrontCorner.x = MIN(boundingBox.bottomLeftFrontCorner.x, other.bottomLeftFrontCorner.x);
+	boundingBox.bottomLeftFrontCorner.y = MIN(boundingBox.bottomLeftFrontCorner.y, other.bottomLeftFrontCorner.y);
+	boundingBox.bottomLeftFrontCorner.z = MIN(boundingBox.bottomLeftFrontCorner.z, other.bottomLeftFrontCorner.z);
+	boundingBox.topRightBackCorner.x = MAX(boundingBox.topRightBackCorner.x, other.topRightBackCorner.x);
+	boundingBox.topRightBackCorner.y = MAX(boundingBox.topRightBackCorner.y, other.topRightBackCorner.y);
+	boundingBox.topRightBackCorner.z = MAX(boundingBox.topRightBackCorner.z, other.topRightBackCorner.z);
+	return boundingBox;
+}
+
+// 0 for an empty box
+static float bvh_getSurfaceArea(BoundingBox boundingBox) {
+	Vec3 size = vec3_sub(boundingBox.topRightBackCorner, boundingBox.bottomLeftFrontCorner);
+	if (size.x < 0.0f) {
+		return 0.0f;
+	}
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static float bvh_getAxis(Vec3 vector, uint32_t axis) {
+	return axis == 0 ? vector.x : axis == 1 ? vector.y : vector.z;
+}
+
+static float bvh_getCost(BvhPrimitive* primitive) {
+	return primitive->isTriangle ? ACCEL_TRIANGLE_COST : ACCEL_SPHERE_COST;
+}
+
+static uint32_t bvh_getBin(BvhPrimitive* primitive, uint32_t axis, float centerMin, float binScale) {
+	uint32_t bin = (uint32_t) ((bvh_getAxis(primitive->center, axis) - centerMin) * binScale);
+	return MIN(bin, BVH_BIN_COUNT - 1);
+}
+
+static void bvh_createLeaf(Accel* accel, BvhPrimitive* primitives, BvhPendingNode* pending, uint32_t* leafIndexes) {
+	// the spheres first, like every leaf (see accel.h)
+	uint32_t sphereCount = 0;
+	for (uint32_t i = pending->begin; i < pending->end; i++) {
+		if (!primitives[i].isTriangle) {
+			leafIndexes[sphereCount++] = primitives[i].index;
+		}
+	}
+	uint32_t triangleCount = 0;
+	for (uint32_t i = pending->begin; i < pending->end; i++) {
+		if (primitives[i].isTriangle) {
+			leafIndexes[sphereCount + triangleCount++] = primitives[i].index;
+		}
+	}
+	accel_setLeaf(accel, pending->nodeId, leafIndexes, sphereCount, triangleCount);
+}
+
+/*
+ * Returns the first primitive of the second child after partitioning the range, or pending->end, if the node stays a leaf.
+ * The split, that is cheapest with the cost model of accel.h, is used, splitting costs the box tests of both children.
+ */
+static uint32_t bvh_partition(BvhPrimitive* primitives, BvhPendingNode* pending, BoundingBox boundingBox) {
+	uint32_t count = pending->end - pending->begin;
+	BoundingBox centerBox = bvh_getEmptyBox();
+	float leafCost = 0.0f;
+	for (uint32_t i = pending->begin; i < pending->end; i++) {
+		centerBox = bvh_addPoint(centerBox, primitives[i].center);
+		leafCost += bvh_getCost(&primitives[i]);
+	}
+	Vec3 centerExtent = vec3_sub(centerBox.topRightBackCorner, centerBox.bottomLeftFrontCorner);
+	uint32_t axis = 0;
+	if (centerExtent.y > centerExtent.x) {
+		axis = 1;
+	}
+	if (centerExtent.z > bvh_getAxis(centerExtent, axis)) {
+		axis = 2;
+	}
+	// primitives with the same center can't be separated
+	if (count < 2 || bvh_getAxis(centerExtent, axis) <= 0.0f) {
+		return pending->end;
+	}
+
+	BoundingBox binBoxes[BVH_BIN_COUNT];
+	float binCosts[BVH_BIN_COUNT] = { 0 };
+	for (uint32_t i = 0; i < BVH_BIN_COUNT; i++) {
+		binBoxes[i] = bvh_getEmptyBox();
+	}
+	float centerMin = bvh_getAxis(centerBox.bottomLeftFrontCorner, axis);
+	float binScale = (float) BVH_BIN_COUNT / bvh_getAxis(centerExtent, axis);
+	for (uint32_t i = pending->begin; i < pending->end; i++) {
+		uint32_t bin = bvh_getBin(&primitives[i], axis, centerMin, binScale);
+		binBoxes[bin] = bvh_addBox(binBoxes[bin], primitives[i].boundingBox);
+		binCosts[bin] += bvh_getCost(&primitives[i]);
+	}
+
+	// the costs of the bins up to each plane, from the right
+	float rightAreas[BVH_BIN_COUNT];
+	float rightCosts[BVH_BIN_COUNT];
+	BoundingBox rightBox = bvh_getEmptyBox();
+	float rightCost = 0.0f;
+	for (uint32_t i = BVH_BIN_COUNT - 1; i > 0; i--) {
+		rightBox = bvh_addBox(rightBox, binBoxes[i]);
+		rightCost += binCosts[i];
+		rightAreas[i] = bvh_getSurfaceArea(rightBox);
+		rightCosts[i] = rightCost;
+	}
+	float area = bvh_getSurfaceArea(boundingBox);
+	BoundingBox leftBox = bvh_getEmptyBox();
+	float leftCost = 0.0f;
+	float bestCost = FLT_MAX;
+	uint32_t bestPlane = 0;
+	for (uint32_t i = 1; i < BVH_BIN_COUNT; i++) {
+		leftBox = bvh_addBox(leftBox, binBoxes[i - 1]);
+		leftCost += binCosts[i - 1];
+		if (leftCost == 0.0f || rightCosts[i] == 0.0f) {
+			continue;
+		}
+		float cost = 2.0f * ACCEL_BOX_COST;
+		if (area > 0.0f) {
+			cost += (bvh_getSurfaceArea(leftBox) * leftCost + rightAreas[i] * rightCosts[i]) / area;
+		} else {
+			cost += leftCost + rightCosts[i];
+		}
+		if (cost < bestCost) {
+			bestCost = cost;
+			bestPlane = i;
+		}
+	}
+	if (bestPlane == 0 || (bestCost >= leafCost && count <= BVH_MAX_LEAF_SIZE)) {
+		return pending->end;
+	}
+
+	uint32_t middle = pending->begin;
+	for (uint32_t i = pending->begin; i < pending->end; i++) {
+		if (bvh_getBin(&primitives[i], axis, centerMin, binScale) < bestPlane) {
+			BvhPrimitive primitive = primitives[i];
+			primitives[i] = primitives[middle];
+			primitives[middle++] = primitive;
+		}
+	}
+	return middle;
+}
+
+Accel* bvh_buildFromScene(Scene* scene) {
+	Accel* accel = accel_create();
+	if (!accel) {
+		return NULL;
+	}
+	uint32_t primitiveCount = scene->sphereCount + scene->triangleCount;
+	// every split adds 2 nodes and makes one leaf less, so there are at most 2 * primitiveCount - 1 nodes
+	size_t scratchBytes = (sizeof(BvhPrimitive) + sizeof(uint32_t) + 2 * sizeof(BvhPendingNode)) * (primitiveCount + 1);
+	BvhPrimitive* primitives = malloc(sizeof(BvhPrimitive) * (primitiveCount + 1));
+	uint32_t* leafIndexes = malloc(sizeof(uint32_t) * (primitiveCount + 1));
+	BvhPendingNode* queue = malloc(sizeof(BvhPendingNode) * 2 * (primitiveCount + 1));
+	int32_t rootId = accel_addNodes(accel, 1);
+	if (!primitives || !leafIndexes || !queue || rootId != 0) {
+		printf("Couldn't allocate the bvh build.\n");
+		free(primitives);
+		free(leafIndexes);
+		free(queue);
+		accel_destroy(accel);
+		return NULL;
+	}
+	memstats_allocate(MEMSTATS_ACCEL_BUILD, scratchBytes);
+
+	for (uint32_t i = 0; i < scene->sphereCount; i++) {
+		Sphere* sphere = &scene->spheres[i];
+		Vec3 radius = { { sphere->radius, sphere->radius, sphere->radius } };
+		primitives[i] = (BvhPrimitive) {
+			{ vec3_sub(sphere->position, radius), vec3_add(sphere->position, radius) },
+			sphere->position,
+			i,
+			false
+		};
+	}
+	for (uint32_t i = 0; i < scene->triangleCount; i++) {
+		Triangle* triangle = &scene->triangles[i];
+		BoundingBox boundingBox = bvh_addPoint(bvh_addPoint(bvh_addPoint(bvh_getEmptyBox(), triangle->v0), triangle->v1), triangle->v2);
+		primitives[scene->sphereCount + i] = (BvhPrimitive) {
+			boundingBox,
+			vec3_mul(vec3_add(boundingBox.bottomLeftFrontCorner, boundingBox.topRightBackCorner), 0.5f),
+			i,
+			true
+		};
+	}
+
+	// breadth first like the octree, so the top levels are at the beginning of the array
+	uint32_t queueStart = 0;
+	uint32_t queueEnd = 0;
+	queue[queueEnd++] = (BvhPendingNode) { rootId, 0, primitiveCount };
+	bool success = true;
+	while (queueStart < queueEnd && success) {
+		BvhPendingNode pending = queue[queueStart++];
+		BoundingBox boundingBox = bvh_getEmptyBox();
+		for (uint32_t i = pending.begin; i < pending.end; i++) {
+			boundingBox = bvh_addBox(boundingBox, primitives[i].boundingBox);
+		}
+		if (pending.begin == pending.end) {
+			// only the root of an empty scene
+			boundingBox = (BoundingBox) { 0 };
+		}
+		accel->nodes[pending.nodeId].boundingBox = boundingBox;
+
+		uint32_t middle = bvh_partition(primitives, &pending, boundingBox);
+		if (middle == pending.end) {
+			bvh_createLeaf(accel, primitives, &pending, leafIndexes);
+			continue;
+		}
+		int32_t firstChildId = accel_addNodes(accel, 2);
+		if (firstChildId == NODE_INDEX_UNDEF) {
+			success = false;
+			break;
+		}
+		// the children fill the last slots
+		accel->nodes[pending.nodeId].childNodeIndexes[6] = firstChildId;
+		accel->nodes[pending.nodeId].childNodeIndexes[7] = firstChildId + 1;
+		queue[queueEnd++] = (BvhPendingNode) { firstChildId, pending.begin, middle };
+		queue[queueEnd++] = (BvhPendingNode) { firstChildId + 1, middle, pending.end };
+	}
+
+	free(primitives);
+	free(leafIndexes);
+	free(queue);
+	memstats_free(MEMSTATS_ACCEL_BUILD, scratchBytes);
+	if (!success) {
+		printf("Couldn't allocate the bvh build.\n");
+		accel_destroy(accel);
+		return NULL;
+	}
+	accel_finish(accel);
+	return accel;
+}
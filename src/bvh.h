@@ -0,0 +1,20 @@
+#ifndef RAYTRACER_BVH_H
+#define RAYTRACER_BVH_H
+
+#include "scene.h"
+#include "accel.h"
+
+/*
+ * Bounding volume hierarchy, that partitions the primitives instead of the space. Every primitive is referenced by
+ * exactly one leaf and the box of a node fits its primitives, so large primitives aren't duplicated like in the octree.
+ * A node is split at the cheapest of BVH_BIN_COUNT planes along the longest axis of the primitive centers,
+ * with the cost model of accel.h. The binary nodes are stored in the node format of accel.h.
+ */
+
+#define BVH_BIN_COUNT 16
+// larger leaves are split, even if the cost model prefers the leaf
+#define BVH_MAX_LEAF_SIZE 8
+
+Accel* bvh_buildFromScene(Scene* scene);
+
+#endif //RAYTRACER_BVH_H
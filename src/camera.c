@@ -45,6 +45,21 @@ Camera* camera_create(Vec3 position, Vec3 lookAt, uint32_t width, uint32_t heigh
     return camera;
 }
 
+void camera_setView(Camera* camera, Vec3 position, Vec3 lookAt, float FOV, float apertureSize) {
+    camera->position = position;
+    camera->lookAt = lookAt;
+    camera->FOV = FOV;
+    camera->focalLength = vec3_length(vec3_sub(position, lookAt));
+    camera->apertureSize = apertureSize;
+    camera_setup(camera);
+}
+
+void camera_setResolution(Camera* camera, uint32_t width, uint32_t height) {
+    camera->width = width;
+    camera->height = height;
+    camera_setup(camera);
+}
+
 void move_camera(Camera *camera, int upDown, int side, int frontal) {
     camera->position = vec3_add(camera->position, vec3_mul(camera->x, side * 0.5f));
     camera->position = vec3_add(camera->position, vec3_mul(camera->y, upDown * 0.5f));
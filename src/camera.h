@@ -16,6 +16,10 @@ typedef struct {
 
 Camera* camera_create(Vec3 position, Vec3 lookAt, uint32_t width, uint32_t height, float FOV, float apetureSize);
 void camera_setup(Camera *camera);
+// moves the camera like camera_create, the focus stays on lookAt
+void camera_setView(Camera* camera, Vec3 position, Vec3 lookAt, float FOV, float apertureSize);
+// changes the number of pixels, the aspect ratio and field of view stay the same
+void camera_setResolution(Camera* camera, uint32_t width, uint32_t height);
 void move_camera(Camera *camera, int upDown, int side, int frontal);
 void camera_destroy(Camera* camera);
 
@@ -0,0 +1,115 @@
+#include "camerapath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils/math.h"
+
+#define CAMERAPATH_LINE_SIZE 512
+#define CAMERAPATH_KEYFRAME_VALUES 9
+
+// uniform Catmull-Rom between p1 and p2, p0 and p3 are the neighbours, which shape the tangents
+static Vec3 camerapath_catmullRom(Vec3 p0, Vec3 p1, Vec3 p2, Vec3 p3, float t) {
+	float t2 = t * t;
+	float t3 = t2 * t;
+	Vec3 result = vec3_mul(p1, 2.0f);
+	result = vec3_add(result, vec3_mul(vec3_sub(p2, p0), t));
+	result = vec3_add(result, vec3_mul(vec3_add(vec3_sub(vec3_mul(p0, 2.0f), vec3_mul(p1, 5.0f)), vec3_sub(vec3_mul(p2, 4.0f), p3)), t2));
+	result = vec3_add(result, vec3_mul(vec3_add(vec3_sub(vec3_mul(p1, 3.0f), p0), vec3_sub(p3, vec3_mul(p2, 3.0f))), t3));
+	return vec3_mul(result, 0.5f);
+}
+
+CameraPath* camerapath_load(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		printf("Couldn't open the camera path %s.\n", path);
+		return NULL;
+	}
+	CameraPath* cameraPath = calloc(1, sizeof(CameraPath));
+	uint32_t capacity = 0;
+	char line[CAMERAPATH_LINE_SIZE];
+	uint32_t lineNumber = 0;
+	bool success = cameraPath != NULL;
+	while (success && fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		CameraKeyframe keyframe;
+		int valueCount = sscanf(line, "%f %f %f %f %f %f %f %f %f", &keyframe.time,
+			&keyframe.position.x, &keyframe.position.y, &keyframe.position.z,
+			&keyframe.lookAt.x, &keyframe.lookAt.y, &keyframe.lookAt.z, &keyframe.FOV, &keyframe.apertureSize);
+		if (valueCount <= 0 || line[0] == '#') {
+			// empty lines and comments
+			continue;
+		}
+		if (valueCount != CAMERAPATH_KEYFRAME_VALUES) {
+			printf("Line %u of %s doesn't have %u values.\n", lineNumber, path, CAMERAPATH_KEYFRAME_VALUES);
+			success = false;
+			break;
+		}
+		if (cameraPath->keyframeCount > 0 && keyframe.time <= cameraPath->keyframes[cameraPath->keyframeCount - 1].time) {
+			printf("Line %u of %s isn't later than the previous keyframe.\n", lineNumber, path);
+			success = false;
+			break;
+		}
+		if (cameraPath->keyframeCount == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			CameraKeyframe* keyframes = realloc(cameraPath->keyframes, sizeof(CameraKeyframe) * capacity);
+			if (!keyframes) {
+				success = false;
+				break;
+			}
+			cameraPath->keyframes = keyframes;
+		}
+		cameraPath->keyframes[cameraPath->keyframeCount++] = keyframe;
+	}
+	fclose(file);
+	if (success && cameraPath->keyframeCount == 0) {
+		printf("The camera path %s has no keyframes.\n", path);
+		success = false;
+	}
+	if (!success) {
+		camerapath_destroy(cameraPath);
+		return NULL;
+	}
+	return cameraPath;
+}
+
+float camerapath_getDuration(CameraPath* path) {
+	return path->keyframes[path->keyframeCount - 1].time - path->keyframes[0].time;
+}
+
+void camerapath_apply(CameraPath* path, float time, Camera* camera) {
+	CameraKeyframe* keyframes = path->keyframes;
+	uint32_t last = path->keyframeCount - 1;
+	if (time <= keyframes[0].time || last == 0) {
+		camera_setView(camera, keyframes[0].position, keyframes[0].lookAt, keyframes[0].FOV, keyframes[0].apertureSize);
+		return;
+	}
+	if (time >= keyframes[last].time) {
+		camera_setView(camera, keyframes[last].position, keyframes[last].lookAt, keyframes[last].FOV, keyframes[last].apertureSize);
+		return;
+	}
+
+	// the segment [i, i + 1] contains the time
+	uint32_t i = 0;
+	while (keyframes[i + 1].time < time) {
+		i++;
+	}
+	CameraKeyframe* k0 = &keyframes[i > 0 ? i - 1 : 0];
+	CameraKeyframe* k1 = &keyframes[i];
+	CameraKeyframe* k2 = &keyframes[i + 1];
+	CameraKeyframe* k3 = &keyframes[MIN(i + 2, last)];
+	float t = (time - k1->time) / (k2->time - k1->time);
+
+	Vec3 position = camerapath_catmullRom(k0->position, k1->position, k2->position, k3->position, t);
+	Vec3 lookAt = camerapath_catmullRom(k0->lookAt, k1->lookAt, k2->lookAt, k3->lookAt, t);
+	float FOV = k1->FOV + (k2->FOV - k1->FOV) * t;
+	float apertureSize = k1->apertureSize + (k2->apertureSize - k1->apertureSize) * t;
+	camera_setView(camera, position, lookAt, FOV, apertureSize);
+}
+
+void camerapath_destroy(CameraPath* path) {
+	if (path) {
+		free(path->keyframes);
+		free(path);
+	}
+}
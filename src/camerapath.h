@@ -0,0 +1,39 @@
+#ifndef RAYTRACER_CAMERAPATH_H
+#define RAYTRACER_CAMERAPATH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "utils/vec3.h"
+
+/*
+ * Keyframes of the camera over time. The position and lookAt follow a Catmull-Rom spline through the keyframes,
+ * so the camera doesn't change direction abruptly at them, the FOV and aperture are interpolated linearly.
+ *
+ * File format, one keyframe per line, sorted by time, lines starting with # are comments:
+ *     time positionX positionY positionZ lookAtX lookAtY lookAtZ FOV apertureSize
+ */
+
+typedef struct {
+	// in seconds
+	float time;
+	Vec3 position;
+	Vec3 lookAt;
+	float FOV;
+	float apertureSize;
+} CameraKeyframe;
+
+typedef struct {
+	CameraKeyframe* keyframes;
+	uint32_t keyframeCount;
+} CameraPath;
+
+// returns NULL, if the file can't be read or has no keyframes
+CameraPath* camerapath_load(const char* path);
+float camerapath_getDuration(CameraPath* path);
+// moves the camera to the given time, times outside of the path use the first or last keyframe
+void camerapath_apply(CameraPath* path, float time, Camera* camera);
+void camerapath_destroy(CameraPath* path);
+
+#endif //RAYTRACER_CAMERAPATH_H
@@ -0,0 +1,137 @@
+#include "denoiser.h"
+
+#include <float.h>
+#include <stdlib.h>
+
+#include "utils/math.h"
+
+// the B3 spline from the center to the outer taps
+static const float denoiser_taps[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+static float denoiser_getLuminance(Vec3 color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+void denoiser_traceGuide(Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y, DenoiserGuide* guide) {
+	Camera* camera = scene->camera;
+	float posX = -1.0f + 2.0f * ((float) x / (float) camera->width);
+	float posY = -1.0f + 2.0f * ((float) y / (float) camera->height);
+	Vec3 offsetX = vec3_mul(camera->x, (posX - sampling->pixelWidth) * camera->renderTargetWidth / 2.0f);
+	Vec3 offsetY = vec3_mul(camera->y, (posY - sampling->pixelHeight) * camera->renderTargetHeight / 2.0f);
+	Ray ray;
+	ray.origin = camera->position;
+	ray.direction = vec3_norm(vec3_sub(vec3_sub(vec3_add(camera->renderTargetCenter, offsetX), offsetY), camera->position));
+
+	float hitDistance;
+	Vec3 normal;
+	uint32_t materialIndex;
+	if (raytracer_intersectScene(scene, accel, &ray, &hitDistance, &normal, &materialIndex, NULL)) {
+		guide->normal = normal;
+		guide->depth = hitDistance;
+		guide->albedo = scene->materials[materialIndex].color;
+	} else {
+		guide->normal = (Vec3) { { 0.0f, 0.0f, 0.0f } };
+		guide->depth = 0.0f;
+		guide->albedo = (Vec3) { { 1.0f, 1.0f, 1.0f } };
+	}
+}
+
+// the lighting without the material color, channels without albedo are black after the shading anyway
+static Vec3 denoiser_demodulate(Vec3 color, Vec3 albedo) {
+	color.r = albedo.r > 0.0f ? color.r / albedo.r : 0.0f;
+	color.g = albedo.g > 0.0f ? color.g / albedo.g : 0.0f;
+	color.b = albedo.b > 0.0f ? color.b / albedo.b : 0.0f;
+	return color;
+}
+
+// the smaller of both one sided differences, so that the gradient doesn't reach over depth edges
+static float denoiser_getDepthGradient(const DenoiserGuide* guides, uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+	int32_t directionX, int32_t directionY) {
+	float depth = guides[y * width + x].depth;
+	float gradient = FLT_MAX;
+	for (int32_t side = -1; side <= 1; side += 2) {
+		int64_t neighborX = (int64_t) x + side * directionX;
+		int64_t neighborY = (int64_t) y + side * directionY;
+		if (neighborX < 0 || neighborY < 0 || neighborX >= width || neighborY >= height) {
+			continue;
+		}
+		float neighborDepth = guides[neighborY * width + neighborX].depth;
+		if (neighborDepth > 0.0f) {
+			gradient = MIN(gradient, fabsf(neighborDepth - depth));
+		}
+	}
+	return gradient == FLT_MAX ? 0.0f : gradient;
+}
+
+static void denoiser_filterPass(const Vec3* input, Vec3* output, const DenoiserGuide* guides, uint32_t width, uint32_t height,
+	int32_t stepWidth, float colorPhi) {
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t index = y * width + x;
+			const DenoiserGuide* center = &guides[index];
+			// the background has nothing to blur
+			if (center->depth <= 0.0f) {
+				output[index] = input[index];
+				continue;
+			}
+			float gradientX = denoiser_getDepthGradient(guides, width, height, x, y, 1, 0);
+			float gradientY = denoiser_getDepthGradient(guides, width, height, x, y, 0, 1);
+			float centerLuminance = denoiser_getLuminance(input[index]);
+
+			Vec3 sum = { { 0.0f, 0.0f, 0.0f } };
+			float weightSum = 0.0f;
+			for (int32_t j = -2; j <= 2; j++) {
+				int64_t tapY = (int64_t) y + j * stepWidth;
+				if (tapY < 0 || tapY >= height) {
+					continue;
+				}
+				for (int32_t i = -2; i <= 2; i++) {
+					int64_t tapX = (int64_t) x + i * stepWidth;
+					if (tapX < 0 || tapX >= width) {
+						continue;
+					}
+					uint32_t tapIndex = (uint32_t) (tapY * width + tapX);
+					const DenoiserGuide* tap = &guides[tapIndex];
+					if (tap->depth <= 0.0f) {
+						continue;
+					}
+					// the depth difference, that the gradient explains, is relative to the depth on flat regions
+					float expectedDepthDifference = gradientX * (float) abs(i * stepWidth) + gradientY * (float) abs(j * stepWidth);
+					float depthWeight = expf(-fabsf(center->depth - tap->depth) / (DENOISER_DEPTH_PHI * expectedDepthDifference + 0.001f * center->depth));
+					float normalWeight = powf(MAX(vec3_dot(center->normal, tap->normal), 0.0f), DENOISER_NORMAL_PHI);
+					float colorWeight = expf(-fabsf(centerLuminance - denoiser_getLuminance(input[tapIndex])) / colorPhi);
+					float weight = denoiser_taps[abs(i)] * denoiser_taps[abs(j)] * depthWeight * normalWeight * colorWeight;
+					sum = vec3_add(sum, vec3_mul(input[tapIndex], weight));
+					weightSum += weight;
+				}
+			}
+			// the center tap has a weight, unless its normal is degenerated
+			output[index] = weightSum > 0.0f ? vec3_div(sum, weightSum) : input[index];
+		}
+	}
+}
+
+bool denoiser_apply(Vec3* colors, const DenoiserGuide* guides, uint32_t width, uint32_t height) {
+	size_t pixelCount = (size_t) width * height;
+	Vec3* buffers[2] = { malloc(sizeof(Vec3) * pixelCount), malloc(sizeof(Vec3) * pixelCount) };
+	if (!buffers[0] || !buffers[1]) {
+		free(buffers[0]);
+		free(buffers[1]);
+		return false;
+	}
+	for (size_t i = 0; i < pixelCount; i++) {
+		buffers[0][i] = denoiser_demodulate(colors[i], guides[i].albedo);
+	}
+	float colorPhi = DENOISER_COLOR_PHI;
+	for (uint32_t pass = 0; pass < DENOISER_PASS_COUNT; pass++) {
+		denoiser_filterPass(buffers[pass % 2], buffers[1 - pass % 2], guides, width, height, 1 << pass, colorPhi);
+		colorPhi /= 2.0f;
+	}
+	Vec3* filtered = buffers[DENOISER_PASS_COUNT % 2];
+	for (size_t i = 0; i < pixelCount; i++) {
+		colors[i] = vec3_clamp(vec3_hadamard(filtered[i], guides[i].albedo), 0.0f, 1.0f);
+	}
+	free(buffers[0]);
+	free(buffers[1]);
+	return true;
+}
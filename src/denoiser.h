@@ -0,0 +1,41 @@
+#ifndef RAYTRACER_DENOISER_H
+#define RAYTRACER_DENOISER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/vec3.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "accel.h"
+
+/*
+ * Edge avoiding a-trous wavelet filter, the denoise kernel in kernel.cl does the same on the device.
+ * Every pass blurs with a 5x5 B3 spline, whose taps are twice as far apart as in the pass before.
+ * Taps on other surfaces are weighted down with the normals and depths of the primary hits, taps with
+ * a different brightness with the color. The material color is divided out before and multiplied back
+ * after filtering, so that only the lighting is blurred and the edges between materials stay sharp.
+ */
+
+// gpu_buildKernel passes the normal and depth PHI to the denoise kernel as well
+#define DENOISER_PASS_COUNT 5
+// brightness difference of the first pass, halved with every pass
+#define DENOISER_COLOR_PHI 0.2f
+// exponent of the cosine between the normals
+#define DENOISER_NORMAL_PHI 128.0f
+// scales the depth difference, that the depth gradient of the pixel explains
+#define DENOISER_DEPTH_PHI 1.0f
+
+typedef struct {
+	Vec3 normal;
+	// distance to the primary hit, 0 without a hit
+	float depth;
+	Vec3 albedo;
+} DenoiserGuide;
+
+// the guide of the pinhole ray through the first sample position of the pixel, which the kernel traces as well
+void denoiser_traceGuide(Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y, DenoiserGuide* guide);
+// filters the clamped colors of a width x height frame in place, returns false if the memory for it is missing
+bool denoiser_apply(Vec3* colors, const DenoiserGuide* guides, uint32_t width, uint32_t height);
+
+#endif //RAYTRACER_DENOISER_H
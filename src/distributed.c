@@ -0,0 +1,870 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utils/image.h"
+#include "utils/math.h"
+#include "utils/socket.h"
+#include "scene.h"
+#include "scenegen.h"
+#include "accel.h"
+#include "raytracer.h"
+#include "gpu.h"
+#include "sceneserial.h"
+
+/*
+ * Renders a single frame with several processes, which may run on other machines.
+ * The coordinator sends the scene and its acceleration structure to every worker once, when it connects, and then hands out
+ * tiles of whole rows. The workers render them with the CPU tracer or an OpenCL device and send them back
+ * run length encoded. The tiles of a worker, that disconnects or stops answering, go back to the queue.
+ * Once the queue is empty, tiles that take much longer than the average are given to an idle worker
+ * as well and the first result is used.
+ * Run with --help for the options.
+ */
+
+#define DISTRIBUTED_VERSION 1
+#define DISTRIBUTED_DEFAULT_PORT 7878
+#define DISTRIBUTED_MAX_WORKERS 64
+// a worker gets the next tile before it is done with the current one, so it doesn't wait for the network
+#define DISTRIBUTED_TILES_PER_WORKER 2
+// a tile is given to a second worker, if it takes this many times longer than the average tile
+#define DISTRIBUTED_SLOW_FACTOR 3.0
+// a worker with tiles, that doesn't answer for this long, is dropped (ms)
+#define DISTRIBUTED_WORKER_TIMEOUT 30000
+// a connection, that doesn't send its hello for this long, is closed (ms)
+#define DISTRIBUTED_HELLO_TIMEOUT 5000
+#define DISTRIBUTED_POLL_INTERVAL 100
+// the longest run of the run length encoding
+#define DISTRIBUTED_MAX_RUN 128
+
+typedef enum {
+	DISTRIBUTED_MESSAGE_HELLO = 1,
+	DISTRIBUTED_MESSAGE_SCENE,
+	DISTRIBUTED_MESSAGE_TILE,
+	DISTRIBUTED_MESSAGE_RESULT,
+	DISTRIBUTED_MESSAGE_DONE
+} DistributedMessageType;
+
+/*
+ * Every message is a header followed by its payload:
+ *     HELLO:  worker -> coordinator, DistributedHello
+ *     SCENE:  coordinator -> worker, DistributedSettings followed by the data of sceneserial_write
+ *     TILE:   coordinator -> worker, DistributedTile
+ *     RESULT: worker -> coordinator, DistributedTile followed by the encoded pixels of its rows
+ *     DONE:   coordinator -> worker, no payload
+ * All values are in the byte order of the machines, which have to match.
+ */
+typedef struct {
+	uint32_t type;
+	uint32_t size;
+} DistributedHeader;
+
+typedef struct {
+	uint32_t version;
+	// 1, if the worker renders with OpenCL
+	uint32_t usesOpenCL;
+} DistributedHello;
+
+typedef struct {
+	uint32_t raysPerPixel;
+	uint32_t maxRayDepth;
+	uint32_t shadowRayCount;
+	// the pixel seeds of the CPU tracer, so every CPU worker renders a tile the same way
+	uint32_t seed;
+} DistributedSettings;
+
+typedef struct {
+	uint32_t tileId;
+	uint32_t rowBegin;
+	uint32_t rowCount;
+} DistributedTile;
+
+typedef enum {
+	DISTRIBUTED_TILE_PENDING,
+	DISTRIBUTED_TILE_ASSIGNED,
+	DISTRIBUTED_TILE_DONE
+} DistributedTileState;
+
+typedef struct {
+	DistributedTile tile;
+	DistributedTileState state;
+	// number of workers rendering the tile, more than 1 if it was slow
+	uint32_t workerCount;
+	// when the tile was handed out the first time in ms
+	double assignTime;
+} CoordinatorTile;
+
+typedef struct {
+	SocketHandle socket;
+	uint32_t id;
+	// false until the hello arrived and the scene was sent
+	bool isConnected;
+	bool usesOpenCL;
+	uint32_t tileIds[DISTRIBUTED_TILES_PER_WORKER];
+	double assignTimes[DISTRIBUTED_TILES_PER_WORKER];
+	uint32_t tileCount;
+	// when the last message arrived in ms
+	double lastMessageTime;
+	uint32_t tilesDone;
+	uint64_t bytesReceived;
+	// the message, that is arriving, is read piece by piece, so a slow worker doesn't block the others
+	DistributedHeader header;
+	size_t headerSize;
+	uint8_t* payload;
+	size_t payloadSize;
+} CoordinatorWorker;
+
+typedef struct {
+	CoordinatorTile* tiles;
+	uint32_t tileCount;
+	uint32_t tilesDone;
+	CoordinatorWorker workers[DISTRIBUTED_MAX_WORKERS];
+	uint32_t workerCount;
+	uint32_t nextWorkerId;
+	// from handing out a tile to its result in ms, including the wait behind the previous tile of the worker
+	double totalTileTime;
+	uint32_t measuredTileCount;
+	uint32_t reassignedTileCount;
+	// the largest valid result message
+	size_t maxResultSize;
+	Image* image;
+} Coordinator;
+
+typedef struct {
+	bool isCoordinator;
+	const char* host;
+	uint16_t port;
+	uint32_t width;
+	uint32_t height;
+	uint32_t raysPerPixel;
+	uint32_t maxRayDepth;
+	uint32_t shadowRayCount;
+	uint32_t tileRows;
+	// 0 renders the scene of scene.c
+	uint32_t sphereCount;
+	uint32_t seed;
+	const char* outputPath;
+	bool useOpenCL;
+	uint32_t deviceIndex;
+} DistributedOptions;
+
+static double distributed_now(void) {
+	return (double) SDL_GetPerformanceCounter() * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+// -------------------- PROTOCOL --------------------
+
+// the payload is the data followed by the extra data, which may be NULL
+static bool distributed_send(SocketHandle socket, DistributedMessageType type, const void* data, size_t size, const void* extra, size_t extraSize) {
+	if (size + extraSize > UINT32_MAX) {
+		printf("The message is too large.\n");
+		return false;
+	}
+	DistributedHeader header = { (uint32_t) type, (uint32_t) (size + extraSize) };
+	return socket_sendAll(socket, &header, sizeof(header))
+		&& (size == 0 || socket_sendAll(socket, data, size))
+		&& (extraSize == 0 || socket_sendAll(socket, extra, extraSize));
+}
+
+// returns the payload, which the caller has to free, or NULL if the connection failed or the message is larger than maxSize
+static uint8_t* distributed_receive(SocketHandle socket, DistributedHeader* header, size_t maxSize) {
+	if (!socket_receiveAll(socket, header, sizeof(DistributedHeader))) {
+		return NULL;
+	}
+	if (header->size > maxSize) {
+		printf("Received a message of %u bytes, which is too large.\n", header->size);
+		return NULL;
+	}
+	// one extra byte, so an empty payload isn't NULL
+	uint8_t* payload = malloc((size_t) header->size + 1);
+	if (!payload) {
+		printf("Couldn't allocate a message of %u bytes.\n", header->size);
+		return NULL;
+	}
+	if (!socket_receiveAll(socket, payload, header->size)) {
+		free(payload);
+		return NULL;
+	}
+	return payload;
+}
+
+// the encoding can't grow the pixels by more than this
+static size_t distributed_getMaxEncodedSize(uint32_t pixelCount) {
+	return (size_t) pixelCount * sizeof(uint32_t) + pixelCount / DISTRIBUTED_MAX_RUN + 1;
+}
+
+/*
+ * PackBits on whole pixels: a control byte c < 128 is followed by c + 1 different pixels,
+ * c >= 128 by one pixel, that repeats c - 126 times. The background and flat shaded areas shrink
+ * to a few bytes, noisy areas grow by one byte per 128 pixels.
+ */
+static size_t distributed_encode(const uint32_t* pixels, uint32_t pixelCount, uint8_t* output) {
+	size_t size = 0;
+	uint32_t i = 0;
+	while (i < pixelCount) {
+		uint32_t run = 1;
+		while (i + run < pixelCount && run < DISTRIBUTED_MAX_RUN && pixels[i + run] == pixels[i]) {
+			run++;
+		}
+		if (run > 1) {
+			output[size++] = (uint8_t) (run + 126);
+			memcpy(output + size, &pixels[i], sizeof(uint32_t));
+			size += sizeof(uint32_t);
+			i += run;
+			continue;
+		}
+		// the literals end, where the next run starts
+		uint32_t literalCount = 1;
+		while (i + literalCount < pixelCount && literalCount < DISTRIBUTED_MAX_RUN
+			&& !(i + literalCount + 1 < pixelCount && pixels[i + literalCount] == pixels[i + literalCount + 1])) {
+			literalCount++;
+		}
+		output[size++] = (uint8_t) (literalCount - 1);
+		memcpy(output + size, &pixels[i], sizeof(uint32_t) * literalCount);
+		size += sizeof(uint32_t) * literalCount;
+		i += literalCount;
+	}
+	return size;
+}
+
+// returns false, if the data doesn't decode to exactly pixelCount pixels
+static bool distributed_decode(const uint8_t* data, size_t size, uint32_t* pixels, uint32_t pixelCount) {
+	size_t offset = 0;
+	uint32_t i = 0;
+	while (offset < size) {
+		uint8_t control = data[offset++];
+		if (control >= 128) {
+			uint32_t run = (uint32_t) control - 126;
+			if (size - offset < sizeof(uint32_t) || pixelCount - i < run) {
+				return false;
+			}
+			uint32_t pixel;
+			memcpy(&pixel, data + offset, sizeof(uint32_t));
+			offset += sizeof(uint32_t);
+			for (uint32_t j = 0; j < run; j++) {
+				pixels[i++] = pixel;
+			}
+		} else {
+			uint32_t literalCount = (uint32_t) control + 1;
+			if (size - offset < sizeof(uint32_t) * literalCount || pixelCount - i < literalCount) {
+				return false;
+			}
+			memcpy(&pixels[i], data + offset, sizeof(uint32_t) * literalCount);
+			offset += sizeof(uint32_t) * literalCount;
+			i += literalCount;
+		}
+	}
+	return i == pixelCount;
+}
+
+// -------------------- COORDINATOR --------------------
+
+typedef enum {
+	DISTRIBUTED_RECEIVE_FAILED,
+	DISTRIBUTED_RECEIVE_PARTIAL,
+	DISTRIBUTED_RECEIVE_DONE
+} DistributedReceiveState;
+
+// reads what arrived of the next message of the worker with a single receive, which doesn't block after the wait.
+// On DONE the worker's header and payload hold the message and the caller has to free the payload.
+static DistributedReceiveState distributed_receivePart(CoordinatorWorker* worker, size_t maxSize) {
+	size_t received;
+	if (worker->headerSize < sizeof(DistributedHeader)) {
+		if (!socket_receive(worker->socket, (uint8_t*) &worker->header + worker->headerSize,
+			sizeof(DistributedHeader) - worker->headerSize, &received)) {
+			return DISTRIBUTED_RECEIVE_FAILED;
+		}
+		worker->headerSize += received;
+		if (worker->headerSize < sizeof(DistributedHeader)) {
+			return DISTRIBUTED_RECEIVE_PARTIAL;
+		}
+		// the size isn't trusted before it is checked
+		if (worker->header.size > maxSize) {
+			printf("Worker %u sent a message of %u bytes, which is too large.\n", worker->id, worker->header.size);
+			return DISTRIBUTED_RECEIVE_FAILED;
+		}
+		// one extra byte, so an empty payload isn't NULL
+		worker->payload = malloc((size_t) worker->header.size + 1);
+		worker->payloadSize = 0;
+		if (!worker->payload) {
+			printf("Couldn't allocate a message of %u bytes.\n", worker->header.size);
+			return DISTRIBUTED_RECEIVE_FAILED;
+		}
+	} else {
+		if (!socket_receive(worker->socket, worker->payload + worker->payloadSize, worker->header.size - worker->payloadSize, &received)) {
+			return DISTRIBUTED_RECEIVE_FAILED;
+		}
+		worker->payloadSize += received;
+	}
+	if (worker->payloadSize < worker->header.size) {
+		return DISTRIBUTED_RECEIVE_PARTIAL;
+	}
+	worker->headerSize = 0;
+	return DISTRIBUTED_RECEIVE_DONE;
+}
+
+static double distributed_getAverageTileTime(Coordinator* coordinator) {
+	return coordinator->measuredTileCount > 0 ? coordinator->totalTileTime / coordinator->measuredTileCount : 0.0;
+}
+
+// the tiles of the worker go back to the queue, unless another worker renders them as well
+static void distributed_dropWorker(Coordinator* coordinator, uint32_t workerIndex, const char* reason) {
+	CoordinatorWorker* worker = &coordinator->workers[workerIndex];
+	uint32_t requeued = 0;
+	for (uint32_t i = 0; i < worker->tileCount; i++) {
+		CoordinatorTile* tile = &coordinator->tiles[worker->tileIds[i]];
+		tile->workerCount--;
+		if (tile->state == DISTRIBUTED_TILE_ASSIGNED && tile->workerCount == 0) {
+			tile->state = DISTRIBUTED_TILE_PENDING;
+			requeued++;
+		}
+	}
+	if (worker->isConnected) {
+		printf("Worker %u %s, %u tiles go back to the queue.\n", worker->id, reason, requeued);
+	} else {
+		printf("A new connection %s, it is closed.\n", reason);
+	}
+	free(worker->payload);
+	socket_close(worker->socket);
+	coordinator->workers[workerIndex] = coordinator->workers[--coordinator->workerCount];
+}
+
+// the worker is added as a connection, that waits for its hello
+static void distributed_acceptWorker(Coordinator* coordinator, SocketHandle listener) {
+	SocketHandle socket = socket_accept(listener);
+	if (socket == SOCKET_INVALID) {
+		return;
+	}
+	if (coordinator->workerCount >= DISTRIBUTED_MAX_WORKERS) {
+		printf("Too many workers, the connection is closed.\n");
+		socket_close(socket);
+		return;
+	}
+	// only the sends block, a worker that stops reading doesn't block the coordinator forever
+	socket_setTimeout(socket, DISTRIBUTED_WORKER_TIMEOUT);
+
+	CoordinatorWorker* worker = &coordinator->workers[coordinator->workerCount++];
+	memset(worker, 0, sizeof(CoordinatorWorker));
+	worker->socket = socket;
+	worker->id = coordinator->nextWorkerId++;
+	worker->lastMessageTime = distributed_now();
+}
+
+// returns false, if the worker has to be dropped
+static bool distributed_receiveHello(CoordinatorWorker* worker, DistributedSettings* settings, const uint8_t* sceneData, size_t sceneSize) {
+	DistributedHello hello = { 0 };
+	if (worker->header.type == DISTRIBUTED_MESSAGE_HELLO && worker->header.size == sizeof(DistributedHello)) {
+		memcpy(&hello, worker->payload, sizeof(DistributedHello));
+	}
+	free(worker->payload);
+	worker->payload = NULL;
+	if (hello.version != DISTRIBUTED_VERSION) {
+		printf("A worker with another protocol version tried to connect.\n");
+		return false;
+	}
+	if (!distributed_send(worker->socket, DISTRIBUTED_MESSAGE_SCENE, settings, sizeof(DistributedSettings), sceneData, sceneSize)) {
+		printf("Couldn't send the scene to a new worker.\n");
+		return false;
+	}
+	worker->isConnected = true;
+	worker->usesOpenCL = hello.usesOpenCL != 0;
+	worker->lastMessageTime = distributed_now();
+	printf("Worker %u connected, it renders with %s.\n", worker->id, worker->usesOpenCL ? "OpenCL" : "the CPU");
+	return true;
+}
+
+// returns false, if the worker has to be dropped
+static bool distributed_receiveResult(Coordinator* coordinator, CoordinatorWorker* worker) {
+	DistributedHeader header = worker->header;
+	uint8_t* payload = worker->payload;
+	worker->payload = NULL;
+	double now = distributed_now();
+	worker->lastMessageTime = now;
+	worker->bytesReceived += sizeof(DistributedHeader) + header.size;
+
+	DistributedTile result;
+	if (header.type != DISTRIBUTED_MESSAGE_RESULT || header.size < sizeof(DistributedTile)) {
+		free(payload);
+		return false;
+	}
+	memcpy(&result, payload, sizeof(DistributedTile));
+	uint32_t slot = 0;
+	while (slot < worker->tileCount && worker->tileIds[slot] != result.tileId) {
+		slot++;
+	}
+	if (slot == worker->tileCount) {
+		// the worker sent a tile, it didn't get
+		free(payload);
+		return false;
+	}
+	CoordinatorTile* tile = &coordinator->tiles[result.tileId];
+	double assignTime = worker->assignTimes[slot];
+	worker->tileIds[slot] = worker->tileIds[worker->tileCount - 1];
+	worker->assignTimes[slot] = worker->assignTimes[worker->tileCount - 1];
+	worker->tileCount--;
+	tile->workerCount--;
+
+	bool success = true;
+	// a slow tile may arrive twice, the first result is used
+	if (tile->state != DISTRIBUTED_TILE_DONE) {
+		Image* image = coordinator->image;
+		uint32_t* pixels = image->buffer + tile->tile.rowBegin * image->width;
+		success = distributed_decode(payload + sizeof(DistributedTile), header.size - sizeof(DistributedTile),
+			pixels, tile->tile.rowCount * image->width);
+		if (success) {
+			tile->state = DISTRIBUTED_TILE_DONE;
+			coordinator->tilesDone++;
+			coordinator->totalTileTime += now - assignTime;
+			coordinator->measuredTileCount++;
+			worker->tilesDone++;
+		} else if (tile->workerCount == 0) {
+			tile->state = DISTRIBUTED_TILE_PENDING;
+		}
+	}
+	free(payload);
+	return success;
+}
+
+// a pending tile, or a slow tile of another worker, if the queue is empty
+static bool distributed_findTile(Coordinator* coordinator, CoordinatorWorker* worker, double now, uint32_t* tileId) {
+	for (uint32_t i = 0; i < coordinator->tileCount; i++) {
+		if (coordinator->tiles[i].state == DISTRIBUTED_TILE_PENDING) {
+			*tileId = i;
+			return true;
+		}
+	}
+	double averageTileTime = distributed_getAverageTileTime(coordinator);
+	if (averageTileTime <= 0.0) {
+		return false;
+	}
+	bool isFound = false;
+	double oldestAssignTime = now - DISTRIBUTED_SLOW_FACTOR * averageTileTime;
+	for (uint32_t i = 0; i < coordinator->tileCount; i++) {
+		CoordinatorTile* tile = &coordinator->tiles[i];
+		if (tile->state != DISTRIBUTED_TILE_ASSIGNED || tile->workerCount > 1 || tile->assignTime > oldestAssignTime) {
+			continue;
+		}
+		bool isOwnTile = false;
+		for (uint32_t j = 0; j < worker->tileCount; j++) {
+			isOwnTile = isOwnTile || worker->tileIds[j] == i;
+		}
+		if (!isOwnTile) {
+			*tileId = i;
+			oldestAssignTime = tile->assignTime;
+			isFound = true;
+		}
+	}
+	return isFound;
+}
+
+static void distributed_assignTiles(Coordinator* coordinator) {
+	double now = distributed_now();
+	// backwards, because dropping a worker moves the last one to its index
+	for (uint32_t i = coordinator->workerCount; i-- > 0;) {
+		CoordinatorWorker* worker = &coordinator->workers[i];
+		if (!worker->isConnected) {
+			continue;
+		}
+		uint32_t tileId;
+		bool isSent = true;
+		while (isSent && worker->tileCount < DISTRIBUTED_TILES_PER_WORKER && distributed_findTile(coordinator, worker, now, &tileId)) {
+			CoordinatorTile* tile = &coordinator->tiles[tileId];
+			if (tile->state == DISTRIBUTED_TILE_PENDING) {
+				tile->state = DISTRIBUTED_TILE_ASSIGNED;
+				tile->assignTime = now;
+			} else {
+				coordinator->reassignedTileCount++;
+			}
+			if (worker->tileCount == 0) {
+				// an idle worker doesn't count as timed out, because it had nothing to answer
+				worker->lastMessageTime = now;
+			}
+			tile->workerCount++;
+			worker->tileIds[worker->tileCount] = tileId;
+			worker->assignTimes[worker->tileCount] = now;
+			worker->tileCount++;
+			isSent = distributed_send(worker->socket, DISTRIBUTED_MESSAGE_TILE, &tile->tile, sizeof(DistributedTile), NULL, 0);
+		}
+		if (!isSent) {
+			distributed_dropWorker(coordinator, i, "disconnected");
+		}
+	}
+}
+
+static Scene* distributed_createScene(DistributedOptions* options) {
+	if (options->sphereCount == 0) {
+		return scene_init(options->width, options->height);
+	}
+	Scene* scene = scenegen_createBase(options->width, options->height);
+	scenegen_addRandomSpheres(scene, options->sphereCount, 20.0f, options->seed);
+	scenegen_addLights(scene, 4, 20.0f, options->seed);
+	scene_shrinkToFit(scene);
+	return scene;
+}
+
+static bool distributed_initCoordinator(Coordinator* coordinator, DistributedOptions* options) {
+	memset(coordinator, 0, sizeof(Coordinator));
+	coordinator->tileCount = (options->height + options->tileRows - 1) / options->tileRows;
+	coordinator->tiles = calloc(coordinator->tileCount, sizeof(CoordinatorTile));
+	coordinator->image = image_create(options->width, options->height);
+	if (!coordinator->tiles || !coordinator->image) {
+		return false;
+	}
+	for (uint32_t i = 0; i < coordinator->tileCount; i++) {
+		CoordinatorTile* tile = &coordinator->tiles[i];
+		tile->tile.tileId = i;
+		tile->tile.rowBegin = i * options->tileRows;
+		tile->tile.rowCount = MIN(options->tileRows, options->height - tile->tile.rowBegin);
+		tile->state = DISTRIBUTED_TILE_PENDING;
+	}
+	coordinator->maxResultSize = sizeof(DistributedTile) + distributed_getMaxEncodedSize(options->tileRows * options->width);
+	return true;
+}
+
+static void distributed_printWorkers(Coordinator* coordinator) {
+	for (uint32_t i = 0; i < coordinator->workerCount; i++) {
+		CoordinatorWorker* worker = &coordinator->workers[i];
+		if (!worker->isConnected) {
+			continue;
+		}
+		printf("  worker %u (%s): %u tiles, %.1f KiB received\n", worker->id, worker->usesOpenCL ? "OpenCL" : "CPU",
+			worker->tilesDone, (double) worker->bytesReceived / 1024.0);
+	}
+}
+
+static int distributed_runCoordinator(DistributedOptions* options) {
+	Scene* scene = distributed_createScene(options);
+	Accel* accel = accel_build(scene, accel_getType(scene));
+	size_t sceneSize = 0;
+	uint8_t* sceneData = accel ? sceneserial_write(scene, accel, &sceneSize) : NULL;
+	accel_destroy(accel);
+	scene_destroy(scene);
+	if (!sceneData) {
+		printf("Couldn't serialize the scene.\n");
+		return 2;
+	}
+	DistributedSettings settings = { options->raysPerPixel, options->maxRayDepth, options->shadowRayCount, options->seed };
+
+	Coordinator coordinator;
+	SocketHandle listener = socket_listen(options->port);
+	if (!distributed_initCoordinator(&coordinator, options) || listener == SOCKET_INVALID) {
+		free(sceneData);
+		free(coordinator.tiles);
+		if (coordinator.image) {
+			image_destroy(coordinator.image);
+		}
+		if (listener != SOCKET_INVALID) {
+			socket_close(listener);
+		}
+		return 2;
+	}
+	printf("Waiting for workers on port %u, the frame has %u tiles and the scene %.1f KiB.\n",
+		options->port, coordinator.tileCount, (double) sceneSize / 1024.0);
+
+	double start = 0.0;
+	SocketHandle sockets[DISTRIBUTED_MAX_WORKERS + 1];
+	bool isReadable[DISTRIBUTED_MAX_WORKERS + 1];
+	while (coordinator.tilesDone < coordinator.tileCount) {
+		// the listener is the last socket, so the workers keep their index
+		uint32_t workerCount = coordinator.workerCount;
+		for (uint32_t i = 0; i < workerCount; i++) {
+			sockets[i] = coordinator.workers[i].socket;
+		}
+		sockets[workerCount] = listener;
+		if (!socket_waitReadable(sockets, workerCount + 1, DISTRIBUTED_POLL_INTERVAL, isReadable)) {
+			printf("Couldn't wait for the workers.\n");
+			break;
+		}
+		for (uint32_t i = workerCount; i-- > 0;) {
+			if (!isReadable[i]) {
+				continue;
+			}
+			CoordinatorWorker* worker = &coordinator.workers[i];
+			size_t maxSize = worker->isConnected ? coordinator.maxResultSize : sizeof(DistributedHello);
+			DistributedReceiveState state = distributed_receivePart(worker, maxSize);
+			bool success = state != DISTRIBUTED_RECEIVE_FAILED;
+			if (state == DISTRIBUTED_RECEIVE_DONE) {
+				success = worker->isConnected ? distributed_receiveResult(&coordinator, worker)
+					: distributed_receiveHello(worker, &settings, sceneData, sceneSize);
+				if (success && start == 0.0 && worker->isConnected) {
+					// the time waiting for the first worker isn't part of the render time
+					start = distributed_now();
+				}
+			}
+			if (!success) {
+				distributed_dropWorker(&coordinator, i, "disconnected or sent an invalid message");
+			}
+		}
+		double now = distributed_now();
+		for (uint32_t i = coordinator.workerCount; i-- > 0;) {
+			CoordinatorWorker* worker = &coordinator.workers[i];
+			if (!worker->isConnected && now - worker->lastMessageTime > DISTRIBUTED_HELLO_TIMEOUT) {
+				distributed_dropWorker(&coordinator, i, "didn't say hello");
+			} else if ((worker->tileCount > 0 || worker->headerSize > 0) && now - worker->lastMessageTime > DISTRIBUTED_WORKER_TIMEOUT) {
+				distributed_dropWorker(&coordinator, i, "timed out");
+			}
+		}
+		if (isReadable[workerCount]) {
+			distributed_acceptWorker(&coordinator, listener);
+		}
+		distributed_assignTiles(&coordinator);
+	}
+	double renderTime = distributed_now() - start;
+
+	for (uint32_t i = 0; i < coordinator.workerCount; i++) {
+		if (coordinator.workers[i].isConnected) {
+			distributed_send(coordinator.workers[i].socket, DISTRIBUTED_MESSAGE_DONE, NULL, 0, NULL, 0);
+		}
+	}
+	bool success = coordinator.tilesDone == coordinator.tileCount;
+	if (success) {
+		printf("Rendered %u tiles in %.1f ms, %u of them were given to a second worker.\n",
+			coordinator.tileCount, renderTime, coordinator.reassignedTileCount);
+		distributed_printWorkers(&coordinator);
+		success = bitmap_save_image(options->outputPath, coordinator.image);
+		if (success) {
+			printf("Wrote the frame to %s.\n", options->outputPath);
+		}
+	}
+	for (uint32_t i = 0; i < coordinator.workerCount; i++) {
+		free(coordinator.workers[i].payload);
+		socket_close(coordinator.workers[i].socket);
+	}
+	socket_close(listener);
+	image_destroy(coordinator.image);
+	free(coordinator.tiles);
+	free(sceneData);
+	return success ? 0 : 3;
+}
+
+// -------------------- WORKER --------------------
+
+static GPUContext* distributed_createContext(Scene* scene, Accel* accel, DistributedSettings* settings, uint32_t deviceIndex) {
+	cl_platform_id platformId;
+	cl_device_id deviceId;
+	if (!gpu_getDevice(deviceIndex, &platformId, &deviceId)) {
+		printf("There is no OpenCL device %u.\n", deviceIndex);
+		return NULL;
+	}
+	GPUContext* context = gpu_initHeadlessContext(scene, accel, settings->raysPerPixel, platformId, deviceId);
+	if (context && !gpu_setRayLimits(context, scene, accel, settings->maxRayDepth, settings->shadowRayCount)) {
+		gpu_destroyContext(context);
+		return NULL;
+	}
+	return context;
+}
+
+static void distributed_renderCpuRows(Scene* scene, Accel* accel, RaytracerSampling* sampling, seed128bit* seeds,
+	DistributedTile* tile, Image* image) {
+	for (uint32_t y = tile->rowBegin; y < tile->rowBegin + tile->rowCount; y++) {
+		for (uint32_t x = 0; x < image->width; x++) {
+			Vec3 color = raytracer_renderPixel(scene, accel, sampling, x, y, &seeds[y * image->width + x], NULL);
+			image->buffer[y * image->width + x] = raytracer_packColor(color);
+		}
+	}
+}
+
+static int distributed_runWorker(DistributedOptions* options) {
+	SocketHandle socket = socket_connect(options->host, options->port);
+	if (socket == SOCKET_INVALID) {
+		printf("Couldn't connect to %s:%u.\n", options->host, options->port);
+		return 2;
+	}
+	DistributedHello hello = { DISTRIBUTED_VERSION, options->useOpenCL ? 1 : 0 };
+	DistributedHeader header;
+	uint8_t* payload = NULL;
+	if (distributed_send(socket, DISTRIBUTED_MESSAGE_HELLO, &hello, sizeof(hello), NULL, 0)) {
+		// the worker trusts the coordinator, it connected to, the scene has no other limit
+		payload = distributed_receive(socket, &header, UINT32_MAX);
+	}
+	Scene* scene = NULL;
+	Accel* accel = NULL;
+	DistributedSettings settings;
+	bool success = payload && header.type == DISTRIBUTED_MESSAGE_SCENE && header.size >= sizeof(DistributedSettings);
+	if (success) {
+		memcpy(&settings, payload, sizeof(DistributedSettings));
+		success = sceneserial_read(payload + sizeof(DistributedSettings), header.size - sizeof(DistributedSettings), &scene, &accel);
+	}
+	free(payload);
+	if (!success) {
+		printf("Couldn't receive the scene.\n");
+		socket_close(socket);
+		return 2;
+	}
+	Camera* camera = scene->camera;
+	printf("Received a scene with %u spheres and %u triangles, rendering %ux%u pixels.\n",
+		scene->sphereCount, scene->triangleCount, camera->width, camera->height);
+
+	// the kernel seeds come from rand() as well
+	srand(settings.seed);
+	GPUContext* context = NULL;
+	seed128bit* seeds = NULL;
+	RaytracerSampling sampling;
+	uint32_t pixelCount = camera->width * camera->height;
+	if (options->useOpenCL) {
+		context = distributed_createContext(scene, accel, &settings, options->deviceIndex);
+		success = context != NULL;
+	} else {
+		raytracer_initSampling(&sampling, camera, settings.raysPerPixel, settings.maxRayDepth, settings.shadowRayCount);
+		seeds = malloc(sizeof(seed128bit) * pixelCount);
+		success = seeds != NULL;
+		for (uint32_t i = 0; success && i < pixelCount; i++) {
+			seeds[i].x = (uint64_t) rand();
+			seeds[i].y = (uint64_t) rand();
+		}
+	}
+	Image* image = image_create(camera->width, camera->height);
+	uint8_t* encoded = malloc(distributed_getMaxEncodedSize(pixelCount));
+	success = success && image && encoded;
+
+	uint32_t tileCount = 0;
+	while (success) {
+		payload = distributed_receive(socket, &header, sizeof(DistributedTile));
+		if (!payload || header.type == DISTRIBUTED_MESSAGE_DONE) {
+			// the coordinator closes the connection, when it's done
+			free(payload);
+			break;
+		}
+		DistributedTile tile;
+		success = header.type == DISTRIBUTED_MESSAGE_TILE && header.size == sizeof(DistributedTile);
+		if (success) {
+			memcpy(&tile, payload, sizeof(DistributedTile));
+			success = tile.rowCount > 0 && tile.rowBegin < camera->height && tile.rowCount <= camera->height - tile.rowBegin;
+		}
+		free(payload);
+		if (!success) {
+			printf("Received an invalid message.\n");
+			break;
+		}
+
+		if (context) {
+			success = gpu_enqueueRows(context, scene, accel, tile.rowBegin, tile.rowCount, image);
+			gpu_finishRows(context);
+		} else {
+			distributed_renderCpuRows(scene, accel, &sampling, seeds, &tile, image);
+		}
+		uint32_t* pixels = image->buffer + tile.rowBegin * image->width;
+		size_t encodedSize = distributed_encode(pixels, tile.rowCount * image->width, encoded);
+		success = success && distributed_send(socket, DISTRIBUTED_MESSAGE_RESULT, &tile, sizeof(tile), encoded, encodedSize);
+		tileCount++;
+	}
+	printf("Rendered %u tiles.\n", tileCount);
+
+	free(encoded);
+	if (image) {
+		image_destroy(image);
+	}
+	free(seeds);
+	gpu_destroyContext(context);
+	accel_destroy(accel);
+	scene_destroy(scene);
+	socket_close(socket);
+	return success ? 0 : 3;
+}
+
+// -------------------- OPTIONS --------------------
+
+static void distributed_printUsage(const char* program) {
+	printf("Usage: %s coordinator|worker [options]\n"
+		"Coordinator:\n"
+		"  --port <port>           port the workers connect to (default 7878)\n"
+		"  --width <pixels>        render width (default 1920)\n"
+		"  --height <pixels>       render height (default 1080)\n"
+		"  --rays <count>          rays per pixel (default 4)\n"
+		"  --depth <count>         maximum ray depth, 1 to 8 (default 5)\n"
+		"  --shadow-rays <count>   shadow rays per light (default 4)\n"
+		"  --tile-rows <rows>      rows per tile (default 16)\n"
+		"  --spheres <count>       render random spheres instead of the scene of scene.c\n"
+		"  --seed <seed>           seed of the spheres and the pixels (default 1)\n"
+		"  --output <path>         bitmap of the frame (default distributed.bmp)\n"
+		"Worker:\n"
+		"  --host <host>           address of the coordinator (default 127.0.0.1)\n"
+		"  --port <port>           port of the coordinator (default 7878)\n"
+		"  --opencl                render with an OpenCL device instead of the CPU tracer\n"
+		"  --device <index>        OpenCL device, counted over all platforms (default 0)\n", program);
+}
+
+static bool distributed_parseOptions(int argc, char* argv[], DistributedOptions* options) {
+	options->host = "127.0.0.1";
+	options->port = DISTRIBUTED_DEFAULT_PORT;
+	options->width = 1920;
+	options->height = 1080;
+	options->raysPerPixel = 4;
+	options->maxRayDepth = 5;
+	options->shadowRayCount = 4;
+	options->tileRows = 16;
+	options->sphereCount = 0;
+	options->seed = 1;
+	options->outputPath = "distributed.bmp";
+	options->useOpenCL = false;
+	options->deviceIndex = 0;
+
+	if (argc < 2) {
+		return false;
+	}
+	if (strcmp(argv[1], "coordinator") == 0) {
+		options->isCoordinator = true;
+	} else if (strcmp(argv[1], "worker") == 0) {
+		options->isCoordinator = false;
+	} else {
+		return false;
+	}
+	for (int i = 2; i < argc; i++) {
+		const char* arg = argv[i];
+		if (strcmp(arg, "--opencl") == 0) {
+			options->useOpenCL = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const char* value = argv[++i];
+		uint32_t number = (uint32_t) strtoul(value, NULL, 10);
+		if (strcmp(arg, "--host") == 0) {
+			options->host = value;
+		} else if (strcmp(arg, "--port") == 0) {
+			options->port = (uint16_t) number;
+		} else if (strcmp(arg, "--width") == 0) {
+			options->width = number;
+		} else if (strcmp(arg, "--height") == 0) {
+			options->height = number;
+		} else if (strcmp(arg, "--rays") == 0) {
+			options->raysPerPixel = number;
+		} else if (strcmp(arg, "--depth") == 0) {
+			options->maxRayDepth = number;
+		} else if (strcmp(arg, "--shadow-rays") == 0) {
+			options->shadowRayCount = number;
+		} else if (strcmp(arg, "--tile-rows") == 0) {
+			options->tileRows = number;
+		} else if (strcmp(arg, "--spheres") == 0) {
+			options->sphereCount = number;
+		} else if (strcmp(arg, "--seed") == 0) {
+			options->seed = number;
+		} else if (strcmp(arg, "--output") == 0) {
+			options->outputPath = value;
+		} else if (strcmp(arg, "--device") == 0) {
+			options->deviceIndex = number;
+		} else {
+			return false;
+		}
+	}
+	return options->width > 0 && options->height > 0 && options->raysPerPixel > 0 && options->tileRows > 0
+		&& options->maxRayDepth >= 1 && options->maxRayDepth <= RAYTRACER_MAX_RAY_DEPTH;
+}
+
+int main(int argc, char* argv[]) {
+	DistributedOptions options;
+	if (!distributed_parseOptions(argc, argv, &options)) {
+		distributed_printUsage(argv[0]);
+		return 1;
+	}
+	if (!socket_init()) {
+		printf("Couldn't initialize the sockets.\n");
+		return 2;
+	}
+	int result = options.isCoordinator ? distributed_runCoordinator(&options) : distributed_runWorker(&options);
+	socket_cleanup();
+	return result;
+}
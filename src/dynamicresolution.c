@@ -0,0 +1,59 @@
+#include "dynamicresolution.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "utils/math.h"
+
+#define DYNAMICRESOLUTION_MIN_SCALE 0.25f
+// only this part of the correction is applied per frame, so single slow frames don't cause jumps
+#define DYNAMICRESOLUTION_SMOOTHING 0.5f
+// smaller changes are ignored, because every resize reallocates the render target
+#define DYNAMICRESOLUTION_HYSTERESIS 0.05f
+#define DYNAMICRESOLUTION_ALIGNMENT 8
+
+DynamicResolution* dynamicresolution_create(uint32_t maxWidth, uint32_t maxHeight, double targetFrameTime) {
+	DynamicResolution* resolution = malloc(sizeof(DynamicResolution));
+	if (!resolution) {
+		return NULL;
+	}
+	resolution->maxWidth = maxWidth;
+	resolution->maxHeight = maxHeight;
+	resolution->targetFrameTime = targetFrameTime;
+	resolution->scale = 1.0f;
+	return resolution;
+}
+
+void dynamicresolution_update(DynamicResolution* resolution, double frameTime) {
+	if (frameTime <= 0.0) {
+		return;
+	}
+	// the frame time grows about linearly with the pixel count, which is the square of the scale
+	float idealScale = resolution->scale * sqrtf((float) (resolution->targetFrameTime / frameTime));
+	float scale = resolution->scale + (idealScale - resolution->scale) * DYNAMICRESOLUTION_SMOOTHING;
+	scale = math_clamp(scale, DYNAMICRESOLUTION_MIN_SCALE, 1.0f);
+
+	// always allow reaching the bounds, otherwise the hysteresis could keep the scale just below them
+	bool isBound = scale == 1.0f || scale == DYNAMICRESOLUTION_MIN_SCALE;
+	if (!isBound && fabsf(scale - resolution->scale) < DYNAMICRESOLUTION_HYSTERESIS * resolution->scale) {
+		return;
+	}
+	resolution->scale = scale;
+}
+
+void dynamicresolution_getSize(DynamicResolution* resolution, uint32_t* width, uint32_t* height) {
+	if (resolution->scale >= 1.0f) {
+		*width = resolution->maxWidth;
+		*height = resolution->maxHeight;
+		return;
+	}
+	uint32_t scaledWidth = (uint32_t) ((float) resolution->maxWidth * resolution->scale);
+	scaledWidth -= scaledWidth % DYNAMICRESOLUTION_ALIGNMENT;
+	scaledWidth = MAX(scaledWidth, DYNAMICRESOLUTION_ALIGNMENT);
+	*width = scaledWidth;
+	*height = MAX((uint32_t) ((uint64_t) scaledWidth * resolution->maxHeight / resolution->maxWidth), 1);
+}
+
+void dynamicresolution_destroy(DynamicResolution* resolution) {
+	free(resolution);
+}
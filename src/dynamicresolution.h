@@ -0,0 +1,27 @@
+#ifndef RAYTRACER_DYNAMICRESOLUTION_H
+#define RAYTRACER_DYNAMICRESOLUTION_H
+
+#include <stdint.h>
+
+/*
+ * Scales the render resolution, so that a frame takes about targetFrameTime ms.
+ * The aspect ratio of the maximum resolution is kept.
+ */
+typedef struct {
+	uint32_t maxWidth;
+	uint32_t maxHeight;
+	double targetFrameTime;
+	// the resolution is scaled by this factor on both axes
+	float scale;
+} DynamicResolution;
+
+DynamicResolution* dynamicresolution_create(uint32_t maxWidth, uint32_t maxHeight, double targetFrameTime);
+
+// adjusts the scale to the time in ms of a frame, which was rendered with the current size
+void dynamicresolution_update(DynamicResolution* resolution, double frameTime);
+
+void dynamicresolution_getSize(DynamicResolution* resolution, uint32_t* width, uint32_t* height);
+
+void dynamicresolution_destroy(DynamicResolution* resolution);
+
+#endif //RAYTRACER_DYNAMICRESOLUTION_H
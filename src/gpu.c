@@ -1,15 +1,63 @@
 #include "gpu.h"
 
 #include <math.h>
+#include <SDL2/SDL.h>
+#include "denoiser.h"
+#include "memstats.h"
+#include "programcache.h"
+#include "raytracer.h"
+#include "trace.h"
+#include "utils/math.h"
 #include "utils/random.h"
 #include "utils/stringbuilder.h"
 
+// generated from kernel.cl at build time, see modules/EmbedFile.cmake
+#include "kernel_source.h"
+
+#define GPU_MAX_RAY_DEPTH 5
+#define GPU_SHADOW_RAY_COUNT 4
+#define GPU_SHADOW_PROBE_COUNT RAYTRACER_SHADOW_PROBE_COUNT
+// plane and light counts up to these are compiled into the specialized kernel
+#define GPU_MAX_CONSTANT_PLANES 8
+#define GPU_MAX_CONSTANT_POINTLIGHTS 8
+#define GPU_KERNEL_BENCHMARK_RUNS 5
+#define GPU_MIN_SHARED_ACCEL_NODES 9
+#define GPU_MAX_PLATFORMS 16
+#define GPU_MAX_DEVICES 16
+// a hit and a packed color for the last and the current frame
+#define GPU_REPROJECTION_BYTES_PER_PIXEL (2 * (sizeof(cl_float4) + sizeof(uint32_t)))
+// two colors for the passes, a guide and a packed albedo
+#define GPU_DENOISE_BYTES_PER_PIXEL (3 * sizeof(cl_float4) + sizeof(uint32_t))
+
 // -------------------- OPENCL STATIC DECLS --------------------
 
 static GPUContext* gpu_initCLContext();
+static void gpu_releaseCLContext(GPUContext* context);
+static bool gpu_initRenderer(GPUContext* context, Scene* scene, Accel* accel, uint32_t raysPerPixel);
+static cl_mem gpu_createImageBufferFromTextureId(GPUContext* context, GLuint textureId);
+static cl_mem gpu_createHeadlessImage(GPUContext* context, uint32_t width, uint32_t height);
+static void gpu_acquireImage(GPUContext* context);
+static void gpu_releaseImage(GPUContext* context);
+static cl_mem gpu_createRandomSeedBuffer(GPUContext* context, Scene* scene);
+static bool gpu_createTraversalStatsBuffer(GPUContext* context);
+static bool gpu_createReprojectionBuffers(GPUContext* context);
+static void gpu_releaseReprojectionBuffers(GPUContext* context);
+static bool gpu_createDenoiseBuffers(GPUContext* context);
+static void gpu_releaseDenoiseBuffers(GPUContext* context);
+static cl_int gpu_setFrameArgs(GPUContext* context, cl_kernel kernel, ReprojectionMode mode, bool isDenoising);
+static bool gpu_enqueueDenoise(GPUContext* context, Scene* scene);
+static void gpu_trackImageSize(GPUContext* context, uint32_t width, uint32_t height);
+static size_t gpu_getPixelBufferBytes(GPUContext* context);
 // this needs to be done after gl texture creation
-static bool gpu_allocateCLMemory(GPUContext* context, Scene* scene, Octree* octree);
-static bool gpu_setupKernel(GPUContext* context, Scene* scene, Octree* octree, uint32_t raysPerPixel);
+static bool gpu_allocateCLMemory(GPUContext* context, Scene* scene, Accel* accel);
+static bool gpu_setupKernel(GPUContext* context, Scene* scene, Accel* accel);
+static bool gpu_selectKernel(GPUContext* context, Scene* scene, Accel* accel);
+static void gpu_releaseKernels(GPUContext* context);
+static void gpu_createKernelConfig(GPUContext* context, Scene* scene, Accel* accel, KernelConfig* config, bool specialize);
+static bool gpu_buildKernel(GPUContext* context, KernelConfig* config, cl_program* program, cl_kernel* kernel);
+static double gpu_benchmarkKernel(GPUContext* context, Scene* scene, cl_kernel kernel);
+static bool gpu_setKernelArgs(GPUContext* context, cl_kernel kernel, Scene* scene, Accel* accel);
+static bool gpu_syncScene(GPUContext* context, Scene* scene, Accel* accel, cl_event* uploadDone);
 static void gpu_deleteCLMemory(GPUContext* context);
 
 // -------------------- OPENGL STATIC DECLS --------------------
@@ -20,136 +68,447 @@ static void gpu_deleteGLObjects(GPUContext* context);
 
 // -------------------- MIXED --------------------
 
-GPUContext* gpu_initContext(Scene* scene, Octree* octree, uint32_t raysPerPixel) {
+GPUContext* gpu_initContext(Scene* scene, Accel* accel, uint32_t raysPerPixel) {
 	GPUContext* context = gpu_initCLContext();
 	if (!context) {
 		return NULL;
 	}
+	context->isHeadless = false;
 	gpu_initGLContext(context, scene->camera->width, scene->camera->height);
-    if (!gpu_allocateCLMemory(context, scene, octree) || !gpu_setupKernel(context, scene, octree, raysPerPixel)) {
-        return NULL;
-    }
+	if (!gpu_initRenderer(context, scene, accel, raysPerPixel)) {
+		gpu_deleteGLObjects(context);
+		gpu_releaseCLContext(context);
+		return NULL;
+	}
+	return context;
+}
+
+bool gpu_getDevice(uint32_t index, cl_platform_id* platformId, cl_device_id* deviceId) {
+	cl_platform_id platformIds[GPU_MAX_PLATFORMS];
+	cl_uint platformCount = 0;
+	if (clGetPlatformIDs(GPU_MAX_PLATFORMS, platformIds, &platformCount) != CL_SUCCESS) {
+		return false;
+	}
+	platformCount = MIN(platformCount, GPU_MAX_PLATFORMS);
+	for (cl_uint i = 0; i < platformCount; i++) {
+		cl_device_id deviceIds[GPU_MAX_DEVICES];
+		cl_uint deviceCount = 0;
+		if (clGetDeviceIDs(platformIds[i], CL_DEVICE_TYPE_ALL, GPU_MAX_DEVICES, deviceIds, &deviceCount) != CL_SUCCESS) {
+			continue;
+		}
+		deviceCount = MIN(deviceCount, GPU_MAX_DEVICES);
+		if (index < deviceCount) {
+			*platformId = platformIds[i];
+			*deviceId = deviceIds[index];
+			return true;
+		}
+		index -= deviceCount;
+	}
+	return false;
+}
+
+GPUContext* gpu_initHeadlessContext(Scene* scene, Accel* accel, uint32_t raysPerPixel, cl_platform_id platformId, cl_device_id deviceId) {
+	GPUContext* context = malloc(sizeof(GPUContext));
+	if (!context) {
+		return NULL;
+	}
+	context->isHeadless = true;
+	context->cl.platformId = platformId;
+	context->cl.deviceId = deviceId;
+	cl_context_properties props[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)platformId,
+		0 };
+	context->cl.ctx = clCreateContext(props, 1, &deviceId, NULL, NULL, &context->cl.err);
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create the OpenCL context.\n");
+		free(context);
+		return NULL;
+	}
+	context->cl.commandQueue = clCreateCommandQueue(context->cl.ctx, deviceId, CL_QUEUE_PROFILING_ENABLE, &context->cl.err);
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create the command queue.\n");
+		clReleaseContext(context->cl.ctx);
+		free(context);
+		return NULL;
+	}
+	if (!gpu_initRenderer(context, scene, accel, raysPerPixel)) {
+		gpu_releaseCLContext(context);
+		return NULL;
+	}
 	return context;
 }
 
-void gpu_renderScene(GPUContext* context, Scene* scene, Image* image) {
-	glFinish();
+static bool gpu_initRenderer(GPUContext* context, Scene* scene, Accel* accel, uint32_t raysPerPixel) {
+	context->cl.raysPerPixel = raysPerPixel;
+	context->cl.maxRayDepth = GPU_MAX_RAY_DEPTH;
+	context->cl.shadowRayCount = GPU_SHADOW_RAY_COUNT;
+	context->cl.shadowProbeCount = GPU_SHADOW_PROBE_COUNT;
+	context->cl.rouletteThreshold = 0.0f;
+	context->cl.isFresnelSampling = false;
+	context->cl.kernelTime = 0.0;
+	context->cl.kernelDone = NULL;
+	context->cl.denoiseDone = NULL;
+	context->cl.program = NULL;
+	context->cl.kernel = NULL;
+	context->cl.denoiseKernel = NULL;
+	context->cl.kernelSelection = KERNEL_SELECTION_AUTO;
+	const char* selection = getenv("RAYTRACER_KERNEL_SELECTION");
+	if (selection && strcmp(selection, "generic") == 0) {
+		context->cl.kernelSelection = KERNEL_SELECTION_GENERIC;
+	} else if (selection && strcmp(selection, "specialized") == 0) {
+		context->cl.kernelSelection = KERNEL_SELECTION_SPECIALIZED;
+	}
+
+    if (!gpu_allocateCLMemory(context, scene, accel)) {
+        return false;
+    }
+	// the kernel benchmark in gpu_setupKernel needs the scene on the device
+	cl_event uploadDone = NULL;
+	bool layoutChanged = false;
+	if (!scenesync_upload(context->cl.sceneSync, scene, accel, &uploadDone, &layoutChanged)) {
+		return false;
+	}
+	if (uploadDone) {
+		clWaitForEvents(1, &uploadDone);
+		clReleaseEvent(uploadDone);
+	}
+	return gpu_setupKernel(context, scene, accel);
+}
+
+bool gpu_setRayLimits(GPUContext* context, Scene* scene, Accel* accel, uint32_t maxRayDepth, uint32_t shadowRayCount) {
+	if (maxRayDepth < 1 || maxRayDepth > RAYTRACER_MAX_RAY_DEPTH) {
+		printf("The ray depth has to be in the range [1, %d].\n", RAYTRACER_MAX_RAY_DEPTH);
+		return false;
+	}
+	if (maxRayDepth != context->cl.maxRayDepth) {
+		// the depth is a kernel argument of the next frame
+		context->cl.maxRayDepth = maxRayDepth;
+		context->cl.isHistoryValid = false;
+	}
+	if (shadowRayCount == context->cl.shadowRayCount) {
+		return true;
+	}
+	context->cl.shadowRayCount = shadowRayCount;
+	context->cl.isHistoryValid = false;
+	clFinish(context->cl.commandQueue);
+	gpu_releaseKernels(context);
+	return gpu_setupKernel(context, scene, accel);
+}
+
+void gpu_setRayTermination(GPUContext* context, float rouletteThreshold, bool isFresnelSampling) {
+	if (rouletteThreshold != context->cl.rouletteThreshold || isFresnelSampling != context->cl.isFresnelSampling) {
+		context->cl.rouletteThreshold = rouletteThreshold;
+		context->cl.isFresnelSampling = isFresnelSampling;
+		context->cl.isHistoryValid = false;
+	}
+}
+
+bool gpu_setShadowProbeCount(GPUContext* context, Scene* scene, Accel* accel, uint32_t probeCount) {
+	if (probeCount == 0) {
+		printf("At least one shadow ray per light has to be traced.\n");
+		return false;
+	}
+	if (probeCount == context->cl.shadowProbeCount) {
+		return true;
+	}
+	context->cl.shadowProbeCount = probeCount;
+	context->cl.isHistoryValid = false;
+	clFinish(context->cl.commandQueue);
+	gpu_releaseKernels(context);
+	return gpu_setupKernel(context, scene, accel);
+}
+
+void gpu_markSceneDirty(GPUContext* context, SceneSyncArray array, uint32_t first, uint32_t count) {
+	scenesync_markDirty(context->cl.sceneSync, array, first, count);
+}
+
+void gpu_renderScene(GPUContext* context, Scene* scene, Accel* accel, Image* image) {
+	if (!gpu_enqueueRows(context, scene, accel, 0, scene->camera->height, image)) {
+		return;
+	}
+	gpu_finishRows(context);
+	gpu_drawFrame(context, NULL, 0, 0);
+}
+
+void gpu_drawFrame(GPUContext* context, Image* image, uint32_t rowBegin, uint32_t rowCount) {
+	if (context->isHeadless) {
+		return;
+	}
+	TRACE_BEGIN("gl draw");
+	if (image && rowCount > 0) {
+		// the rows replace the ones the kernel wrote into the shared texture
+		glBindTexture(GL_TEXTURE_2D, context->gl.texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint) rowBegin, (GLsizei) image->width, (GLsizei) rowCount,
+			GL_RGBA, GL_UNSIGNED_BYTE, image->buffer + rowBegin * image->width);
+	}
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	TRACE_END();
+}
+
+bool gpu_enqueueRows(GPUContext* context, Scene* scene, Accel* accel, uint32_t rowBegin, uint32_t rowCount, Image* image) {
+	cl_event uploadDone = NULL;
+	TRACE_BEGIN("scene sync");
+	bool isSynced = gpu_syncScene(context, scene, accel, &uploadDone);
+	TRACE_END();
+	if (!isSynced) {
+		printf("Couldn't sync the scene.\n");
+		return false;
+	}
+	if (!context->isHeadless) {
+		TRACE_BEGIN("gl finish");
+		glFinish();
+		TRACE_END();
+	}
+	TRACE_BEGIN("camera upload");
 	clEnqueueWriteBuffer(context->cl.commandQueue, context->cl.camera, CL_TRUE, 0, sizeof(Camera), scene->camera, 0, NULL, NULL);
 	context->cl.err = clSetKernelArg(context->cl.kernel, 0, sizeof(cl_mem), &context->cl.camera);
-	const size_t threadsPerDim[2] = { scene->camera->width, scene->camera->height };
-	clEnqueueAcquireGLObjects(context->cl.commandQueue, 1, &context->cl.image, 0, NULL, NULL);
-	context->cl.err = clEnqueueNDRangeKernel(context->cl.commandQueue, context->cl.kernel, 2, NULL, threadsPerDim, NULL, 0, NULL, NULL);
+	TRACE_END();
+	// the history is kept for whole frames, the rows of a split frame are all traced
+	// and the filter needs the neighbors of every pixel
+	bool isFullFrame = rowBegin == 0 && rowCount == scene->camera->height;
+	ReprojectionMode reprojectionMode = REPROJECTION_OFF;
+	if (context->cl.reprojectionMode != REPROJECTION_OFF && isFullFrame) {
+		bool canReuse = context->cl.reprojectionMode == REPROJECTION_REUSE && context->cl.isHistoryValid;
+		reprojectionMode = canReuse ? REPROJECTION_REUSE : REPROJECTION_RECORD;
+	}
+	bool isDenoising = context->cl.isDenoising && isFullFrame;
+	context->cl.isHistoryValid = false;
+	if (gpu_setFrameArgs(context, context->cl.kernel, reprojectionMode, isDenoising) != CL_SUCCESS) {
+		printf("Couldn't set the reprojection and denoise args.\n");
+		if (uploadDone) {
+			clReleaseEvent(uploadDone);
+		}
+		return false;
+	}
+	// the offset keeps the pixel coordinates of the rows, so the kernel doesn't know about the bands
+	const size_t threadOffset[2] = { 0, rowBegin };
+	const size_t threadsPerDim[2] = { scene->camera->width, rowCount };
+	TRACE_BEGIN("kernel enqueue");
+	gpu_acquireImage(context);
+	// the kernel must not start before the scene uploads on the transfer queue are done
+	context->cl.kernelEnqueueTime = trace_enabled ? trace_now() : 0;
+	context->cl.err = clEnqueueNDRangeKernel(context->cl.commandQueue, context->cl.kernel, 2, threadOffset, threadsPerDim, NULL,
+		uploadDone ? 1 : 0, uploadDone ? &uploadDone : NULL, &context->cl.kernelDone);
+	TRACE_END();
+	if (uploadDone) {
+		clReleaseEvent(uploadDone);
+	}
 	if (context->cl.err != CL_SUCCESS) {
 		printf("Couldn't enqueue kernel.\n");
-		return;
+		context->cl.kernelDone = NULL;
+		gpu_releaseImage(context);
+		return false;
+	}
+	if (reprojectionMode != REPROJECTION_OFF) {
+		// the queue is in order, so the kernel above still reads the camera of the last frame
+		clEnqueueCopyBuffer(context->cl.commandQueue, context->cl.camera, context->cl.previousCamera, 0, 0, sizeof(Camera), 0, NULL, NULL);
+		context->cl.historyIndex = 1 - context->cl.historyIndex;
+		context->cl.isHistoryValid = true;
+	}
+	// the passes overwrite the image before it's read back
+	if (isDenoising && !gpu_enqueueDenoise(context, scene)) {
+		printf("Couldn't enqueue the denoise kernel.\n");
 	}
 	if (image != NULL) {
-		size_t origin[3] = { 0, 0, 0 };
-		size_t region[3] = { image->width, image->height, 1 };
+		size_t origin[3] = { 0, rowBegin, 0 };
+		size_t region[3] = { image->width, rowCount, 1 };
 		size_t rowPitch = sizeof(uint32_t) * image->width;
 		size_t slicePitch = 0;
-		clEnqueueReadImage(context->cl.commandQueue, context->cl.image, CL_TRUE, origin, region, rowPitch, slicePitch, image->buffer, 0, NULL, NULL);
+		clEnqueueReadImage(context->cl.commandQueue, context->cl.image, CL_FALSE, origin, region, rowPitch, slicePitch,
+			image->buffer + (size_t) rowBegin * image->width, 0, NULL, NULL);
 	}
-	clEnqueueReleaseGLObjects(context->cl.commandQueue, 1, &context->cl.image, 0, NULL, NULL);
+	gpu_releaseImage(context);
+	// other devices may be waited for first, so the work has to be submitted now
+	clFlush(context->cl.commandQueue);
+	return true;
+}
+
+void gpu_finishRows(GPUContext* context) {
+	TRACE_BEGIN("device wait");
 	context->cl.err = clFinish(context->cl.commandQueue);
+	TRACE_END();
+	if (!context->cl.kernelDone) {
+		return;
+	}
 
-	glClear(GL_COLOR_BUFFER_BIT);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	cl_ulong kernelQueued = 0;
+	cl_ulong kernelStart = 0;
+	cl_ulong kernelEnd = 0;
+	clGetEventProfilingInfo(context->cl.kernelDone, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &kernelStart, NULL);
+	clGetEventProfilingInfo(context->cl.kernelDone, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &kernelEnd, NULL);
+	// the filter is part of the frame time, the dynamic resolution has to account for it
+	cl_ulong denoiseEnd = kernelEnd;
+	if (context->cl.denoiseDone) {
+		clGetEventProfilingInfo(context->cl.denoiseDone, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &denoiseEnd, NULL);
+	}
+	context->cl.kernelTime = (double) (denoiseEnd - kernelStart) / 1000000.0;
+	if (trace_enabled) {
+		// the device clock has an unknown offset, so align the time the kernel was queued with the enqueue call
+		uint64_t kernelEnqueueTime = context->cl.kernelEnqueueTime;
+		clGetEventProfilingInfo(context->cl.kernelDone, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &kernelQueued, NULL);
+		trace_addSpan("raytrace", TRACE_THREAD_DEVICE, kernelEnqueueTime + (kernelStart - kernelQueued) / 1000,
+			kernelEnqueueTime + (kernelEnd - kernelQueued) / 1000);
+		if (context->cl.denoiseDone) {
+			trace_addSpan("denoise", TRACE_THREAD_DEVICE, kernelEnqueueTime + (kernelEnd - kernelQueued) / 1000,
+				kernelEnqueueTime + (denoiseEnd - kernelQueued) / 1000);
+		}
+	}
+	clReleaseEvent(context->cl.kernelDone);
+	context->cl.kernelDone = NULL;
+	if (context->cl.denoiseDone) {
+		clReleaseEvent(context->cl.denoiseDone);
+		context->cl.denoiseDone = NULL;
+	}
 }
 
-void gpu_destroyContext(GPUContext* context) {
-	if (context) {
-		gpu_deleteGLObjects(context);
-		gpu_deleteCLMemory(context);
+bool gpu_resizeRenderTarget(GPUContext* context, Scene* scene, Accel* accel, uint32_t width, uint32_t height) {
+	if (width == scene->camera->width && height == scene->camera->height) {
+		return true;
+	}
+	clFinish(context->cl.commandQueue);
+	camera_setResolution(scene->camera, width, height);
 
-		clReleaseProgram(context->cl.program);
-		clReleaseCommandQueue(context->cl.commandQueue);
-		clReleaseContext(context->cl.ctx);
-		free(context);
+	// the cl image shares the storage of the texture, so both have to be recreated
+	clReleaseMemObject(context->cl.image);
+	if (context->isHeadless) {
+		context->cl.image = gpu_createHeadlessImage(context, width, height);
+	} else {
+		glBindTexture(GL_TEXTURE_2D, context->gl.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei) width, (GLsizei) height, 0, GL_RGBA, GL_FLOAT, NULL);
+		glFinish();
+		context->cl.image = gpu_createImageBufferFromTextureId(context, context->gl.texture);
 	}
+	gpu_trackImageSize(context, width, height);
+	if (!context->cl.image) {
+		return false;
+	}
+
+	// the per pixel buffers only grow, a smaller resolution just uses a part of them
+	if (width * height > context->cl.pixelCapacity) {
+		memstats_free(MEMSTATS_DEVICE_PIXELS, gpu_getPixelBufferBytes(context));
+		clReleaseMemObject(context->cl.randomSeed);
+		context->cl.randomSeed = gpu_createRandomSeedBuffer(context, scene);
+		if (!context->cl.randomSeed || !gpu_createTraversalStatsBuffer(context)) {
+			return false;
+		}
+		if (context->cl.hits[0] && !gpu_createReprojectionBuffers(context)) {
+			return false;
+		}
+		if (context->cl.denoiseGuides && !gpu_createDenoiseBuffers(context)) {
+			return false;
+		}
+	}
+	// the pixel sizes are kernel arguments
+	return gpu_setKernelArgs(context, context->cl.kernel, scene, accel);
 }
 
-// -------------------- OPENCL --------------------
+bool gpu_setReprojectionMode(GPUContext* context, ReprojectionMode mode) {
+	if (mode != REPROJECTION_OFF && !context->cl.hits[0] && !gpu_createReprojectionBuffers(context)) {
+		return false;
+	}
+	context->cl.reprojectionMode = mode;
+	return true;
+}
 
-static cl_mem gpu_createImageBufferFromTextureId(GPUContext* context, GLuint textureId) {
-	cl_mem dev_image = clCreateFromGLTexture(context->cl.ctx, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, textureId, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_image.\n");
-		return NULL;
+bool gpu_setDenoising(GPUContext* context, bool enabled) {
+	if (enabled && !context->cl.denoiseGuides && !gpu_createDenoiseBuffers(context)) {
+		return false;
 	}
-	return dev_image;
+	context->cl.isDenoising = enabled;
+	return true;
 }
 
-static cl_mem gpu_createCameraBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_camera = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Camera), scene->camera, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_camera.\n");
-		return NULL;
+bool gpu_resetSeeds(GPUContext* context, Scene* scene) {
+	uint32_t pixelCount = scene->camera->width * scene->camera->height;
+	seed128bit* seeds = malloc(sizeof(seed128bit) * pixelCount);
+	if (!seeds) {
+		return false;
 	}
-	return dev_camera;
+	for (uint32_t i = 0; i < pixelCount; i++) {
+		seeds[i].x = (uint64_t) rand();
+		seeds[i].y = (uint64_t) rand();
+	}
+	context->cl.err = clEnqueueWriteBuffer(context->cl.commandQueue, context->cl.randomSeed, CL_TRUE, 0, sizeof(seed128bit) * pixelCount,
+		seeds, 0, NULL, NULL);
+	free(seeds);
+	return context->cl.err == CL_SUCCESS;
 }
 
-static cl_mem gpu_createMaterialsBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_materials = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Material) * scene->materialCount, scene->materials, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_materials.\n");
-		return NULL;
+bool gpu_readTraversalStats(GPUContext* context, Scene* scene, TraversalStats* stats) {
+	if (!context->cl.traversalStats) {
+		printf("The traversal stats need a build with ENABLE_TRAVERSAL_STATS.\n");
+		return false;
 	}
-	return dev_materials;
+	size_t size = sizeof(TraversalStats) * scene->camera->width * scene->camera->height;
+	context->cl.err = clEnqueueReadBuffer(context->cl.commandQueue, context->cl.traversalStats, CL_TRUE, 0, size, stats, 0, NULL, NULL);
+	return context->cl.err == CL_SUCCESS;
 }
 
-static cl_mem gpu_createPlanesBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_planes = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Plane) * scene->planeCount, scene->planes, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_planes.\n");
-		return NULL;
+void gpu_destroyContext(GPUContext* context) {
+	if (context) {
+		if (!context->isHeadless) {
+			gpu_deleteGLObjects(context);
+		}
+		gpu_deleteCLMemory(context);
+
+		clReleaseProgram(context->cl.program);
+		clReleaseCommandQueue(context->cl.commandQueue);
+		clReleaseContext(context->cl.ctx);
+		free(context);
 	}
-	return dev_planes;
 }
 
-static cl_mem gpu_createSpheresBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_spheres = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Sphere) * scene->sphereCount, scene->spheres, &context->cl.err);
+// -------------------- OPENCL --------------------
+
+static cl_mem gpu_createImageBufferFromTextureId(GPUContext* context, GLuint textureId) {
+	cl_mem dev_image = clCreateFromGLTexture(context->cl.ctx, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, textureId, &context->cl.err);
 	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_spheres.\n");
+		printf("Couldn't create dev_image.\n");
 		return NULL;
 	}
-	return dev_spheres;
+	return dev_image;
 }
 
-static cl_mem gpu_createTrianglesBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_triangles = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Triangle) * scene->triangleCount, scene->triangles, &context->cl.err);
+// without an OpenGL context, the kernel renders into a plain image, that can only be read back
+static cl_mem gpu_createHeadlessImage(GPUContext* context, uint32_t width, uint32_t height) {
+	cl_image_format format;
+	format.image_channel_order = CL_RGBA;
+	format.image_channel_data_type = CL_UNORM_INT8;
+	cl_image_desc desc;
+	memset(&desc, 0, sizeof(cl_image_desc));
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	desc.image_width = width;
+	desc.image_height = height;
+	cl_mem dev_image = clCreateImage(context->cl.ctx, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &context->cl.err);
 	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_triangles.\n");
+		printf("Couldn't create dev_image.\n");
 		return NULL;
 	}
-	return dev_triangles;
+	return dev_image;
 }
 
-static cl_mem gpu_createPointLightsBuffer(GPUContext* context, Scene* scene) {
-	cl_mem dev_pointLights = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(PointLight) * scene->pointLightCount, scene->pointLights, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_pointlights.\n");
-		return NULL;
+// the image has to be acquired from OpenGL, before the kernel writes to it
+static void gpu_acquireImage(GPUContext* context) {
+	if (!context->isHeadless) {
+		clEnqueueAcquireGLObjects(context->cl.commandQueue, 1, &context->cl.image, 0, NULL, NULL);
 	}
-	return dev_pointLights;
 }
 
-static cl_mem gpu_createOctreeNodesBuffer(GPUContext* context, Octree* octree) {
-	cl_mem dev_octreeNodes = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(OctreeNode) * octree->nodeCount, octree->nodes, &context->cl.err);
-	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_octreeNodes.\n");
-		return NULL;
+static void gpu_releaseImage(GPUContext* context) {
+	if (!context->isHeadless) {
+		clEnqueueReleaseGLObjects(context->cl.commandQueue, 1, &context->cl.image, 0, NULL, NULL);
 	}
-	return dev_octreeNodes;
 }
 
-static cl_mem gpu_createOctreeIndexesBuffer(GPUContext* context, Octree* octree) {
-	cl_mem dev_octreeIndexes = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * octree->indexCount, octree->indexes, &context->cl.err);
+static cl_mem gpu_createCameraBuffer(GPUContext* context, Scene* scene) {
+	cl_mem dev_camera = (void*)clCreateBuffer(context->cl.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Camera), scene->camera, &context->cl.err);
 	if (context->cl.err != CL_SUCCESS) {
-		printf("Couldn't create dev_octreeIndexes.\n");
+		printf("Couldn't create dev_camera.\n");
 		return NULL;
 	}
-	return dev_octreeIndexes;
+	memstats_allocate(MEMSTATS_DEVICE_SCENE, sizeof(Camera));
+	return dev_camera;
 }
 
 static cl_mem gpu_createRandomSeedBuffer(GPUContext* context, Scene* scene) {
@@ -167,11 +526,140 @@ static cl_mem gpu_createRandomSeedBuffer(GPUContext* context, Scene* scene) {
         printf("Couldn't create dev_randomSeed.\n");
         return NULL;
     }
+    context->cl.pixelCapacity = scene->camera->width * scene->camera->height;
+    memstats_allocate(MEMSTATS_DEVICE_PIXELS, seedSize);
     return dev_randomSeed;
 }
 
+// the buffer has the capacity of the random seed buffer
+static bool gpu_createTraversalStatsBuffer(GPUContext* context) {
+#ifdef ENABLE_TRAVERSAL_STATS
+	if (context->cl.traversalStats) {
+		clReleaseMemObject(context->cl.traversalStats);
+	}
+	context->cl.traversalStats = clCreateBuffer(context->cl.ctx, CL_MEM_WRITE_ONLY, sizeof(TraversalStats) * context->cl.pixelCapacity, NULL, &context->cl.err);
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create dev_traversalStats.\n");
+		context->cl.traversalStats = NULL;
+		return false;
+	}
+	memstats_allocate(MEMSTATS_DEVICE_PIXELS, sizeof(TraversalStats) * context->cl.pixelCapacity);
+#else
+	(void) context;
+#endif
+	return true;
+}
+
+// the history has the capacity of the random seed buffer, the buffers are created again, if it grows
+static bool gpu_createReprojectionBuffers(GPUContext* context) {
+	gpu_releaseReprojectionBuffers(context);
+	size_t hitsSize = sizeof(cl_float4) * context->cl.pixelCapacity;
+	size_t colorsSize = sizeof(uint32_t) * context->cl.pixelCapacity;
+	context->cl.err = CL_SUCCESS;
+	for (uint32_t i = 0; i < 2 && context->cl.err == CL_SUCCESS; i++) {
+		context->cl.hits[i] = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, hitsSize, NULL, &context->cl.err);
+		if (context->cl.err == CL_SUCCESS) {
+			context->cl.colors[i] = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, colorsSize, NULL, &context->cl.err);
+		}
+	}
+	if (context->cl.err == CL_SUCCESS) {
+		context->cl.previousCamera = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, sizeof(Camera), NULL, &context->cl.err);
+	}
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create the reprojection buffers.\n");
+		gpu_releaseReprojectionBuffers(context);
+		context->cl.reprojectionMode = REPROJECTION_OFF;
+		return false;
+	}
+	memstats_allocate(MEMSTATS_DEVICE_PIXELS, GPU_REPROJECTION_BYTES_PER_PIXEL * context->cl.pixelCapacity + sizeof(Camera));
+	return true;
+}
+
+// the memory stats are updated by the caller
+static void gpu_releaseReprojectionBuffers(GPUContext* context) {
+	for (uint32_t i = 0; i < 2; i++) {
+		if (context->cl.hits[i]) {
+			clReleaseMemObject(context->cl.hits[i]);
+			context->cl.hits[i] = NULL;
+		}
+		if (context->cl.colors[i]) {
+			clReleaseMemObject(context->cl.colors[i]);
+			context->cl.colors[i] = NULL;
+		}
+	}
+	if (context->cl.previousCamera) {
+		clReleaseMemObject(context->cl.previousCamera);
+		context->cl.previousCamera = NULL;
+	}
+	context->cl.isHistoryValid = false;
+}
+
+// the buffers have the capacity of the random seed buffer and are created again, if it grows
+static bool gpu_createDenoiseBuffers(GPUContext* context) {
+	gpu_releaseDenoiseBuffers(context);
+	size_t pixelsSize = sizeof(cl_float4) * context->cl.pixelCapacity;
+	size_t albedosSize = sizeof(uint32_t) * context->cl.pixelCapacity;
+	context->cl.err = CL_SUCCESS;
+	for (uint32_t i = 0; i < 2 && context->cl.err == CL_SUCCESS; i++) {
+		context->cl.denoiseColors[i] = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, pixelsSize, NULL, &context->cl.err);
+	}
+	if (context->cl.err == CL_SUCCESS) {
+		context->cl.denoiseGuides = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, pixelsSize, NULL, &context->cl.err);
+	}
+	if (context->cl.err == CL_SUCCESS) {
+		context->cl.denoiseAlbedos = clCreateBuffer(context->cl.ctx, CL_MEM_READ_WRITE, albedosSize, NULL, &context->cl.err);
+	}
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create the denoise buffers.\n");
+		gpu_releaseDenoiseBuffers(context);
+		context->cl.isDenoising = false;
+		return false;
+	}
+	memstats_allocate(MEMSTATS_DEVICE_PIXELS, GPU_DENOISE_BYTES_PER_PIXEL * context->cl.pixelCapacity);
+	return true;
+}
+
+// the memory stats are updated by the caller
+static void gpu_releaseDenoiseBuffers(GPUContext* context) {
+	cl_mem* buffers[4] = { &context->cl.denoiseColors[0], &context->cl.denoiseColors[1], &context->cl.denoiseGuides, &context->cl.denoiseAlbedos };
+	for (uint32_t i = 0; i < 4; i++) {
+		if (*buffers[i]) {
+			clReleaseMemObject(*buffers[i]);
+			*buffers[i] = NULL;
+		}
+	}
+}
+
+// the gl texture has 4 floats per pixel, the headless image 4 bytes
+static void gpu_trackImageSize(GPUContext* context, uint32_t width, uint32_t height) {
+	size_t bytesPerPixel = context->isHeadless ? 4 : 4 * sizeof(float);
+	size_t bytes = context->cl.image ? bytesPerPixel * width * height : 0;
+	memstats_reallocate(MEMSTATS_DEVICE_PIXELS, context->cl.imageBytes, bytes);
+	context->cl.imageBytes = bytes;
+}
+
+// the random seed, traversal stats, reprojection and denoise buffers, without the render target
+static size_t gpu_getPixelBufferBytes(GPUContext* context) {
+	size_t bytesPerPixel = sizeof(seed128bit);
+	size_t bytes = 0;
+	if (context->cl.traversalStats) {
+		bytesPerPixel += sizeof(TraversalStats);
+	}
+	if (context->cl.hits[0]) {
+		bytesPerPixel += GPU_REPROJECTION_BYTES_PER_PIXEL;
+		bytes += sizeof(Camera);
+	}
+	if (context->cl.denoiseGuides) {
+		bytesPerPixel += GPU_DENOISE_BYTES_PER_PIXEL;
+	}
+	return bytes + bytesPerPixel * context->cl.pixelCapacity;
+}
+
 static GPUContext* gpu_initCLContext() {
 	GPUContext* context = malloc(sizeof(GPUContext));
+	if (!context) {
+		return NULL;
+	}
 	clGetPlatformIDs(1, &context->cl.platformId, NULL);
 	clGetDeviceIDs(context->cl.platformId, CL_DEVICE_TYPE_GPU, 1, &context->cl.deviceId, NULL);
 
@@ -194,23 +682,51 @@ static GPUContext* gpu_initCLContext() {
 			0 };
 #endif
 	context->cl.ctx = clCreateContext(props, 1, &context->cl.deviceId, NULL, NULL, &context->cl.err);
-	context->cl.commandQueue = clCreateCommandQueue(context->cl.ctx, context->cl.deviceId, 0, &context->cl.err);
+	// profiling is needed to measure the kernel time for the dynamic resolution
+	context->cl.commandQueue = clCreateCommandQueue(context->cl.ctx, context->cl.deviceId, CL_QUEUE_PROFILING_ENABLE, &context->cl.err);
 	return context;
 }
 
-static bool gpu_allocateCLMemory(GPUContext* context, Scene* scene, Octree* octree) {
+// releases what the init functions created before gpu_initRenderer failed, the device memory is released by the renderer itself
+static void gpu_releaseCLContext(GPUContext* context) {
+	if (context->cl.kernel) {
+		clReleaseKernel(context->cl.kernel);
+	}
+	if (context->cl.program) {
+		clReleaseProgram(context->cl.program);
+	}
+	clReleaseCommandQueue(context->cl.commandQueue);
+	clReleaseContext(context->cl.ctx);
+	free(context);
+}
+
+static bool gpu_allocateCLMemory(GPUContext* context, Scene* scene, Accel* accel) {
     context->cl.image = NULL;
+    context->cl.imageBytes = 0;
     context->cl.camera = NULL;
-    context->cl.materials = NULL;
-    context->cl.planes = NULL;
-    context->cl.spheres = NULL;
-    context->cl.triangles = NULL;
-    context->cl.pointLights = NULL;
-    context->cl.octreeNodes = NULL;
-    context->cl.octreeIndexes = NULL;
+    context->cl.sceneSync = NULL;
     context->cl.randomSeed = NULL;
-    
-	context->cl.image = gpu_createImageBufferFromTextureId(context, context->gl.texture);
+	context->cl.traversalStats = NULL;
+	context->cl.hits[0] = NULL;
+	context->cl.hits[1] = NULL;
+	context->cl.colors[0] = NULL;
+	context->cl.colors[1] = NULL;
+	context->cl.previousCamera = NULL;
+	context->cl.historyIndex = 0;
+	context->cl.reprojectionMode = REPROJECTION_OFF;
+	context->cl.isHistoryValid = false;
+	context->cl.denoiseColors[0] = NULL;
+	context->cl.denoiseColors[1] = NULL;
+	context->cl.denoiseGuides = NULL;
+	context->cl.denoiseAlbedos = NULL;
+	context->cl.isDenoising = false;
+
+	if (context->isHeadless) {
+		context->cl.image = gpu_createHeadlessImage(context, scene->camera->width, scene->camera->height);
+	} else {
+		context->cl.image = gpu_createImageBufferFromTextureId(context, context->gl.texture);
+	}
+	gpu_trackImageSize(context, scene->camera->width, scene->camera->height);
 	if (!context->cl.image) {
 		return false;
 	}
@@ -218,93 +734,47 @@ static bool gpu_allocateCLMemory(GPUContext* context, Scene* scene, Octree* octr
 	if (!context->cl.camera) {
 		return false;
 	}
-    
-    if (scene->materialCount > 0) {
-        context->cl.materials = gpu_createMaterialsBuffer(context, scene);
-        if (!context->cl.materials) {
-            return false;
-        }
-    }
-    
-    if (scene->planeCount > 0) {
-        context->cl.planes = gpu_createPlanesBuffer(context, scene);
-        if (!context->cl.planes) {
-            return false;
-        }
-    }
-    
-    if (scene->sphereCount > 0) {
-        context->cl.spheres = gpu_createSpheresBuffer(context, scene);
-        if (!context->cl.spheres) {
-            return false;
-        }
-    }
-
-    if (scene->triangleCount > 0) {
-        context->cl.triangles = gpu_createTrianglesBuffer(context, scene);
-        if (!context->cl.triangles) {
-            return false;
-        }
-    }
-
-    if (scene->pointLightCount > 0) {
-        context->cl.pointLights = gpu_createPointLightsBuffer(context, scene);
-        if (!context->cl.pointLights) {
-            return false;
-        }
-    }
-
-    if (octree->nodeCount > 0) {
-        context->cl.octreeNodes = gpu_createOctreeNodesBuffer(context, octree);
-        if (!context->cl.octreeNodes) {
-            return false;
-        }
-    }
 
-    if (octree->indexCount > 0) {
-        context->cl.octreeIndexes = gpu_createOctreeIndexesBuffer(context, octree);
-        if (!context->cl.octreeIndexes) {
-            return false;
-        }
-    }
+	// the scene buffers are filled by the first gpu_syncScene call
+	context->cl.sceneSync = scenesync_create(context->cl.ctx, context->cl.deviceId, scene, accel);
+	if (!context->cl.sceneSync) {
+		return false;
+	}
 
     context->cl.randomSeed = gpu_createRandomSeedBuffer(context, scene);
     if (!context->cl.randomSeed) {
         return false;
     }
-	return true;
+	return gpu_createTraversalStatsBuffer(context);
 }
 
-static bool gpu_setupKernel(GPUContext* context, Scene* scene, Octree* octree, uint32_t raysPerPixel) {
-	// check which part of the scene, we can fit into shared memory
-	const char* sharedMemDef = "#define USE_SHARED_MEMORY\n";
-	const char* sharedMemCameraDef = "#define USE_SHARED_MEMORY_CAMERA\n";
-	const char* sharedMemMaterialsDef = "#define USE_SHARED_MEMORY_MATERIALS\n";
-	const char* sharedMemPlanesDef = "#define USE_SHARED_MEMORY_PLANES\n";
-	const char* sharedMemSpheresDef = "#define USE_SHARED_MEMORY_SPHERES\n";
-	const char* sharedMemTrianglesDef = "#define USE_SHARED_MEMORY_TRIANGLES\n";
-	const char* sharedMemPointLightsDef = "#define USE_SHARED_MEMORY_POINTLIGHTS\n";
-	const char* sharedMemOctreeNodesDef = "#define USE_SHARED_MEMORY_OCTREENODES\n";
-	const char* sharedMemOctreeIndexesDef = "#define USE_SHARED_MEMORY_OCTREEINDEXES\n";
-
-	bool useSharedMem = false;
-	bool useSharedMemCamera = false;
-	bool useSharedMemMaterials = false;
-	bool useSharedMemPlanes = false;
-	bool useSharedMemSpheres = false;
-	bool useSharedMemTriangles = false;
-	bool useSharedMemPointLights = false;
-	bool useSharedMemOctreeNodes = false;
-	bool useSharedMemOctreeIndexes = false;
-
-	size_t sharedMemCameraSize = sizeof(Camera);
-	size_t sharedMemMaterialsSize = sizeof(Material) * scene->materialCount;
-	size_t sharedMemPlanesSize = sizeof(Plane) * scene->planeCount;
-	size_t sharedMemSpheresSize = sizeof(Sphere) * scene->sphereCount;
-	size_t sharedMemTrianglesSize = sizeof(Triangle) * scene->triangleCount;
-	size_t sharedMemPointLightsSize = sizeof(PointLight) * scene->pointLightCount;
-	size_t sharedMemOctreeNodesSize = sizeof(OctreeNode) * octree->nodeCount;
-	size_t sharedMemOctreeIndexesSize = sizeof(uint32_t) * octree->indexCount;
+// the shared memory sizes are kernel arguments, so only the other fields need a new kernel
+static bool gpu_hasSameDefines(KernelConfig* config, KernelConfig* other) {
+	KernelConfig defines;
+	memcpy(&defines, config, sizeof(KernelConfig));
+	defines.sharedMemCameraSize = other->sharedMemCameraSize;
+	defines.sharedMemMaterialsSize = other->sharedMemMaterialsSize;
+	defines.sharedMemPlanesSize = other->sharedMemPlanesSize;
+	defines.sharedMemSpheresSize = other->sharedMemSpheresSize;
+	defines.sharedMemTrianglesSize = other->sharedMemTrianglesSize;
+	defines.sharedMemPointLightsSize = other->sharedMemPointLightsSize;
+	defines.sharedMemAccelNodesSize = other->sharedMemAccelNodesSize;
+	defines.sharedMemAccelIndexesSize = other->sharedMemAccelIndexesSize;
+	return memcmp(&defines, other, sizeof(KernelConfig)) == 0;
+}
+
+static void gpu_createKernelConfig(GPUContext* context, Scene* scene, Accel* accel, KernelConfig* config, bool specialize) {
+	// the config is compared with memcmp, so the padding has to be zeroed as well
+	memset(config, 0, sizeof(KernelConfig));
+
+	config->sharedMemCameraSize = sizeof(Camera);
+	config->sharedMemMaterialsSize = sizeof(Material) * scene->materialCount;
+	config->sharedMemPlanesSize = sizeof(Plane) * scene->planeCount;
+	config->sharedMemSpheresSize = sizeof(Sphere) * scene->sphereCount;
+	config->sharedMemTrianglesSize = sizeof(Triangle) * scene->triangleCount;
+	config->sharedMemPointLightsSize = sizeof(PointLight) * scene->pointLightCount;
+	config->sharedMemAccelNodesSize = sizeof(AccelNode) * accel->nodeCount;
+	config->sharedMemAccelIndexesSize = sizeof(uint32_t) * accel->indexCount;
 
 	// check if the gpu has a dedicated faster low latency local memory
 	// if not don't use shared memory at all, because the copying process just makes the kernel slower
@@ -316,186 +786,381 @@ static bool gpu_setupKernel(GPUContext* context, Scene* scene, Octree* octree, u
 		clGetDeviceInfo(context->cl.deviceId, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &availableLocalMemSize, NULL);
 	}
 
-	if (availableLocalMemSize >= sharedMemCameraSize) {
-		useSharedMemCamera = true;
-		availableLocalMemSize -= sharedMemCameraSize;
+	if (availableLocalMemSize >= config->sharedMemCameraSize) {
+		config->useSharedMemCamera = true;
+		availableLocalMemSize -= config->sharedMemCameraSize;
 	} else {
-		sharedMemCameraSize = 0;
+		config->sharedMemCameraSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemOctreeNodesSize) {
-		useSharedMemOctreeNodes = true;
-		availableLocalMemSize -= sharedMemOctreeNodesSize;
+	if (availableLocalMemSize >= config->sharedMemAccelNodesSize) {
+		config->useSharedMemAccelNodes = true;
+		availableLocalMemSize -= config->sharedMemAccelNodesSize;
 	} else {
-		sharedMemOctreeNodesSize = 0;
+		config->sharedMemAccelNodesSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemOctreeIndexesSize) {
-		useSharedMemOctreeIndexes = true;
-		availableLocalMemSize -= sharedMemOctreeIndexesSize;
+	if (availableLocalMemSize >= config->sharedMemAccelIndexesSize) {
+		config->useSharedMemAccelIndexes = true;
+		availableLocalMemSize -= config->sharedMemAccelIndexesSize;
 	} else {
-		sharedMemOctreeIndexesSize = 0;
+		config->sharedMemAccelIndexesSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemMaterialsSize) {
-		useSharedMemMaterials = true;
-		availableLocalMemSize -= sharedMemMaterialsSize;
+	if (availableLocalMemSize >= config->sharedMemMaterialsSize) {
+		config->useSharedMemMaterials = true;
+		availableLocalMemSize -= config->sharedMemMaterialsSize;
 	} else {
-		sharedMemMaterialsSize = 0;
+		config->sharedMemMaterialsSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemPlanesSize) {
-		useSharedMemPlanes = true;
-		availableLocalMemSize -= sharedMemPlanesSize;
+	if (availableLocalMemSize >= config->sharedMemPlanesSize) {
+		config->useSharedMemPlanes = true;
+		availableLocalMemSize -= config->sharedMemPlanesSize;
 	} else {
-		sharedMemPlanesSize = 0;
+		config->sharedMemPlanesSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemSpheresSize) {
-		useSharedMemSpheres = true;
-		availableLocalMemSize -= sharedMemSpheresSize;
+	if (availableLocalMemSize >= config->sharedMemSpheresSize) {
+		config->useSharedMemSpheres = true;
+		availableLocalMemSize -= config->sharedMemSpheresSize;
 	} else {
-		sharedMemSpheresSize = 0;
+		config->sharedMemSpheresSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemTrianglesSize) {
-		useSharedMemTriangles = true;
-		availableLocalMemSize -= sharedMemTrianglesSize;
+	if (availableLocalMemSize >= config->sharedMemTrianglesSize) {
+		config->useSharedMemTriangles = true;
+		availableLocalMemSize -= config->sharedMemTrianglesSize;
 	} else {
-		sharedMemTrianglesSize = 0;
+		config->sharedMemTrianglesSize = 0;
 	}
 
-	if (availableLocalMemSize >= sharedMemPointLightsSize) {
-		useSharedMemPointLights = true;
-		availableLocalMemSize -= sharedMemPointLightsSize;
+	if (availableLocalMemSize >= config->sharedMemPointLightsSize) {
+		config->useSharedMemPointLights = true;
+		availableLocalMemSize -= config->sharedMemPointLightsSize;
 	} else {
-		sharedMemPointLightsSize = 0;
+		config->sharedMemPointLightsSize = 0;
 	}
 
-	if (useSharedMemCamera || useSharedMemMaterials || useSharedMemPlanes || useSharedMemSpheres || useSharedMemTriangles || useSharedMemPointLights || useSharedMemOctreeNodes || useSharedMemOctreeIndexes) {
-		useSharedMem = true;
+	// if the whole hierarchy doesn't fit, stage its top levels with the remaining memory
+	// below the root and its children, the extra branch per node load isn't worth it
+	if (!config->useSharedMemAccelNodes) {
+		uint32_t nodeCount = (uint32_t) (availableLocalMemSize / sizeof(AccelNode));
+		if (nodeCount >= GPU_MIN_SHARED_ACCEL_NODES) {
+			config->sharedMemAccelNodesCount = nodeCount;
+			config->sharedMemAccelNodesSize = sizeof(AccelNode) * nodeCount;
+			availableLocalMemSize -= config->sharedMemAccelNodesSize;
+		}
 	}
 
-	size_t sourceSize = 0;
-	const char* source = file_readFile("kernel.cl", &sourceSize);
+	if (config->sharedMemAccelNodesCount > 0 || config->useSharedMemCamera || config->useSharedMemMaterials || config->useSharedMemPlanes || config->useSharedMemSpheres || config->useSharedMemTriangles || config->useSharedMemPointLights || config->useSharedMemAccelNodes || config->useSharedMemAccelIndexes) {
+		config->useSharedMem = true;
+	}
+
+	config->shadowRayCount = context->cl.shadowRayCount;
+	config->shadowProbeCount = context->cl.shadowProbeCount;
+	if (!specialize) {
+		return;
+	}
+
+	config->noSpheres = scene->sphereCount == 0;
+	config->noTriangles = scene->triangleCount == 0;
+	// without reflecting or refracting materials only the primary ray is traced
+	config->noSecondaryRays = true;
+	for (uint32_t i = 0; i < scene->materialCount; i++) {
+		if (scene->materials[i].reflectionIndex > 0 || scene->materials[i].refractionIndex > 0) {
+			config->noSecondaryRays = false;
+			break;
+		}
+	}
+	if (scene->planeCount <= GPU_MAX_CONSTANT_PLANES) {
+		config->constantPlaneCount = true;
+		config->planeCount = scene->planeCount;
+	}
+	if (scene->pointLightCount <= GPU_MAX_CONSTANT_POINTLIGHTS) {
+		config->constantPointLightCount = true;
+		config->pointLightCount = scene->pointLightCount;
+	}
+	config->specialized = config->noSpheres || config->noTriangles || config->noSecondaryRays ||
+		config->constantPlaneCount || config->constantPointLightCount;
+}
+
+static bool gpu_setupKernel(GPUContext* context, Scene* scene, Accel* accel) {
+	if (!gpu_selectKernel(context, scene, accel)) {
+		return false;
+	}
+	// the denoise kernel doesn't depend on the scene, it's taken from the program, that was kept
+	context->cl.denoiseKernel = clCreateKernel(context->cl.program, "denoise", &context->cl.err);
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create kernel denoise.\n");
+		context->cl.denoiseKernel = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void gpu_releaseKernels(GPUContext* context) {
+	if (context->cl.denoiseKernel) {
+		clReleaseKernel(context->cl.denoiseKernel);
+		context->cl.denoiseKernel = NULL;
+	}
+	clReleaseKernel(context->cl.kernel);
+	clReleaseProgram(context->cl.program);
+	context->cl.kernel = NULL;
+	context->cl.program = NULL;
+}
+
+static bool gpu_selectKernel(GPUContext* context, Scene* scene, Accel* accel) {
+	KernelSelection selection = context->cl.kernelSelection;
+	KernelConfig* config = &context->cl.kernelConfig;
+	gpu_createKernelConfig(context, scene, accel, config, selection != KERNEL_SELECTION_GENERIC);
+
+	if (!gpu_buildKernel(context, config, &context->cl.program, &context->cl.kernel) ||
+		!gpu_setKernelArgs(context, context->cl.kernel, scene, accel)) {
+		return false;
+	}
+	if (selection != KERNEL_SELECTION_AUTO || !config->specialized) {
+		return true;
+	}
+
+	// a specialized kernel isn't faster on every device, so compare it with the generic one on the actual scene
+	KernelConfig genericConfig;
+	gpu_createKernelConfig(context, scene, accel, &genericConfig, false);
+	cl_program genericProgram;
+	cl_kernel genericKernel;
+	if (!gpu_buildKernel(context, &genericConfig, &genericProgram, &genericKernel)) {
+		// keep the specialized kernel
+		return true;
+	}
+	if (!gpu_setKernelArgs(context, genericKernel, scene, accel)) {
+		clReleaseKernel(genericKernel);
+		clReleaseProgram(genericProgram);
+		return true;
+	}
+
+	double specializedTime = gpu_benchmarkKernel(context, scene, context->cl.kernel);
+	double genericTime = gpu_benchmarkKernel(context, scene, genericKernel);
+	printf("Specialized kernel: %.2f ms, generic kernel: %.2f ms\n", specializedTime, genericTime);
+	if (genericTime < specializedTime) {
+		clReleaseKernel(context->cl.kernel);
+		clReleaseProgram(context->cl.program);
+		context->cl.program = genericProgram;
+		context->cl.kernel = genericKernel;
+	} else {
+		clReleaseKernel(genericKernel);
+		clReleaseProgram(genericProgram);
+	}
+	return true;
+}
+
+static void gpu_appendDefine(StringBuilder* builder, const char* name, uint32_t value) {
+	char define[128];
+	snprintf(define, sizeof(define), "#define %s %u\n", name, value);
+	stringbuilder_append(builder, define);
+}
+
+static void gpu_appendFloatDefine(StringBuilder* builder, const char* name, float value) {
+	char define[128];
+	// the exponent notation keeps every digit of the float and stays a float literal
+	snprintf(define, sizeof(define), "#define %s %.9ef\n", name, (double) value);
+	stringbuilder_append(builder, define);
+}
+
+static bool gpu_buildKernel(GPUContext* context, KernelConfig* config, cl_program* program, cl_kernel* kernel) {
+	// check which part of the scene, we can fit into shared memory
+	const char* sharedMemDef = "#define USE_SHARED_MEMORY\n";
+	const char* sharedMemCameraDef = "#define USE_SHARED_MEMORY_CAMERA\n";
+	const char* sharedMemMaterialsDef = "#define USE_SHARED_MEMORY_MATERIALS\n";
+	const char* sharedMemPlanesDef = "#define USE_SHARED_MEMORY_PLANES\n";
+	const char* sharedMemSpheresDef = "#define USE_SHARED_MEMORY_SPHERES\n";
+	const char* sharedMemTrianglesDef = "#define USE_SHARED_MEMORY_TRIANGLES\n";
+	const char* sharedMemPointLightsDef = "#define USE_SHARED_MEMORY_POINTLIGHTS\n";
+	const char* sharedMemAccelNodesDef = "#define USE_SHARED_MEMORY_ACCELNODES\n";
+	const char* sharedMemAccelIndexesDef = "#define USE_SHARED_MEMORY_ACCELINDEXES\n";
+
+	// the kernel is embedded into the executable, but can be overridden to iterate on it without rebuilding
+	size_t sourceSize = sizeof(kernelSource);
+	const char* kernelPath = getenv("RAYTRACER_KERNEL_PATH");
+	char* fileSource = NULL;
+	if (kernelPath) {
+		fileSource = file_readFile(kernelPath, &sourceSize);
+		if (!fileSource) {
+			printf("Couldn't read %s.\n", kernelPath);
+			return false;
+		}
+	}
 
 	StringBuilder* builder = stringbuilder_create(sourceSize + 1000L);
-	if (useSharedMem) {
+	if (config->useSharedMem) {
 		stringbuilder_append(builder, sharedMemDef);
 	}
-	if (useSharedMemCamera) {
+	if (config->useSharedMemCamera) {
 		stringbuilder_append(builder, sharedMemCameraDef);
 	}
-	if (useSharedMemMaterials) {
+	if (config->useSharedMemMaterials) {
 		stringbuilder_append(builder, sharedMemMaterialsDef);
 	}
-	if (useSharedMemPlanes) {
+	if (config->useSharedMemPlanes) {
 		stringbuilder_append(builder, sharedMemPlanesDef);
 	}
-	if (useSharedMemSpheres) {
+	if (config->useSharedMemSpheres) {
 		stringbuilder_append(builder, sharedMemSpheresDef);
 	}
-	if (useSharedMemTriangles) {
+	if (config->useSharedMemTriangles) {
 		stringbuilder_append(builder, sharedMemTrianglesDef);
 	}
-	if (useSharedMemPointLights) {
+	if (config->useSharedMemPointLights) {
 		stringbuilder_append(builder, sharedMemPointLightsDef);
 	}
-	if (useSharedMemOctreeNodes) {
-		stringbuilder_append(builder, sharedMemOctreeNodesDef);
+	if (config->useSharedMemAccelNodes) {
+		stringbuilder_append(builder, sharedMemAccelNodesDef);
+	}
+	if (config->useSharedMemAccelIndexes) {
+		stringbuilder_append(builder, sharedMemAccelIndexesDef);
+	}
+	if (config->sharedMemAccelNodesCount > 0) {
+		gpu_appendDefine(builder, "SHARED_ACCELNODES_COUNT", config->sharedMemAccelNodesCount);
+	}
+
+	// scene specialization
+	if (config->noSpheres) {
+		stringbuilder_append(builder, "#define SCENE_NO_SPHERES\n");
+	}
+	if (config->noTriangles) {
+		stringbuilder_append(builder, "#define SCENE_NO_TRIANGLES\n");
+	}
+	if (config->noSecondaryRays) {
+		stringbuilder_append(builder, "#define SCENE_NO_SECONDARY_RAYS\n");
+	}
+	if (config->constantPlaneCount) {
+		gpu_appendDefine(builder, "SCENE_PLANE_COUNT", config->planeCount);
 	}
-	if (useSharedMemOctreeIndexes) {
-		stringbuilder_append(builder, sharedMemOctreeIndexesDef);
+	if (config->constantPointLightCount) {
+		gpu_appendDefine(builder, "SCENE_POINTLIGHT_COUNT", config->pointLightCount);
 	}
-	stringbuilder_append(builder, source);
-	source = stringbuilder_cstr(builder);
+	gpu_appendDefine(builder, "SHADOW_RAY_COUNT", config->shadowRayCount);
+	gpu_appendDefine(builder, "SHADOW_PROBE_COUNT", config->shadowProbeCount);
+	// the denoise kernel filters like denoiser.c
+	gpu_appendFloatDefine(builder, "DENOISER_NORMAL_PHI", DENOISER_NORMAL_PHI);
+	gpu_appendFloatDefine(builder, "DENOISER_DEPTH_PHI", DENOISER_DEPTH_PHI);
+#ifdef ENABLE_TRAVERSAL_STATS
+	stringbuilder_append(builder, "#define TRAVERSAL_STATS\n");
+#endif
+
+	stringbuilder_append(builder, fileSource ? fileSource : kernelSource);
+	free(fileSource);
+	char* source = stringbuilder_cstr(builder);
 	sourceSize = builder->length;
 	stringbuilder_destroy(builder);
-	
-	context->cl.program = clCreateProgramWithSource(context->cl.ctx, 1, &source, &sourceSize, &context->cl.err);
 
-	free((void*) source);
-	clBuildProgram(context->cl.program, 1, &context->cl.deviceId, NULL, NULL, NULL);
+	// the program is only compiled, if the cache has no binary for this source and device
+	*program = programcache_buildProgram(context->cl.ctx, context->cl.deviceId, source, sourceSize, NULL, &context->cl.err);
+	free(source);
+	if (context->cl.err != CL_SUCCESS) {
+		printf("Couldn't create the program.\n");
+		return false;
+	}
 #ifndef NDEBUG
 	cl_build_status status;
-	clGetProgramBuildInfo(context->cl.program, context->cl.deviceId, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &status, NULL);
+	clGetProgramBuildInfo(*program, context->cl.deviceId, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &status, NULL);
 	if (status != CL_BUILD_SUCCESS) {
 		char* log;
 		size_t log_size = 0;
 
 		// get the size of the log
-		clGetProgramBuildInfo(context->cl.program, context->cl.deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		clGetProgramBuildInfo(*program, context->cl.deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
 
 		log = malloc(sizeof(char) * (log_size + 1));
 		// get the log itself
-		clGetProgramBuildInfo(context->cl.program, context->cl.deviceId, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		clGetProgramBuildInfo(*program, context->cl.deviceId, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
 		log[log_size] = '\0';
 		// print the log
 		printf("Build log:\n%s\n", log);
 		free(log);
+		clReleaseProgram(*program);
+		*program = NULL;
 		return false;
 	}
 #endif
 
-	cl_kernel raytrace_kernel = context->cl.kernel = clCreateKernel(context->cl.program, "raytrace", &context->cl.err);
+	*kernel = clCreateKernel(*program, "raytrace", &context->cl.err);
 	if (context->cl.err != CL_SUCCESS) {
 		printf("Couldn't create kernel raytrace.\n");
+		clReleaseProgram(*program);
+		*program = NULL;
 		return false;
 	}
+	return true;
+}
 
-	// this calculates how many rays we have on X and Y, and how much the deltaX/Y for these subpixel samples are
-	assert(raysPerPixel > 0);
-	float rayColorContribution = 1.0f / (float)raysPerPixel;
+// returns the average time of a frame in ms
+static double gpu_benchmarkKernel(GPUContext* context, Scene* scene, cl_kernel kernel) {
+	const size_t threadsPerDim[2] = { scene->camera->width, scene->camera->height };
+	if (!context->isHeadless) {
+		glFinish();
+	}
+	gpu_acquireImage(context);
+	// the first run may include lazy initialization of the driver
+	clEnqueueNDRangeKernel(context->cl.commandQueue, kernel, 2, NULL, threadsPerDim, NULL, 0, NULL, NULL);
+	clFinish(context->cl.commandQueue);
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < GPU_KERNEL_BENCHMARK_RUNS; i++) {
+		clEnqueueNDRangeKernel(context->cl.commandQueue, kernel, 2, NULL, threadsPerDim, NULL, 0, NULL, NULL);
+	}
+	clFinish(context->cl.commandQueue);
+	uint64_t end = SDL_GetPerformanceCounter();
 
-	float pixelWidth = 1.0f / (float)(scene->camera->width);
-	float pixelHeight = 1.0f / (float)(scene->camera->height);
-	float rootTerm = sqrtf(pixelWidth / pixelHeight * raysPerPixel + powf(pixelWidth - pixelHeight, 2) / 4 * powf(pixelHeight, 2));
+	gpu_releaseImage(context);
+	clFinish(context->cl.commandQueue);
+	return (double) (end - start) * 1000.0 / (double) SDL_GetPerformanceFrequency() / GPU_KERNEL_BENCHMARK_RUNS;
+}
 
-	uint32_t raysPerWidthPixel = 1;
-	uint32_t raysPerHeightPixel = 1;
-	float deltaX = pixelWidth;
-	float deltaY = pixelHeight;
-
-	// prevent division by 0
-	if (raysPerPixel > 1) {
-		raysPerWidthPixel = (uint32_t)(rootTerm - (pixelWidth - pixelHeight / 2 * pixelHeight));
-		raysPerHeightPixel = (uint32_t)(raysPerPixel / raysPerWidthPixel);
-		deltaX = pixelWidth / raysPerWidthPixel;
-		deltaY = pixelHeight / raysPerHeightPixel;
-	}
+static bool gpu_setKernelArgs(GPUContext* context, cl_kernel raytrace_kernel, Scene* scene, Accel* accel) {
+	KernelConfig* config = &context->cl.kernelConfig;
+	DeviceArray* deviceArrays = context->cl.sceneSync->arrays;
+	// the CPU tracer uses the same samples, so its pixels can be mixed with the kernel ones
+	RaytracerSampling sampling;
+	raytracer_initSampling(&sampling, scene->camera, context->cl.raysPerPixel, context->cl.maxRayDepth, context->cl.shadowRayCount);
 
 	context->cl.err = clSetKernelArg(raytrace_kernel, 0, sizeof(cl_mem), &context->cl.camera);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 1, sharedMemCameraSize, NULL); // sharedMemory camera
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 2, sizeof(cl_mem), &context->cl.materials);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 3, sharedMemMaterialsSize, NULL); // sharedMemory materials
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 1, config->sharedMemCameraSize, NULL); // sharedMemory camera
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 2, sizeof(cl_mem), &deviceArrays[SCENESYNC_MATERIALS].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 3, config->sharedMemMaterialsSize, NULL); // sharedMemory materials
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 4, sizeof(uint32_t), &scene->materialCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 5, sizeof(cl_mem), &context->cl.planes);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 6, sharedMemPlanesSize, NULL); // sharedMemory planes
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 5, sizeof(cl_mem), &deviceArrays[SCENESYNC_PLANES].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 6, config->sharedMemPlanesSize, NULL); // sharedMemory planes
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 7, sizeof(uint32_t), &scene->planeCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 8, sizeof(cl_mem), &context->cl.spheres);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 9, sharedMemSpheresSize, NULL); // sharedMemory spheres
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 8, sizeof(cl_mem), &deviceArrays[SCENESYNC_SPHERES].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 9, config->sharedMemSpheresSize, NULL); // sharedMemory spheres
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 10, sizeof(uint32_t), &scene->sphereCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 11, sizeof(cl_mem), &context->cl.triangles);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 12, sharedMemTrianglesSize, NULL); // sharedMemory triangles
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 11, sizeof(cl_mem), &deviceArrays[SCENESYNC_TRIANGLES].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 12, config->sharedMemTrianglesSize, NULL); // sharedMemory triangles
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 13, sizeof(uint32_t), &scene->triangleCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 14, sizeof(cl_mem), &context->cl.pointLights);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 15, sharedMemPointLightsSize, NULL); // sharedMemory pointLights
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 14, sizeof(cl_mem), &deviceArrays[SCENESYNC_POINTLIGHTS].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 15, config->sharedMemPointLightsSize, NULL); // sharedMemory pointLights
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 16, sizeof(uint32_t), &scene->pointLightCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 17, sizeof(cl_mem), &context->cl.octreeNodes);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 18, sharedMemOctreeNodesSize, NULL); // sharedMemory octreeNodes
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 19, sizeof(uint32_t), &octree->nodeCount);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 20, sizeof(cl_mem), &context->cl.octreeIndexes);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 21, sharedMemOctreeIndexesSize, NULL); // sharedMemory octreeIndexes
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 22, sizeof(uint32_t), &octree->indexCount);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 17, sizeof(cl_mem), &deviceArrays[SCENESYNC_ACCELNODES].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 18, config->sharedMemAccelNodesSize, NULL); // sharedMemory accelNodes
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 19, sizeof(uint32_t), &accel->nodeCount);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 20, sizeof(cl_mem), &deviceArrays[SCENESYNC_ACCELINDEXES].buffer);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 21, config->sharedMemAccelIndexesSize, NULL); // sharedMemory accelIndexes
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 22, sizeof(uint32_t), &accel->indexCount);
     context->cl.err |= clSetKernelArg(raytrace_kernel, 23, sizeof(cl_mem), &context->cl.randomSeed);
 	context->cl.err |= clSetKernelArg(raytrace_kernel, 24, sizeof(cl_mem), &context->cl.image);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 25, sizeof(float), &rayColorContribution);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 26, sizeof(float), &deltaX);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 27, sizeof(float), &deltaY);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 28, sizeof(float), &pixelWidth);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 29, sizeof(float), &pixelHeight);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 30, sizeof(uint32_t), &raysPerWidthPixel);
-	context->cl.err |= clSetKernelArg(raytrace_kernel, 31, sizeof(uint32_t), &raysPerHeightPixel);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 25, sizeof(float), &sampling.rayColorContribution);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 26, sizeof(float), &sampling.deltaX);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 27, sizeof(float), &sampling.deltaY);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 28, sizeof(float), &sampling.pixelWidth);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 29, sizeof(float), &sampling.pixelHeight);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 30, sizeof(uint32_t), &sampling.raysPerWidthPixel);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 31, sizeof(uint32_t), &sampling.raysPerHeightPixel);
+	// every frame sets the modes and the buffers again, see gpu_enqueueRows
+	context->cl.err |= gpu_setFrameArgs(context, raytrace_kernel, REPROJECTION_OFF, false);
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 42, sizeof(cl_mem), &deviceArrays[SCENESYNC_LIGHTTREENODES].buffer);
+#ifdef ENABLE_TRAVERSAL_STATS
+	context->cl.err |= clSetKernelArg(raytrace_kernel, 46, sizeof(cl_mem), &context->cl.traversalStats);
+#endif
 	if (context->cl.err != CL_SUCCESS) {
 		printf("Couldn't set all kernel args correctly.\n");
 		return false;
@@ -503,17 +1168,110 @@ static bool gpu_setupKernel(GPUContext* context, Scene* scene, Octree* octree, u
 	return true;
 }
 
+// the current frame writes into the history buffers of historyIndex, the last frame is read from the other ones
+static cl_int gpu_setFrameArgs(GPUContext* context, cl_kernel kernel, ReprojectionMode mode, bool isDenoising) {
+	uint32_t current = context->cl.historyIndex;
+	uint32_t previous = 1 - current;
+	uint32_t modeArg = (uint32_t) mode;
+	uint32_t isDenoisingArg = isDenoising ? 1 : 0;
+	cl_int err = clSetKernelArg(kernel, 32, sizeof(cl_mem), &context->cl.previousCamera);
+	err |= clSetKernelArg(kernel, 33, sizeof(cl_mem), &context->cl.hits[previous]);
+	err |= clSetKernelArg(kernel, 34, sizeof(cl_mem), &context->cl.colors[previous]);
+	err |= clSetKernelArg(kernel, 35, sizeof(cl_mem), &context->cl.hits[current]);
+	err |= clSetKernelArg(kernel, 36, sizeof(cl_mem), &context->cl.colors[current]);
+	err |= clSetKernelArg(kernel, 37, sizeof(uint32_t), &modeArg);
+	// the raytrace kernel writes the input of the first denoise pass
+	err |= clSetKernelArg(kernel, 38, sizeof(cl_mem), &context->cl.denoiseColors[0]);
+	err |= clSetKernelArg(kernel, 39, sizeof(cl_mem), &context->cl.denoiseGuides);
+	err |= clSetKernelArg(kernel, 40, sizeof(cl_mem), &context->cl.denoiseAlbedos);
+	err |= clSetKernelArg(kernel, 41, sizeof(uint32_t), &isDenoisingArg);
+	// the ray depth and the termination don't need another kernel
+	uint32_t isFresnelSamplingArg = context->cl.isFresnelSampling ? 1 : 0;
+	err |= clSetKernelArg(kernel, 43, sizeof(uint32_t), &context->cl.maxRayDepth);
+	err |= clSetKernelArg(kernel, 44, sizeof(float), &context->cl.rouletteThreshold);
+	err |= clSetKernelArg(kernel, 45, sizeof(uint32_t), &isFresnelSamplingArg);
+	return err;
+}
+
+// the passes of denoiser_apply, the colors go back and forth between both buffers and the last pass writes the image
+static bool gpu_enqueueDenoise(GPUContext* context, Scene* scene) {
+	const size_t threadsPerDim[2] = { scene->camera->width, scene->camera->height };
+	float colorPhi = DENOISER_COLOR_PHI;
+	for (uint32_t pass = 0; pass < DENOISER_PASS_COUNT; pass++) {
+		uint32_t stepWidth = 1u << pass;
+		uint32_t isLastPass = pass == DENOISER_PASS_COUNT - 1 ? 1 : 0;
+		cl_kernel kernel = context->cl.denoiseKernel;
+		context->cl.err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &context->cl.denoiseColors[pass % 2]);
+		context->cl.err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &context->cl.denoiseColors[1 - pass % 2]);
+		context->cl.err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &context->cl.denoiseGuides);
+		context->cl.err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &context->cl.denoiseAlbedos);
+		context->cl.err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &context->cl.image);
+		context->cl.err |= clSetKernelArg(kernel, 5, sizeof(uint32_t), &stepWidth);
+		context->cl.err |= clSetKernelArg(kernel, 6, sizeof(float), &colorPhi);
+		context->cl.err |= clSetKernelArg(kernel, 7, sizeof(uint32_t), &isLastPass);
+		if (context->cl.err != CL_SUCCESS) {
+			return false;
+		}
+		context->cl.err = clEnqueueNDRangeKernel(context->cl.commandQueue, kernel, 2, NULL, threadsPerDim, NULL, 0, NULL,
+			isLastPass ? &context->cl.denoiseDone : NULL);
+		if (context->cl.err != CL_SUCCESS) {
+			context->cl.denoiseDone = NULL;
+			return false;
+		}
+		colorPhi /= 2.0f;
+	}
+	return true;
+}
+
+static bool gpu_syncScene(GPUContext* context, Scene* scene, Accel* accel, cl_event* uploadDone) {
+	// modified materials may need a different specialization
+	DeviceArray* materials = &context->cl.sceneSync->arrays[SCENESYNC_MATERIALS];
+	bool materialsChanged = materials->dirtyBegin != materials->dirtyEnd;
+	bool layoutChanged = false;
+	if (!scenesync_upload(context->cl.sceneSync, scene, accel, uploadDone, &layoutChanged)) {
+		return false;
+	}
+	// the shading of the last frame is outdated
+	if (*uploadDone || layoutChanged) {
+		context->cl.isHistoryValid = false;
+	}
+	if (!layoutChanged && !materialsChanged) {
+		return true;
+	}
+
+	// check if the arrays still fit into the same shared memory layout and specialization
+	KernelConfig config;
+	gpu_createKernelConfig(context, scene, accel, &config, context->cl.kernelSelection != KERNEL_SELECTION_GENERIC);
+	if (!gpu_hasSameDefines(&config, &context->cl.kernelConfig)) {
+		// the kernel benchmark needs the new scene data
+		if (*uploadDone) {
+			clWaitForEvents(1, uploadDone);
+		}
+		gpu_releaseKernels(context);
+		return gpu_setupKernel(context, scene, accel);
+	}
+	// new primitive counts only change the sizes of the shared memory arguments
+	bool sizesChanged = memcmp(&config, &context->cl.kernelConfig, sizeof(KernelConfig)) != 0;
+	memcpy(&context->cl.kernelConfig, &config, sizeof(KernelConfig));
+	return (!layoutChanged && !sizesChanged) || gpu_setKernelArgs(context, context->cl.kernel, scene, accel);
+}
+
 static void gpu_deleteCLMemory(GPUContext* context) {
+	memstats_free(MEMSTATS_DEVICE_SCENE, sizeof(Camera));
+	memstats_free(MEMSTATS_DEVICE_PIXELS, context->cl.imageBytes + gpu_getPixelBufferBytes(context));
+	if (context->cl.denoiseKernel) {
+		clReleaseKernel(context->cl.denoiseKernel);
+	}
 	clReleaseKernel(context->cl.kernel);
+	clReleaseMemObject(context->cl.image);
 	clReleaseMemObject(context->cl.camera);
-	clReleaseMemObject(context->cl.materials);
-	clReleaseMemObject(context->cl.planes);
-	clReleaseMemObject(context->cl.spheres);
-	clReleaseMemObject(context->cl.triangles);
-	clReleaseMemObject(context->cl.pointLights);
-	clReleaseMemObject(context->cl.octreeNodes);
-	clReleaseMemObject(context->cl.octreeIndexes);
+	scenesync_destroy(context->cl.sceneSync);
     clReleaseMemObject(context->cl.randomSeed);
+	if (context->cl.traversalStats) {
+		clReleaseMemObject(context->cl.traversalStats);
+	}
+	gpu_releaseReprojectionBuffers(context);
+	gpu_releaseDenoiseBuffers(context);
 }
 
 // -------------------- OPENGL--------------------
@@ -583,7 +1341,7 @@ static void gpu_initGLContext(GPUContext* context, uint32_t renderWidth, uint32_
 
 	glGenTextures(1, &context->gl.texture);
 	glBindTexture(GL_TEXTURE_2D, context->gl.texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderWidth, renderHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei) renderWidth, (GLsizei) renderHeight, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -604,7 +1362,7 @@ static void gpu_initGLContext(GPUContext* context, uint32_t renderWidth, uint32_
 	// initially no scaling is required, because renderAspectRatio is the same as viewAspectRatio
 	context->gl.scaleLocation = glGetUniformLocation(context->gl.shaderProgram, "scale");
 	glUniform2f(context->gl.scaleLocation, 1.0f, 1.0f);
-	glViewport(0, 0, renderWidth, renderHeight);
+	glViewport(0, 0, (GLsizei) renderWidth, (GLsizei) renderHeight);
 }
 
 static GLuint gpu_compileShaderProgram(const char* vertexShaderSrc, const char* fragmentShaderSrc) {
@@ -654,7 +1412,7 @@ void gpu_updateDimensions(GPUContext* context, uint32_t viewWidth, uint32_t view
 		xScale = renderAspectRatio / viewAspectRatio;
 	}
 	glUniform2f(context->gl.scaleLocation, xScale, yScale);
-	glViewport(0, 0, viewWidth, viewHeight);
+	glViewport(0, 0, (GLsizei) viewWidth, (GLsizei) viewHeight);
 }
 
 static void gpu_deleteGLObjects(GPUContext* context) {
@@ -22,9 +22,68 @@
 #include "utils/file.h"
 #include "utils/image.h"
 #include "scene.h"
-#include "octree.h"
+#include "accel.h"
+#include "traversalstats.h"
+#include "scenesync.h"
 
+// describes the compile time configuration of the raytrace kernel
 typedef struct {
+	bool useSharedMem;
+	bool useSharedMemCamera;
+	bool useSharedMemMaterials;
+	bool useSharedMemPlanes;
+	bool useSharedMemSpheres;
+	bool useSharedMemTriangles;
+	bool useSharedMemPointLights;
+	bool useSharedMemAccelNodes;
+	bool useSharedMemAccelIndexes;
+
+	size_t sharedMemCameraSize;
+	size_t sharedMemMaterialsSize;
+	size_t sharedMemPlanesSize;
+	size_t sharedMemSpheresSize;
+	size_t sharedMemTrianglesSize;
+	size_t sharedMemPointLightsSize;
+	size_t sharedMemAccelNodesSize;
+	size_t sharedMemAccelIndexesSize;
+	// number of nodes staged, if only the top of the hierarchy fits into shared memory
+	uint32_t sharedMemAccelNodesCount;
+
+	// scene specialization, all of these are false for the generic kernel
+	bool specialized;
+	bool noSpheres;
+	bool noTriangles;
+	// no material reflects or refracts, so only primary and shadow rays are traced
+	bool noSecondaryRays;
+	// small plane and light counts are compiled in, so that the loops over them can be unrolled
+	bool constantPlaneCount;
+	bool constantPointLightCount;
+	uint32_t planeCount;
+	uint32_t pointLightCount;
+	uint32_t shadowRayCount;
+	uint32_t shadowProbeCount;
+} KernelConfig;
+
+typedef enum {
+	// benchmark the scene specialized kernel against the generic one and use the faster one
+	KERNEL_SELECTION_AUTO,
+	KERNEL_SELECTION_GENERIC,
+	KERNEL_SELECTION_SPECIALIZED
+} KernelSelection;
+
+// what the kernel does with the primary hits and colors of the last frame, the values are used in kernel.cl
+typedef enum {
+	// every pixel is traced and no history is kept
+	REPROJECTION_OFF,
+	// every pixel is traced, the hits and colors are kept for the next frame
+	REPROJECTION_RECORD,
+	// pixels, whose primary hit was visible at the same place in the last frame, reuse its color
+	REPROJECTION_REUSE
+} ReprojectionMode;
+
+typedef struct {
+	// renders into an OpenCL image without a window, see gpu_initHeadlessContext
+	bool isHeadless;
 	struct {
 		cl_platform_id platformId;
 		cl_device_id deviceId;
@@ -32,16 +91,53 @@ typedef struct {
 		cl_command_queue commandQueue;
 		cl_program program;
 		cl_kernel kernel;
+		// one pass of the a-trous filter, from the program of the selected raytrace kernel
+		cl_kernel denoiseKernel;
 		cl_mem image;
+		// size of the render target, for the memory stats
+		size_t imageBytes;
 		cl_mem camera;
-		cl_mem materials;
-		cl_mem planes;
-		cl_mem spheres;
-		cl_mem triangles;
-		cl_mem pointLights;
-		cl_mem octreeNodes;
-		cl_mem octreeIndexes;
+		// owns the materials, planes, spheres, triangles, pointLights, accelNodes and accelIndexes buffers
+		SceneSync* sceneSync;
         cl_mem randomSeed;
+		// TraversalStats per pixel, NULL without ENABLE_TRAVERSAL_STATS
+		cl_mem traversalStats;
+		// primary hits and packed colors of the last and the current frame, NULL until reprojection is enabled
+		cl_mem hits[2];
+		cl_mem colors[2];
+		cl_mem previousCamera;
+		// the buffers of the current frame
+		uint32_t historyIndex;
+		ReprojectionMode reprojectionMode;
+		// the last frame was traced with the current scene and kernel, so its history can be reused
+		bool isHistoryValid;
+		// demodulated colors (ping pong), normal and depth and packed albedos of the primary hits,
+		// NULL until denoising is enabled
+		cl_mem denoiseColors[2];
+		cl_mem denoiseGuides;
+		cl_mem denoiseAlbedos;
+		bool isDenoising;
+		// the config the kernel was requested with, the generic kernel may be used instead
+		KernelConfig kernelConfig;
+		KernelSelection kernelSelection;
+		// limits of the kernel, see gpu_setRayLimits, only the shadow rays are compiled in
+		uint32_t maxRayDepth;
+		uint32_t shadowRayCount;
+		// see gpu_setShadowProbeCount
+		uint32_t shadowProbeCount;
+		// see gpu_setRayTermination
+		float rouletteThreshold;
+		bool isFresnelSampling;
+		// number of pixels the per pixel buffers can hold
+		uint32_t pixelCapacity;
+		// duration of the last raytrace kernel in ms
+		double kernelTime;
+		// the kernel enqueued by gpu_enqueueRows, until gpu_finishRows
+		cl_event kernelDone;
+		// the last denoise pass of the frame, NULL if the frame isn't denoised
+		cl_event denoiseDone;
+		uint64_t kernelEnqueueTime;
+		uint32_t raysPerPixel;
 		cl_int err;
 	} cl;
 	struct {
@@ -57,8 +153,42 @@ typedef struct {
 
 // -------------------- MIXED --------------------
 
-GPUContext* gpu_initContext(Scene* scene, Octree* octree, uint32_t raysPerPixel);
-void gpu_renderScene(GPUContext* context, Scene* scene, Image* image);
+GPUContext* gpu_initContext(Scene* scene, Accel* accel, uint32_t raysPerPixel);
+// creates a context without OpenGL interop, the result can only be read back with gpu_renderScene or gpu_enqueueRows
+GPUContext* gpu_initHeadlessContext(Scene* scene, Accel* accel, uint32_t raysPerPixel, cl_platform_id platformId, cl_device_id deviceId);
+// the device with the given index, counted over the devices of all platforms
+bool gpu_getDevice(uint32_t index, cl_platform_id* platformId, cl_device_id* deviceId);
+// changes the recursion depth (1 to RAYTRACER_MAX_RAY_DEPTH), the kernel is only rebuilt for a different number of shadow rays per light
+bool gpu_setRayLimits(GPUContext* context, Scene* scene, Accel* accel, uint32_t maxRayDepth, uint32_t shadowRayCount);
+// rebuilds the kernel, so that the shadow rays of a light after the first probeCount (at least 1) are only traced,
+// if the probes disagree about the visibility of the light. This sharpens the penumbra a little, where the probes agree
+// by chance, probeCount >= shadowRayCount traces all of them and is unbiased
+bool gpu_setShadowProbeCount(GPUContext* context, Scene* scene, Accel* accel, uint32_t probeCount);
+// secondary rays below the roulette threshold (0 disables it) are dropped at random, and with isFresnelSampling
+// refracting materials trace either the reflected or the refracted ray, see RaytracerSampling
+void gpu_setRayTermination(GPUContext* context, float rouletteThreshold, bool isFresnelSampling);
+// marks the elements [first, first + count) of a scene or acceleration structure array as modified,
+// they are uploaded before the next frame is rendered
+void gpu_markSceneDirty(GPUContext* context, SceneSyncArray array, uint32_t first, uint32_t count);
+void gpu_renderScene(GPUContext* context, Scene* scene, Accel* accel, Image* image);
+// enqueues the kernel for the rows [rowBegin, rowBegin + rowCount) without waiting for it,
+// the rows are copied into the same rows of the image, if it's not NULL
+bool gpu_enqueueRows(GPUContext* context, Scene* scene, Accel* accel, uint32_t rowBegin, uint32_t rowCount, Image* image);
+// waits for the rows of gpu_enqueueRows and updates the kernel time
+void gpu_finishRows(GPUContext* context);
+// draws the texture to the window, the rows [rowBegin, rowBegin + rowCount) of the image are uploaded first,
+// does nothing for headless contexts
+void gpu_drawFrame(GPUContext* context, Image* image, uint32_t rowBegin, uint32_t rowCount);
+// changes the render resolution to width x height, the result is scaled to the window
+bool gpu_resizeRenderTarget(GPUContext* context, Scene* scene, Accel* accel, uint32_t width, uint32_t height);
+// the mode is used by the following frames, the history is only kept for frames rendered as a whole
+bool gpu_setReprojectionMode(GPUContext* context, ReprojectionMode mode);
+// filters the following frames with the denoise kernel, rows of a split frame stay noisy
+bool gpu_setDenoising(GPUContext* context, bool enabled);
+// draws new pixel seeds from rand(), so a frame can be rendered again with the same noise after srand()
+bool gpu_resetSeeds(GPUContext* context, Scene* scene);
+// copies the counters of the last frame into stats, which has to hold width * height entries of the camera
+bool gpu_readTraversalStats(GPUContext* context, Scene* scene, TraversalStats* stats);
 void gpu_destroyContext(GPUContext* context);
 
 // -------------------- OPENGL --------------------
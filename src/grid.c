@@ -0,0 +1,319 @@
+#include "grid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memstats.h"
+#include "utils/math.h"
+
+// primitives this close to a cell border in cells are also tested against the neighbor cell
+#define GRID_CELL_MARGIN 0.001f
+
+typedef struct {
+	BoundingBox boundingBox;
+	uint32_t resolution[3];
+	uint32_t cellCount;
+	// the references of a cell are its spheres followed by its triangles, cellOffsets has cellCount + 1 entries
+	uint32_t* cellOffsets;
+	uint32_t* cellSphereCounts;
+	uint32_t* references;
+	// the references of all cells before a corner along every axis, to count the references of a range of cells
+	uint32_t* referenceSums;
+} Grid;
+
+// a node and its range of cells, the maximums are exclusive
+typedef struct {
+	int32_t nodeId;
+	uint32_t min[3];
+	uint32_t max[3];
+} GridPendingNode;
+
+static float grid_getAxis(Vec3 vector, uint32_t axis) {
+	return axis == 0 ? vector.x : axis == 1 ? vector.y : vector.z;
+}
+
+static uint32_t grid_getCellIndex(Grid* grid, uint32_t x, uint32_t y, uint32_t z) {
+	return (z * grid->resolution[1] + y) * grid->resolution[0] + x;
+}
+
+static uint32_t grid_getSumIndex(Grid* grid, uint32_t x, uint32_t y, uint32_t z) {
+	return (z * (grid->resolution[1] + 1) + y) * (grid->resolution[0] + 1) + x;
+}
+
+// the border between the cells i - 1 and i along the axis, the same for both cells, so there are no gaps between them
+static float grid_getBorder(Grid* grid, uint32_t axis, uint32_t i) {
+	float min = grid_getAxis(grid->boundingBox.bottomLeftFrontCorner, axis);
+	float max = grid_getAxis(grid->boundingBox.topRightBackCorner, axis);
+	if (i == grid->resolution[axis]) {
+		return max;
+	}
+	return min + (max - min) * ((float) i / (float) grid->resolution[axis]);
+}
+
+static BoundingBox grid_getRangeBox(Grid* grid, const uint32_t* min, const uint32_t* max) {
+	return (BoundingBox) {
+		{ { grid_getBorder(grid, 0, min[0]), grid_getBorder(grid, 1, min[1]), grid_getBorder(grid, 2, min[2]) } },
+		{ { grid_getBorder(grid, 0, max[0]), grid_getBorder(grid, 1, max[1]), grid_getBorder(grid, 2, max[2]) } }
+	};
+}
+
+// the cells, that the box may overlap
+static void grid_getCellRange(Grid* grid, Vec3 boxMin, Vec3 boxMax, uint32_t* min, uint32_t* max) {
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		float gridMin = grid_getAxis(grid->boundingBox.bottomLeftFrontCorner, axis);
+		float extent = grid_getAxis(grid->boundingBox.topRightBackCorner, axis) - gridMin;
+		float scale = extent > 0.0f ? (float) grid->resolution[axis] / extent : 0.0f;
+		float first = floorf((grid_getAxis(boxMin, axis) - gridMin) * scale - GRID_CELL_MARGIN);
+		float last = floorf((grid_getAxis(boxMax, axis) - gridMin) * scale + GRID_CELL_MARGIN);
+		float lastCell = (float) (grid->resolution[axis] - 1);
+		min[axis] = (uint32_t) math_clamp(first, 0.0f, lastCell);
+		max[axis] = (uint32_t) math_clamp(last, 0.0f, lastCell) + 1;
+	}
+}
+
+/*
+ * Calls the exact overlap test of the primitive for every cell in the range of its box, and counts (references == NULL)
+ * or adds (references != NULL) the primitive to the overlapped cells, cellCounts is advanced in both cases.
+ */
+static void grid_addPrimitive(Grid* grid, Scene* scene, uint32_t index, bool isTriangle, uint32_t* cellCounts,
+	uint32_t* references) {
+	Vec3 boxMin;
+	Vec3 boxMax;
+	if (isTriangle) {
+		Triangle* triangle = &scene->triangles[index];
+		boxMin = (Vec3) { { MIN(MIN(triangle->v0.x, triangle->v1.x), triangle->v2.x),
+			MIN(MIN(triangle->v0.y, triangle->v1.y), triangle->v2.y), MIN(MIN(triangle->v0.z, triangle->v1.z), triangle->v2.z) } };
+		boxMax = (Vec3) { { MAX(MAX(triangle->v0.x, triangle->v1.x), triangle->v2.x),
+			MAX(MAX(triangle->v0.y, triangle->v1.y), triangle->v2.y), MAX(MAX(triangle->v0.z, triangle->v1.z), triangle->v2.z) } };
+	} else {
+		Sphere* sphere = &scene->spheres[index];
+		Vec3 radius = { { sphere->radius, sphere->radius, sphere->radius } };
+		boxMin = vec3_sub(sphere->position, radius);
+		boxMax = vec3_add(sphere->position, radius);
+	}
+	uint32_t min[3];
+	uint32_t max[3];
+	grid_getCellRange(grid, boxMin, boxMax, min, max);
+	for (uint32_t z = min[2]; z < max[2]; z++) {
+		for (uint32_t y = min[1]; y < max[1]; y++) {
+			for (uint32_t x = min[0]; x < max[0]; x++) {
+				uint32_t cellMin[3] = { x, y, z };
+				uint32_t cellMax[3] = { x + 1, y + 1, z + 1 };
+				BoundingBox cellBox = grid_getRangeBox(grid, cellMin, cellMax);
+				bool overlaps = isTriangle
+					? accel_intersectTriangle(&scene->triangles[index], cellBox)
+					: accel_intersectSphere(&scene->spheres[index], cellBox);
+				if (overlaps) {
+					uint32_t cell = grid_getCellIndex(grid, x, y, z);
+					if (references) {
+						references[cellCounts[cell]] = index;
+					}
+					cellCounts[cell]++;
+				}
+			}
+		}
+	}
+}
+
+static void grid_addPrimitives(Grid* grid, Scene* scene, uint32_t* cellCounts, uint32_t* references) {
+	for (uint32_t i = 0; i < scene->sphereCount; i++) {
+		grid_addPrimitive(grid, scene, i, false, cellCounts, references);
+	}
+	if (!references) {
+		memcpy(grid->cellSphereCounts, cellCounts, sizeof(uint32_t) * grid->cellCount);
+	}
+	for (uint32_t i = 0; i < scene->triangleCount; i++) {
+		grid_addPrimitive(grid, scene, i, true, cellCounts, references);
+	}
+}
+
+static uint32_t grid_getRangeReferenceCount(Grid* grid, const uint32_t* min, const uint32_t* max) {
+	uint32_t count = 0;
+	// inclusion-exclusion over the 8 corners, the unsigned overflows cancel out
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		uint32_t x = corner & 1 ? max[0] : min[0];
+		uint32_t y = corner & 2 ? max[1] : min[1];
+		uint32_t z = corner & 4 ? max[2] : min[2];
+		uint32_t sum = grid->referenceSums[grid_getSumIndex(grid, x, y, z)];
+		count += (((corner & 1) + ((corner >> 1) & 1) + ((corner >> 2) & 1)) % 2 == 1) ? sum : -sum;
+	}
+	return count;
+}
+
+static void grid_initResolution(Grid* grid, Scene* scene) {
+	Vec3 extent = vec3_sub(grid->boundingBox.topRightBackCorner, grid->boundingBox.bottomLeftFrontCorner);
+	float maxExtent = MAX(MAX(extent.x, extent.y), extent.z);
+	// flat scenes get a volume from their largest extent
+	float minExtent = maxExtent * 0.001f;
+	float volume = MAX(extent.x, minExtent) * MAX(extent.y, minExtent) * MAX(extent.z, minExtent);
+	float primitiveCount = (float) (scene->sphereCount + scene->triangleCount);
+	float cellSize = cbrtf(volume / (GRID_CELLS_PER_PRIMITIVE * MAX(primitiveCount, 1.0f)));
+	grid->cellCount = 1;
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		float cells = cellSize > 0.0f ? ceilf(grid_getAxis(extent, axis) / cellSize) : 1.0f;
+		grid->resolution[axis] = (uint32_t) math_clamp(cells, 1.0f, (float) GRID_MAX_RESOLUTION);
+		grid->cellCount *= grid->resolution[axis];
+	}
+}
+
+static bool grid_createCells(Grid* grid, Scene* scene) {
+	uint32_t* cellCounts = calloc(grid->cellCount + 1, sizeof(uint32_t));
+	grid->cellOffsets = malloc(sizeof(uint32_t) * (grid->cellCount + 1));
+	grid->cellSphereCounts = malloc(sizeof(uint32_t) * grid->cellCount);
+	grid->referenceSums = calloc((size_t) (grid->resolution[0] + 1) * (grid->resolution[1] + 1) * (grid->resolution[2] + 1),
+		sizeof(uint32_t));
+	if (!cellCounts || !grid->cellOffsets || !grid->cellSphereCounts || !grid->referenceSums) {
+		free(cellCounts);
+		return false;
+	}
+	grid_addPrimitives(grid, scene, cellCounts, NULL);
+
+	uint32_t referenceCount = 0;
+	for (uint32_t cell = 0; cell < grid->cellCount; cell++) {
+		grid->cellOffsets[cell] = referenceCount;
+		referenceCount += cellCounts[cell];
+		// from now on the next free reference of the cell
+		cellCounts[cell] = grid->cellOffsets[cell];
+	}
+	grid->cellOffsets[grid->cellCount] = referenceCount;
+	grid->references = malloc(sizeof(uint32_t) * MAX(referenceCount, 1));
+	if (!grid->references) {
+		free(cellCounts);
+		return false;
+	}
+	grid_addPrimitives(grid, scene, cellCounts, grid->references);
+	free(cellCounts);
+
+	for (uint32_t z = 0; z < grid->resolution[2]; z++) {
+		for (uint32_t y = 0; y < grid->resolution[1]; y++) {
+			for (uint32_t x = 0; x < grid->resolution[0]; x++) {
+				uint32_t cell = grid_getCellIndex(grid, x, y, z);
+				grid->referenceSums[grid_getSumIndex(grid, x + 1, y + 1, z + 1)] = grid->cellOffsets[cell + 1] - grid->cellOffsets[cell]
+					+ grid->referenceSums[grid_getSumIndex(grid, x, y + 1, z + 1)]
+					+ grid->referenceSums[grid_getSumIndex(grid, x + 1, y, z + 1)]
+					+ grid->referenceSums[grid_getSumIndex(grid, x + 1, y + 1, z)]
+					- grid->referenceSums[grid_getSumIndex(grid, x, y, z + 1)]
+					- grid->referenceSums[grid_getSumIndex(grid, x, y + 1, z)]
+					- grid->referenceSums[grid_getSumIndex(grid, x + 1, y, z)]
+					+ grid->referenceSums[grid_getSumIndex(grid, x, y, z)];
+			}
+		}
+	}
+	return true;
+}
+
+static void grid_destroyCells(Grid* grid) {
+	free(grid->cellOffsets);
+	free(grid->cellSphereCounts);
+	free(grid->references);
+	free(grid->referenceSums);
+}
+
+/*
+ * Halves the range of the pending node until both halves have references, returns false, if it is narrowed to a single
+ * cell or has no references at all. The node keeps the narrowed range.
+ */
+static bool grid_splitRange(Grid* grid, GridPendingNode* pending, GridPendingNode* low, GridPendingNode* high) {
+	if (grid_getRangeReferenceCount(grid, pending->min, pending->max) == 0) {
+		return false;
+	}
+	while (true) {
+		uint32_t axis = 0;
+		for (uint32_t i = 1; i < 3; i++) {
+			if (pending->max[i] - pending->min[i] > pending->max[axis] - pending->min[axis]) {
+				axis = i;
+			}
+		}
+		if (pending->max[axis] - pending->min[axis] == 1) {
+			return false;
+		}
+		*low = *pending;
+		*high = *pending;
+		low->max[axis] = high->min[axis] = (pending->min[axis] + pending->max[axis]) / 2;
+		bool lowUsed = grid_getRangeReferenceCount(grid, low->min, low->max) > 0;
+		bool highUsed = grid_getRangeReferenceCount(grid, high->min, high->max) > 0;
+		if (lowUsed && highUsed) {
+			return true;
+		}
+		memcpy(pending->min, lowUsed ? low->min : high->min, sizeof(pending->min));
+		memcpy(pending->max, lowUsed ? low->max : high->max, sizeof(pending->max));
+	}
+}
+
+static bool grid_createNodes(Grid* grid, Accel* accel) {
+	// every inner node has 2 children with references, so there are fewer nodes than twice the used cells
+	uint32_t usedCellCount = 0;
+	for (uint32_t cell = 0; cell < grid->cellCount; cell++) {
+		usedCellCount += grid->cellOffsets[cell + 1] > grid->cellOffsets[cell];
+	}
+	GridPendingNode* queue = malloc(sizeof(GridPendingNode) * (2 * usedCellCount + 1));
+	int32_t rootId = accel_addNodes(accel, 1);
+	if (!queue || rootId != 0) {
+		free(queue);
+		return false;
+	}
+	memstats_allocate(MEMSTATS_ACCEL_BUILD, sizeof(GridPendingNode) * (2 * usedCellCount + 1));
+
+	uint32_t queueStart = 0;
+	uint32_t queueEnd = 0;
+	queue[queueEnd++] = (GridPendingNode) { rootId, { 0, 0, 0 }, { grid->resolution[0], grid->resolution[1], grid->resolution[2] } };
+	bool success = true;
+	while (queueStart < queueEnd) {
+		GridPendingNode pending = queue[queueStart++];
+		GridPendingNode low;
+		GridPendingNode high;
+		bool isInner = grid_splitRange(grid, &pending, &low, &high);
+		accel->nodes[pending.nodeId].boundingBox = grid_getRangeBox(grid, pending.min, pending.max);
+		if (!isInner) {
+			uint32_t referenceCount = grid_getRangeReferenceCount(grid, pending.min, pending.max);
+			if (referenceCount > 0) {
+				uint32_t cell = grid_getCellIndex(grid, pending.min[0], pending.min[1], pending.min[2]);
+				accel_setLeaf(accel, pending.nodeId, &grid->references[grid->cellOffsets[cell]], grid->cellSphereCounts[cell],
+					referenceCount - grid->cellSphereCounts[cell]);
+			}
+			continue;
+		}
+		int32_t firstChildId = accel_addNodes(accel, 2);
+		if (firstChildId == NODE_INDEX_UNDEF) {
+			success = false;
+			break;
+		}
+		// the children fill the last slots
+		accel->nodes[pending.nodeId].childNodeIndexes[6] = firstChildId;
+		accel->nodes[pending.nodeId].childNodeIndexes[7] = firstChildId + 1;
+		low.nodeId = firstChildId;
+		high.nodeId = firstChildId + 1;
+		queue[queueEnd++] = low;
+		queue[queueEnd++] = high;
+	}
+	free(queue);
+	memstats_free(MEMSTATS_ACCEL_BUILD, sizeof(GridPendingNode) * (2 * usedCellCount + 1));
+	return success;
+}
+
+Accel* grid_buildFromScene(Scene* scene) {
+	Accel* accel = accel_create();
+	if (!accel) {
+		return NULL;
+	}
+	Grid grid = { 0 };
+	grid.boundingBox = accel_getSceneBoundingBox(scene);
+	grid_initResolution(&grid, scene);
+	bool success = grid_createCells(&grid, scene);
+	size_t cellBytes = sizeof(uint32_t) * ((size_t) grid.cellCount * 2 + 1 + (success ? grid.cellOffsets[grid.cellCount] : 0)
+		+ (size_t) (grid.resolution[0] + 1) * (grid.resolution[1] + 1) * (grid.resolution[2] + 1));
+	if (success) {
+		memstats_allocate(MEMSTATS_ACCEL_BUILD, cellBytes);
+		success = grid_createNodes(&grid, accel);
+		memstats_free(MEMSTATS_ACCEL_BUILD, cellBytes);
+	}
+	grid_destroyCells(&grid);
+	if (!success) {
+		printf("Couldn't allocate the grid build.\n");
+		accel_destroy(accel);
+		return NULL;
+	}
+	accel_finish(accel);
+	return accel;
+}
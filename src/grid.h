@@ -0,0 +1,20 @@
+#ifndef RAYTRACER_GRID_H
+#define RAYTRACER_GRID_H
+
+#include "scene.h"
+#include "accel.h"
+
+/*
+ * Uniform grid over the box of the scene, with about GRID_CELLS_PER_PRIMITIVE cubic cells per primitive and at most
+ * GRID_MAX_RESOLUTION cells along an axis. Every cell references the primitives, that overlap it.
+ * The cells aren't walked with a 3D-DDA but stored as leaves of a binary hierarchy in the node format of accel.h:
+ * a node halves its cells along the axis with the most of them, empty halves are dropped and nodes with a single
+ * child are merged into it, so rays skip empty space with a box test.
+ */
+
+#define GRID_CELLS_PER_PRIMITIVE 8.0f
+#define GRID_MAX_RESOLUTION 128
+
+Accel* grid_buildFromScene(Scene* scene);
+
+#endif //RAYTRACER_GRID_H
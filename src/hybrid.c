@@ -0,0 +1,196 @@
+#include "hybrid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "utils/math.h"
+
+#define HYBRID_TILE_SIZE 32
+#define HYBRID_INITIAL_CPU_SHARE 0.1f
+// only this part of the correction is applied per frame, so a single slow frame doesn't move all rows
+#define HYBRID_SMOOTHING 0.5f
+
+static double hybrid_now(void) {
+	return (double) SDL_GetPerformanceCounter() * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+static void hybrid_renderTiles(HybridRenderer* hybrid) {
+	Camera* camera = hybrid->scene->camera;
+	Image* target = hybrid->target;
+	while (true) {
+		uint32_t tile = (uint32_t) SDL_AtomicAdd(&hybrid->nextTile, 1);
+		if (tile >= hybrid->tileCount) {
+			return;
+		}
+		uint32_t beginX = (tile % hybrid->tileColumns) * HYBRID_TILE_SIZE;
+		uint32_t beginY = hybrid->rowBegin + (tile / hybrid->tileColumns) * HYBRID_TILE_SIZE;
+		uint32_t endX = MIN(beginX + HYBRID_TILE_SIZE, camera->width);
+		uint32_t endY = MIN(beginY + HYBRID_TILE_SIZE, camera->height);
+		for (uint32_t y = beginY; y < endY; y++) {
+			for (uint32_t x = beginX; x < endX; x++) {
+				seed128bit* seed = &hybrid->seeds[y * camera->width + x];
+				Vec3 color = raytracer_renderPixel(hybrid->scene, hybrid->accel, &hybrid->sampling, x, y, seed, NULL);
+				target->buffer[y * target->width + x] = raytracer_packColor(color);
+			}
+		}
+	}
+}
+
+static int hybrid_work(void* data) {
+	HybridRenderer* hybrid = data;
+	while (true) {
+		SDL_SemWait(hybrid->frameStart);
+		if (SDL_AtomicGet(&hybrid->isStopping)) {
+			return 0;
+		}
+		hybrid_renderTiles(hybrid);
+		SDL_SemPost(hybrid->frameDone);
+	}
+}
+
+static bool hybrid_reserveSeeds(HybridRenderer* hybrid, uint32_t pixelCount) {
+	if (pixelCount <= hybrid->seedCapacity) {
+		return true;
+	}
+	seed128bit* seeds = realloc(hybrid->seeds, sizeof(seed128bit) * pixelCount);
+	if (!seeds) {
+		return false;
+	}
+	// the seeds are created like the ones of the kernel
+	for (uint32_t i = hybrid->seedCapacity; i < pixelCount; i++) {
+		seeds[i].x = (uint64_t) rand();
+		seeds[i].y = (uint64_t) rand();
+	}
+	hybrid->seeds = seeds;
+	hybrid->seedCapacity = pixelCount;
+	return true;
+}
+
+// the CPU rows need a target without a read back, which has to match the resolution
+static Image* hybrid_getFrame(HybridRenderer* hybrid, uint32_t width, uint32_t height) {
+	if (hybrid->frame && (hybrid->frame->width != width || hybrid->frame->height != height)) {
+		image_destroy(hybrid->frame);
+		hybrid->frame = NULL;
+	}
+	if (!hybrid->frame) {
+		hybrid->frame = image_create(width, height);
+	}
+	return hybrid->frame;
+}
+
+static void hybrid_rebalance(HybridRenderer* hybrid, uint32_t gpuRows) {
+	if (hybrid->cpuRows == 0 || gpuRows == 0 || hybrid->cpuTime <= 0.0 || hybrid->gpuTime <= 0.0) {
+		return;
+	}
+	double cpuSpeed = (double) hybrid->cpuRows / hybrid->cpuTime;
+	double gpuSpeed = (double) gpuRows / hybrid->gpuTime;
+	float idealShare = (float) (cpuSpeed / (cpuSpeed + gpuSpeed));
+	hybrid->cpuShare += (idealShare - hybrid->cpuShare) * HYBRID_SMOOTHING;
+}
+
+HybridRenderer* hybrid_create(uint32_t threadCount) {
+	HybridRenderer* hybrid = calloc(1, sizeof(HybridRenderer));
+	if (!hybrid) {
+		return NULL;
+	}
+	hybrid->cpuShare = HYBRID_INITIAL_CPU_SHARE;
+	hybrid->frameStart = SDL_CreateSemaphore(0);
+	hybrid->frameDone = SDL_CreateSemaphore(0);
+	hybrid->threads = malloc(sizeof(SDL_Thread*) * MAX(threadCount, 1));
+	if (!hybrid->frameStart || !hybrid->frameDone || !hybrid->threads) {
+		hybrid_destroy(hybrid);
+		return NULL;
+	}
+	SDL_AtomicSet(&hybrid->isStopping, 0);
+	for (uint32_t i = 0; i < threadCount; i++) {
+		SDL_Thread* thread = SDL_CreateThread(hybrid_work, "hybrid worker", hybrid);
+		if (!thread) {
+			printf("Couldn't create the worker thread %u.\n", i);
+			break;
+		}
+		hybrid->threads[hybrid->threadCount++] = thread;
+	}
+	return hybrid;
+}
+
+bool hybrid_renderScene(HybridRenderer* hybrid, GPUContext* context, Scene* scene, Accel* accel, Image* image) {
+	Camera* camera = scene->camera;
+	Image* target = image ? image : hybrid_getFrame(hybrid, camera->width, camera->height);
+	if (!target || !hybrid_reserveSeeds(hybrid, camera->width * camera->height)) {
+		printf("Couldn't allocate the CPU pixels.\n");
+		return false;
+	}
+
+	// both sides keep a row, so that their speed is still measured
+	uint32_t minRows = camera->height > 1 ? 1 : 0;
+	uint32_t cpuRows = (uint32_t) (hybrid->cpuShare * (float) camera->height + 0.5f);
+	cpuRows = MIN(MAX(cpuRows, minRows), camera->height - minRows);
+	uint32_t gpuRows = camera->height - cpuRows;
+
+	TRACE_BEGIN("hybrid frame");
+	// the device starts first, the CPU rows are rendered while it works
+	bool success = gpuRows == 0 || gpu_enqueueRows(context, scene, accel, 0, gpuRows, image);
+
+	hybrid->scene = scene;
+	hybrid->accel = accel;
+	hybrid->target = target;
+	raytracer_initSampling(&hybrid->sampling, camera, context->cl.raysPerPixel, context->cl.maxRayDepth, context->cl.shadowRayCount);
+	hybrid->sampling.shadowProbeCount = context->cl.shadowProbeCount;
+	hybrid->sampling.rouletteThreshold = context->cl.rouletteThreshold;
+	hybrid->sampling.isFresnelSampling = context->cl.isFresnelSampling;
+	hybrid->rowBegin = gpuRows;
+	hybrid->tileColumns = (camera->width + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE;
+	hybrid->tileCount = hybrid->tileColumns * ((cpuRows + HYBRID_TILE_SIZE - 1) / HYBRID_TILE_SIZE);
+	SDL_AtomicSet(&hybrid->nextTile, 0);
+
+	TRACE_BEGIN("cpu tiles");
+	double start = hybrid_now();
+	for (uint32_t i = 0; i < hybrid->threadCount; i++) {
+		SDL_SemPost(hybrid->frameStart);
+	}
+	hybrid_renderTiles(hybrid);
+	for (uint32_t i = 0; i < hybrid->threadCount; i++) {
+		SDL_SemWait(hybrid->frameDone);
+	}
+	hybrid->cpuTime = hybrid_now() - start;
+	TRACE_END();
+
+	hybrid->gpuTime = 0.0;
+	if (success && gpuRows > 0) {
+		gpu_finishRows(context);
+		hybrid->gpuTime = context->cl.kernelTime;
+	}
+	gpu_drawFrame(context, target, gpuRows, cpuRows);
+	TRACE_END();
+
+	hybrid->cpuRows = cpuRows;
+	if (success) {
+		hybrid_rebalance(hybrid, gpuRows);
+	}
+	return success;
+}
+
+void hybrid_destroy(HybridRenderer* hybrid) {
+	if (hybrid) {
+		SDL_AtomicSet(&hybrid->isStopping, 1);
+		for (uint32_t i = 0; i < hybrid->threadCount; i++) {
+			SDL_SemPost(hybrid->frameStart);
+		}
+		for (uint32_t i = 0; i < hybrid->threadCount; i++) {
+			SDL_WaitThread(hybrid->threads[i], NULL);
+		}
+		if (hybrid->frameStart) {
+			SDL_DestroySemaphore(hybrid->frameStart);
+		}
+		if (hybrid->frameDone) {
+			SDL_DestroySemaphore(hybrid->frameDone);
+		}
+		if (hybrid->frame) {
+			image_destroy(hybrid->frame);
+		}
+		free(hybrid->threads);
+		free(hybrid->seeds);
+		free(hybrid);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef RAYTRACER_HYBRID_H
+#define RAYTRACER_HYBRID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#include "gpu.h"
+#include "raytracer.h"
+
+/*
+ * Renders the bottom rows of every frame with the CPU tracer, while the OpenCL device renders the top rows.
+ * The CPU rows are split into tiles, which the worker threads and the calling thread take one after another.
+ * The split follows the pixels per ms both sides reached in the last frames, so that they finish at about the same time.
+ * The CPU pixels use the samples, shading and random numbers of the kernel, see raytracer_renderPixel.
+ */
+
+typedef struct {
+	SDL_Thread** threads;
+	uint32_t threadCount;
+	// posted once per worker for every frame
+	SDL_sem* frameStart;
+	SDL_sem* frameDone;
+	SDL_atomic_t nextTile;
+	SDL_atomic_t isStopping;
+
+	// the frame the tiles belong to, only written while the workers wait
+	Scene* scene;
+	Accel* accel;
+	Image* target;
+	RaytracerSampling sampling;
+	uint32_t rowBegin;
+	uint32_t tileColumns;
+	uint32_t tileCount;
+
+	// the CPU pixels keep their seed over the frames, like the seed buffer of the kernel
+	seed128bit* seeds;
+	uint32_t seedCapacity;
+	// holds the CPU rows, if the caller doesn't read the frame back
+	Image* frame;
+
+	// part of the rows rendered on the CPU
+	float cpuShare;
+	uint32_t cpuRows;
+	// the time both sides took in the last frame in ms
+	double cpuTime;
+	double gpuTime;
+} HybridRenderer;
+
+// threadCount is the number of worker threads, the calling thread renders tiles as well
+HybridRenderer* hybrid_create(uint32_t threadCount);
+// renders and draws a frame like gpu_renderScene, the image may be NULL
+bool hybrid_renderScene(HybridRenderer* hybrid, GPUContext* context, Scene* scene, Accel* accel, Image* image);
+void hybrid_destroy(HybridRenderer* hybrid);
+
+#endif //RAYTRACER_HYBRID_H
@@ -0,0 +1,350 @@
+#ifdef __linux__
+// for syscall
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utils/random.h"
+#include "utils/simd.h"
+#include "raytracer.h"
+
+/*
+ * Measures the single primitive intersection tests on fixed datasets.
+ * Every dataset has a controlled share of hits, so the branch behavior of the tests can be compared as well.
+ * Run with --help for the options.
+ */
+
+#define INTERSECTBENCH_HIT_RATE_COUNT 5
+// the rays start this far away from the primitive
+#define INTERSECTBENCH_RAY_DISTANCE 30.0f
+
+typedef enum {
+	INTERSECTBENCH_BOX,
+	INTERSECTBENCH_SPHERE,
+	INTERSECTBENCH_TRIANGLE
+} IntersectPrimitive;
+
+typedef struct {
+	uint32_t count;
+	Ray* rays;
+	BoundingBox* boxes;
+	Sphere* spheres;
+	Triangle* triangles;
+} IntersectDataset;
+
+// tests ray i against primitive i, returns the hit count and adds the hit distances to distanceSum
+typedef uint32_t (*IntersectTest)(IntersectDataset* dataset, float* distanceSum);
+
+typedef struct {
+	const char* name;
+	IntersectPrimitive primitive;
+	IntersectTest test;
+} IntersectVariant;
+
+static uint32_t intersectbench_testBoxes(IntersectDataset* dataset, float* distanceSum) {
+	uint32_t hitCount = 0;
+	for (uint32_t i = 0; i < dataset->count; i++) {
+		hitCount += raytracer_intersectBoundingBox(&dataset->rays[i], &dataset->boxes[i]);
+	}
+	(void) distanceSum;
+	return hitCount;
+}
+
+// the slab test with SSE and the fast reciprocal of the direction, edge cases may differ from the exact test
+static uint32_t intersectbench_testBoxesRcp(IntersectDataset* dataset, float* distanceSum) {
+	uint32_t hitCount = 0;
+	for (uint32_t i = 0; i < dataset->count; i++) {
+		Ray* ray = &dataset->rays[i];
+		BoundingBox* box = &dataset->boxes[i];
+		Vec4 origin = vec4_fromVec3(ray->origin, 0.0f);
+		Vec4 inverseDirection = vec4_rcpFast(vec4_fromVec3(ray->direction, 1.0f));
+		Vec4 t0 = vec4_mul(vec4_sub(vec4_fromVec3(box->bottomLeftFrontCorner, 0.0f), origin), inverseDirection);
+		Vec4 t1 = vec4_mul(vec4_sub(vec4_fromVec3(box->topRightBackCorner, 0.0f), origin), inverseDirection);
+		hitCount += vec4_maxXYZ(vec4_min(t0, t1)) <= vec4_minXYZ(vec4_max(t0, t1));
+	}
+	(void) distanceSum;
+	return hitCount;
+}
+
+static uint32_t intersectbench_testSpheres(IntersectDataset* dataset, float* distanceSum) {
+	uint32_t hitCount = 0;
+	for (uint32_t i = 0; i < dataset->count; i++) {
+		float hitDistance;
+		Vec3 intersectionNormal;
+		if (raytracer_intersectSphere(&dataset->spheres[i], &dataset->rays[i], &hitDistance, &intersectionNormal)) {
+			*distanceSum += hitDistance;
+			hitCount++;
+		}
+	}
+	return hitCount;
+}
+
+static uint32_t intersectbench_testTriangles(IntersectDataset* dataset, float* distanceSum) {
+	uint32_t hitCount = 0;
+	for (uint32_t i = 0; i < dataset->count; i++) {
+		float hitDistance;
+		Vec3 intersectionNormal;
+		if (raytracer_intersectTriangle(&dataset->triangles[i], &dataset->rays[i], &hitDistance, &intersectionNormal)) {
+			*distanceSum += hitDistance;
+			hitCount++;
+		}
+	}
+	return hitCount;
+}
+
+// new implementations of a test are added here, so they are measured on the same datasets
+static const IntersectVariant intersectbench_variants[] = {
+	{ "box", INTERSECTBENCH_BOX, intersectbench_testBoxes },
+	{ "box-rcp", INTERSECTBENCH_BOX, intersectbench_testBoxesRcp },
+	{ "sphere", INTERSECTBENCH_SPHERE, intersectbench_testSpheres },
+	{ "triangle", INTERSECTBENCH_TRIANGLE, intersectbench_testTriangles }
+};
+
+static const float intersectbench_hitRates[INTERSECTBENCH_HIT_RATE_COUNT] = { 0.0f, 0.25f, 0.5f, 0.75f, 1.0f };
+
+// xorshift128+, independent of rand(), so the datasets are the same on every platform
+static float intersectbench_unilateral(seed128bit* seed) {
+	uint64_t x = seed->x;
+	uint64_t y = seed->y;
+	seed->x = y;
+	x ^= x << 23;
+	seed->y = x ^ y ^ (x >> 17) ^ (y >> 26);
+	return (float) ((seed->y + y) >> 40) / (float) (1 << 24);
+}
+
+static float intersectbench_range(seed128bit* seed, float min, float max) {
+	return min + (max - min) * intersectbench_unilateral(seed);
+}
+
+static Vec3 intersectbench_direction(seed128bit* seed) {
+	Vec3 direction;
+	do {
+		direction = (Vec3) { { intersectbench_range(seed, -1.0f, 1.0f), intersectbench_range(seed, -1.0f, 1.0f),
+			intersectbench_range(seed, -1.0f, 1.0f) } };
+	} while (vec3_dot(direction, direction) < 0.01f);
+	return vec3_norm(direction);
+}
+
+// a ray with the given direction, that passes the center at the given distance
+static Ray intersectbench_createRay(seed128bit* seed, Vec3 center, Vec3 direction, float distance) {
+	Vec3 perpendicular = vec3_norm(vec3_cross(direction, intersectbench_direction(seed)));
+	Vec3 target = vec3_add(center, vec3_mul(perpendicular, distance));
+	Ray ray;
+	ray.origin = vec3_sub(target, vec3_mul(direction, INTERSECTBENCH_RAY_DISTANCE));
+	ray.direction = direction;
+	return ray;
+}
+
+/*
+ * Hits pass the primitive well inside, misses well outside, so the share of hits is exact
+ * and doesn't depend on the precision of the tests.
+ */
+static void intersectbench_fillDataset(IntersectDataset* dataset, IntersectPrimitive primitive, float hitRate, uint64_t seedValue) {
+	seed128bit seed = { seedValue * 0x9E3779B97F4A7C15ULL + 1, 0x2545F4914F6CDD1DULL };
+	for (uint32_t i = 0; i < dataset->count; i++) {
+		bool isHit = intersectbench_unilateral(&seed) < hitRate;
+		Vec3 center = { { intersectbench_range(&seed, -10.0f, 10.0f), intersectbench_range(&seed, -10.0f, 10.0f),
+			intersectbench_range(&seed, -10.0f, 10.0f) } };
+		float size = intersectbench_range(&seed, 0.5f, 2.0f);
+		Vec3 direction = intersectbench_direction(&seed);
+
+		switch (primitive) {
+		case INTERSECTBENCH_BOX:
+			dataset->boxes[i].bottomLeftFrontCorner = vec3_offset(center, -size);
+			dataset->boxes[i].topRightBackCorner = vec3_offset(center, size);
+			// the inscribed sphere has radius size, the circumscribed one size * sqrt(3)
+			dataset->rays[i] = intersectbench_createRay(&seed, center, direction,
+				isHit ? intersectbench_range(&seed, 0.0f, 0.9f) * size : intersectbench_range(&seed, 1.8f, 3.0f) * size);
+			break;
+		case INTERSECTBENCH_SPHERE:
+			dataset->spheres[i].materialIndex = 1;
+			dataset->spheres[i].position = center;
+			dataset->spheres[i].radius = size;
+			dataset->rays[i] = intersectbench_createRay(&seed, center, direction,
+				isHit ? intersectbench_range(&seed, 0.0f, 0.9f) * size : intersectbench_range(&seed, 1.1f, 2.0f) * size);
+			break;
+		case INTERSECTBENCH_TRIANGLE: {
+			Triangle* triangle = &dataset->triangles[i];
+			triangle->materialIndex = 1;
+			triangle->v0 = vec3_add(center, vec3_mul(intersectbench_direction(&seed), size));
+			triangle->v1 = vec3_add(center, vec3_mul(intersectbench_direction(&seed), size));
+			triangle->v2 = vec3_add(center, vec3_mul(intersectbench_direction(&seed), size));
+			Vec3 edge1 = vec3_sub(triangle->v1, triangle->v0);
+			Vec3 edge2 = vec3_sub(triangle->v2, triangle->v0);
+			Vec3 normal = vec3_norm(vec3_cross(edge1, edge2));
+			// barycentric coordinates inside or clearly outside of the triangle
+			float u = intersectbench_range(&seed, 0.1f, 0.8f);
+			float v = intersectbench_range(&seed, 0.1f, 0.9f - u);
+			if (!isHit) {
+				u += 1.0f;
+			}
+			Vec3 target = vec3_add(triangle->v0, vec3_add(vec3_mul(edge1, u), vec3_mul(edge2, v)));
+			// avoid grazing rays, which the test rejects as parallel
+			direction = vec3_norm(vec3_add(vec3_mul(normal, -1.0f), vec3_mul(direction, 0.5f)));
+			dataset->rays[i].origin = vec3_sub(target, vec3_mul(direction, INTERSECTBENCH_RAY_DISTANCE));
+			dataset->rays[i].direction = direction;
+			break;
+		}
+		}
+	}
+}
+
+typedef struct {
+	bool isAvailable;
+#ifdef __linux__
+	int fd;
+#endif
+} BranchMissCounter;
+
+static BranchMissCounter intersectbench_openCounter(void) {
+	BranchMissCounter counter = { 0 };
+#ifdef __linux__
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counter.fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	// fails without hardware counters, e.g. in VMs or with a restrictive perf_event_paranoid
+	counter.isAvailable = counter.fd >= 0;
+#endif
+	return counter;
+}
+
+static void intersectbench_startCounter(BranchMissCounter* counter) {
+#ifdef __linux__
+	if (counter->isAvailable) {
+		ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void) counter;
+#endif
+}
+
+static uint64_t intersectbench_stopCounter(BranchMissCounter* counter) {
+	uint64_t value = 0;
+#ifdef __linux__
+	if (counter->isAvailable) {
+		ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter->fd, &value, sizeof(value)) != sizeof(value)) {
+			value = 0;
+		}
+	}
+#else
+	(void) counter;
+#endif
+	return value;
+}
+
+static void intersectbench_closeCounter(BranchMissCounter* counter) {
+#ifdef __linux__
+	if (counter->isAvailable) {
+		close(counter->fd);
+	}
+#else
+	(void) counter;
+#endif
+}
+
+static void intersectbench_printUsage(const char* program) {
+	printf("Usage: %s [options]\n"
+		"  --count <pairs>         ray/primitive pairs per dataset (default 4096)\n"
+		"  --iterations <count>    passes over every dataset (default 2000)\n"
+		"  --seed <seed>           seed of the datasets (default 1)\n", program);
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t count = 4096;
+	uint32_t iterations = 2000;
+	uint64_t seed = 1;
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			intersectbench_printUsage(argv[0]);
+			return 1;
+		}
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], "--count") == 0) {
+			count = (uint32_t) strtoul(value, NULL, 10);
+		} else if (strcmp(argv[i - 1], "--iterations") == 0) {
+			iterations = (uint32_t) strtoul(value, NULL, 10);
+		} else if (strcmp(argv[i - 1], "--seed") == 0) {
+			seed = strtoull(value, NULL, 10);
+		} else {
+			intersectbench_printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (count == 0 || iterations == 0) {
+		intersectbench_printUsage(argv[0]);
+		return 1;
+	}
+
+	IntersectDataset dataset;
+	dataset.count = count;
+	dataset.rays = malloc(sizeof(Ray) * count);
+	dataset.boxes = malloc(sizeof(BoundingBox) * count);
+	dataset.spheres = malloc(sizeof(Sphere) * count);
+	dataset.triangles = malloc(sizeof(Triangle) * count);
+	if (!dataset.rays || !dataset.boxes || !dataset.spheres || !dataset.triangles) {
+		printf("Couldn't allocate the datasets.\n");
+		return 2;
+	}
+
+	BranchMissCounter counter = intersectbench_openCounter();
+	if (!counter.isAvailable) {
+		printf("Branch misses are not available on this system.\n");
+	}
+	printf("%-10s %8s %8s %10s %10s %14s\n", "test", "target", "hits", "ns/test", "Mtests/s", "misses/test");
+
+	float distanceSum = 0.0f;
+	uint64_t frequency = SDL_GetPerformanceFrequency();
+	uint32_t variantCount = sizeof(intersectbench_variants) / sizeof(intersectbench_variants[0]);
+	for (uint32_t i = 0; i < variantCount; i++) {
+		const IntersectVariant* variant = &intersectbench_variants[i];
+		for (uint32_t j = 0; j < INTERSECTBENCH_HIT_RATE_COUNT; j++) {
+			intersectbench_fillDataset(&dataset, variant->primitive, intersectbench_hitRates[j], seed);
+			// warm up the caches and the branch predictor
+			uint32_t hitCount = variant->test(&dataset, &distanceSum);
+
+			intersectbench_startCounter(&counter);
+			uint64_t start = SDL_GetPerformanceCounter();
+			for (uint32_t k = 0; k < iterations; k++) {
+				variant->test(&dataset, &distanceSum);
+			}
+			uint64_t end = SDL_GetPerformanceCounter();
+			uint64_t branchMisses = intersectbench_stopCounter(&counter);
+
+			double tests = (double) count * (double) iterations;
+			double ns = (double) (end - start) * 1000000000.0 / (double) frequency;
+			printf("%-10s %8.2f %8.2f %10.2f %10.1f ", variant->name, (double) intersectbench_hitRates[j],
+				(double) hitCount / (double) count, ns / tests, tests / (ns / 1000.0));
+			if (counter.isAvailable) {
+				printf("%14.3f\n", (double) branchMisses / tests);
+			} else {
+				printf("%14s\n", "n/a");
+			}
+		}
+	}
+	// the sum is printed, so the tests can't be optimized away
+	printf("Checksum: %f\n", (double) distanceSum);
+
+	intersectbench_closeCounter(&counter);
+	free(dataset.rays);
+	free(dataset.boxes);
+	free(dataset.spheres);
+	free(dataset.triangles);
+	return 0;
+}
@@ -1,5 +1,3 @@
-#define MAX_NODE_STACK_SIZE 250
-
 #ifdef USE_SHARED_MEMORY_CAMERA
 	#define CAMERA_QUALIFIER __local
 #else
@@ -36,16 +34,75 @@
 #define POINTLIGHTS_QUALIFIER __global
 #endif
 
-#ifdef USE_SHARED_MEMORY_OCTREENODES
-#define OCTREENODES_QUALIFIER __local
+#ifdef USE_SHARED_MEMORY_ACCELNODES
+#define ACCELNODES_QUALIFIER __local
+#else
+#define ACCELNODES_QUALIFIER __global
+#endif
+
+#ifdef USE_SHARED_MEMORY_ACCELINDEXES
+#define ACCELINDEX_QUALIFIER __local
+#else
+#define ACCELINDEX_QUALIFIER __global
+#endif
+
+// if the hierarchy doesn't fit into local memory, only its first SHARED_ACCELNODES_COUNT nodes are staged
+// the nodes are sorted breadth first, so these are the top levels, which every ray traverses
+#ifdef SHARED_ACCELNODES_COUNT
+#define SHARED_ACCELNODES_PARAM , __local AccelNode* sharedAccelNodes
+#define SHARED_ACCELNODES_ARG , sharedAccelNodes
+#define LOAD_ACCEL_NODE(index) ((index) < SHARED_ACCELNODES_COUNT ? sharedAccelNodes[index] : accelNodes[index])
+#else
+#define SHARED_ACCELNODES_PARAM
+#define SHARED_ACCELNODES_ARG
+#define LOAD_ACCEL_NODE(index) (accelNodes[index])
+#endif
+
+// per pixel counters of the traversal, the layout has to match TraversalStats in traversalstats.h
+#ifdef TRAVERSAL_STATS
+#define TRAVERSAL_STATS_PARAM , TraversalStats* stats
+#define TRAVERSAL_STATS_ARG , stats
+#define TRAVERSAL_STATS_ADD(counter, value) (stats->counter += (value))
 #else
-#define OCTREENODES_QUALIFIER __global
+#define TRAVERSAL_STATS_PARAM
+#define TRAVERSAL_STATS_ARG
+#define TRAVERSAL_STATS_ADD(counter, value)
 #endif
 
-#ifdef USE_SHARED_MEMORY_OCTREEINDEXES
-#define OCTREEINDEX_QUALIFIER __local
+// scene specialization, see gpu_createKernelConfig
+#ifdef SCENE_PLANE_COUNT
+#define PLANE_COUNT(runtimeCount) SCENE_PLANE_COUNT
 #else
-#define OCTREEINDEX_QUALIFIER __global
+#define PLANE_COUNT(runtimeCount) (runtimeCount)
+#endif
+
+#ifdef SCENE_POINTLIGHT_COUNT
+#define POINTLIGHT_COUNT(runtimeCount) SCENE_POINTLIGHT_COUNT
+#else
+#define POINTLIGHT_COUNT(runtimeCount) (runtimeCount)
+#endif
+
+#ifdef SCENE_NO_SECONDARY_RAYS
+#define TRACE_SECONDARY_RAYS 0
+#else
+#define TRACE_SECONDARY_RAYS 1
+#endif
+
+// the deepest ray tree, that the stack of raytracer_raycast can hold, has to match RAYTRACER_MAX_RAY_DEPTH in raytracer.h
+// the depth of a frame is the maxRayDepth argument of the kernel
+#define MAX_RAY_DEPTH 8
+
+#ifndef SHADOW_RAY_COUNT
+#define SHADOW_RAY_COUNT 4
+#endif
+
+// the first shadow rays of a light, the others are only traced if these disagree about the visibility of the light.
+// Biased in the penumbra, where the probes of a partly visible light can agree, see RAYTRACER_SHADOW_PROBE_COUNT.
+#ifndef SHADOW_PROBE_COUNT
+#define SHADOW_PROBE_COUNT 2
+#endif
+#if SHADOW_PROBE_COUNT < 1
+#error "SHADOW_PROBE_COUNT has to be at least 1"
 #endif
 
 #define uint32_t uint
@@ -237,6 +294,15 @@ typedef struct {
     float strength;
 } PointLight;
 
+// see lighttree.h
+typedef struct {
+	Vec3 min;
+	Vec3 max;
+	float power;
+	uint32_t firstChild;
+	uint32_t lightIndex;
+} LightTreeNode;
+
 typedef struct {
     uint32_t width, height;
     uint32_t* buffer; // Stores the data as rgba top to bottom, left to right
@@ -264,8 +330,19 @@ typedef struct {
 	uint32_t triangleIndexOffset;
 	uint32_t triangleIndexCount;
 
+	// the children fill the last slots, see accel.h
 	int32_t childNodeIndexes[8];
-} OctreeNode;
+	// see accel.h, the traversal follows these links instead of a stack
+	int32_t skipNodeIndex;
+} AccelNode;
+
+typedef struct {
+	uint32_t nodesVisited;
+	uint32_t boxTests;
+	uint32_t sphereTests;
+	uint32_t triangleTests;
+	uint32_t shadowRays;
+} TraversalStats;
 
 #define EPSILON 0.00001f
 static Vec3 raytracer_refract(Vec3 direction, Vec3 normal, float refractionIndex) {
@@ -472,7 +549,7 @@ static bool raytracer_intersectBoundingBox(Ray* ray, BoundingBox boundingBox) {
 }
 
 static bool raytracer_isAnyPlaneIntersectCloserThan(PLANES_QUALIFIER Plane* planes, uint32_t planeCount, Ray* ray, float minDistance) {
-    for (uint32_t i = 0; i < planeCount; i++) {
+    for (uint32_t i = 0; i < PLANE_COUNT(planeCount); i++) {
         PLANES_QUALIFIER Plane* plane = &planes[i];
         float planeHitDistance = FLT_MAX;
         Vec3 planeIntersectionNormal;
@@ -487,7 +564,7 @@ static bool raytracer_isAnyPlaneIntersectCloserThan(PLANES_QUALIFIER Plane* plan
 
 static void raytracer_calcClosestPlaneIntersect(PLANES_QUALIFIER Plane* planes, uint32_t planeCount, Ray* ray, float* minHitDistance, Vec3* intersectionNormal,
                                                 uint32_t* hitMaterialIndex) {
-    for (uint32_t i = 0; i < planeCount; i++) {
+    for (uint32_t i = 0; i < PLANE_COUNT(planeCount); i++) {
 		PLANES_QUALIFIER Plane* plane = &planes[i];
         float planeHitDistance = FLT_MAX;
         Vec3 planeIntersectionNormal;
@@ -501,29 +578,30 @@ static void raytracer_calcClosestPlaneIntersect(PLANES_QUALIFIER Plane* planes,
     }
 }
 
-static bool raytracer_isAnyIntersectUsingOctreeCloserThan(SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount,
-    Ray* ray, OCTREENODES_QUALIFIER OctreeNode* octreeNodes, OCTREEINDEX_QUALIFIER uint32_t* octreeIndexes, float minDistance) {
-    uint32_t nodesToCheck[MAX_NODE_STACK_SIZE];
-    uint32_t nodesToCheckCount = 0;
-
-    // push root to the stack
-    nodesToCheck[nodesToCheckCount++] = 0;
-
-    while (nodesToCheckCount > 0) {
-        uint32_t currentNodeIndex = nodesToCheck[--nodesToCheckCount];
-        OCTREENODES_QUALIFIER OctreeNode* currentNode = &octreeNodes[currentNodeIndex];
-        if (raytracer_intersectBoundingBox(ray, currentNode->boundingBox)) {
-            // if we have a inner node we just add all children to the search
-            if (currentNode->childNodeIndexes[0] != NODE_INDEX_UNDEF) {
-                for (uint32_t i = 0; i < 8; i++) {
-                    nodesToCheck[nodesToCheckCount++] = currentNode->childNodeIndexes[i];
-                }
+static bool raytracer_isAnyIntersectUsingAccelCloserThan(SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount,
+    Ray* ray, ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM, float minDistance) {
+#if defined(SCENE_NO_SPHERES) && defined(SCENE_NO_TRIANGLES)
+    // the hierarchy is empty
+    return false;
+#endif
+    // starts at the root, a missed box or a finished leaf continues after its subtree
+    int32_t currentNodeIndex = 0;
+    while (currentNodeIndex != NODE_INDEX_UNDEF) {
+        AccelNode currentNode = LOAD_ACCEL_NODE((uint32_t) currentNodeIndex);
+        currentNodeIndex = currentNode.skipNodeIndex;
+        TRAVERSAL_STATS_ADD(boxTests, 1);
+        if (raytracer_intersectBoundingBox(ray, currentNode.boundingBox)) {
+            TRAVERSAL_STATS_ADD(nodesVisited, 1);
+            // an inner node is entered at its last child, which the skip links chain to the others
+            if (currentNode.childNodeIndexes[7] != NODE_INDEX_UNDEF) {
+                currentNodeIndex = currentNode.childNodeIndexes[7];
                 // otherwise we have a leaf node
             }
             else {
-
-                for (uint32_t i = 0; i < currentNode->sphereIndexCount; i++) {
-                    SPHERES_QUALIFIER Sphere* sphere = &spheres[octreeIndexes[i + currentNode->sphereIndexOffset]];
+#ifndef SCENE_NO_SPHERES
+                for (uint32_t i = 0; i < currentNode.sphereIndexCount; i++) {
+                    SPHERES_QUALIFIER Sphere* sphere = &spheres[accelIndexes[i + currentNode.sphereIndexOffset]];
+                    TRAVERSAL_STATS_ADD(sphereTests, 1);
                     float sphereHitDistance = FLT_MAX;
                     Vec3 sphereIntersectionNormal;
                     if (raytracer_intersectSphere(sphere, ray, &sphereHitDistance, &sphereIntersectionNormal)) {
@@ -532,9 +610,12 @@ static bool raytracer_isAnyIntersectUsingOctreeCloserThan(SPHERES_QUALIFIER Sphe
                         }
                     }
                 }
+#endif
 
-                for (uint32_t i = 0; i < currentNode->triangleIndexCount; i++) {
-                    TRIANGLES_QUALIFIER Triangle* triangle = &triangles[octreeIndexes[i + currentNode->triangleIndexOffset]];
+#ifndef SCENE_NO_TRIANGLES
+                for (uint32_t i = 0; i < currentNode.triangleIndexCount; i++) {
+                    TRIANGLES_QUALIFIER Triangle* triangle = &triangles[accelIndexes[i + currentNode.triangleIndexOffset]];
+                    TRAVERSAL_STATS_ADD(triangleTests, 1);
                     float triangleHitDistance = FLT_MAX;
                     Vec3 triangleIntersectionNormal;
                     if (raytracer_intersectTriangle(triangle, ray, &triangleHitDistance, &triangleIntersectionNormal)) {
@@ -543,35 +624,36 @@ static bool raytracer_isAnyIntersectUsingOctreeCloserThan(SPHERES_QUALIFIER Sphe
                         }
                     }
                 }
+#endif
             }
         }
     }
     return false;
 }
 
-static void raytracer_calcClosestIntersectUsingOctree(SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, 
+static void raytracer_calcClosestIntersectUsingAccel(SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, 
                                                  Ray* ray, float* minHitDistance, Vec3* intersectionNormal,
-                                                 uint32_t* hitMaterialIndex, OCTREENODES_QUALIFIER OctreeNode* octreeNodes, OCTREEINDEX_QUALIFIER uint32_t* octreeIndexes) {
-	uint32_t nodesToCheck[200];
-	uint32_t nodesToCheckCount = 0;
-
-	// push root to the stack
-	nodesToCheck[nodesToCheckCount++] = 0;
-
-	while (nodesToCheckCount > 0) {
-		uint32_t currentNodeIndex = nodesToCheck[--nodesToCheckCount];
-		OCTREENODES_QUALIFIER OctreeNode* currentNode = &octreeNodes[currentNodeIndex];
-		if (raytracer_intersectBoundingBox(ray, currentNode->boundingBox)) {
-			// if we have a inner node we just add all children to the search
-			if (currentNode->childNodeIndexes[0] != NODE_INDEX_UNDEF) {
-				for (uint32_t i = 0; i < 8; i++) {
-					nodesToCheck[nodesToCheckCount++] = currentNode->childNodeIndexes[i];
-				}
+                                                 uint32_t* hitMaterialIndex, ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM) {
+#if defined(SCENE_NO_SPHERES) && defined(SCENE_NO_TRIANGLES)
+	return;
+#endif
+	// starts at the root, a missed box or a finished leaf continues after its subtree
+	int32_t currentNodeIndex = 0;
+	while (currentNodeIndex != NODE_INDEX_UNDEF) {
+		AccelNode currentNode = LOAD_ACCEL_NODE((uint32_t) currentNodeIndex);
+		currentNodeIndex = currentNode.skipNodeIndex;
+		TRAVERSAL_STATS_ADD(boxTests, 1);
+		if (raytracer_intersectBoundingBox(ray, currentNode.boundingBox)) {
+			TRAVERSAL_STATS_ADD(nodesVisited, 1);
+			// an inner node is entered at its last child, which the skip links chain to the others
+			if (currentNode.childNodeIndexes[7] != NODE_INDEX_UNDEF) {
+				currentNodeIndex = currentNode.childNodeIndexes[7];
 			// otherwise we have a leaf node
 			} else {
-
-				for (uint32_t i = 0; i < currentNode->sphereIndexCount; i++) {
-					SPHERES_QUALIFIER Sphere* sphere = &spheres[octreeIndexes[i + currentNode->sphereIndexOffset]];
+#ifndef SCENE_NO_SPHERES
+				for (uint32_t i = 0; i < currentNode.sphereIndexCount; i++) {
+					SPHERES_QUALIFIER Sphere* sphere = &spheres[accelIndexes[i + currentNode.sphereIndexOffset]];
+					TRAVERSAL_STATS_ADD(sphereTests, 1);
 					float sphereHitDistance = FLT_MAX;
 					Vec3 sphereIntersectionNormal;
 					if (raytracer_intersectSphere(sphere, ray, &sphereHitDistance, &sphereIntersectionNormal)) {
@@ -582,9 +664,12 @@ static void raytracer_calcClosestIntersectUsingOctree(SPHERES_QUALIFIER Sphere*
 						}
 					}
 				}
+#endif
 
-				for (uint32_t i = 0; i < currentNode->triangleIndexCount; i++) {
-					TRIANGLES_QUALIFIER Triangle* triangle = &triangles[octreeIndexes[i + currentNode->triangleIndexOffset]];
+#ifndef SCENE_NO_TRIANGLES
+				for (uint32_t i = 0; i < currentNode.triangleIndexCount; i++) {
+					TRIANGLES_QUALIFIER Triangle* triangle = &triangles[accelIndexes[i + currentNode.triangleIndexOffset]];
+					TRAVERSAL_STATS_ADD(triangleTests, 1);
 					float triangleHitDistance = FLT_MAX;
 					Vec3 triangleIntersectionNormal;
 					if (raytracer_intersectTriangle(triangle, ray, &triangleHitDistance, &triangleIntersectionNormal)) {
@@ -595,139 +680,366 @@ static void raytracer_calcClosestIntersectUsingOctree(SPHERES_QUALIFIER Sphere*
 						}
 					}
 				}
+#endif
 			}
 		}
 	}
 }
 
-static Vec3 raytracer_raycast_helper_0(CAMERA_QUALIFIER Camera* camera, MATERIALS_QUALIFIER Material* materials, uint32_t materialCount, 
-	PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, 
-	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, 
-	POINTLIGHTS_QUALIFIER PointLight* pointLights, uint32_t pointLightCount, 
-	OCTREENODES_QUALIFIER OctreeNode* octreeNodes, OCTREEINDEX_QUALIFIER uint32_t* octreeIndexes, __global seed128bit* seed, Ray* primaryRay) {
+// scenes with more lights sample them from the light tree, see lighttree.h
+#define LIGHTTREE_MIN_LIGHT_COUNT 8
+
+// see lighttree_getImportance in lighttree.c
+static float lighttree_getImportance(__global LightTreeNode* node, Vec3 point) {
+	float dx = MAX(MAX(node->min.x - point.x, point.x - node->max.x), 0.0f);
+	float dy = MAX(MAX(node->min.y - point.y, point.y - node->max.y), 0.0f);
+	float dz = MAX(MAX(node->min.z - point.z, point.z - node->max.z), 0.0f);
+	return node->power / (1.0f + 4 * PI * (dx * dx + dy * dy + dz * dz));
+}
+
+// see lighttree_sampleLight in lighttree.c
+static uint32_t lighttree_sampleLight(__global LightTreeNode* nodes, Vec3 point, float u, float* probability) {
+	__global LightTreeNode* node = &nodes[0];
+	*probability = 1.0f;
+	while (node->firstChild != 0) {
+		__global LightTreeNode* left = &nodes[node->firstChild];
+		float leftImportance = lighttree_getImportance(left, point);
+		float rightImportance = lighttree_getImportance(left + 1, point);
+		float totalImportance = leftImportance + rightImportance;
+		float leftProbability = totalImportance > 0.0f ? leftImportance / totalImportance : 0.5f;
+		if (u < leftProbability || leftProbability >= 1.0f) {
+			node = left;
+			*probability *= leftProbability;
+			u = u / leftProbability;
+		} else {
+			node = left + 1;
+			*probability *= 1.0f - leftProbability;
+			u = (u - leftProbability) / (1.0f - leftProbability);
+		}
+	}
+	return node->lightIndex;
+}
+
+// the lighting of a shadow ray to a random point around the light, black if it's occluded
+static Vec3 raytracer_shadeLight(CAMERA_QUALIFIER Camera* camera, MATERIALS_QUALIFIER Material* hitMaterial,
+	PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount,
+	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, POINTLIGHTS_QUALIFIER PointLight* pointLight,
+	ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM,
+	__global seed128bit* seed, Vec3 hitPoint, Vec3 intersectionNormal, bool* isLit) {
+	Vec3 lighting;
+	lighting.r = 0.0f;
+	lighting.g = 0.0f;
+	lighting.b = 0.0f;
+	Ray shadowRay;
+	TRAVERSAL_STATS_ADD(shadowRays, 1);
+	Vec3 hitToLight = vec3_sub(pointLight->position, hitPoint);
+	Vec3 randomOffset;
+	randomOffset.x = random_bilateral(seed);
+	randomOffset.y = random_bilateral(seed);
+	randomOffset.z = random_bilateral(seed);
+	randomOffset = vec3_norm(randomOffset);
+	hitToLight = vec3_add(hitToLight, randomOffset);
+	float distanceToLight = vec3_length(hitToLight);
+	float distanceToLightSquared = hitToLight.x * hitToLight.x + hitToLight.y * hitToLight.y + hitToLight.z * hitToLight.z;
+	shadowRay.origin = hitPoint;
+	shadowRay.direction = vec3_norm(hitToLight);
+	raytracer_moveRayOutOfObject(&shadowRay);
+
+	*isLit = !raytracer_isAnyPlaneIntersectCloserThan(planes, planeCount, &shadowRay, distanceToLight) &&
+		!raytracer_isAnyIntersectUsingAccelCloserThan(spheres, sphereCount, triangles, triangleCount, &shadowRay, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, distanceToLight);
+	if (!*isLit) {
+		return lighting;
+	}
+	// we hit the light
+	float cosAngle = vec3_dot(shadowRay.direction, intersectionNormal);
+	cosAngle = math_clamp(cosAngle, 0.0f, 1.0f);
+	float lightAttenuation = 1.0f / (1.0f + 4 * PI * distanceToLightSquared);
+	float lightStrength = pointLight->strength * lightAttenuation;
+	Vec3 ambientLighting = vec3_mul(pointLight->emissionColor, hitMaterial->ambientWeight * lightStrength);
+	Vec3 diffuseLighting = vec3_mul(pointLight->emissionColor, hitMaterial->diffuseWeight * cosAngle * lightStrength);
+	Vec3 toView = vec3_norm(vec3_sub(camera->position, hitPoint));
+	Vec3 toLight = vec3_mul(shadowRay.direction, -1);
+	Vec3 reflectionVector = vec3_reflect(toLight, intersectionNormal);
+	cosAngle = vec3_dot(toView, reflectionVector);
+	cosAngle = pow(cosAngle, hitMaterial->specularExponent);
+	Vec3 specularLighting = vec3_mul(pointLight->emissionColor, hitMaterial->specularWeight * cosAngle * lightStrength);
+	return vec3_mul(vec3_add(ambientLighting, vec3_add(diffuseLighting, specularLighting)), (1 - hitMaterial->reflectionIndex));
+}
+
+// a refracted ray, that is traced once the reflected ray of its hit and everything behind it is done
+typedef struct {
+	Ray ray;
+	Vec3 throughput;
+	uint32_t depth;
+} PendingRay;
+
+// Russian roulette for rays with a throughput below the threshold, the survivors carry the weight of the dropped rays
+static bool raytracer_playRoulette(Vec3* throughput, float rouletteThreshold, __global seed128bit* seed) {
+	float maxWeight = fmax(throughput->r, fmax(throughput->g, throughput->b));
+	if (maxWeight >= rouletteThreshold) {
+		return true;
+	}
+	float survivalProbability = maxWeight / rouletteThreshold;
+	if (random_unilateral(seed) >= survivalProbability) {
+		return false;
+	}
+	*throughput = vec3_div(*throughput, survivalProbability);
+	return true;
+}
+
+// the direct lighting of a hit, which isn't filtered by the material color yet
+static Vec3 raytracer_shadeHit(CAMERA_QUALIFIER Camera* camera, MATERIALS_QUALIFIER Material* hitMaterial,
+	PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount,
+	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, POINTLIGHTS_QUALIFIER PointLight* pointLights, uint32_t pointLightCount,
+	__global LightTreeNode* lightTreeNodes, ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM,
+	__global seed128bit* seed, Vec3 hitPoint, Vec3 intersectionNormal) {
 	Vec3 outColor;
 	outColor.r = 0.0f;
 	outColor.g = 0.0f;
 	outColor.b = 0.0f;
+	uint32_t shadowRays = SHADOW_RAY_COUNT;
+	if (POINTLIGHT_COUNT(pointLightCount) > LIGHTTREE_MIN_LIGHT_COUNT) {
+		// a fixed number of shadow rays to lights picked by their estimated contribution
+		Vec3 directLighting = outColor;
+		for (uint32_t x = 0; x < shadowRays; x++) {
+			float lightProbability;
+			uint32_t lightIndex = lighttree_sampleLight(lightTreeNodes, hitPoint, random_unilateral(seed), &lightProbability);
+			bool isLit;
+			Vec3 lighting = raytracer_shadeLight(camera, hitMaterial, planes, planeCount, spheres, sphereCount, triangles, triangleCount, &pointLights[lightIndex], accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, seed, hitPoint, intersectionNormal, &isLit);
+			directLighting = vec3_add(directLighting, vec3_div(lighting, lightProbability));
+			// averaged like the loop over all lights, so the expected color is the same
+			directLighting = vec3_div(directLighting, shadowRays);
+			outColor = vec3_add(outColor, directLighting);
+		}
+		return outColor;
+	}
+	for (uint32_t i = 0; i < POINTLIGHT_COUNT(pointLightCount); i++) {
+		POINTLIGHTS_QUALIFIER PointLight* pointLight = &pointLights[i];
+		Vec3 directLighting;
+		directLighting.r = 0.0f;
+		directLighting.g = 0.0f;
+		directLighting.b = 0.0f;
+		Vec3 probeLighting = directLighting;
+		uint32_t litProbeCount = 0;
+		for (uint32_t x = 0; x < shadowRays; x++) {
+			Vec3 lighting;
+			if (x < SHADOW_PROBE_COUNT || (litProbeCount > 0 && litProbeCount < SHADOW_PROBE_COUNT)) {
+				bool isLit;
+				lighting = raytracer_shadeLight(camera, hitMaterial, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLight, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, seed, hitPoint, intersectionNormal, &isLit);
+				if (x < SHADOW_PROBE_COUNT) {
+					litProbeCount += isLit;
+					probeLighting = vec3_add(probeLighting, lighting);
+				}
+			} else {
+				// the probes agree, so the light is taken as fully visible or fully blocked
+				lighting = vec3_div(probeLighting, SHADOW_PROBE_COUNT);
+			}
+			directLighting = vec3_add(directLighting, lighting);
+			directLighting = vec3_div(directLighting, shadowRays);
+			outColor = vec3_add(outColor, directLighting);
+		}
+	}
 	return outColor;
 }
 
-#define DEFINE_RAYCAST_HELPER(X, Y) \
-static Vec3 raytracer_raycast_helper_##X(CAMERA_QUALIFIER Camera* camera, MATERIALS_QUALIFIER Material* materials, uint32_t materialCount, \
-                                    PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, \
-									TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, POINTLIGHTS_QUALIFIER PointLight* pointLights, uint32_t pointLightCount, \
-									OCTREENODES_QUALIFIER OctreeNode* octreeNodes, OCTREEINDEX_QUALIFIER uint32_t* octreeIndexes, __global seed128bit* seed, Ray* primaryRay) { \
-	Vec3 outColor; \
-	outColor.r = 0.0f; \
-	outColor.g = 0.0f; \
-	outColor.b = 0.0f; \
-	\
-	float minHitDistance = FLT_MAX; \
-	uint32_t hitMaterialIndex = 0; \
-	Vec3 intersectionNormal; \
-	raytracer_calcClosestPlaneIntersect(planes, planeCount, primaryRay, &minHitDistance, &intersectionNormal, &hitMaterialIndex); \
-	raytracer_calcClosestIntersectUsingOctree(spheres, sphereCount, triangles, triangleCount, primaryRay, &minHitDistance, &intersectionNormal, &hitMaterialIndex, octreeNodes, octreeIndexes); \
-	\
-	if (hitMaterialIndex) { \
-		MATERIALS_QUALIFIER Material* hitMaterial = &materials[hitMaterialIndex]; \
-		/* if we got a hit, calculate the hitPoint and send a shadow rays to each lightsource */ \
-		Vec3 hitPoint = raytracer_calculateHitpoint(primaryRay, minHitDistance); \
-										\
-		/* REFLECTION AND REFRACTION */ \
-		if (hitMaterial->refractionIndex > 0) { \
-			float kr = raytracer_fresnel(primaryRay->direction, intersectionNormal, hitMaterial->refractionIndex); \
-			Vec3 refractionColor; \
-			refractionColor.r = 0.0f; \
-			refractionColor.g = 0.0f; \
-			refractionColor.b = 0.0f; \
-			/* compute refraction if it is not a case of total internal reflection */ \
-			if (kr < 1) { \
-				Ray refractedRay; \
-				refractedRay.origin = hitPoint; \
-				refractedRay.direction = raytracer_refract(primaryRay->direction, intersectionNormal, hitMaterial->refractionIndex); \
-				raytracer_moveRayOutOfObject(&refractedRay); \
-				refractionColor = raytracer_raycast_helper_##Y(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, octreeNodes, octreeIndexes, seed, &refractedRay); \
-			} \
-			\
-			Ray reflectedRay; \
-			reflectedRay.origin = hitPoint; \
-			reflectedRay.direction = vec3_reflect(primaryRay->direction, intersectionNormal); \
-			raytracer_moveRayOutOfObject(&reflectedRay); \
-			Vec3 reflectionColor = raytracer_raycast_helper_##Y(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, octreeNodes, octreeIndexes, seed, &reflectedRay); \
-			/* mix the two */ \
-			outColor = vec3_add(outColor, vec3_add(vec3_mul(reflectionColor, kr), vec3_mul(refractionColor, (1 - kr)))); \
-		} else \
-			/* REFLECTION: */ \
-		if (hitMaterial->reflectionIndex > 0) { \
-			Ray reflectedRay; \
-			reflectedRay.origin = hitPoint; \
-			reflectedRay.direction = vec3_reflect(primaryRay->direction, intersectionNormal); \
-			raytracer_moveRayOutOfObject(&reflectedRay); \
-			Vec3 reflectionColor = raytracer_raycast_helper_##Y(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, octreeNodes, octreeIndexes, seed, &reflectedRay); \
-			outColor = vec3_add(outColor, vec3_mul(reflectionColor, hitMaterial->reflectionIndex)); \
-		} \
-			\
-		/* SHADOWS */ \
-		for (uint32_t i = 0; i < pointLightCount; i++) { \
-			POINTLIGHTS_QUALIFIER PointLight* pointLight = &pointLights[i]; \
-            uint32_t shadowRays = 4; \
-            \
-            Vec3 directLighting; \
-			directLighting.r = 0.0f; \
-			directLighting.g = 0.0f; \
-			directLighting.b = 0.0f; \
-            for (uint32_t x = 0; x < shadowRays; x++) { \
-                Ray shadowRay; \
-			    Vec3 hitToLight = vec3_sub(pointLight->position, hitPoint); \
-			    Vec3 randomOffset; \
-                randomOffset.x = random_bilateral(seed); \
-                randomOffset.y = random_bilateral(seed); \
-                randomOffset.z = random_bilateral(seed); \
-                randomOffset = vec3_norm(randomOffset); \
-			    hitToLight = vec3_add(hitToLight, randomOffset); \
-			    float distanceToLight = vec3_length(hitToLight); \
-                float distanceToLightSquared = hitToLight.x * hitToLight.x + hitToLight.y * hitToLight.y + hitToLight.z * hitToLight.z; \
-			    shadowRay.origin = hitPoint; \
-			    shadowRay.direction = vec3_norm(hitToLight); \
-			    raytracer_moveRayOutOfObject(&shadowRay); \
-                \
-			    if (!raytracer_isAnyPlaneIntersectCloserThan(planes, planeCount, &shadowRay, distanceToLight) && \
-			        !raytracer_isAnyIntersectUsingOctreeCloserThan(spheres, sphereCount, triangles, triangleCount, &shadowRay, octreeNodes, octreeIndexes, distanceToLight)) { \
-			        /* we hit the light */ \
-				    float cosAngle = vec3_dot(shadowRay.direction, intersectionNormal); \
-				    cosAngle = math_clamp(cosAngle, 0.0f, 1.0f); \
-				    float lightAttenuation = 1.0f / (1.0f + 4 * PI * distanceToLightSquared); \
-                    float lightStrength = pointLight->strength * lightAttenuation; \
-                    Vec3 ambientLighting = vec3_mul(pointLight->emissionColor, hitMaterial->ambientWeight * lightStrength); \
-				    Vec3 diffuseLighting = vec3_mul(pointLight->emissionColor, hitMaterial->diffuseWeight * cosAngle * lightStrength); \
-				    Vec3 toView = vec3_norm(vec3_sub(camera->position, hitPoint)); \
-				    Vec3 toLight = vec3_mul(shadowRay.direction, -1); \
-				    Vec3 reflectionVector = vec3_reflect(toLight, intersectionNormal); \
-				    cosAngle = vec3_dot(toView, reflectionVector); \
-				    cosAngle = pow(cosAngle, hitMaterial->specularExponent); \
-				    Vec3 specularLighting = vec3_mul(pointLight->emissionColor, hitMaterial->specularWeight * cosAngle * lightStrength); \
-				    directLighting = vec3_add(directLighting, vec3_mul(vec3_add(ambientLighting, vec3_add(diffuseLighting, specularLighting)), (1 - hitMaterial->reflectionIndex))); \
-			    } \
-                directLighting = vec3_div(directLighting, shadowRays); \
-                outColor = vec3_add(outColor, directLighting); \
-            } \
-		} \
-		outColor = vec3_hadamard(outColor, hitMaterial->color); \
-	} \
-	return outColor; \
-} \
-
-DEFINE_RAYCAST_HELPER(1, 0);
-DEFINE_RAYCAST_HELPER(2, 1);
-DEFINE_RAYCAST_HELPER(3, 2);
-DEFINE_RAYCAST_HELPER(4, 3);
-DEFINE_RAYCAST_HELPER(5, 4);
-
+/*
+ * Traces the ray tree of a primary ray without recursion. The reflected ray of a hit is followed right away,
+ * the refracted ray waits on a stack. Every ray carries its weight in the pixel (throughput), so weak branches
+ * end early with Russian roulette, and with isFresnelSampling a refracting hit follows only one of both rays.
+ */
 Vec3 raytracer_raycast(CAMERA_QUALIFIER Camera* camera, MATERIALS_QUALIFIER Material* materials, uint32_t materialCount, 
 	PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount, 
-	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, POINTLIGHTS_QUALIFIER PointLight* pointLights, uint32_t pointLightCount, 
-	OCTREENODES_QUALIFIER OctreeNode* octreeNodes, OCTREEINDEX_QUALIFIER uint32_t* octreeIndexes, __global seed128bit* seed, Ray* primaryRay) {
-    return raytracer_raycast_helper_5(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, octreeNodes, octreeIndexes, seed, primaryRay);
+	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount, POINTLIGHTS_QUALIFIER PointLight* pointLights, uint32_t pointLightCount,
+	__global LightTreeNode* lightTreeNodes, ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM, __global seed128bit* seed, Ray* primaryRay,
+	uint32_t maxRayDepth, float rouletteThreshold, uint32_t isFresnelSampling) {
+	Vec3 outColor;
+	outColor.r = 0.0f;
+	outColor.g = 0.0f;
+	outColor.b = 0.0f;
+	// at most one refracted ray per depth waits for its reflected ray
+	PendingRay pendingRays[MAX_RAY_DEPTH];
+	uint32_t pendingRayCount = 0;
+	maxRayDepth = min(maxRayDepth, (uint32_t) MAX_RAY_DEPTH);
+
+	Ray ray = *primaryRay;
+	// the weight of the color seen along the ray in the pixel
+	Vec3 throughput;
+	throughput.r = 1.0f;
+	throughput.g = 1.0f;
+	throughput.b = 1.0f;
+	uint32_t depth = 0;
+	while (true) {
+		float minHitDistance = FLT_MAX;
+		uint32_t hitMaterialIndex = 0;
+		Vec3 intersectionNormal;
+		raytracer_calcClosestPlaneIntersect(planes, planeCount, &ray, &minHitDistance, &intersectionNormal, &hitMaterialIndex);
+		raytracer_calcClosestIntersectUsingAccel(spheres, sphereCount, triangles, triangleCount, &ray, &minHitDistance, &intersectionNormal, &hitMaterialIndex, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG);
+
+		bool hasNextRay = false;
+		Ray nextRay;
+		Vec3 nextThroughput;
+		if (hitMaterialIndex) {
+			MATERIALS_QUALIFIER Material* hitMaterial = &materials[hitMaterialIndex];
+			Vec3 hitPoint = raytracer_calculateHitpoint(&ray, minHitDistance);
+			// everything seen from the hit is filtered by the material color
+			Vec3 hitThroughput = vec3_hadamard(throughput, hitMaterial->color);
+
+			/* REFLECTION AND REFRACTION */
+			if (TRACE_SECONDARY_RAYS && depth + 1 < maxRayDepth && (hitMaterial->refractionIndex > 0 || hitMaterial->reflectionIndex > 0)) {
+				nextRay.origin = hitPoint;
+				nextRay.direction = vec3_reflect(ray.direction, intersectionNormal);
+				raytracer_moveRayOutOfObject(&nextRay);
+				nextThroughput = vec3_mul(hitThroughput, hitMaterial->reflectionIndex);
+
+				if (hitMaterial->refractionIndex > 0) {
+					float kr = raytracer_fresnel(ray.direction, intersectionNormal, hitMaterial->refractionIndex);
+					/* no refraction in the case of total internal reflection */
+					if (kr < 1) {
+						Ray refractedRay;
+						refractedRay.origin = hitPoint;
+						refractedRay.direction = raytracer_refract(ray.direction, intersectionNormal, hitMaterial->refractionIndex);
+						raytracer_moveRayOutOfObject(&refractedRay);
+						if (isFresnelSampling) {
+							// only one of both rays, picked with the fresnel weights, which cancel out
+							nextThroughput = hitThroughput;
+							if (random_unilateral(seed) >= kr) {
+								nextRay = refractedRay;
+							}
+						} else {
+							nextThroughput = vec3_mul(hitThroughput, kr);
+							Vec3 refractedThroughput = vec3_mul(hitThroughput, 1 - kr);
+							if (raytracer_playRoulette(&refractedThroughput, rouletteThreshold, seed)) {
+								pendingRays[pendingRayCount].ray = refractedRay;
+								pendingRays[pendingRayCount].throughput = refractedThroughput;
+								pendingRays[pendingRayCount].depth = depth + 1;
+								pendingRayCount++;
+							}
+						}
+					} else {
+						nextThroughput = hitThroughput;
+					}
+				}
+				hasNextRay = raytracer_playRoulette(&nextThroughput, rouletteThreshold, seed);
+			}
+
+			/* SHADOWS, the direct lighting is scaled by 1 - reflectionIndex, so perfect mirrors skip the shadow rays */
+			if (hitMaterial->reflectionIndex < 1) {
+				Vec3 directLighting = raytracer_shadeHit(camera, hitMaterial, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, lightTreeNodes, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, seed, hitPoint, intersectionNormal);
+				outColor = vec3_add(outColor, vec3_hadamard(directLighting, hitThroughput));
+			}
+		}
+
+		if (hasNextRay) {
+			ray = nextRay;
+			throughput = nextThroughput;
+			depth++;
+		} else if (pendingRayCount > 0) {
+			pendingRayCount--;
+			ray = pendingRays[pendingRayCount].ray;
+			throughput = pendingRays[pendingRayCount].throughput;
+			depth = pendingRays[pendingRayCount].depth;
+		} else {
+			return outColor;
+		}
+	}
+}
+
+// the closest hit of the ray without shading it, returns the material index or 0 without a hit
+static uint32_t raytracer_findHit(PLANES_QUALIFIER Plane* planes, uint32_t planeCount, SPHERES_QUALIFIER Sphere* spheres, uint32_t sphereCount,
+	TRIANGLES_QUALIFIER Triangle* triangles, uint32_t triangleCount,
+	ACCELNODES_QUALIFIER AccelNode* accelNodes, ACCELINDEX_QUALIFIER uint32_t* accelIndexes SHARED_ACCELNODES_PARAM TRAVERSAL_STATS_PARAM, Ray* ray,
+	float* hitDistance, Vec3* intersectionNormal) {
+	uint32_t hitMaterialIndex = 0;
+	*hitDistance = FLT_MAX;
+	raytracer_calcClosestPlaneIntersect(planes, planeCount, ray, hitDistance, intersectionNormal, &hitMaterialIndex);
+	raytracer_calcClosestIntersectUsingAccel(spheres, sphereCount, triangles, triangleCount, ray, hitDistance, intersectionNormal, &hitMaterialIndex, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG);
+	return hitMaterialIndex;
+}
+
+// the rgba layout of raytracer_packColor in raytracer.c, rint rounds halves to even like its lrintf
+static uint32_t raytracer_packColor(Vec3 color) {
+	return 0xFF000000u | (uint32_t) rint(color.b * 255.0f) << 16 | (uint32_t) rint(color.g * 255.0f) << 8 | (uint32_t) rint(color.r * 255.0f);
+}
+
+static Vec3 raytracer_unpackColor(uint32_t packed) {
+	Vec3 color;
+	color.r = (packed & 0xFF) / 255.0f;
+	color.g = ((packed >> 8) & 0xFF) / 255.0f;
+	color.b = ((packed >> 16) & 0xFF) / 255.0f;
+	return color;
+}
+
+// has to match ReprojectionMode in gpu.h
+#define REPROJECTION_OFF 0
+#define REPROJECTION_RECORD 1
+#define REPROJECTION_REUSE 2
+// a reused pixel is traced again after at most this many frames
+#define REPROJECTION_MAX_AGE 16
+// how far the hits of both frames may be apart, in pixels of the previous frame
+#define REPROJECTION_TOLERANCE 4.0f
+
+/*
+ * Finds the pixel of the previous frame, whose first sample position is closest to the point.
+ * The history of that pixel is only reused, if its hit is close to the point as well, otherwise
+ * the pixel saw another surface in front of or behind it.
+ */
+static bool reprojection_findPreviousPixel(__global Camera* camera, Vec3 point, uint32_t* pixelIndex, float* tolerance) {
+	Vec3 toPoint = vec3_sub(point, camera->position);
+	// the camera looks along -z
+	float depth = -vec3_dot(toPoint, camera->z);
+	if (depth <= 0.0f) {
+		return false;
+	}
+	float scale = camera->renderTargetDistance / depth;
+	float u = vec3_dot(toPoint, camera->x) * scale / (camera->renderTargetWidth / 2.0f);
+	float v = -vec3_dot(toPoint, camera->y) * scale / (camera->renderTargetHeight / 2.0f);
+	// inverse of u = -1 + (2 * x - 1) / width, then rounded to the closest pixel
+	float x = floor((u + 1.0f) * camera->width / 2.0f + 1.0f);
+	float y = floor((v + 1.0f) * camera->height / 2.0f + 1.0f);
+	if (x < 0.0f || y < 0.0f || x >= camera->width || y >= camera->height) {
+		return false;
+	}
+	*pixelIndex = (uint32_t) y * camera->width + (uint32_t) x;
+	*tolerance = REPROJECTION_TOLERANCE * depth * camera->renderTargetWidth / (camera->renderTargetDistance * camera->width);
+	return true;
+}
+
+// traced pixels start at different ages, so that only a few of them expire in the same frame
+static float reprojection_initialAge(uint32_t x, uint32_t y) {
+	return (float) (((x * 73856093u) ^ (y * 19349663u)) % REPROJECTION_MAX_AGE);
+}
+
+// DENOISER_NORMAL_PHI and DENOISER_DEPTH_PHI are defined by gpu_buildKernel from denoiser.h
+
+// the lighting without the material color, see denoiser_demodulate in denoiser.c
+static Vec3 denoise_demodulate(Vec3 color, Vec3 albedo) {
+	color.r = albedo.r > 0.0f ? color.r / albedo.r : 0.0f;
+	color.g = albedo.g > 0.0f ? color.g / albedo.g : 0.0f;
+	color.b = albedo.b > 0.0f ? color.b / albedo.b : 0.0f;
+	return color;
+}
+
+static float denoise_getLuminance(float4 color) {
+	return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+// the smaller of both one sided differences, so that the gradient doesn't reach over depth edges
+static float denoise_getDepthGradient(__global float4* guides, uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+	int32_t directionX, int32_t directionY) {
+	float depth = guides[y * width + x].w;
+	float gradient = FLT_MAX;
+	for (int32_t side = -1; side <= 1; side += 2) {
+		int32_t neighborX = (int32_t) x + side * directionX;
+		int32_t neighborY = (int32_t) y + side * directionY;
+		if (neighborX < 0 || neighborY < 0 || neighborX >= (int32_t) width || neighborY >= (int32_t) height) {
+			continue;
+		}
+		float neighborDepth = guides[neighborY * width + neighborX].w;
+		if (neighborDepth > 0.0f) {
+			gradient = min(gradient, fabs(neighborDepth - depth));
+		}
+	}
+	return gradient == FLT_MAX ? 0.0f : gradient;
 }
 
 
@@ -735,78 +1047,99 @@ __kernel void raytrace(__global Camera* camera, __local Camera* sharedCamera, __
 	__global Plane* planes, __local Plane* sharedPlanes, uint32_t planeCount, __global Sphere* spheres, __local Sphere* sharedSpheres, uint32_t sphereCount,
 	__global Triangle* triangles, __local Triangle* sharedTriangles, uint32_t triangleCount,
 	__global PointLight* pointLights, __local PointLight* sharedPointLights, uint32_t pointLightCount,
-	__global OctreeNode* octreeNodes, __local OctreeNode* sharedOctreeNodes, uint32_t octreeNodeCount,
-	__global uint32_t* octreeIndexes, __local uint32_t* sharedOctreeIndexes, uint32_t octreeIndexCount,
+	__global AccelNode* accelNodes, __local AccelNode* sharedAccelNodes, uint32_t accelNodeCount,
+	__global uint32_t* accelIndexes, __local uint32_t* sharedAccelIndexes, uint32_t accelIndexCount,
     __global seed128bit* seed,
 	__write_only image2d_t image, float rayColorContribution, float deltaX, float deltaY,
-	float pixelWidth, float pixelHeight, uint32_t raysPerWidthPixel, uint32_t raysPerHeightPixel) {
+	float pixelWidth, float pixelHeight, uint32_t raysPerWidthPixel, uint32_t raysPerHeightPixel,
+	__global Camera* previousCamera, __global float4* previousHits, __global uint32_t* previousColors,
+	__global float4* hits, __global uint32_t* colors, uint32_t reprojectionMode,
+	__global float4* denoiseColors, __global float4* denoiseGuides, __global uint32_t* denoiseAlbedos, uint32_t isDenoising,
+	__global LightTreeNode* lightTreeNodes, uint32_t maxRayDepth, float rouletteThreshold, uint32_t isFresnelSampling
+#ifdef TRAVERSAL_STATS
+	, __global TraversalStats* traversalStats
+#endif
+	) {
 
-	// copy global data into local shared memory
+	// copy global data into local shared memory, every work item of the group copies a part of it
 #ifdef USE_SHARED_MEMORY
-	if (get_local_id(0)) {
+	uint32_t localId = get_local_id(1) * get_local_size(0) + get_local_id(0);
+	uint32_t localSize = get_local_size(0) * get_local_size(1);
 #ifdef USE_SHARED_MEMORY_CAMERA
+	if (localId == 0) {
 		*sharedCamera = *camera;
+	}
 #define camera sharedCamera
 #endif
 
 #ifdef USE_SHARED_MEMORY_MATERIALS
-		for (uint32_t i = 0; i < materialCount; i++) {
-			sharedMaterials[i] = materials[i];
-		}
+	for (uint32_t i = localId; i < materialCount; i += localSize) {
+		sharedMaterials[i] = materials[i];
+	}
 #define materials sharedMaterials
 #endif
 
 #ifdef USE_SHARED_MEMORY_PLANES
-		for (uint32_t i = 0; i < planeCount; i++) {
-			sharedPlanes[i] = planes[i];
-		}
+	for (uint32_t i = localId; i < planeCount; i += localSize) {
+		sharedPlanes[i] = planes[i];
+	}
 #define planes sharedPlanes
 #endif
 
 #ifdef USE_SHARED_MEMORY_SPHERES
-		for (uint32_t i = 0; i < sphereCount; i++) {
-			sharedSpheres[i] = spheres[i];
-		}
+	for (uint32_t i = localId; i < sphereCount; i += localSize) {
+		sharedSpheres[i] = spheres[i];
+	}
 #define spheres sharedSpheres
 #endif
 
 #ifdef USE_SHARED_MEMORY_TRIANGLES
-		for (uint32_t i = 0; i < triangleCount; i++) {
-			sharedTriangles[i] = triangles[i];
-		}
+	for (uint32_t i = localId; i < triangleCount; i += localSize) {
+		sharedTriangles[i] = triangles[i];
+	}
 #define triangles sharedTriangles
 #endif
 
 #ifdef USE_SHARED_MEMORY_POINTLIGHTS
-		for (uint32_t i = 0; i < pointLightCount; i++) {
-			sharedPointLights[i] = pointLights[i];
-		}
+	for (uint32_t i = localId; i < pointLightCount; i += localSize) {
+		sharedPointLights[i] = pointLights[i];
+	}
 #define pointLights sharedPointLights
 #endif
 
-#ifdef USE_SHARED_MEMORY_OCTREENODES
-		for (uint32_t i = 0; i < octreeNodeCount; i++) {
-			sharedOctreeNodes[i] = octreeNodes[i];
-		}
-#define octreeNodes sharedOctreeNodes
+#ifdef USE_SHARED_MEMORY_ACCELNODES
+	for (uint32_t i = localId; i < accelNodeCount; i += localSize) {
+		sharedAccelNodes[i] = accelNodes[i];
+	}
+#define accelNodes sharedAccelNodes
+#elif defined(SHARED_ACCELNODES_COUNT)
+	for (uint32_t i = localId; i < SHARED_ACCELNODES_COUNT; i += localSize) {
+		sharedAccelNodes[i] = accelNodes[i];
+	}
 #endif
 
-#ifdef USE_SHARED_MEMORY_OCTREEINDEXES
-		for (uint32_t i = 0; i < octreeIndexCount; i++) {
-			sharedOctreeIndexes[i] = octreeIndexes[i];
-		}
-#define octreeIndexes sharedOctreeIndexes
-#endif
-		barrier(CLK_LOCAL_MEM_FENCE);
+#ifdef USE_SHARED_MEMORY_ACCELINDEXES
+	for (uint32_t i = localId; i < accelIndexCount; i += localSize) {
+		sharedAccelIndexes[i] = accelIndexes[i];
 	}
+#define accelIndexes sharedAccelIndexes
+#endif
+	// every work item has to reach the barrier, so it must not be inside divergent control flow
+	barrier(CLK_LOCAL_MEM_FENCE);
 #endif
 
 	uint32_t x = get_global_id(0);
 	uint32_t width = camera->width;
 	uint32_t y = get_global_id(1);
 
-    // pick the correct seed for the thread
-    seed = &seed[x * get_global_size(1) + y];
+#ifdef TRAVERSAL_STATS
+	TraversalStats pixelStats = { 0, 0, 0, 0, 0 };
+	TraversalStats* stats = &pixelStats;
+#endif
+
+    // pick the correct seed for the pixel, the work may start at a row offset
+    uint32_t pixelIndex = y * width + x;
+    seed = &seed[pixelIndex];
 
 	float PosX = -1.0f + 2.0f * ((float)x / (camera->width));
 	float PosY = -1.0f + 2.0f * ((float)y / (camera->height));
@@ -814,8 +1147,54 @@ __kernel void raytrace(__global Camera* camera, __local Camera* sharedCamera, __
 	color.r = 0.0f;
 	color.g = 0.0f;
 	color.b = 0.0f;
+
+	// the hit of a pinhole ray through the first sample position identifies the surface the pixel shows,
+	// w is the number of frames the color was reused or -1 without a hit
+	float4 hit = (float4) (0.0f, 0.0f, 0.0f, -1.0f);
+	// normal and depth of the hit guide the denoiser, a depth of 0 marks the background
+	float4 guide = (float4) (0.0f, 0.0f, 0.0f, 0.0f);
+	Vec3 albedo;
+	albedo.r = 1.0f;
+	albedo.g = 1.0f;
+	albedo.b = 1.0f;
+	bool isReused = false;
+	if (reprojectionMode != REPROJECTION_OFF || isDenoising) {
+		Vec3 offsetX = vec3_mul(camera->x, (PosX - pixelWidth) * camera->renderTargetWidth / 2.0f);
+		Vec3 offsetY = vec3_mul(camera->y, (PosY - pixelHeight) * camera->renderTargetHeight / 2.0f);
+		Ray pixelRay = {
+			camera->position,
+			vec3_norm(vec3_sub(vec3_sub(vec3_add(camera->renderTargetCenter, offsetX), offsetY), camera->position))
+		};
+		float hitDistance;
+		Vec3 hitNormal;
+		uint32_t hitMaterialIndex = raytracer_findHit(planes, planeCount, spheres, sphereCount, triangles, triangleCount, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, &pixelRay, &hitDistance, &hitNormal);
+		Vec3 hitPoint = raytracer_calculateHitpoint(&pixelRay, hitDistance);
+		if (hitMaterialIndex != 0) {
+			hit = (float4) (hitPoint.x, hitPoint.y, hitPoint.z, reprojection_initialAge(x, y));
+			guide = (float4) (hitNormal.x, hitNormal.y, hitNormal.z, hitDistance);
+			albedo = materials[hitMaterialIndex].color;
+		}
+		if (hitMaterialIndex != 0 && reprojectionMode != REPROJECTION_OFF) {
+			uint32_t previousIndex;
+			float tolerance;
+			if (reprojectionMode == REPROJECTION_REUSE && reprojection_findPreviousPixel(previousCamera, hitPoint, &previousIndex, &tolerance)) {
+				float4 previousHit = previousHits[previousIndex];
+				Vec3 previousPoint;
+				previousPoint.x = previousHit.x;
+				previousPoint.y = previousHit.y;
+				previousPoint.z = previousHit.z;
+				// disoccluded pixels find a different surface in the previous frame
+				if (previousHit.w >= 0.0f && previousHit.w < REPROJECTION_MAX_AGE && vec3_length(vec3_sub(previousPoint, hitPoint)) < tolerance) {
+					color = raytracer_unpackColor(previousColors[previousIndex]);
+					hit.w = previousHit.w + 1.0f;
+					isReused = true;
+				}
+			}
+		}
+	}
+
 	// Supersampling loops
-	for (uint32_t j = 0; j < raysPerHeightPixel; j++) {
+	for (uint32_t j = 0; j < raysPerHeightPixel && !isReused; j++) {
 		Vec3 OffsetY = vec3_mul(camera->y,
 			(PosY - pixelHeight + j * deltaY) * camera->renderTargetHeight / 2.0f);
 		for (uint32_t i = 0; i < raysPerWidthPixel; i++) {
@@ -837,7 +1216,8 @@ __kernel void raytrace(__global Camera* camera, __local Camera* sharedCamera, __
             ray.origin = vec3_add(ray.origin, vec3_mul(randomOffset, camera->apertureSize));
             ray.direction = vec3_norm(vec3_sub(focalPoint, ray.origin));
 
-			Vec3 currentRayColor = raytracer_raycast(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, octreeNodes, octreeIndexes, seed, &ray);
+			Vec3 currentRayColor = raytracer_raycast(camera, materials, materialCount, planes, planeCount, spheres, sphereCount, triangles, triangleCount, pointLights, pointLightCount, lightTreeNodes, accelNodes, accelIndexes SHARED_ACCELNODES_ARG TRAVERSAL_STATS_ARG, seed, &ray,
+				maxRayDepth, rouletteThreshold, isFresnelSampling);
 			color = vec3_add(color, vec3_mul(currentRayColor, rayColorContribution));
 		}
 	}
@@ -854,4 +1234,101 @@ __kernel void raytrace(__global Camera* camera, __local Camera* sharedCamera, __
 
 	float4 pixel = (float4) (color.r, color.g, color.b, 1.0f);
 	write_imagef(image, pixelcoord, pixel);
+	if (reprojectionMode != REPROJECTION_OFF) {
+		hits[pixelIndex] = hit;
+		colors[pixelIndex] = raytracer_packColor(color);
+	}
+	// the denoise kernel overwrites the image with the filtered lighting times the albedo
+	if (isDenoising) {
+		uint32_t packedAlbedo = raytracer_packColor(albedo);
+		Vec3 lighting = denoise_demodulate(color, raytracer_unpackColor(packedAlbedo));
+		denoiseColors[pixelIndex] = (float4) (lighting.r, lighting.g, lighting.b, 0.0f);
+		denoiseGuides[pixelIndex] = guide;
+		denoiseAlbedos[pixelIndex] = packedAlbedo;
+	}
+#ifdef TRAVERSAL_STATS
+	traversalStats[pixelIndex] = pixelStats;
+#endif
+}
+
+/*
+ * One pass of the edge avoiding a-trous filter in denoiser.c over the demodulated colors of the raytrace kernel.
+ * The host runs it once per pass with doubled step width and halved color phi, the last pass multiplies
+ * the albedo back and writes the image.
+ */
+__kernel void denoise(__global float4* input, __global float4* output, __global float4* guides, __global uint32_t* albedos,
+	__write_only image2d_t image, uint32_t stepWidth, float colorPhi, uint32_t isLastPass) {
+	const float taps[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	uint32_t x = get_global_id(0);
+	uint32_t y = get_global_id(1);
+	uint32_t width = get_global_size(0);
+	uint32_t height = get_global_size(1);
+	uint32_t index = y * width + x;
+	float4 center = guides[index];
+	float4 filtered = input[index];
+
+	// the background has nothing to blur
+	if (center.w > 0.0f) {
+		Vec3 centerNormal;
+		centerNormal.x = center.x;
+		centerNormal.y = center.y;
+		centerNormal.z = center.z;
+		float gradientX = denoise_getDepthGradient(guides, width, height, x, y, 1, 0);
+		float gradientY = denoise_getDepthGradient(guides, width, height, x, y, 0, 1);
+		float centerLuminance = denoise_getLuminance(filtered);
+
+		Vec3 sum;
+		sum.x = 0.0f;
+		sum.y = 0.0f;
+		sum.z = 0.0f;
+		float weightSum = 0.0f;
+		for (int32_t j = -2; j <= 2; j++) {
+			int32_t tapY = (int32_t) y + j * (int32_t) stepWidth;
+			if (tapY < 0 || tapY >= (int32_t) height) {
+				continue;
+			}
+			for (int32_t i = -2; i <= 2; i++) {
+				int32_t tapX = (int32_t) x + i * (int32_t) stepWidth;
+				if (tapX < 0 || tapX >= (int32_t) width) {
+					continue;
+				}
+				uint32_t tapIndex = tapY * width + tapX;
+				float4 tap = guides[tapIndex];
+				if (tap.w <= 0.0f) {
+					continue;
+				}
+				Vec3 tapNormal;
+				tapNormal.x = tap.x;
+				tapNormal.y = tap.y;
+				tapNormal.z = tap.z;
+				float4 tapColor = input[tapIndex];
+				float expectedDepthDifference = gradientX * (float) abs(i * (int32_t) stepWidth) + gradientY * (float) abs(j * (int32_t) stepWidth);
+				float depthWeight = exp(-fabs(center.w - tap.w) / (DENOISER_DEPTH_PHI * expectedDepthDifference + 0.001f * center.w));
+				float normalWeight = pow(max(vec3_dot(centerNormal, tapNormal), 0.0f), DENOISER_NORMAL_PHI);
+				float colorWeight = exp(-fabs(centerLuminance - denoise_getLuminance(tapColor)) / colorPhi);
+				float weight = taps[abs(i)] * taps[abs(j)] * depthWeight * normalWeight * colorWeight;
+				sum.x += tapColor.x * weight;
+				sum.y += tapColor.y * weight;
+				sum.z += tapColor.z * weight;
+				weightSum += weight;
+			}
+		}
+		if (weightSum > 0.0f) {
+			filtered = (float4) (sum.x / weightSum, sum.y / weightSum, sum.z / weightSum, 0.0f);
+		}
+	}
+
+	output[index] = filtered;
+	if (isLastPass) {
+		Vec3 albedo = raytracer_unpackColor(albedos[index]);
+		Vec3 color;
+		color.r = filtered.x;
+		color.g = filtered.y;
+		color.b = filtered.z;
+		color = vec3_clamp(vec3_hadamard(color, albedo), 0.0f, 1.0f);
+		int2 pixelcoord;
+		pixelcoord.x = x;
+		pixelcoord.y = y;
+		write_imagef(image, pixelcoord, (float4) (color.r, color.g, color.b, 1.0f));
+	}
 }
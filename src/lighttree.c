@@ -0,0 +1,129 @@
+#include "lighttree.h"
+
+#include <stdlib.h>
+
+#include "utils/math.h"
+
+static float lighttree_getPower(const PointLight* light) {
+	Vec3 color = light->emissionColor;
+	return light->strength * (0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b);
+}
+
+static float lighttree_getAxis(Vec3 v, uint32_t axis) {
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// moves the light with the k-th smallest position on the axis to k, the smaller ones before and the larger ones after it
+static void lighttree_select(const PointLight* lights, uint32_t* indexes, uint32_t count, uint32_t k, uint32_t axis) {
+	uint32_t begin = 0;
+	uint32_t end = count;
+	while (end - begin > 1) {
+		float pivot = lighttree_getAxis(lights[indexes[begin + (end - begin) / 2]].position, axis);
+		uint32_t less = begin;
+		uint32_t greater = end;
+		uint32_t i = begin;
+		// three way partition, so equal positions can't loop forever
+		while (i < greater) {
+			float value = lighttree_getAxis(lights[indexes[i]].position, axis);
+			uint32_t index = indexes[i];
+			if (value < pivot) {
+				indexes[i++] = indexes[less];
+				indexes[less++] = index;
+			} else if (value > pivot) {
+				indexes[i] = indexes[--greater];
+				indexes[greater] = index;
+			} else {
+				i++;
+			}
+		}
+		if (k < less) {
+			end = less;
+		} else if (k >= greater) {
+			begin = greater;
+		} else {
+			return;
+		}
+	}
+}
+
+static uint32_t lighttree_buildNode(const PointLight* lights, uint32_t* indexes, uint32_t count, LightTreeNode* nodes,
+	uint32_t nodeIndex, uint32_t nodeCount) {
+	LightTreeNode* node = &nodes[nodeIndex];
+	node->min = lights[indexes[0]].position;
+	node->max = lights[indexes[0]].position;
+	node->power = 0.0f;
+	for (uint32_t i = 0; i < count; i++) {
+		Vec3 position = lights[indexes[i]].position;
+		node->min = (Vec3) { { MIN(node->min.x, position.x), MIN(node->min.y, position.y), MIN(node->min.z, position.z) } };
+		node->max = (Vec3) { { MAX(node->max.x, position.x), MAX(node->max.y, position.y), MAX(node->max.z, position.z) } };
+		node->power += lighttree_getPower(&lights[indexes[i]]);
+	}
+	if (count == 1) {
+		node->firstChild = 0;
+		node->lightIndex = indexes[0];
+		return nodeCount;
+	}
+
+	// median split along the longest side
+	Vec3 extent = vec3_sub(node->max, node->min);
+	uint32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	uint32_t leftCount = count / 2;
+	lighttree_select(lights, indexes, count, leftCount, axis);
+	uint32_t firstChild = nodeCount;
+	node->firstChild = firstChild;
+	node->lightIndex = 0;
+	nodeCount = lighttree_buildNode(lights, indexes, leftCount, nodes, firstChild, nodeCount + 2);
+	return lighttree_buildNode(lights, indexes + leftCount, count - leftCount, nodes, firstChild + 1, nodeCount);
+}
+
+uint32_t lighttree_getNodeCount(uint32_t lightCount) {
+	return lightCount > 0 ? 2 * lightCount - 1 : 0;
+}
+
+bool lighttree_build(const PointLight* lights, uint32_t lightCount, LightTreeNode* nodes) {
+	if (lightCount == 0) {
+		return true;
+	}
+	uint32_t* indexes = malloc(sizeof(uint32_t) * lightCount);
+	if (!indexes) {
+		return false;
+	}
+	for (uint32_t i = 0; i < lightCount; i++) {
+		indexes[i] = i;
+	}
+	lighttree_buildNode(lights, indexes, lightCount, nodes, 0, 1);
+	free(indexes);
+	return true;
+}
+
+// the power attenuated like a point light at the closest point of the bounds, see the lightAttenuation of raytracer_createShadowRay
+static float lighttree_getImportance(const LightTreeNode* node, Vec3 point) {
+	float dx = MAX(MAX(node->min.x - point.x, point.x - node->max.x), 0.0f);
+	float dy = MAX(MAX(node->min.y - point.y, point.y - node->max.y), 0.0f);
+	float dz = MAX(MAX(node->min.z - point.z, point.z - node->max.z), 0.0f);
+	return node->power / (1.0f + 4 * PI * (dx * dx + dy * dy + dz * dz));
+}
+
+uint32_t lighttree_sampleLight(const LightTreeNode* nodes, Vec3 point, float u, float* probability) {
+	const LightTreeNode* node = &nodes[0];
+	*probability = 1.0f;
+	while (node->firstChild != 0) {
+		const LightTreeNode* left = &nodes[node->firstChild];
+		float leftImportance = lighttree_getImportance(left, point);
+		float rightImportance = lighttree_getImportance(left + 1, point);
+		float totalImportance = leftImportance + rightImportance;
+		float leftProbability = totalImportance > 0.0f ? leftImportance / totalImportance : 0.5f;
+		// the random number is reused for the next level, scaled to [0, 1) within the picked child,
+		// rounding may push it to 1, which must not pick a child without probability
+		if (u < leftProbability || leftProbability >= 1.0f) {
+			node = left;
+			*probability *= leftProbability;
+			u = u / leftProbability;
+		} else {
+			node = left + 1;
+			*probability *= 1.0f - leftProbability;
+			u = (u - leftProbability) / (1.0f - leftProbability);
+		}
+	}
+	return node->lightIndex;
+}
@@ -0,0 +1,39 @@
+#ifndef RAYTRACER_LIGHTTREE_H
+#define RAYTRACER_LIGHTTREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pointlight.h"
+#include "utils/vec3.h"
+
+/*
+ * Binary tree over the point lights, which picks a light for a shadow ray with a probability proportional
+ * to its estimated contribution at the hit point. The estimate of a node is the summed power of its lights,
+ * attenuated like a point light at the closest point of the node bounds, so it ignores occlusion and the normal.
+ * Dividing the lighting by the probability keeps the expected color of the loop over all lights.
+ * The raytrace kernel in kernel.cl samples the tree the same way.
+ */
+
+// scenes with more lights trace a fixed number of shadow rays per hit to lights picked from the tree
+#define LIGHTTREE_MIN_LIGHT_COUNT 8
+
+typedef struct {
+	// bounds of the light positions below the node
+	Vec3 min;
+	Vec3 max;
+	// strength times the luminance of the emission color, summed over the lights below the node
+	float power;
+	// the children are firstChild and firstChild + 1, a leaf has no children (0) and the index of its light
+	uint32_t firstChild;
+	uint32_t lightIndex;
+} LightTreeNode;
+
+// the number of nodes a tree over lightCount lights has
+uint32_t lighttree_getNodeCount(uint32_t lightCount);
+// writes the tree into nodes, which has to hold lighttree_getNodeCount entries, returns false if the memory for it is missing
+bool lighttree_build(const PointLight* lights, uint32_t lightCount, LightTreeNode* nodes);
+// the light for the random number u in [0, 1) and the probability, with which it was picked
+uint32_t lighttree_sampleLight(const LightTreeNode* nodes, Vec3 point, float u, float* probability);
+
+#endif //RAYTRACER_LIGHTTREE_H
@@ -9,8 +9,14 @@
 #include "camera.h"
 #include "scene.h"
 #include "octree.h"
+#include "accel.h"
 #include "raytracer.h"
 #include "gpu.h"
+#include "hybrid.h"
+#include "dynamicresolution.h"
+#include "trace.h"
+#include "memstats.h"
+#include "traversalstats.h"
 
 #include "utils/random.h"
 #include "utils/math.h"
@@ -20,12 +26,20 @@
 
 #define RENDER_WIDTH  1920
 #define RENDER_HEIGHT 1080
+// while the scene changes, the render resolution is lowered to hold this frame time
+#define TARGET_FRAME_TIME (1000.0 / 30.0)
 
 uint32_t viewWidth = RENDER_WIDTH;
 uint32_t viewHeight = RENDER_HEIGHT;
 
 uint32_t raysPerPixel = 1;
 
+static void main_printMemoryStats(Scene* scene, Accel* accel, AccelType accelType) {
+	memstats_print(stdout);
+	// only the octree has a depth limit
+	accel_printReport(accel, scene, accelType, accelType == ACCEL_OCTREE ? OCTREE_MAX_DEPTH : ACCEL_NO_DEPTH_LIMIT, stdout);
+}
+
 int main(int argc, char* argv[]) {
     (void) argc;
     (void) argv;
@@ -49,6 +63,9 @@ int main(int argc, char* argv[]) {
         return 2;
     }
 
+	// set RAYTRACER_TRACE to a file path to record a timeline of all frames
+	trace_init(getenv("RAYTRACER_TRACE"));
+
 	SDL_GLContext glContext = SDL_GL_CreateContext(window);
 	// try to set adaptive swap interval
 	if (SDL_GL_SetSwapInterval(-1) != 0) {
@@ -62,20 +79,38 @@ int main(int argc, char* argv[]) {
 	}
 	
 	Scene* scene = scene_init(RENDER_WIDTH, RENDER_HEIGHT);
-	Octree* octree = octree_buildFromScene(scene);
+	AccelType accelType = accel_getType(scene);
+	Accel* accel = accel_build(scene, accelType);
+	if (!accel) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to build the %s.", accel_getName(accelType));
+		return 3;
+	}
 	Image* image = image_create(RENDER_WIDTH, RENDER_HEIGHT);
 
-	GPUContext* context = gpu_initContext(scene, octree, raysPerPixel);
+	GPUContext* context = gpu_initContext(scene, accel, raysPerPixel);
     if (!context) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to create gpuContext.");
         return 3;
     }
+	DynamicResolution* resolution = dynamicresolution_create(RENDER_WIDTH, RENDER_HEIGHT, TARGET_FRAME_TIME);
+	// one core is left for the main thread, which renders tiles as well
+	HybridRenderer* hybrid = hybrid_create((uint32_t) MAX(SDL_GetCPUCount() - 1, 0));
 
     // wait for quit event before quitting
     bool running = true;
 	bool takeScreenshot = false;
+	bool takeHeatmap = false;
     bool isSceneChanged = true;
     bool alwaysRender = false;
+	// without the controller every frame is rendered with the full resolution
+	bool useDynamicResolution = resolution != NULL;
+	bool useHybridRendering = false;
+	bool useReprojection = false;
+	bool useDenoising = false;
+	bool useFresnelSampling = false;
+	bool useRoulette = false;
+	// the last frame reused pixels of the frame before, so it has to be traced completely once the camera stops
+	bool isFrameReprojected = false;
 
 	uint32_t previousTime = SDL_GetTicks();
 	double delta = 0.0;
@@ -94,6 +129,7 @@ int main(int argc, char* argv[]) {
             int moveFrontal = 0;
 
 		    // input handling
+			TRACE_BEGIN("input");
             SDL_Event event;
             while (SDL_PollEvent(&event)) {
                 switch(event.type) {
@@ -136,6 +172,40 @@ int main(int argc, char* argv[]) {
                             break;
                         case SDLK_r: // toggle alwaysRender
                             alwaysRender = !alwaysRender;
+                            break;
+                        case SDLK_f: // toggle the dynamic resolution
+                            useDynamicResolution = resolution && !useDynamicResolution;
+                            break;
+                        case SDLK_c: // toggle rendering part of the frame on the CPU
+                            useHybridRendering = hybrid && !useHybridRendering;
+                            isSceneChanged = true;
+                            break;
+                        case SDLK_p: // toggle reusing the pixels of the last frame while the camera moves
+                            useReprojection = !useReprojection;
+                            isSceneChanged = true;
+                            break;
+                        case SDLK_n: // toggle the denoiser
+                            useDenoising = !useDenoising;
+                            if (!gpu_setDenoising(context, useDenoising)) {
+                                useDenoising = false;
+                            }
+                            isSceneChanged = true;
+                            break;
+                        case SDLK_g: // toggle tracing only one of the reflected and refracted rays of glass
+                            useFresnelSampling = !useFresnelSampling;
+                            gpu_setRayTermination(context, useRoulette ? RAYTRACER_ROULETTE_THRESHOLD : 0.0f, useFresnelSampling);
+                            isSceneChanged = true;
+                            break;
+                        case SDLK_t: // toggle dropping weak secondary rays by Russian roulette
+                            useRoulette = !useRoulette;
+                            gpu_setRayTermination(context, useRoulette ? RAYTRACER_ROULETTE_THRESHOLD : 0.0f, useFresnelSampling);
+                            isSceneChanged = true;
+                            break;
+                        case SDLK_h: // write the traversal heatmaps
+                            takeHeatmap = true;
+                            break;
+                        case SDLK_m: // print the memory stats
+                            main_printMemoryStats(scene, accel, accelType);
                             break;
 					    case SDLK_PRINTSCREEN:
 						    takeScreenshot = true;
@@ -154,6 +224,8 @@ int main(int argc, char* argv[]) {
                 }
             }
 
+			TRACE_END();
+
             if (moveUpDown || moveSide || moveFrontal) {
                 move_camera(scene->camera, moveUpDown, moveSide, moveFrontal);
                 camera_setup(scene->camera);
@@ -165,32 +237,90 @@ int main(int argc, char* argv[]) {
 		}
 
 		// render
-        if (alwaysRender || isSceneChanged || takeScreenshot) {
+		bool renderFrame = alwaysRender || isSceneChanged || takeScreenshot || takeHeatmap || isFrameReprojected;
+		bool isDynamicFrame = useDynamicResolution && (alwaysRender || isSceneChanged) && !takeScreenshot && !takeHeatmap;
+		uint32_t renderWidth = RENDER_WIDTH;
+		uint32_t renderHeight = RENDER_HEIGHT;
+		if (isDynamicFrame) {
+			dynamicresolution_getSize(resolution, &renderWidth, &renderHeight);
+		} else if (scene->camera->width != RENDER_WIDTH || scene->camera->height != RENDER_HEIGHT) {
+			// the scene stopped changing, so refine the last frame with the full resolution
+			renderFrame = true;
+		}
+
+        if (renderFrame) {
+			TRACE_BEGIN("frame");
+			if (!gpu_resizeRenderTarget(context, scene, accel, renderWidth, renderHeight)) {
+				SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to resize the render target.");
+				TRACE_END();
+				break;
+			}
+			// still frames are traced completely, but recorded, so that the next movement can start from them
+			ReprojectionMode reprojectionMode = REPROJECTION_OFF;
+			if (useReprojection) {
+				bool isMoving = isSceneChanged && !takeScreenshot && !takeHeatmap;
+				reprojectionMode = isMoving ? REPROJECTION_REUSE : REPROJECTION_RECORD;
+			}
+			if (!gpu_setReprojectionMode(context, reprojectionMode)) {
+				useReprojection = false;
+			}
+			// the hybrid frames are split, so they are traced completely
+			isFrameReprojected = reprojectionMode == REPROJECTION_REUSE && !useHybridRendering;
             if (takeScreenshot) {
                 // render to the backbuffer and copy the clImage to the image struct
-                gpu_renderScene(context, scene, image);
+                gpu_renderScene(context, scene, accel, image);
 
                 char filename[255];
                 time_t now = time(NULL);
                 snprintf(filename, sizeof(filename), "%d_raytracer.bmp", (int)now);
 
+                TRACE_BEGIN("bmp save");
                 bitmap_save_image(filename, image);
+                TRACE_END();
                 takeScreenshot = false;
             } else {
                 // just render to the backbuffer
-                gpu_renderScene(context, scene, NULL);
+                if (useHybridRendering) {
+                    hybrid_renderScene(hybrid, context, scene, accel, NULL);
+                } else {
+                    gpu_renderScene(context, scene, accel, NULL);
+                }
+            }
+            if (takeHeatmap) {
+                TraversalStats* stats = malloc(sizeof(TraversalStats) * renderWidth * renderHeight);
+                if (stats && gpu_readTraversalStats(context, scene, stats)) {
+                    char prefix[255];
+                    snprintf(prefix, sizeof(prefix), "%d_heatmap", (int) time(NULL));
+                    traversalstats_writeReport(prefix, stats, renderWidth, renderHeight);
+                }
+                free(stats);
+                takeHeatmap = false;
             }
+            TRACE_BEGIN("swap");
             SDL_GL_SwapWindow(window);
+            TRACE_END();
             isSceneChanged = false;
+			if (isDynamicFrame) {
+				// the hybrid frame is done, when the slower side is done
+				double frameTime = useHybridRendering ? MAX(hybrid->cpuTime, hybrid->gpuTime) : context->cl.kernelTime;
+				dynamicresolution_update(resolution, frameTime);
+			}
+			TRACE_END();
         }
     }
 
+	main_printMemoryStats(scene, accel, accelType);
+
+	hybrid_destroy(hybrid);
+	dynamicresolution_destroy(resolution);
     gpu_destroyContext(context);
 	
 	image_destroy(image);
-	octree_destroy(octree);
+	accel_destroy(accel);
 	scene_destroy(scene);
 
+	trace_shutdown();
+
 	SDL_GL_DeleteContext(glContext);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -0,0 +1,75 @@
+#include "memstats.h"
+
+#include <stdint.h>
+
+typedef struct {
+	size_t live;
+	size_t peak;
+} MemStatsCounter;
+
+static const char* memstats_names[MEMSTATS_SUBSYSTEM_COUNT] = {
+	"scene",
+	"objectLoad",
+	"accelBuild",
+	"accel",
+	"deviceScene",
+	"devicePixels"
+};
+
+static MemStatsCounter memstats_counters[MEMSTATS_SUBSYSTEM_COUNT];
+
+void memstats_allocate(MemStatsSubsystem subsystem, size_t bytes) {
+	MemStatsCounter* counter = &memstats_counters[subsystem];
+	counter->live += bytes;
+	if (counter->live > counter->peak) {
+		counter->peak = counter->live;
+	}
+}
+
+void memstats_free(MemStatsSubsystem subsystem, size_t bytes) {
+	MemStatsCounter* counter = &memstats_counters[subsystem];
+	// a missed allocation must not wrap around
+	counter->live = bytes < counter->live ? counter->live - bytes : 0;
+}
+
+void memstats_reallocate(MemStatsSubsystem subsystem, size_t oldBytes, size_t newBytes) {
+	if (newBytes < oldBytes) {
+		memstats_free(subsystem, oldBytes - newBytes);
+		return;
+	}
+	// a growing realloc may copy, so both blocks can exist at the same time
+	memstats_allocate(subsystem, newBytes);
+	memstats_free(subsystem, oldBytes);
+}
+
+size_t memstats_getLiveBytes(MemStatsSubsystem subsystem) {
+	return memstats_counters[subsystem].live;
+}
+
+size_t memstats_getPeakBytes(MemStatsSubsystem subsystem) {
+	return memstats_counters[subsystem].peak;
+}
+
+const char* memstats_getName(MemStatsSubsystem subsystem) {
+	return memstats_names[subsystem];
+}
+
+void memstats_resetPeaks(void) {
+	for (uint32_t i = 0; i < MEMSTATS_SUBSYSTEM_COUNT; i++) {
+		memstats_counters[i].peak = memstats_counters[i].live;
+	}
+}
+
+void memstats_print(FILE* file) {
+	size_t totalLive = 0;
+	size_t totalPeak = 0;
+	fprintf(file, "%-14s %12s %12s\n", "memory", "live KiB", "peak KiB");
+	for (uint32_t i = 0; i < MEMSTATS_SUBSYSTEM_COUNT; i++) {
+		MemStatsCounter* counter = &memstats_counters[i];
+		fprintf(file, "%-14s %12.1f %12.1f\n", memstats_names[i], (double) counter->live / 1024.0, (double) counter->peak / 1024.0);
+		totalLive += counter->live;
+		// the subsystems don't peak at the same time, so this is an upper bound
+		totalPeak += counter->peak;
+	}
+	fprintf(file, "%-14s %12.1f %12.1f\n", "total", (double) totalLive / 1024.0, (double) totalPeak / 1024.0);
+}
@@ -0,0 +1,39 @@
+#ifndef RAYTRACER_MEMSTATS_H
+#define RAYTRACER_MEMSTATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Counts the live and peak bytes of the large allocations per subsystem.
+ * The owners report every allocation, resize and free of their arrays by its capacity in bytes,
+ * small structs like the Scene or Accel headers aren't tracked.
+ * Only the main thread may report allocations.
+ */
+
+typedef enum {
+	MEMSTATS_SCENE,
+	// vertex tables and triangle lists, while an obj file is loaded
+	MEMSTATS_OBJECT_LOAD,
+	// the scratch memory of the builders, e.g. the index lists of the queued octree nodes
+	MEMSTATS_ACCEL_BUILD,
+	MEMSTATS_ACCEL,
+	MEMSTATS_DEVICE_SCENE,
+	// random seeds, traversal stats and the render target
+	MEMSTATS_DEVICE_PIXELS,
+	MEMSTATS_SUBSYSTEM_COUNT
+} MemStatsSubsystem;
+
+void memstats_allocate(MemStatsSubsystem subsystem, size_t bytes);
+void memstats_free(MemStatsSubsystem subsystem, size_t bytes);
+void memstats_reallocate(MemStatsSubsystem subsystem, size_t oldBytes, size_t newBytes);
+
+size_t memstats_getLiveBytes(MemStatsSubsystem subsystem);
+size_t memstats_getPeakBytes(MemStatsSubsystem subsystem);
+const char* memstats_getName(MemStatsSubsystem subsystem);
+// sets the peaks to the live bytes, to measure the peak of a single phase
+void memstats_resetPeaks(void);
+
+void memstats_print(FILE* file);
+
+#endif //RAYTRACER_MEMSTATS_H
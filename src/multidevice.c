@@ -0,0 +1,172 @@
+#include "multidevice.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "utils/math.h"
+
+// every device keeps a few rows, so its speed is still measured
+#define MULTIDEVICE_MIN_ROWS 8
+// only this part of the correction is applied per frame, so a single slow frame doesn't move all rows
+#define MULTIDEVICE_SMOOTHING 0.5f
+
+static void multidevice_assignRows(MultiDevice* multiDevice, uint32_t height) {
+	uint32_t minRows = MIN(MULTIDEVICE_MIN_ROWS, height / multiDevice->deviceCount);
+	uint32_t rowBegin = 0;
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		uint32_t remainingRows = height - rowBegin;
+		uint32_t devicesLeft = multiDevice->deviceCount - i - 1;
+		uint32_t rowCount = remainingRows;
+		if (devicesLeft > 0) {
+			rowCount = (uint32_t) (band->share * (float) height + 0.5f);
+			rowCount = MAX(rowCount, minRows);
+			rowCount = MIN(rowCount, remainingRows - devicesLeft * minRows);
+		}
+		band->rowBegin = rowBegin;
+		band->rowCount = rowCount;
+		rowBegin += rowCount;
+	}
+}
+
+// moves the shares towards the rows per ms, that the devices reached in the last frame
+static void multidevice_rebalance(MultiDevice* multiDevice) {
+	float totalSpeed = 0.0f;
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		if (band->rowCount == 0 || band->context->cl.kernelTime <= 0.0) {
+			// without a measurement the shares stay as they are
+			return;
+		}
+		totalSpeed += (float) ((double) band->rowCount / band->context->cl.kernelTime);
+	}
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		float speed = (float) ((double) band->rowCount / band->context->cl.kernelTime);
+		band->share += (speed / totalSpeed - band->share) * MULTIDEVICE_SMOOTHING;
+	}
+}
+
+MultiDevice* multidevice_create(Scene* scene, Accel* accel, uint32_t raysPerPixel,
+	const cl_platform_id* platformIds, const cl_device_id* deviceIds, uint32_t deviceCount) {
+	if (deviceCount == 0) {
+		return NULL;
+	}
+	MultiDevice* multiDevice = malloc(sizeof(MultiDevice));
+	if (!multiDevice) {
+		return NULL;
+	}
+	multiDevice->bands = calloc(deviceCount, sizeof(MultiDeviceBand));
+	if (!multiDevice->bands) {
+		free(multiDevice);
+		return NULL;
+	}
+	multiDevice->deviceCount = deviceCount;
+	multiDevice->kernelTime = 0.0;
+	for (uint32_t i = 0; i < deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		band->context = gpu_initHeadlessContext(scene, accel, raysPerPixel, platformIds[i], deviceIds[i]);
+		if (!band->context) {
+			printf("Couldn't create the context of device %u.\n", i);
+			multidevice_destroy(multiDevice);
+			return NULL;
+		}
+		// the first frame splits the rows evenly
+		band->share = 1.0f / (float) deviceCount;
+	}
+	multidevice_assignRows(multiDevice, scene->camera->height);
+	return multiDevice;
+}
+
+bool multidevice_setRayLimits(MultiDevice* multiDevice, Scene* scene, Accel* accel, uint32_t maxRayDepth, uint32_t shadowRayCount) {
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		if (!gpu_setRayLimits(multiDevice->bands[i].context, scene, accel, maxRayDepth, shadowRayCount)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void multidevice_markSceneDirty(MultiDevice* multiDevice, SceneSyncArray array, uint32_t first, uint32_t count) {
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		gpu_markSceneDirty(multiDevice->bands[i].context, array, first, count);
+	}
+}
+
+bool multidevice_renderScene(MultiDevice* multiDevice, Scene* scene, Accel* accel, Image* image) {
+	TRACE_BEGIN("multi device frame");
+	bool success = true;
+	// all devices work at the same time, so everything is enqueued before the first wait
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		if (band->rowCount == 0) {
+			continue;
+		}
+		if (!gpu_enqueueRows(band->context, scene, accel, band->rowBegin, band->rowCount, image)) {
+			band->context->cl.kernelTime = 0.0;
+			success = false;
+		}
+	}
+	multiDevice->kernelTime = 0.0;
+	for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+		MultiDeviceBand* band = &multiDevice->bands[i];
+		if (band->rowCount == 0) {
+			continue;
+		}
+		gpu_finishRows(band->context);
+		multiDevice->kernelTime = MAX(multiDevice->kernelTime, band->context->cl.kernelTime);
+	}
+	TRACE_END();
+
+	if (success) {
+		multidevice_rebalance(multiDevice);
+		multidevice_assignRows(multiDevice, scene->camera->height);
+	}
+	return success;
+}
+
+void multidevice_destroy(MultiDevice* multiDevice) {
+	if (multiDevice) {
+		for (uint32_t i = 0; i < multiDevice->deviceCount; i++) {
+			gpu_destroyContext(multiDevice->bands[i].context);
+		}
+		free(multiDevice->bands);
+		free(multiDevice);
+	}
+}
+
+uint32_t multidevice_createSubDevices(cl_device_id deviceId, uint32_t maxCount, cl_device_id* subDeviceIds) {
+	cl_uint computeUnits = 0;
+	if (maxCount == 0 || clGetDeviceInfo(deviceId, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, NULL) != CL_SUCCESS) {
+		return 0;
+	}
+	cl_uint unitsPerDevice = MAX(computeUnits / maxCount, 1);
+	const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property) unitsPerDevice, 0 };
+
+	// the partition may create more devices than requested, if the units don't divide evenly
+	cl_uint subDeviceCount = 0;
+	if (clCreateSubDevices(deviceId, properties, 0, NULL, &subDeviceCount) != CL_SUCCESS || subDeviceCount == 0) {
+		printf("The device can't be partitioned.\n");
+		return 0;
+	}
+	cl_device_id* allSubDeviceIds = malloc(sizeof(cl_device_id) * subDeviceCount);
+	if (!allSubDeviceIds) {
+		return 0;
+	}
+	if (clCreateSubDevices(deviceId, properties, subDeviceCount, allSubDeviceIds, NULL) != CL_SUCCESS) {
+		printf("Couldn't create the sub devices.\n");
+		free(allSubDeviceIds);
+		return 0;
+	}
+	uint32_t count = MIN(subDeviceCount, maxCount);
+	for (uint32_t i = 0; i < subDeviceCount; i++) {
+		if (i < count) {
+			subDeviceIds[i] = allSubDeviceIds[i];
+		} else {
+			clReleaseDevice(allSubDeviceIds[i]);
+		}
+	}
+	free(allSubDeviceIds);
+	return count;
+}
@@ -0,0 +1,44 @@
+#ifndef RAYTRACER_MULTIDEVICE_H
+#define RAYTRACER_MULTIDEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpu.h"
+
+/*
+ * Renders a frame on several OpenCL devices at once. Every device has a headless context with its own
+ * copy of the scene and renders a band of rows, which is read back into the same rows of the image.
+ * The band heights follow the rows per ms of the previous frames, so faster devices get more rows.
+ * The resolution is fixed, because all contexts share the camera of the scene.
+ */
+
+typedef struct {
+	GPUContext* context;
+	uint32_t rowBegin;
+	uint32_t rowCount;
+	// part of the frame the device should render, the shares of all devices add up to 1
+	float share;
+} MultiDeviceBand;
+
+typedef struct {
+	MultiDeviceBand* bands;
+	uint32_t deviceCount;
+	// kernel time of the slowest device in the last frame in ms
+	double kernelTime;
+} MultiDevice;
+
+// the platform of every device is needed for its context
+MultiDevice* multidevice_create(Scene* scene, Accel* accel, uint32_t raysPerPixel,
+	const cl_platform_id* platformIds, const cl_device_id* deviceIds, uint32_t deviceCount);
+bool multidevice_setRayLimits(MultiDevice* multiDevice, Scene* scene, Accel* accel, uint32_t maxRayDepth, uint32_t shadowRayCount);
+void multidevice_markSceneDirty(MultiDevice* multiDevice, SceneSyncArray array, uint32_t first, uint32_t count);
+// the image may be NULL, if the result isn't needed
+bool multidevice_renderScene(MultiDevice* multiDevice, Scene* scene, Accel* accel, Image* image);
+void multidevice_destroy(MultiDevice* multiDevice);
+
+// partitions the device into at most maxCount sub devices with the same number of compute units,
+// returns the number of sub devices, which have to be released with clReleaseDevice
+uint32_t multidevice_createSubDevices(cl_device_id deviceId, uint32_t maxCount, cl_device_id* subDeviceIds);
+
+#endif //RAYTRACER_MULTIDEVICE_H
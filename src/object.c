@@ -7,6 +7,7 @@
 
 #include "utils/file.h"
 #include "vertextable.h"
+#include "memstats.h"
 
 #define DEFAULT_CAPACITY 200
 
@@ -100,6 +101,7 @@ static Object* object_createObject(void) {
     object->triangleCount = 0;
     object->capacity = DEFAULT_CAPACITY;
     object->triangles= malloc(sizeof(Triangle) * object->capacity);
+    memstats_allocate(MEMSTATS_OBJECT_LOAD, sizeof(Triangle) * object->capacity);
     return object;
 }
 
@@ -107,6 +109,7 @@ static void object_addTriangle(Object* object, Triangle triangle) {
     if (object->capacity < object->triangleCount + 1) {
         object->capacity *= 2;
         object->triangles = realloc(object->triangles, sizeof(Triangle) * object->capacity);
+        memstats_reallocate(MEMSTATS_OBJECT_LOAD, sizeof(Triangle) * object->capacity / 2, sizeof(Triangle) * object->capacity);
     }
     object->triangles[object->triangleCount++] = triangle;
 }
@@ -146,8 +149,9 @@ Object* object_loadFromFile(const char* filepath) {
     Object* object = object_createObject();
     VertexTable* vertexTable = vertextable_create();
 
-    size_t fileSize;
-    const char* data = file_readFile(filepath, &fileSize);
+    size_t fileSize = 0;
+    char* data = file_readFile(filepath, &fileSize);
+    memstats_allocate(MEMSTATS_OBJECT_LOAD, fileSize);
     size_t offset = 0;
     do {
         object_skipWhitespace(data, &offset);
@@ -179,7 +183,8 @@ Object* object_loadFromFile(const char* filepath) {
         }
     } while (object_skipToNextLine(data, &offset));
 
-    free((void*) data);
+    free(data);
+    memstats_free(MEMSTATS_OBJECT_LOAD, fileSize);
     vertextable_destroy(vertexTable);
     return object;
 }
@@ -211,6 +216,7 @@ void object_materialIndex(Object* object, uint32_t materialIndex) {
 
 void object_destroy(Object* object) {
     if (object) {
+        memstats_free(MEMSTATS_OBJECT_LOAD, sizeof(Triangle) * object->capacity);
         free(object->triangles);
         free(object);
     }
@@ -3,425 +3,278 @@
 #include <stdlib.h>
 #include <float.h>
 #include <stdbool.h>
-
-static BoundingBox octree_calculateRootBoundingBox(Scene* scene) {
-	BoundingBox boundingBox = { 0 };
-	for (uint32_t i = 0; i < scene->sphereCount; i++) {
-		Sphere* sphere = &scene->spheres[i];
-		Vec3 extremePoints[6] = {
-			vec3_add(sphere->position, (Vec3) { 0.0f, 0.0f, sphere->radius }), // FRONT
-			vec3_add(sphere->position, (Vec3) { 0.0f, 0.0f, -sphere->radius }), // BACK
-			vec3_add(sphere->position, (Vec3) { 0.0f, sphere->radius, 0.0f }), // TOP
-			vec3_add(sphere->position, (Vec3) { 0.0f, -sphere->radius, 0.0f }), // BOTTOM
-			vec3_add(sphere->position, (Vec3) { -sphere->radius, 0.0f, 0.0f }), // LEFT
-			vec3_add(sphere->position, (Vec3) { sphere->radius, 0.0f, 0.0f }) // RIGHT
-		};
-		for (uint32_t x = 0; x < 6; x++) {
-			Vec3* v = &extremePoints[x];
-			if (v->x < boundingBox.bottomLeftFrontCorner.x) {
-				boundingBox.bottomLeftFrontCorner.x = v->x;
-			}
-			if (v->y < boundingBox.bottomLeftFrontCorner.y) {
-				boundingBox.bottomLeftFrontCorner.y = v->y;
-			}
-			if (v->z < boundingBox.bottomLeftFrontCorner.z) {
-				boundingBox.bottomLeftFrontCorner.z = v->z;
-			}
-
-			if (v->x > boundingBox.topRightBackCorner.x) {
-				boundingBox.topRightBackCorner.x = v->x;
-			}
-			if (v->y > boundingBox.topRightBackCorner.y) {
-				boundingBox.topRightBackCorner.y = v->y;
-			}
-			if (v->z > boundingBox.topRightBackCorner.z) {
-				boundingBox.topRightBackCorner.z = v->z;
-			}
-		}
-	}
-	for (uint32_t i = 0; i < scene->triangleCount; i++) {
-		Triangle* triangle = &scene->triangles[i];
-		Vec3 vertices[3] = { triangle->v0, triangle->v1, triangle->v2 };
-		for (uint32_t x = 0; x < 3; x++) {
-			Vec3* v = &vertices[x];
-			if (v->x < boundingBox.bottomLeftFrontCorner.x) {
-				boundingBox.bottomLeftFrontCorner.x = v->x;
-			}
-			if (v->y < boundingBox.bottomLeftFrontCorner.y) {
-				boundingBox.bottomLeftFrontCorner.y = v->y;
-			}
-			if (v->z < boundingBox.bottomLeftFrontCorner.z) {
-				boundingBox.bottomLeftFrontCorner.z = v->z;
-			}
-
-			if (v->x > boundingBox.topRightBackCorner.x) {
-				boundingBox.topRightBackCorner.x = v->x;
-			}
-			if (v->y > boundingBox.topRightBackCorner.y) {
-				boundingBox.topRightBackCorner.y = v->y;
-			}
-			if (v->z > boundingBox.topRightBackCorner.z) {
-				boundingBox.topRightBackCorner.z = v->z;
-			}
-		}
-	}
-	return boundingBox;
-}
-
-static void octree_shrinkToFit(Octree* octree) {
-	if (octree->nodeCapacity > octree->nodeCount) {
-		octree->nodes = realloc(octree->nodes, sizeof(OctreeNode) * octree->nodeCount);
-		octree->nodeCapacity = octree->nodeCount;
-	}
-	if (octree->indexCapacity > octree->indexCount) {
-		octree->indexes = realloc(octree->indexes, sizeof(uint32_t) * octree->indexCount);
-		octree->indexCapacity = octree->indexCount;
-	}
-}
-
-static bool octree_intersectSphere(Sphere* sphere, BoundingBox boundingBox) {
-	float distSquared = sphere->radius * sphere->radius;
-	if (sphere->position.x < boundingBox.bottomLeftFrontCorner.x) {
-		distSquared -= (sphere->position.x - boundingBox.bottomLeftFrontCorner.x) * (sphere->position.x - boundingBox.bottomLeftFrontCorner.x);
-	}
-	else if (sphere->position.x > boundingBox.topRightBackCorner.x) {
-		distSquared -= (sphere->position.x - boundingBox.topRightBackCorner.x) * (sphere->position.x - boundingBox.topRightBackCorner.x);
-	}
-
-	if (sphere->position.y < boundingBox.bottomLeftFrontCorner.y) {
-		distSquared -= (sphere->position.y - boundingBox.bottomLeftFrontCorner.y) * (sphere->position.y - boundingBox.bottomLeftFrontCorner.y);
-	}
-	else if (sphere->position.y > boundingBox.topRightBackCorner.y) {
-		distSquared -= (sphere->position.y - boundingBox.topRightBackCorner.y) * (sphere->position.y - boundingBox.topRightBackCorner.y);
+#include <string.h>
+
+#include "memstats.h"
+#include "utils/math.h"
+
+// a node, whose primitives are known, but that isn't split or filled yet
+typedef struct {
+	int32_t nodeId;
+	uint32_t depth;
+	BoundingBox boundingBox;
+	// the sphere indexes followed by the triangle indexes of the primitives, that intersect the box
+	uint32_t* indexes;
+	uint32_t sphereIndexCount;
+	uint32_t triangleIndexCount;
+} OctreePendingNode;
+
+typedef struct {
+	OctreeBuildOptions* options;
+	// the references the leaves would hold, if no node split anymore
+	uint64_t referenceCount;
+	uint64_t maxReferenceCount;
+	// the nodes are built in the order of this queue, so the upper levels spend the reference budget first
+	OctreePendingNode* queue;
+	uint32_t queueStart;
+	uint32_t queueEnd;
+	uint32_t queueCapacity;
+} OctreeBuilder;
+
+// bit 0 selects the right half, bit 1 the back half and bit 2 the top half, in the order of childNodeIndexes
+static BoundingBox octree_getChildBoundingBox(BoundingBox boundingBox, Vec3 center, uint32_t child) {
+	BoundingBox childBox = boundingBox;
+	if (child & 1) {
+		childBox.bottomLeftFrontCorner.x = center.x;
+	} else {
+		childBox.topRightBackCorner.x = center.x;
 	}
-
-	// @POSSIBLE BUG: i think i may have to swap the condition here
-	if (sphere->position.z < boundingBox.bottomLeftFrontCorner.z) {
-		distSquared -= (sphere->position.z - boundingBox.bottomLeftFrontCorner.z) * (sphere->position.z - boundingBox.bottomLeftFrontCorner.z);
+	if (child & 2) {
+		childBox.bottomLeftFrontCorner.z = center.z;
+	} else {
+		childBox.topRightBackCorner.z = center.z;
 	}
-	else if (sphere->position.z > boundingBox.topRightBackCorner.z) {
-		distSquared -= (sphere->position.z - boundingBox.topRightBackCorner.z) * (sphere->position.z - boundingBox.topRightBackCorner.z);
+	if (child & 4) {
+		childBox.bottomLeftFrontCorner.y = center.y;
+	} else {
+		childBox.topRightBackCorner.y = center.y;
 	}
-
-	return distSquared > 0;
+	return childBox;
 }
 
-static void octree_project(Vec3* points, uint32_t pointCount, Vec3 axis, float* min, float* max) {
-	*min = INFINITY;
-	*max = -INFINITY;
-	for (uint32_t i = 0; i < pointCount; i++) {
-		Vec3 point = points[i];
-		float val = vec3_dot(axis, point);
-		if (val < *min) {
-			*min = val;
-		}
-		if (val > *max) {
-			*max = val;
-		}
+/*
+ * A ray, that hits a box, hits each half as large child with a probability of a quarter, the ratio of their surfaces.
+ * Splitting costs the 8 box tests of the children and the primitives of every child with that probability,
+ * the children are assumed to be leaves. The split is skipped, if it is more expensive than testing the primitives here,
+ * which also ends the splitting, once the children get the same primitives as their parent.
+ */
+static bool octree_isSplitCheaper(uint32_t sphereCount, uint32_t triangleCount,
+	const uint32_t childSphereCounts[8], const uint32_t childTriangleCounts[8]) {
+	float leafCost = ACCEL_SPHERE_COST * (float) sphereCount + ACCEL_TRIANGLE_COST * (float) triangleCount;
+	float splitCost = 8.0f * ACCEL_BOX_COST;
+	for (uint32_t i = 0; i < 8; i++) {
+		splitCost += 0.25f * (ACCEL_SPHERE_COST * (float) childSphereCounts[i] + ACCEL_TRIANGLE_COST * (float) childTriangleCounts[i]);
 	}
+	return splitCost < leafCost;
 }
 
-static bool octree_intersectTriangle(Triangle* triangle, BoundingBox boundingBox) {
-	float triangleMin;
-	float triangleMax;
-	float boxMin;
-	float boxMax;
-
-	Vec3 boxNormals[3] = {
-		(Vec3) {1.0f, 0.0f, 0.0f},
-		(Vec3) {0.0f, 1.0f, 0.0f},
-		(Vec3) {0.0f, 0.0f, 1.0f}
-	};
-
-	Vec3 triangleVertices[3] = {
-		triangle->v0,
-		triangle->v1,
-		triangle->v2
-	};
-
-	float boundingBoxV0[3] = {
-		boundingBox.bottomLeftFrontCorner.x,
-		boundingBox.bottomLeftFrontCorner.y,
-		boundingBox.bottomLeftFrontCorner.z
-	};
-
-	float boundingBoxV1[3] = {
-		boundingBox.topRightBackCorner.x,
-		boundingBox.topRightBackCorner.y,
-		boundingBox.topRightBackCorner.z
-	};
-
-	for (uint32_t i = 0; i < 3; i++) {
-		Vec3 n = boxNormals[i];
-		octree_project(triangleVertices, 3, n, &triangleMin, &triangleMax);
-		if (triangleMax < boundingBoxV0[i] || triangleMin > boundingBoxV1[i]) {
-			return false;
-		}
-	}
-
-	Vec3 boxVertices[8] = {
-		boundingBox.bottomLeftFrontCorner, // bottom left front
-		(Vec3) {boundingBox.topRightBackCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.bottomLeftFrontCorner.z}, // bottom right front
-		(Vec3) {boundingBox.bottomLeftFrontCorner.x, boundingBox.topRightBackCorner.y, boundingBox.bottomLeftFrontCorner.z}, // top left front
-		(Vec3) {boundingBox.topRightBackCorner.x, boundingBox.topRightBackCorner.y, boundingBox.bottomLeftFrontCorner.z}, // top right front
-		(Vec3) {boundingBox.bottomLeftFrontCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.topRightBackCorner.z}, // bottom left back
-		(Vec3) {boundingBox.topRightBackCorner.x, boundingBox.bottomLeftFrontCorner.y, boundingBox.topRightBackCorner.z}, // bottom right back
-		(Vec3) {boundingBox.bottomLeftFrontCorner.x, boundingBox.topRightBackCorner.y, boundingBox.topRightBackCorner.z}, // top left back
-		boundingBox.topRightBackCorner // top right back
-	};
-
-	Vec3 v0v1 = vec3_sub(triangle->v1, triangle->v0);
-	Vec3 v0v2 = vec3_sub(triangle->v2, triangle->v0);
-	Vec3 triangleNormal = vec3_norm(vec3_cross(v0v1, v0v2));
-	float triangleOffset = vec3_dot(triangleNormal, triangle->v0);
-
-	octree_project(boxVertices, 8, triangleNormal, &boxMin, &boxMax);
-	if (boxMax < triangleOffset || boxMin > triangleOffset) {
-		return false;
-	}
-
-	Vec3 triangleEdges[3] = {
-		vec3_sub(triangle->v0, triangle->v1),
-		vec3_sub(triangle->v1, triangle->v2),
-		vec3_sub(triangle->v2, triangle->v0)
-	};
-
-	for (uint32_t i = 0; i < 3; i++) {
-		for (uint32_t j = 0; j < 3; j++) {
-			Vec3 axis = vec3_cross(triangleEdges[i], boxNormals[j]);
-			octree_project(boxVertices, 8, axis, &boxMin, &boxMax);
-			octree_project(triangleVertices, 3, axis, &triangleMin, &triangleMax);
-			if (boxMax < triangleMin || boxMin > triangleMax) {
+static bool octree_pushPendingNode(OctreeBuilder* builder, OctreePendingNode node) {
+	if (builder->queueEnd == builder->queueCapacity) {
+		// the processed nodes at the front are dropped, before the queue grows
+		uint32_t pendingCount = builder->queueEnd - builder->queueStart;
+		memmove(builder->queue, builder->queue + builder->queueStart, sizeof(OctreePendingNode) * pendingCount);
+		builder->queueStart = 0;
+		builder->queueEnd = pendingCount;
+		if (pendingCount * 2 > builder->queueCapacity) {
+			OctreePendingNode* queue = realloc(builder->queue, sizeof(OctreePendingNode) * builder->queueCapacity * 2);
+			if (!queue) {
 				return false;
 			}
+			memstats_reallocate(MEMSTATS_ACCEL_BUILD, sizeof(OctreePendingNode) * builder->queueCapacity,
+				sizeof(OctreePendingNode) * builder->queueCapacity * 2);
+			builder->queue = queue;
+			builder->queueCapacity *= 2;
 		}
 	}
-
+	builder->queue[builder->queueEnd++] = node;
 	return true;
 }
 
-static void octree_buildNode(Octree* octree, Scene* scene, int32_t nodeId,
-	uint32_t* sphereIndexes, uint32_t sphereIndexCount, 
-	uint32_t* triangleIndexes, uint32_t triangleIndexCount, 
-	BoundingBox boundingBox) {
-	if (octree->nodeCount + 1 > octree->nodeCapacity) {
-		octree->nodeCapacity *= 2;
-		octree->nodes = realloc(octree->nodes, sizeof(OctreeNode) * octree->nodeCapacity);
-	}
-
+// splits the node and queues its children or makes it a leaf, returns false if the memory for the children is missing
+static bool octree_buildNode(Accel* octree, Scene* scene, OctreeBuilder* builder, OctreePendingNode* pending) {
+	BoundingBox boundingBox = pending->boundingBox;
 	assert(boundingBox.bottomLeftFrontCorner.x <= boundingBox.topRightBackCorner.x);
 	assert(boundingBox.bottomLeftFrontCorner.y <= boundingBox.topRightBackCorner.y);
 	assert(boundingBox.bottomLeftFrontCorner.z <= boundingBox.topRightBackCorner.z);
+	octree->nodes[pending->nodeId].boundingBox = boundingBox;
+
+	uint32_t sphereIndexCount = pending->sphereIndexCount;
+	uint32_t triangleIndexCount = pending->triangleIndexCount;
+	uint32_t* sphereIndexes = pending->indexes;
+	uint32_t* triangleIndexes = pending->indexes + sphereIndexCount;
+
+	Vec3 halfDiagonal = vec3_mul(vec3_sub(boundingBox.topRightBackCorner, boundingBox.bottomLeftFrontCorner), 0.5f);
+	Vec3 centerOfBoundingBox = vec3_add(boundingBox.bottomLeftFrontCorner, halfDiagonal);
+	BoundingBox childBoxes[8];
+	for (uint32_t i = 0; i < 8; i++) {
+		childBoxes[i] = octree_getChildBoundingBox(boundingBox, centerOfBoundingBox, i);
+	}
 
-	// we can't save a pointer to the currentNode,
-	// because the underlying array may change it's address due to a realloc call
-	octree->nodes[nodeId].boundingBox = boundingBox;
-
-	uint32_t sphereElementsInside = 0;
-	uint32_t sphereElementsCapacity = 10;
-	uint32_t* sphereIndexesInside = malloc(sizeof(uint32_t) * sphereElementsCapacity);
-
-	uint32_t triangleElementsInside = 0;
-	uint32_t triangleElementsCapacity = 10;
-	uint32_t* triangleIndexesInside = malloc(sizeof(uint32_t) * triangleElementsCapacity);
-
-	for (uint32_t i = 0; i < sphereIndexCount; i++) {
-		uint32_t index = sphereIndexes[i];
-		Sphere* sphere = &scene->spheres[index];
-		if (octree_intersectSphere(sphere, boundingBox)) {
-			// add index to sphereIndexesInside
-			if (sphereElementsInside + 1 > sphereElementsCapacity) {
-				sphereElementsCapacity *= 2;
-				sphereIndexesInside = realloc(sphereIndexesInside, sizeof(uint32_t) * sphereElementsCapacity);
+	// the children each primitive intersects, one bit per child
+	size_t maskBytes = sphereIndexCount + triangleIndexCount;
+	uint8_t* masks = NULL;
+	uint32_t childSphereCounts[8] = { 0 };
+	uint32_t childTriangleCounts[8] = { 0 };
+	bool isSplit = false;
+	if (pending->depth < builder->options->maxDepth && maskBytes > 0) {
+		masks = malloc(maskBytes);
+	}
+	if (masks) {
+		memstats_allocate(MEMSTATS_ACCEL_BUILD, maskBytes);
+		for (uint32_t i = 0; i < sphereIndexCount; i++) {
+			Sphere* sphere = &scene->spheres[sphereIndexes[i]];
+			masks[i] = 0;
+			for (uint32_t j = 0; j < 8; j++) {
+				if (accel_intersectSphere(sphere, childBoxes[j])) {
+					masks[i] |= (uint8_t) (1u << j);
+					childSphereCounts[j]++;
+				}
 			}
-			sphereIndexesInside[sphereElementsInside++] = index;
 		}
-	}
-
-	for (uint32_t i = 0; i < triangleIndexCount; i++) {
-		uint32_t index = triangleIndexes[i];
-		Triangle* triangle = &scene->triangles[index];
-		if (octree_intersectTriangle(triangle, boundingBox)) {
-			// add index to triangleIndexesInside
-			if (triangleElementsInside + 1 > triangleElementsCapacity) {
-				triangleElementsCapacity *= 2;
-				triangleIndexesInside = realloc(triangleIndexesInside, sizeof(uint32_t) * triangleElementsCapacity);
+		for (uint32_t i = 0; i < triangleIndexCount; i++) {
+			Triangle* triangle = &scene->triangles[triangleIndexes[i]];
+			uint8_t* mask = &masks[sphereIndexCount + i];
+			*mask = 0;
+			for (uint32_t j = 0; j < 8; j++) {
+				if (accel_intersectTriangle(triangle, childBoxes[j])) {
+					*mask |= (uint8_t) (1u << j);
+					childTriangleCounts[j]++;
+				}
 			}
-			triangleIndexesInside[triangleElementsInside++] = index;
 		}
-	}
 
-	// shrink the array to save space
-	if (sphereElementsCapacity > sphereElementsInside) {
-		sphereIndexesInside = realloc(sphereIndexesInside, sizeof(uint32_t) * sphereElementsInside);
-		sphereElementsCapacity = sphereElementsInside;
-	}
-	if (triangleElementsCapacity > triangleElementsInside) {
-		triangleIndexesInside = realloc(triangleIndexesInside, sizeof(uint32_t) * triangleElementsInside);
-		triangleElementsCapacity = triangleElementsInside;
+		if (octree_isSplitCheaper(sphereIndexCount, triangleIndexCount, childSphereCounts, childTriangleCounts)) {
+			// the primitives of the node are replaced by the ones of the children
+			uint64_t referenceCount = builder->referenceCount - sphereIndexCount - triangleIndexCount;
+			for (uint32_t i = 0; i < 8; i++) {
+				referenceCount += childSphereCounts[i] + childTriangleCounts[i];
+			}
+			if (referenceCount <= builder->maxReferenceCount) {
+				builder->referenceCount = referenceCount;
+				isSplit = true;
+			}
+		}
 	}
 
-	// we keep splitting, if our subdivision has changed one of the array sizes
-	if ((sphereIndexCount != sphereElementsInside || triangleIndexCount != triangleElementsInside || nodeId == 0) && !(sphereElementsInside < MIN_ELEMENTS_PER_NODE && triangleElementsInside < MIN_ELEMENTS_PER_NODE)) {
-		Vec3 diagonal = vec3_sub(boundingBox.topRightBackCorner, boundingBox.bottomLeftFrontCorner);
-		Vec3 halfDiagonal = vec3_mul(diagonal, 0.5f);
-		Vec3 centerOfBoundingBox = vec3_add(boundingBox.bottomLeftFrontCorner, halfDiagonal);
-
-		int32_t childId1 = (int32_t) octree->nodeCount++;
-		int32_t childId2 = (int32_t) octree->nodeCount++;
-		int32_t childId3 = (int32_t) octree->nodeCount++;
-		int32_t childId4 = (int32_t) octree->nodeCount++;
-		int32_t childId5 = (int32_t) octree->nodeCount++;
-		int32_t childId6 = (int32_t) octree->nodeCount++;
-		int32_t childId7 = (int32_t) octree->nodeCount++;
-		int32_t childId8 = (int32_t) octree->nodeCount++;
-
-		octree->nodes[nodeId].childNodeIndexes[0] = childId1;
-		octree->nodes[nodeId].childNodeIndexes[1] = childId2;
-		octree->nodes[nodeId].childNodeIndexes[2] = childId3;
-		octree->nodes[nodeId].childNodeIndexes[3] = childId4;
-		octree->nodes[nodeId].childNodeIndexes[4] = childId5;
-		octree->nodes[nodeId].childNodeIndexes[5] = childId6;
-		octree->nodes[nodeId].childNodeIndexes[6] = childId7;
-		octree->nodes[nodeId].childNodeIndexes[7] = childId8;
-        octree->nodes[nodeId].sphereIndexCount = 0;
-        octree->nodes[nodeId].triangleIndexCount = 0;
-
-		// front bottom left
-		BoundingBox bbFrontBottomLeft = (BoundingBox) { boundingBox.bottomLeftFrontCorner, centerOfBoundingBox };
-		octree_buildNode(octree, scene, childId1, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbFrontBottomLeft);
-
-		// front bottom right
-		BoundingBox bbFrontBottomRight = 
-			(BoundingBox) { 
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { halfDiagonal.x, 0.0f, 0.0f }), 
-				vec3_add(centerOfBoundingBox, (Vec3) { halfDiagonal.x, 0.0f, 0.0f })
-			};
-		octree_buildNode(octree, scene, childId2, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbFrontBottomRight);
-
-		// back bottom left
-		BoundingBox bbBackBottomLeft =
-			(BoundingBox) {
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { 0.0f, 0.0f, halfDiagonal.z }),
-				vec3_add(centerOfBoundingBox, (Vec3) { 0.0f, 0.0f, halfDiagonal.z })
-			};
-		octree_buildNode(octree, scene, childId3, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbBackBottomLeft);
-
-		// back bottom right
-		BoundingBox bbBackBottomRight =
-			(BoundingBox) {
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { halfDiagonal.x, 0.0f, halfDiagonal.z }),
-				vec3_add(centerOfBoundingBox, (Vec3) { halfDiagonal.x, 0.0f, halfDiagonal.z })
-			};
-		octree_buildNode(octree, scene, childId4, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbBackBottomRight);
-
-		// front top left
-		BoundingBox bbFrontTopLeft =
-			(BoundingBox) {
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { 0.0f, halfDiagonal.y, 0.0f }),
-				vec3_add(centerOfBoundingBox, (Vec3) { 0.0f, halfDiagonal.y, 0.0f })
-			};
-		octree_buildNode(octree, scene, childId5, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbFrontTopLeft);
-
-		// front top right
-		BoundingBox bbFrontTopRight =
-			(BoundingBox) {
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { halfDiagonal.x, halfDiagonal.y, 0.0f }),
-				vec3_add(centerOfBoundingBox, (Vec3) { halfDiagonal.x, halfDiagonal.y, 0.0f })
-			};
-		octree_buildNode(octree, scene, childId6, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbFrontTopRight);
+	bool success = true;
+	if (isSplit) {
+		// all 8 children are allocated together, so that they are next to each other
+		int32_t firstChildId = accel_addNodes(octree, 8);
+		success = firstChildId != NODE_INDEX_UNDEF;
+		for (uint32_t i = 0; i < 8 && success; i++) {
+			octree->nodes[pending->nodeId].childNodeIndexes[i] = firstChildId + (int32_t) i;
+		}
 
-		// front - back +
-		// back top left
-		BoundingBox bbBackTopLeft =
-			(BoundingBox) {
-				vec3_add(boundingBox.bottomLeftFrontCorner, (Vec3) { 0.0f, 0.0f, halfDiagonal.z }),
-				vec3_add(centerOfBoundingBox, (Vec3) { 0.0f, halfDiagonal.y, halfDiagonal.z })
+		for (uint32_t i = 0; i < 8 && success; i++) {
+			uint32_t childIndexCount = childSphereCounts[i] + childTriangleCounts[i];
+			OctreePendingNode child = {
+				octree->nodes[pending->nodeId].childNodeIndexes[i],
+				pending->depth + 1,
+				childBoxes[i],
+				malloc(sizeof(uint32_t) * MAX(childIndexCount, 1)),
+				0,
+				0
 			};
-		octree_buildNode(octree, scene, childId7, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbBackTopLeft);
-
-		// back top right
-		BoundingBox bbBackTopRight = (BoundingBox) { centerOfBoundingBox, boundingBox.topRightBackCorner };
-		octree_buildNode(octree, scene, childId8, sphereIndexesInside, sphereElementsInside, triangleIndexesInside, triangleElementsInside, bbBackTopRight);
-	} else {
-		// here we can temporarily take a pointer to the array, because
-		// we don't call octree_buildNode here.
-		// so no reallocations are happening in between usages
-		OctreeNode* currentNode = &octree->nodes[nodeId];
-
-		// we are a leaf node
-		// no children indexes
-		for (uint32_t i = 0; i < 8; i++) {
-			currentNode->childNodeIndexes[i] = NODE_INDEX_UNDEF;
-		}
-		
-		// realloc index array, if too small
-		if (octree->indexCount + sphereElementsInside + triangleElementsInside > octree->indexCapacity) {
-			octree->indexCapacity = octree->indexCapacity + octree->indexCount + sphereElementsInside + triangleElementsInside;
-			octree->indexes = realloc(octree->indexes, sizeof(uint32_t) * octree->indexCapacity);
+			if (!child.indexes) {
+				success = false;
+				break;
+			}
+			memstats_allocate(MEMSTATS_ACCEL_BUILD, sizeof(uint32_t) * MAX(childIndexCount, 1));
+			for (uint32_t j = 0; j < sphereIndexCount; j++) {
+				if (masks[j] & (1u << i)) {
+					child.indexes[child.sphereIndexCount++] = sphereIndexes[j];
+				}
+			}
+			for (uint32_t j = 0; j < triangleIndexCount; j++) {
+				if (masks[sphereIndexCount + j] & (1u << i)) {
+					child.indexes[child.sphereIndexCount + child.triangleIndexCount++] = triangleIndexes[j];
+				}
+			}
+			if (!octree_pushPendingNode(builder, child)) {
+				free(child.indexes);
+				memstats_free(MEMSTATS_ACCEL_BUILD, sizeof(uint32_t) * MAX(childIndexCount, 1));
+				success = false;
+			}
 		}
+	} else {
+		accel_setLeaf(octree, pending->nodeId, pending->indexes, pending->sphereIndexCount, pending->triangleIndexCount);
+	}
+	if (masks) {
+		free(masks);
+		memstats_free(MEMSTATS_ACCEL_BUILD, maskBytes);
+	}
+	return success;
+}
 
-		// copy the spheres
-		currentNode->sphereIndexOffset = octree->indexCount;
-		currentNode->sphereIndexCount = sphereElementsInside;
-		for (uint32_t i = 0; i < sphereElementsInside; i++) {
-			octree->indexes[i + octree->indexCount] = sphereIndexesInside[i];
-		}
-		octree->indexCount += sphereElementsInside;
+void octree_initBuildOptions(OctreeBuildOptions* options) {
+	options->maxDepth = OCTREE_MAX_DEPTH;
+	options->maxReferencesPerPrimitive = OCTREE_MAX_REFERENCES_PER_PRIMITIVE;
+}
 
-		// copy the triangles
-		currentNode->triangleIndexOffset = octree->indexCount;
-		currentNode->triangleIndexCount = triangleElementsInside;
-		for (uint32_t i = 0; i < triangleElementsInside; i++) {
-			octree->indexes[i + octree->indexCount] = triangleIndexesInside[i];
-		}
-		octree->indexCount += triangleElementsInside;
-	}
-	free(sphereIndexesInside);
-	free(triangleIndexesInside);
+Accel* octree_buildFromScene(Scene* scene) {
+	OctreeBuildOptions options;
+	octree_initBuildOptions(&options);
+	return octree_buildFromSceneWithOptions(scene, &options);
 }
 
-Octree* octree_buildFromScene(Scene* scene) {
-	Octree* octree = malloc(sizeof(Octree));
+Accel* octree_buildFromSceneWithOptions(Scene* scene, OctreeBuildOptions* options) {
+	Accel* octree = accel_create();
 	if (!octree) {
 		return NULL;
 	}
 
-	octree->nodeCapacity = 1;
-	octree->nodeCount = 0;
-	octree->nodes = malloc(sizeof(OctreeNode) * octree->nodeCapacity);
-	octree->indexCapacity = 2000;
-	octree->indexCount= 0;
-	octree->indexes = malloc(sizeof(uint32_t) * octree->indexCapacity);
+	OctreeBuilder builder = { 0 };
+	builder.options = options;
+	builder.referenceCount = (uint64_t) scene->sphereCount + scene->triangleCount;
+	builder.maxReferenceCount = (uint64_t) ((double) options->maxReferencesPerPrimitive * (double) builder.referenceCount);
+	builder.queueCapacity = 64;
+	builder.queue = malloc(sizeof(OctreePendingNode) * builder.queueCapacity);
+
+	// the root box contains every element
+	OctreePendingNode root = {
+		accel_addNodes(octree, 1),
+		0,
+		accel_getSceneBoundingBox(scene),
+		malloc(sizeof(uint32_t) * MAX(builder.referenceCount, 1)),
+		scene->sphereCount,
+		scene->triangleCount
+	};
+	assert(root.nodeId == 0);
+	bool success = builder.queue && root.indexes && root.nodeId == 0;
+	if (success) {
+		memstats_allocate(MEMSTATS_ACCEL_BUILD, sizeof(OctreePendingNode) * builder.queueCapacity
+			+ sizeof(uint32_t) * MAX(builder.referenceCount, 1));
+		for (uint32_t i = 0; i < scene->sphereCount; i++) {
+			root.indexes[i] = i;
+		}
+		for (uint32_t i = 0; i < scene->triangleCount; i++) {
+			root.indexes[scene->sphereCount + i] = i;
+		}
+		octree_pushPendingNode(&builder, root);
+	} else {
+		free(builder.queue);
+		free(root.indexes);
+		builder.queue = NULL;
+	}
 
-	BoundingBox rootBoundingBox = octree_calculateRootBoundingBox(scene);
-	
-	// this array indicates which elements with which index are inside the boundingBox of the parent
-	// for the root node this should be all elements
-	uint32_t* sphereIndexes = malloc(sizeof(uint32_t) * scene->sphereCount);
-	for (uint32_t i = 0; i < scene->sphereCount; i++) {
-		sphereIndexes[i] = i;
+	// the children are queued after all nodes of the level of their parent, so the nodes are created breadth first
+	// and the gpu can keep a prefix of the array with the top levels in local memory, if the whole octree doesn't fit
+	while (builder.queueStart < builder.queueEnd) {
+		OctreePendingNode pending = builder.queue[builder.queueStart++];
+		success = success && octree_buildNode(octree, scene, &builder, &pending);
+		free(pending.indexes);
+		memstats_free(MEMSTATS_ACCEL_BUILD, sizeof(uint32_t) * MAX(pending.sphereIndexCount + pending.triangleIndexCount, 1));
+	}
+	if (builder.queue) {
+		free(builder.queue);
+		memstats_free(MEMSTATS_ACCEL_BUILD, sizeof(OctreePendingNode) * builder.queueCapacity);
 	}
-	uint32_t* triangleIndexes = malloc(sizeof(uint32_t) * scene->triangleCount);
-	for (uint32_t i = 0; i < scene->triangleCount; i++) {
-		triangleIndexes[i] = i;
+	if (!success) {
+		printf("Couldn't allocate the octree build.\n");
+		accel_destroy(octree);
+		return NULL;
 	}
 
-	int32_t rootId = octree->nodeCount++;
-	assert(rootId == 0);
-	octree_buildNode(octree, scene, rootId, sphereIndexes, scene->sphereCount, triangleIndexes, scene->triangleCount, rootBoundingBox);
-	
-	free(sphereIndexes);
-	free(triangleIndexes);
-	
-	octree_shrinkToFit(octree);
+	accel_finish(octree);
 	return octree;
 }
-
-void octree_destroy(Octree* octree) {
-	if (octree) {
-		free(octree->nodes);
-		free(octree->indexes);
-		free(octree);
-	}
-}
\ No newline at end of file
@@ -2,38 +2,25 @@
 #define RAYTRACER_OCTREE_H
 
 #include "scene.h"
-#include "utils/vec3.h"
+#include "accel.h"
 
-#define MIN_ELEMENTS_PER_NODE 8
-#define NODE_INDEX_UNDEF -1
+// the defaults of OctreeBuildOptions
+#define OCTREE_MAX_DEPTH 16
+#define OCTREE_MAX_REFERENCES_PER_PRIMITIVE 4.0f
 
 typedef struct {
-	Vec3 bottomLeftFrontCorner;
-	Vec3 topRightBackCorner;
-} BoundingBox;
-
-typedef struct {
-	BoundingBox boundingBox;
-
-	uint32_t sphereIndexOffset;
-	uint32_t sphereIndexCount;
-
-	uint32_t triangleIndexOffset;
-	uint32_t triangleIndexCount;
-
-	int32_t childNodeIndexes[8];
-} OctreeNode;
-
-typedef struct {
-	OctreeNode* nodes;
-	uint32_t nodeCount;
-	uint32_t nodeCapacity;
-	uint32_t* indexes;
-	uint32_t indexCount;
-	uint32_t indexCapacity;
-} Octree;
-
-Octree* octree_buildFromScene(Scene* scene);
-void octree_destroy(Octree* octree);
-
-#endif //RAYTRACER_OCTREE_H
\ No newline at end of file
+	// the root is depth 0
+	uint32_t maxDepth;
+	// the budget of leaf references of the whole tree, a split, that would exceed it, isn't made
+	float maxReferencesPerPrimitive;
+} OctreeBuildOptions;
+
+void octree_initBuildOptions(OctreeBuildOptions* options);
+Accel* octree_buildFromScene(Scene* scene);
+/*
+ * Splits a node at its center, if the cost model expects the 8 children to be cheaper to trace than its primitives,
+ * the depth is below the limit and the duplicated references still fit into the budget.
+ */
+Accel* octree_buildFromSceneWithOptions(Scene* scene, OctreeBuildOptions* options);
+
+#endif //RAYTRACER_OCTREE_H
@@ -0,0 +1,213 @@
+#include "programcache.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/file.h"
+#include "utils/stringbuilder.h"
+
+// bump the version, if the file layout changes
+#define PROGRAMCACHE_MAGIC "RTCLBIN1"
+#define PROGRAMCACHE_MAGIC_SIZE 8
+#define PROGRAMCACHE_PATH_SIZE 1024
+
+// FNV-1a, see: http://www.isthe.com/chongo/tech/comp/fnv/
+#define PROGRAMCACHE_HASH_INIT 14695981039346656037ULL
+static uint64_t programcache_hash(uint64_t hash, const void* data, size_t size) {
+	const unsigned char* bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void programcache_appendDeviceInfo(StringBuilder* builder, cl_device_id deviceId, cl_device_info param, const char* name) {
+	size_t valueSize = 0;
+	clGetDeviceInfo(deviceId, param, 0, NULL, &valueSize);
+	char* value = malloc(valueSize + 1);
+	if (!value) {
+		return;
+	}
+	if (clGetDeviceInfo(deviceId, param, valueSize, value, NULL) != CL_SUCCESS) {
+		valueSize = 0;
+	}
+	value[valueSize] = '\0';
+	stringbuilder_append(builder, name);
+	stringbuilder_append(builder, "=");
+	stringbuilder_append(builder, value);
+	stringbuilder_append(builder, "\n");
+	free(value);
+}
+
+// the key identifies everything, that influences the compiled binary
+static char* programcache_createKey(cl_device_id deviceId, const char* source, size_t sourceSize, const char* options) {
+	StringBuilder* builder = stringbuilder_create(512);
+	programcache_appendDeviceInfo(builder, deviceId, CL_DEVICE_NAME, "device");
+	programcache_appendDeviceInfo(builder, deviceId, CL_DEVICE_VENDOR, "vendor");
+	programcache_appendDeviceInfo(builder, deviceId, CL_DEVICE_VERSION, "version");
+	programcache_appendDeviceInfo(builder, deviceId, CL_DRIVER_VERSION, "driver");
+
+	char line[64];
+	snprintf(line, sizeof(line), "source=%016" PRIx64 "\n", programcache_hash(PROGRAMCACHE_HASH_INIT, source, sourceSize));
+	stringbuilder_append(builder, line);
+	stringbuilder_append(builder, "options=");
+	stringbuilder_append(builder, options ? options : "");
+
+	char* key = stringbuilder_cstr(builder);
+	stringbuilder_destroy(builder);
+	return key;
+}
+
+// returns false, if the cache is disabled
+static bool programcache_getPath(const char* key, char* path, size_t pathSize) {
+	const char* dir = getenv("RAYTRACER_KERNEL_CACHE_DIR");
+	if (!dir) {
+		dir = getenv("TMPDIR");
+	}
+	if (!dir) {
+		dir = getenv("TEMP");
+	}
+	if (!dir) {
+#ifdef _WIN32
+		dir = ".";
+#else
+		dir = "/tmp";
+#endif
+	}
+	if (dir[0] == '\0') {
+		return false;
+	}
+	uint64_t keyHash = programcache_hash(PROGRAMCACHE_HASH_INIT, key, strlen(key));
+	snprintf(path, pathSize, "%s/raytracer_kernel_%016" PRIx64 ".bin", dir, keyHash);
+	return true;
+}
+
+/*
+ * File layout:
+ *     char magic[8]
+ *     uint32_t keySize
+ *     char key[keySize]
+ *     uint64_t binarySize
+ *     unsigned char binary[binarySize]
+ */
+static cl_program programcache_load(cl_context ctx, cl_device_id deviceId, const char* path, const char* key, const char* options) {
+	size_t fileSize = 0;
+	char* data = file_readFile(path, &fileSize);
+	if (!data) {
+		return NULL;
+	}
+	// file_readFile counts the appended zero terminator
+	fileSize -= 1;
+
+	size_t keySize = strlen(key);
+	size_t offset = 0;
+	cl_program program = NULL;
+	uint32_t storedKeySize;
+	uint64_t binarySize;
+	if (fileSize < PROGRAMCACHE_MAGIC_SIZE + sizeof(uint32_t) || memcmp(data, PROGRAMCACHE_MAGIC, PROGRAMCACHE_MAGIC_SIZE) != 0) {
+		goto cleanup;
+	}
+	offset += PROGRAMCACHE_MAGIC_SIZE;
+	memcpy(&storedKeySize, &data[offset], sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	// a different key means a hash collision of the filename
+	if (storedKeySize != keySize || fileSize - offset < keySize + sizeof(uint64_t) || memcmp(&data[offset], key, keySize) != 0) {
+		goto cleanup;
+	}
+	offset += keySize;
+	memcpy(&binarySize, &data[offset], sizeof(uint64_t));
+	offset += sizeof(uint64_t);
+	if (binarySize == 0 || fileSize - offset != binarySize) {
+		goto cleanup;
+	}
+
+	size_t programBinarySize = (size_t) binarySize;
+	const unsigned char* binary = (const unsigned char*) &data[offset];
+	cl_int binaryStatus;
+	cl_int err;
+	program = clCreateProgramWithBinary(ctx, 1, &deviceId, &programBinarySize, &binary, &binaryStatus, &err);
+	if (err != CL_SUCCESS || binaryStatus != CL_SUCCESS) {
+		if (program) {
+			clReleaseProgram(program);
+		}
+		program = NULL;
+		goto cleanup;
+	}
+	// binaries have to be built as well, this fails if the driver can't use the binary anymore
+	if (clBuildProgram(program, 1, &deviceId, options, NULL, NULL) != CL_SUCCESS) {
+		clReleaseProgram(program);
+		program = NULL;
+	}
+cleanup:
+	free(data);
+	return program;
+}
+
+static void programcache_store(cl_program program, const char* path, const char* key) {
+	size_t binarySize = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, NULL) != CL_SUCCESS || binarySize == 0) {
+		return;
+	}
+	uint32_t keySize = (uint32_t) strlen(key);
+	uint64_t storedBinarySize = binarySize;
+	size_t fileSize = PROGRAMCACHE_MAGIC_SIZE + sizeof(uint32_t) + keySize + sizeof(uint64_t) + binarySize;
+	unsigned char* data = malloc(fileSize);
+	if (!data) {
+		return;
+	}
+
+	size_t offset = 0;
+	memcpy(&data[offset], PROGRAMCACHE_MAGIC, PROGRAMCACHE_MAGIC_SIZE);
+	offset += PROGRAMCACHE_MAGIC_SIZE;
+	memcpy(&data[offset], &keySize, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	memcpy(&data[offset], key, keySize);
+	offset += keySize;
+	memcpy(&data[offset], &storedBinarySize, sizeof(uint64_t));
+	offset += sizeof(uint64_t);
+
+	// the program was built for a single device, so there is exactly one binary
+	unsigned char* binaries[1] = { &data[offset] };
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) == CL_SUCCESS) {
+		if (!file_writeFile(path, data, fileSize)) {
+			printf("Couldn't write the kernel cache file %s.\n", path);
+		}
+	}
+	free(data);
+}
+
+cl_program programcache_buildProgram(cl_context ctx, cl_device_id deviceId, const char* source, size_t sourceSize,
+	const char* options, cl_int* err) {
+	char* key = programcache_createKey(deviceId, source, sourceSize, options);
+	char path[PROGRAMCACHE_PATH_SIZE];
+	bool useCache = programcache_getPath(key, path, sizeof(path));
+
+	if (useCache) {
+		cl_program program = programcache_load(ctx, deviceId, path, key, options);
+		if (program) {
+			free(key);
+			*err = CL_SUCCESS;
+			return program;
+		}
+	}
+
+	cl_program program = clCreateProgramWithSource(ctx, 1, &source, &sourceSize, err);
+	if (*err != CL_SUCCESS) {
+		free(key);
+		return NULL;
+	}
+	clBuildProgram(program, 1, &deviceId, options, NULL, NULL);
+
+	cl_build_status status;
+	clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &status, NULL);
+	if (useCache && status == CL_BUILD_SUCCESS) {
+		programcache_store(program, path, key);
+	}
+	free(key);
+	return program;
+}
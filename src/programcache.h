@@ -0,0 +1,26 @@
+#ifndef RAYTRACER_PROGRAMCACHE_H
+#define RAYTRACER_PROGRAMCACHE_H
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <stddef.h>
+
+/*
+ * Creates and builds the program for the device.
+ * A compiled binary is loaded from the on-disk cache, if one exists for the same device, driver version,
+ * build options and source. Otherwise the program is built from source and its binary is added to the cache.
+ * Stale or broken cache entries are rebuilt from source and overwritten.
+ *
+ * The cache directory is taken from the RAYTRACER_KERNEL_CACHE_DIR environment variable and defaults to the
+ * temp directory. Setting the variable to an empty string disables the cache.
+ *
+ * Like clBuildProgram, the build status has to be checked with clGetProgramBuildInfo.
+ */
+cl_program programcache_buildProgram(cl_context ctx, cl_device_id deviceId, const char* source, size_t sourceSize,
+	const char* options, cl_int* err);
+
+#endif //RAYTRACER_PROGRAMCACHE_H
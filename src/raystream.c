@@ -0,0 +1,450 @@
+#include "raystream.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lighttree.h"
+#include "utils/math.h"
+
+// bits per axis of the Morton code of the ray origins, the octant of the direction is stored above them
+#define RAYSTREAM_MORTON_BITS 9
+#define RAYSTREAM_NO_GROUP UINT32_MAX
+
+typedef struct {
+	Ray ray;
+	// the weight of the color seen along the ray in the pixel
+	Vec3 throughput;
+	// in the tile
+	uint32_t pixelIndex;
+	uint32_t depth;
+} RayStreamRay;
+
+typedef struct {
+	Ray ray;
+	float distanceToLight;
+	// added to the pixel, if the light is visible
+	Vec3 color;
+	// the lighting without the weights, which the probes of a group collect
+	Vec3 lighting;
+	uint32_t pixelIndex;
+	uint32_t groupIndex;
+} RayStreamShadowRay;
+
+// the shadow rays of a hit to one light, see the probes in raytracer_shadeHit
+typedef struct {
+	Material* material;
+	PointLight* pointLight;
+	Vec3 hitPoint;
+	Vec3 intersectionNormal;
+	// the throughput of the hit times its material color and the contribution of the sample
+	Vec3 weight;
+	uint32_t pixelIndex;
+	uint32_t litProbeCount;
+	Vec3 probeLighting;
+} RayStreamProbeGroup;
+
+struct RayStream {
+	RayStreamRay* rays;
+	uint32_t rayCount;
+	uint32_t rayCapacity;
+	RayStreamRay* nextRays;
+	uint32_t nextRayCount;
+	uint32_t nextRayCapacity;
+	RayStreamShadowRay* shadowRays;
+	uint32_t shadowRayCount;
+	uint32_t shadowRayCapacity;
+	RayStreamProbeGroup* groups;
+	uint32_t groupCount;
+	uint32_t groupCapacity;
+	// sort keys and the sorted order of a wave, the second arrays are the scratch of the radix sort
+	uint32_t* keys[2];
+	uint32_t* order[2];
+	uint32_t sortCapacity;
+	// the weight of every shadow ray of a light in the averaging of the kernel
+	float* shadowWeights;
+	uint32_t shadowWeightCapacity;
+};
+
+RayStream* raystream_create(void) {
+	return calloc(1, sizeof(RayStream));
+}
+
+void raystream_destroy(RayStream* stream) {
+	free(stream->rays);
+	free(stream->nextRays);
+	free(stream->shadowRays);
+	free(stream->groups);
+	for (uint32_t i = 0; i < 2; i++) {
+		free(stream->keys[i]);
+		free(stream->order[i]);
+	}
+	free(stream->shadowWeights);
+	free(stream);
+}
+
+// makes room for one more element, the capacity doubles
+static bool raystream_reserve(void** elements, uint32_t count, uint32_t* capacity, size_t elementSize) {
+	if (count < *capacity) {
+		return true;
+	}
+	uint32_t newCapacity = *capacity ? *capacity * 2 : 1024;
+	void* newElements = realloc(*elements, elementSize * newCapacity);
+	if (!newElements) {
+		return false;
+	}
+	*elements = newElements;
+	*capacity = newCapacity;
+	return true;
+}
+
+static bool raystream_appendRay(RayStream* stream, RayStreamRay ray) {
+	if (!raystream_reserve((void**) &stream->nextRays, stream->nextRayCount, &stream->nextRayCapacity, sizeof(RayStreamRay))) {
+		return false;
+	}
+	stream->nextRays[stream->nextRayCount++] = ray;
+	return true;
+}
+
+static bool raystream_appendShadowRay(RayStream* stream, RayStreamShadowRay shadowRay) {
+	if (!raystream_reserve((void**) &stream->shadowRays, stream->shadowRayCount, &stream->shadowRayCapacity, sizeof(RayStreamShadowRay))) {
+		return false;
+	}
+	stream->shadowRays[stream->shadowRayCount++] = shadowRay;
+	return true;
+}
+
+// spreads the lower 9 bits of value to every third bit
+static uint32_t raystream_spreadBits(uint32_t value) {
+	value &= 0x1FF;
+	value = (value | value << 16) & 0x030000FF;
+	value = (value | value << 8) & 0x0300F00F;
+	value = (value | value << 4) & 0x030C30C3;
+	value = (value | value << 2) & 0x09249249;
+	return value;
+}
+
+static uint32_t raystream_getKey(Ray* ray, BoundingBox* bounds) {
+	uint32_t octant = (ray->direction.x < 0.0f ? 1u : 0u) | (ray->direction.y < 0.0f ? 2u : 0u) | (ray->direction.z < 0.0f ? 4u : 0u);
+	float cells = (float) (1 << RAYSTREAM_MORTON_BITS);
+	Vec3 extent = vec3_sub(bounds->topRightBackCorner, bounds->bottomLeftFrontCorner);
+	Vec3 relative = vec3_sub(ray->origin, bounds->bottomLeftFrontCorner);
+	// hits on planes may be outside of the root box, a flat box has a single cell on that axis
+	uint32_t x = extent.x > 0.0f ? (uint32_t) math_clamp(relative.x / extent.x * cells, 0.0f, cells - 1.0f) : 0;
+	uint32_t y = extent.y > 0.0f ? (uint32_t) math_clamp(relative.y / extent.y * cells, 0.0f, cells - 1.0f) : 0;
+	uint32_t z = extent.z > 0.0f ? (uint32_t) math_clamp(relative.z / extent.z * cells, 0.0f, cells - 1.0f) : 0;
+	return octant << (3 * RAYSTREAM_MORTON_BITS) | raystream_spreadBits(x) << 2 | raystream_spreadBits(y) << 1 | raystream_spreadBits(z);
+}
+
+// the indexes of the rays ordered by the keys in stream->keys[0], written to stream->order[0]
+static void raystream_sort(RayStream* stream, uint32_t count) {
+	uint32_t* keys = stream->keys[0];
+	uint32_t* order = stream->order[0];
+	uint32_t* sortedKeys = stream->keys[1];
+	uint32_t* sortedOrder = stream->order[1];
+	for (uint32_t i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	// least significant digit first, the keys have 3 + 3 * 9 bits
+	for (uint32_t shift = 0; shift < 3 + 3 * RAYSTREAM_MORTON_BITS; shift += 8) {
+		uint32_t offsets[256] = { 0 };
+		for (uint32_t i = 0; i < count; i++) {
+			offsets[(keys[i] >> shift) & 0xFF]++;
+		}
+		uint32_t sum = 0;
+		for (uint32_t digit = 0; digit < 256; digit++) {
+			uint32_t digitCount = offsets[digit];
+			offsets[digit] = sum;
+			sum += digitCount;
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t target = offsets[(keys[i] >> shift) & 0xFF]++;
+			sortedKeys[target] = keys[i];
+			sortedOrder[target] = order[i];
+		}
+		uint32_t* swap = keys;
+		keys = sortedKeys;
+		sortedKeys = swap;
+		swap = order;
+		order = sortedOrder;
+		sortedOrder = swap;
+	}
+	// an odd number of passes ends in the scratch arrays
+	if (order != stream->order[0]) {
+		memcpy(stream->order[0], order, sizeof(uint32_t) * count);
+	}
+}
+
+static bool raystream_reserveSort(RayStream* stream, uint32_t count) {
+	if (count <= stream->sortCapacity) {
+		return true;
+	}
+	for (uint32_t i = 0; i < 2; i++) {
+		uint32_t* keys = realloc(stream->keys[i], sizeof(uint32_t) * count);
+		if (keys) {
+			stream->keys[i] = keys;
+		}
+		uint32_t* order = realloc(stream->order[i], sizeof(uint32_t) * count);
+		if (order) {
+			stream->order[i] = order;
+		}
+		if (!keys || !order) {
+			return false;
+		}
+	}
+	stream->sortCapacity = count;
+	return true;
+}
+
+static BoundingBox raystream_getBounds(Accel* accel) {
+	if (accel->nodeCount > 0) {
+		return accel->nodes[0].boundingBox;
+	}
+	BoundingBox bounds = { { { -1.0f, -1.0f, -1.0f } }, { { 1.0f, 1.0f, 1.0f } } };
+	return bounds;
+}
+
+// traces the shadow rays from first on in sorted order and adds the visible ones to their pixels
+static bool raystream_traceShadowRays(RayStream* stream, Scene* scene, Accel* accel, uint32_t first, BoundingBox* bounds,
+	uint32_t tileX, uint32_t tileY, uint32_t width, Vec3* colors, TraversalStats* stats) {
+	uint32_t count = stream->shadowRayCount - first;
+	if (!raystream_reserveSort(stream, count)) {
+		return false;
+	}
+	RayStreamShadowRay* shadowRays = &stream->shadowRays[first];
+	for (uint32_t i = 0; i < count; i++) {
+		stream->keys[0][i] = raystream_getKey(&shadowRays[i].ray, bounds);
+	}
+	raystream_sort(stream, count);
+	for (uint32_t i = 0; i < count; i++) {
+		RayStreamShadowRay* shadowRay = &shadowRays[stream->order[0][i]];
+		TraversalStats* pixelStats = NULL;
+		if (stats) {
+			pixelStats = &stats[(tileY + shadowRay->pixelIndex / width) * scene->camera->width + tileX + shadowRay->pixelIndex % width];
+		}
+		TRAVERSALSTATS_ADD(pixelStats, shadowRays, 1);
+		if (raytracer_isOccluded(scene, accel, &shadowRay->ray, shadowRay->distanceToLight, pixelStats)) {
+			continue;
+		}
+		colors[shadowRay->pixelIndex] = vec3_add(colors[shadowRay->pixelIndex], shadowRay->color);
+		if (shadowRay->groupIndex != RAYSTREAM_NO_GROUP) {
+			RayStreamProbeGroup* group = &stream->groups[shadowRay->groupIndex];
+			group->litProbeCount++;
+			group->probeLighting = vec3_add(group->probeLighting, shadowRay->lighting);
+		}
+	}
+	return true;
+}
+
+// queues the shadow rays of a hit, lights with probes get a group, which decides about their other shadow rays
+static bool raystream_shadeHit(RayStream* stream, Scene* scene, RaytracerSampling* sampling, Material* hitMaterial, Vec3 hitPoint,
+	Vec3 intersectionNormal, Vec3 weight, uint32_t pixelIndex, seed128bit* seed) {
+	uint32_t shadowRayCount = sampling->shadowRayCount;
+	if (scene->pointLightCount > LIGHTTREE_MIN_LIGHT_COUNT) {
+		for (uint32_t j = 0; j < shadowRayCount; j++) {
+			float lightProbability;
+			uint32_t lightIndex = lighttree_sampleLight(scene->lightTreeNodes, hitPoint, random_unilateralSeeded(seed), &lightProbability);
+			RayStreamShadowRay shadowRay;
+			Vec3 lighting = raytracer_createShadowRay(scene, hitMaterial, &scene->pointLights[lightIndex], hitPoint, intersectionNormal,
+				seed, &shadowRay.ray, &shadowRay.distanceToLight);
+			shadowRay.lighting = vec3_div(lighting, lightProbability);
+			shadowRay.color = vec3_mul(vec3_hadamard(shadowRay.lighting, weight), stream->shadowWeights[j]);
+			shadowRay.pixelIndex = pixelIndex;
+			shadowRay.groupIndex = RAYSTREAM_NO_GROUP;
+			if (!raystream_appendShadowRay(stream, shadowRay)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	uint32_t probeCount = MIN(sampling->shadowProbeCount, shadowRayCount);
+	for (uint32_t i = 0; i < scene->pointLightCount; i++) {
+		if (!raystream_reserve((void**) &stream->groups, stream->groupCount, &stream->groupCapacity, sizeof(RayStreamProbeGroup))) {
+			return false;
+		}
+		RayStreamProbeGroup* group = &stream->groups[stream->groupCount];
+		group->material = hitMaterial;
+		group->pointLight = &scene->pointLights[i];
+		group->hitPoint = hitPoint;
+		group->intersectionNormal = intersectionNormal;
+		group->weight = weight;
+		group->pixelIndex = pixelIndex;
+		group->litProbeCount = 0;
+		group->probeLighting = (Vec3) { { 0.0f, 0.0f, 0.0f } };
+		for (uint32_t j = 0; j < probeCount; j++) {
+			RayStreamShadowRay shadowRay;
+			shadowRay.lighting = raytracer_createShadowRay(scene, hitMaterial, group->pointLight, hitPoint, intersectionNormal,
+				seed, &shadowRay.ray, &shadowRay.distanceToLight);
+			shadowRay.color = vec3_mul(vec3_hadamard(shadowRay.lighting, weight), stream->shadowWeights[j]);
+			shadowRay.pixelIndex = pixelIndex;
+			shadowRay.groupIndex = stream->groupCount;
+			if (!raystream_appendShadowRay(stream, shadowRay)) {
+				return false;
+			}
+		}
+		stream->groupCount++;
+	}
+	return true;
+}
+
+// the shadow rays after the probes, traced in the penumbra, otherwise the probes stand in for them
+static bool raystream_finishGroups(RayStream* stream, Scene* scene, RaytracerSampling* sampling, seed128bit* seeds, uint32_t tileX,
+	uint32_t tileY, uint32_t width, Vec3* colors) {
+	uint32_t shadowRayCount = sampling->shadowRayCount;
+	uint32_t probeCount = MIN(sampling->shadowProbeCount, shadowRayCount);
+	float remainingWeight = 0.0f;
+	for (uint32_t j = probeCount; j < shadowRayCount; j++) {
+		remainingWeight += stream->shadowWeights[j];
+	}
+	for (uint32_t i = 0; i < stream->groupCount; i++) {
+		RayStreamProbeGroup* group = &stream->groups[i];
+		if (group->litProbeCount == 0 || group->litProbeCount == probeCount) {
+			Vec3 probeMean = vec3_div(group->probeLighting, (float) probeCount);
+			colors[group->pixelIndex] = vec3_add(colors[group->pixelIndex], vec3_mul(vec3_hadamard(probeMean, group->weight), remainingWeight));
+			continue;
+		}
+		seed128bit* seed = &seeds[(tileY + group->pixelIndex / width) * scene->camera->width + tileX + group->pixelIndex % width];
+		for (uint32_t j = probeCount; j < shadowRayCount; j++) {
+			RayStreamShadowRay shadowRay;
+			shadowRay.lighting = raytracer_createShadowRay(scene, group->material, group->pointLight, group->hitPoint,
+				group->intersectionNormal, seed, &shadowRay.ray, &shadowRay.distanceToLight);
+			shadowRay.color = vec3_mul(vec3_hadamard(shadowRay.lighting, group->weight), stream->shadowWeights[j]);
+			shadowRay.pixelIndex = group->pixelIndex;
+			shadowRay.groupIndex = RAYSTREAM_NO_GROUP;
+			if (!raystream_appendShadowRay(stream, shadowRay)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool raystream_renderTile(RayStream* stream, Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t tileX, uint32_t tileY,
+	uint32_t width, uint32_t height, seed128bit* seeds, Vec3* colors, TraversalStats* stats) {
+	Camera* camera = scene->camera;
+	BoundingBox bounds = raystream_getBounds(accel);
+	uint32_t maxRayDepth = MIN(sampling->maxRayDepth, RAYTRACER_MAX_RAY_DEPTH);
+
+	// the weight of the shadow ray j, which raytracer_shadeHit adds and divides by the count in every step
+	if (sampling->shadowRayCount > stream->shadowWeightCapacity) {
+		float* shadowWeights = realloc(stream->shadowWeights, sizeof(float) * sampling->shadowRayCount);
+		if (!shadowWeights) {
+			return false;
+		}
+		stream->shadowWeights = shadowWeights;
+		stream->shadowWeightCapacity = sampling->shadowRayCount;
+	}
+	float shadowWeight = 0.0f;
+	for (uint32_t j = sampling->shadowRayCount; j-- > 0;) {
+		shadowWeight = (1.0f + shadowWeight) / (float) sampling->shadowRayCount;
+		stream->shadowWeights[j] = shadowWeight;
+	}
+
+	stream->nextRayCount = 0;
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t pixelIndex = y * width + x;
+			colors[pixelIndex] = (Vec3) { { 0.0f, 0.0f, 0.0f } };
+			seed128bit* seed = &seeds[(tileY + y) * camera->width + tileX + x];
+			for (uint32_t j = 0; j < sampling->raysPerHeightPixel; j++) {
+				for (uint32_t i = 0; i < sampling->raysPerWidthPixel; i++) {
+					RayStreamRay ray = { raytracer_createSampleRay(camera, sampling, tileX + x, tileY + y, i, j, seed), { { 1.0f, 1.0f, 1.0f } }, pixelIndex, 0 };
+					if (!raystream_appendRay(stream, ray)) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// one wave per depth, the secondary rays of a wave form the next one
+	while (stream->nextRayCount > 0) {
+		RayStreamRay* rays = stream->nextRays;
+		stream->nextRays = stream->rays;
+		stream->rays = rays;
+		uint32_t capacity = stream->nextRayCapacity;
+		stream->nextRayCapacity = stream->rayCapacity;
+		stream->rayCapacity = capacity;
+		stream->rayCount = stream->nextRayCount;
+		stream->nextRayCount = 0;
+		stream->shadowRayCount = 0;
+		stream->groupCount = 0;
+
+		if (!raystream_reserveSort(stream, stream->rayCount)) {
+			return false;
+		}
+		for (uint32_t i = 0; i < stream->rayCount; i++) {
+			stream->keys[0][i] = raystream_getKey(&stream->rays[i].ray, &bounds);
+		}
+		raystream_sort(stream, stream->rayCount);
+		for (uint32_t i = 0; i < stream->rayCount; i++) {
+			RayStreamRay* ray = &stream->rays[stream->order[0][i]];
+			uint32_t imageIndex = (tileY + ray->pixelIndex / width) * camera->width + tileX + ray->pixelIndex % width;
+			seed128bit* seed = &seeds[imageIndex];
+			TraversalStats* pixelStats = stats ? &stats[imageIndex] : NULL;
+			float hitDistance;
+			Vec3 intersectionNormal;
+			uint32_t hitMaterialIndex;
+			if (!raytracer_intersectScene(scene, accel, &ray->ray, &hitDistance, &intersectionNormal, &hitMaterialIndex, pixelStats)) {
+				continue;
+			}
+			Material* hitMaterial = &scene->materials[hitMaterialIndex];
+			Vec3 hitPoint = vec3_add(ray->ray.origin, vec3_mul(ray->ray.direction, hitDistance));
+			// everything seen from the hit is filtered by the material color
+			Vec3 hitThroughput = vec3_hadamard(ray->throughput, hitMaterial->color);
+			if (ray->depth + 1 < maxRayDepth) {
+				Ray nextRays[2];
+				Vec3 nextThroughputs[2];
+				uint32_t nextRayCount = raytracer_continueRay(sampling, &ray->ray, hitMaterial, hitPoint, intersectionNormal, hitThroughput,
+					seed, nextRays, nextThroughputs);
+				for (uint32_t j = 0; j < nextRayCount; j++) {
+					RayStreamRay nextRay = { nextRays[j], nextThroughputs[j], ray->pixelIndex, ray->depth + 1 };
+					if (!raystream_appendRay(stream, nextRay)) {
+						return false;
+					}
+				}
+			}
+			// the direct lighting is scaled by 1 - reflectionIndex, so perfect mirrors skip the shadow rays
+			if (hitMaterial->reflectionIndex < 1 && !raystream_shadeHit(stream, scene, sampling, hitMaterial, hitPoint, intersectionNormal,
+				vec3_mul(hitThroughput, sampling->rayColorContribution), ray->pixelIndex, seed)) {
+				return false;
+			}
+		}
+
+		if (!raystream_traceShadowRays(stream, scene, accel, 0, &bounds, tileX, tileY, width, colors, stats)) {
+			return false;
+		}
+		uint32_t probeRayCount = stream->shadowRayCount;
+		if (!raystream_finishGroups(stream, scene, sampling, seeds, tileX, tileY, width, colors)
+			|| !raystream_traceShadowRays(stream, scene, accel, probeRayCount, &bounds, tileX, tileY, width, colors, stats)) {
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < width * height; i++) {
+		colors[i] = vec3_clamp(colors[i], 0.0f, 1.0f);
+	}
+	return true;
+}
+
+bool raystream_render(Scene* scene, Accel* accel, RaytracerSampling* sampling, seed128bit* seeds, Vec3* colors, TraversalStats* stats) {
+	Camera* camera = scene->camera;
+	RayStream* stream = raystream_create();
+	Vec3* tileColors = malloc(sizeof(Vec3) * RAYSTREAM_TILE_SIZE * RAYSTREAM_TILE_SIZE);
+	bool isRendered = stream && tileColors;
+	for (uint32_t tileY = 0; tileY < camera->height && isRendered; tileY += RAYSTREAM_TILE_SIZE) {
+		for (uint32_t tileX = 0; tileX < camera->width && isRendered; tileX += RAYSTREAM_TILE_SIZE) {
+			uint32_t width = MIN(RAYSTREAM_TILE_SIZE, camera->width - tileX);
+			uint32_t height = MIN(RAYSTREAM_TILE_SIZE, camera->height - tileY);
+			isRendered = raystream_renderTile(stream, scene, accel, sampling, tileX, tileY, width, height, seeds, tileColors, stats);
+			for (uint32_t y = 0; y < height && isRendered; y++) {
+				memcpy(&colors[(tileY + y) * camera->width + tileX], &tileColors[y * width], sizeof(Vec3) * width);
+			}
+		}
+	}
+	if (stream) {
+		raystream_destroy(stream);
+	}
+	free(tileColors);
+	return isRendered;
+}
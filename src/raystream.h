@@ -0,0 +1,38 @@
+#ifndef RAYTRACER_RAYSTREAM_H
+#define RAYTRACER_RAYSTREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/vec3.h"
+#include "utils/random.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "accel.h"
+#include "traversalstats.h"
+
+/*
+ * Stream mode of the CPU tracer. Instead of following every ray tree depth first, the rays of a tile are traced
+ * in waves, one per depth. Before a wave is traced, its rays are sorted by the octant of their direction and the
+ * Morton code of their origin, so that rays traced one after another visit the same nodes of the acceleration structure and primitives.
+ * The shadow rays of a wave are sorted the same way, and the colors of the hits are scattered back to the pixels.
+ * The colors have the expected value of raytracer_renderPixel, but the random numbers are drawn in another order.
+ */
+
+// the tiles of raystream_render, the rays of a tile are sorted together
+#define RAYSTREAM_TILE_SIZE 32
+
+// the ray buffers, which grow with the largest wave and are reused by the following tiles
+typedef struct RayStream RayStream;
+
+RayStream* raystream_create(void);
+void raystream_destroy(RayStream* stream);
+// renders the tile of width x height pixels at (tileX, tileY) into colors, which holds the clamped colors of the tile row by row,
+// seeds and stats (may be NULL) are per pixel of the whole image, returns false if the memory for the rays is missing
+bool raystream_renderTile(RayStream* stream, Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t tileX, uint32_t tileY,
+	uint32_t width, uint32_t height, seed128bit* seeds, Vec3* colors, TraversalStats* stats);
+// renders the whole image tile by tile like raytracer_render, colors, seeds and stats (may be NULL) are per pixel,
+// returns false if the memory for the rays is missing, the colors are incomplete then
+bool raystream_render(Scene* scene, Accel* accel, RaytracerSampling* sampling, seed128bit* seeds, Vec3* colors, TraversalStats* stats);
+
+#endif //RAYTRACER_RAYSTREAM_H
@@ -1,10 +1,14 @@
 #include "raytracer.h"
 
+#include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <stdbool.h>
 #include <utils/random.h>
 
 #include "utils/math.h"
+#include "utils/simd.h"
+#include "visibility.h"
 
 static Vec3 raytracer_refract(Vec3 direction, Vec3 normal, float refractionIndex) {
     float cosi = math_clamp(-1, 1, vec3_dot(direction, normal));
@@ -67,7 +71,7 @@ static void raytracer_moveRayOutOfObject(Ray* ray) {
     ray->origin = vec3_add(ray->origin, vec3_mul(ray->direction, 1.0f/1000.0f));
 }
 
-static bool raytracer_intersectPlane(Plane* plane, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
+bool raytracer_intersectPlane(Plane* plane, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
         // We use the "Hesse normal form":
         //     normal * p - distanceFromOrigin = 0
         // to describe our planes
@@ -85,7 +89,7 @@ static bool raytracer_intersectPlane(Plane* plane, Ray* ray, float* hitDistance,
         return false;
 }
 
-static bool raytracer_intersectSphere(Sphere* sphere, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
+bool raytracer_intersectSphere(Sphere* sphere, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
         Vec3 sphereRelativeOrigin = vec3_sub(ray->origin, sphere->position);
 
         // Mitternachtsformel
@@ -107,7 +111,7 @@ static bool raytracer_intersectSphere(Sphere* sphere, Ray* ray, float* hitDistan
             }
             if (t > 0) {
                 Vec3 hitPoint = raytracer_calculateHitpoint(ray, t);
-                *intersectionNormal = vec3_norm(vec3_sub(hitPoint, sphere->position));
+                *intersectionNormal = vec3_normFast(vec3_sub(hitPoint, sphere->position));
                 *hitDistance = t;
                 return true;
             }
@@ -115,10 +119,10 @@ static bool raytracer_intersectSphere(Sphere* sphere, Ray* ray, float* hitDistan
 		return false;
 }
 
-static bool raytracer_intersectTriangle(Triangle* triangle, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
+bool raytracer_intersectTriangle(Triangle* triangle, Ray* ray, float* hitDistance, Vec3* intersectionNormal) {
     Vec3 v0v1 = vec3_sub(triangle->v1, triangle->v0);
     Vec3 v0v2 = vec3_sub(triangle->v2, triangle->v0);
-    Vec3 normal = vec3_norm(vec3_cross(v0v1, v0v2));
+    Vec3 normal = vec3_normFast(vec3_cross(v0v1, v0v2));
     float normalDotRayDir = vec3_dot(normal, ray->direction);
     if (fabs(normalDotRayDir) < EPSILON) {
         return false;
@@ -160,6 +164,71 @@ static bool raytracer_intersectTriangle(Triangle* triangle, Ray* ray, float* hit
     return false;
 }
 
+// the slab test of the kernel, hits behind the ray origin count as well
+bool raytracer_intersectBoundingBox(Ray* ray, BoundingBox* boundingBox) {
+    float txmin = (boundingBox->bottomLeftFrontCorner.x - ray->origin.x) / ray->direction.x;
+    float txmax = (boundingBox->topRightBackCorner.x - ray->origin.x) / ray->direction.x;
+    if (txmin > txmax) {
+        float tmp = txmin;
+        txmin = txmax;
+        txmax = tmp;
+    }
+
+    float tymin = (boundingBox->bottomLeftFrontCorner.y - ray->origin.y) / ray->direction.y;
+    float tymax = (boundingBox->topRightBackCorner.y - ray->origin.y) / ray->direction.y;
+    if (tymin > tymax) {
+        float tmp = tymin;
+        tymin = tymax;
+        tymax = tmp;
+    }
+
+    if ((txmin > tymax) || (tymin > txmax)) {
+        return false;
+    }
+    if (tymin > txmin) {
+        txmin = tymin;
+    }
+    if (tymax < txmax) {
+        txmax = tymax;
+    }
+
+    float tzmin = (boundingBox->bottomLeftFrontCorner.z - ray->origin.z) / ray->direction.z;
+    float tzmax = (boundingBox->topRightBackCorner.z - ray->origin.z) / ray->direction.z;
+    if (tzmin > tzmax) {
+        float tmp = tzmin;
+        tzmin = tzmax;
+        tzmax = tmp;
+    }
+
+    if ((txmin > tzmax) || (tzmin > txmax)) {
+        return false;
+    }
+    return true;
+}
+
+// the direction components, that are replaced for the reciprocal
+#define RAYTRACER_MIN_DIRECTION 1e-20f
+
+// the reciprocal of the direction for the box tests of a traversal. The fast reciprocal of 0 is NaN, so zero components are
+// replaced by tiny ones of the same sign, whose huge reciprocal leaves the slab of the axis unbounded like the division by zero.
+static Vec4 raytracer_getInverseDirection(Vec3 direction) {
+    Vec4 safeDirection = vec4_fromVec3(direction, 1.0f);
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(safeDirection.v[i]) < RAYTRACER_MIN_DIRECTION) {
+            safeDirection.v[i] = copysignf(RAYTRACER_MIN_DIRECTION, safeDirection.v[i]);
+        }
+    }
+    return vec4_rcpFast(safeDirection);
+}
+
+// raytracer_intersectBoundingBox with the reciprocal instead of the division. It is accurate to about 22 bits,
+// so a box, that the ray only grazes, may be hit or missed unlike the kernel.
+static bool raytracer_intersectBoundingBoxFast(Vec4 origin, Vec4 inverseDirection, BoundingBox* boundingBox) {
+    Vec4 t0 = vec4_mul(vec4_sub(vec4_fromVec3(boundingBox->bottomLeftFrontCorner, 0.0f), origin), inverseDirection);
+    Vec4 t1 = vec4_mul(vec4_sub(vec4_fromVec3(boundingBox->topRightBackCorner, 0.0f), origin), inverseDirection);
+    return vec4_maxXYZ(vec4_min(t0, t1)) <= vec4_minXYZ(vec4_max(t0, t1));
+}
+
 static void raytracer_calcClosestPlaneIntersect(Scene* scene, Ray* ray, float* minHitDistance, Vec3* intersectionNormal,
                                                 uint32_t* hitMaterialIndex) {
     for (uint32_t i = 0; i < scene->planeCount; i++) {
@@ -176,143 +245,487 @@ static void raytracer_calcClosestPlaneIntersect(Scene* scene, Ray* ray, float* m
     }
 }
 
-static void raytracer_calcClosestSphereIntersect(Scene* scene, Ray *ray, float* minHitDistance, Vec3* intersectionNormal,
-                                                 uint32_t* hitMaterialIndex) {
-    for (uint32_t i = 0; i < scene->sphereCount; i++) {
-        Sphere* sphere = &scene->spheres[i];
-        float sphereHitDistance = FLT_MAX;
-        Vec3 sphereIntersectionNormal = {0};
-        if (raytracer_intersectSphere(sphere, ray, &sphereHitDistance, &sphereIntersectionNormal)) {
-            if (sphereHitDistance < *minHitDistance) {
-                *intersectionNormal = sphereIntersectionNormal;
-                *minHitDistance = sphereHitDistance;
-                *hitMaterialIndex = sphere->materialIndex;
+static bool raytracer_isAnyIntersectUsingAccelCloserThan(Scene* scene, Accel* accel, Ray* ray, float maxDistance, TraversalStats* stats) {
+    if (accel->nodeCount == 0) {
+        return false;
+    }
+    Vec4 origin = vec4_fromVec3(ray->origin, 0.0f);
+    Vec4 inverseDirection = raytracer_getInverseDirection(ray->direction);
+    // the skip links of the nodes replace the stack, like in the kernel
+    int32_t currentNodeIndex = 0;
+    while (currentNodeIndex != NODE_INDEX_UNDEF) {
+        AccelNode* currentNode = &accel->nodes[currentNodeIndex];
+        currentNodeIndex = currentNode->skipNodeIndex;
+        TRAVERSALSTATS_ADD(stats, boxTests, 1);
+        if (!raytracer_intersectBoundingBoxFast(origin, inverseDirection, &currentNode->boundingBox)) {
+            continue;
+        }
+        TRAVERSALSTATS_ADD(stats, nodesVisited, 1);
+        // an inner node is entered at its last child, which the skip links chain to the others
+        if (currentNode->childNodeIndexes[7] != NODE_INDEX_UNDEF) {
+            currentNodeIndex = currentNode->childNodeIndexes[7];
+            continue;
+        }
+        float hitDistance;
+        Vec3 intersectionNormal;
+        for (uint32_t i = 0; i < currentNode->sphereIndexCount; i++) {
+            Sphere* sphere = &scene->spheres[accel->indexes[i + currentNode->sphereIndexOffset]];
+            TRAVERSALSTATS_ADD(stats, sphereTests, 1);
+            if (raytracer_intersectSphere(sphere, ray, &hitDistance, &intersectionNormal) && hitDistance < maxDistance) {
+                return true;
+            }
+        }
+        for (uint32_t i = 0; i < currentNode->triangleIndexCount; i++) {
+            Triangle* triangle = &scene->triangles[accel->indexes[i + currentNode->triangleIndexOffset]];
+            TRAVERSALSTATS_ADD(stats, triangleTests, 1);
+            if (raytracer_intersectTriangle(triangle, ray, &hitDistance, &intersectionNormal) && hitDistance < maxDistance) {
+                return true;
             }
         }
     }
+    return false;
 }
 
-static void raytracer_calcClosestTriangleIntersect(Scene* scene, Ray* ray, float* minHitDistance, Vec3* intersectionNormal,
-                                                   uint32_t* hitMaterialIndex) {
-    for (uint32_t i = 0; i < scene->triangleCount; i++) {
-        Triangle* triangle = &scene->triangles[i];
-        float triangleHitDistance = FLT_MAX;
-        Vec3 triangleIntersectionNormal = {0};
-        if (raytracer_intersectTriangle(triangle, ray, &triangleHitDistance, &triangleIntersectionNormal)) {
-            if (triangleHitDistance < *minHitDistance) {
-                *intersectionNormal = triangleIntersectionNormal;
-                *minHitDistance = triangleHitDistance;
-                *hitMaterialIndex = triangle->materialIndex;
+static void raytracer_calcClosestIntersectUsingAccel(Scene* scene, Accel* accel, Ray* ray, float* minHitDistance, Vec3* intersectionNormal,
+                                                      uint32_t* hitMaterialIndex, TraversalStats* stats) {
+    if (accel->nodeCount == 0) {
+        return;
+    }
+    Vec4 origin = vec4_fromVec3(ray->origin, 0.0f);
+    Vec4 inverseDirection = raytracer_getInverseDirection(ray->direction);
+    // the skip links of the nodes replace the stack, like in the kernel
+    int32_t currentNodeIndex = 0;
+    while (currentNodeIndex != NODE_INDEX_UNDEF) {
+        AccelNode* currentNode = &accel->nodes[currentNodeIndex];
+        currentNodeIndex = currentNode->skipNodeIndex;
+        TRAVERSALSTATS_ADD(stats, boxTests, 1);
+        if (!raytracer_intersectBoundingBoxFast(origin, inverseDirection, &currentNode->boundingBox)) {
+            continue;
+        }
+        TRAVERSALSTATS_ADD(stats, nodesVisited, 1);
+        // an inner node is entered at its last child, which the skip links chain to the others
+        if (currentNode->childNodeIndexes[7] != NODE_INDEX_UNDEF) {
+            currentNodeIndex = currentNode->childNodeIndexes[7];
+            continue;
+        }
+        for (uint32_t i = 0; i < currentNode->sphereIndexCount; i++) {
+            Sphere* sphere = &scene->spheres[accel->indexes[i + currentNode->sphereIndexOffset]];
+            float sphereHitDistance = FLT_MAX;
+            Vec3 sphereIntersectionNormal = {0};
+            TRAVERSALSTATS_ADD(stats, sphereTests, 1);
+            if (raytracer_intersectSphere(sphere, ray, &sphereHitDistance, &sphereIntersectionNormal)) {
+                if (sphereHitDistance < *minHitDistance) {
+                    *intersectionNormal = sphereIntersectionNormal;
+                    *minHitDistance = sphereHitDistance;
+                    *hitMaterialIndex = sphere->materialIndex;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < currentNode->triangleIndexCount; i++) {
+            Triangle* triangle = &scene->triangles[accel->indexes[i + currentNode->triangleIndexOffset]];
+            float triangleHitDistance = FLT_MAX;
+            Vec3 triangleIntersectionNormal = {0};
+            TRAVERSALSTATS_ADD(stats, triangleTests, 1);
+            if (raytracer_intersectTriangle(triangle, ray, &triangleHitDistance, &triangleIntersectionNormal)) {
+                if (triangleHitDistance < *minHitDistance) {
+                    *intersectionNormal = triangleIntersectionNormal;
+                    *minHitDistance = triangleHitDistance;
+                    *hitMaterialIndex = triangle->materialIndex;
+                }
             }
         }
     }
 }
 
-static Vec3 raytracer_raycast_helper(Scene* scene, Ray* primaryRay, uint32_t recursionDepth, uint32_t maxRecursionDepth) {
-    Vec3 outColor = (Vec3) {0};
+Vec3 raytracer_createShadowRay(Scene* scene, Material* hitMaterial, PointLight* pointLight, Vec3 hitPoint, Vec3 intersectionNormal,
+                               seed128bit* seed, Ray* shadowRay, float* distanceToLight) {
+    Vec3 hitToLight = vec3_sub(pointLight->position, hitPoint);
+    Vec3 randomOffset;
+    randomOffset.x = random_bilateralSeeded(seed);
+    randomOffset.y = random_bilateralSeeded(seed);
+    randomOffset.z = random_bilateralSeeded(seed);
+    randomOffset = vec3_norm(randomOffset);
+    hitToLight = vec3_add(hitToLight, randomOffset);
+    *distanceToLight = vec3_length(hitToLight);
+    float distanceToLightSquared = hitToLight.x * hitToLight.x + hitToLight.y * hitToLight.y + hitToLight.z * hitToLight.z;
+
+    shadowRay->origin = hitPoint;
+    shadowRay->direction = vec3_normFast(hitToLight);
+    raytracer_moveRayOutOfObject(shadowRay);
+
+    float cosAngle = vec3_dot(shadowRay->direction, intersectionNormal);
+    cosAngle = math_clamp(cosAngle, 0.0f, 1.0f);
+    float lightAttenuation = 1.0f / (1.0f + 4 * PI * distanceToLightSquared);
+    float lightStrength = pointLight->strength * lightAttenuation;
+    Vec3 ambientLighting = vec3_mul(pointLight->emissionColor, hitMaterial->ambientWeight * lightStrength);
+    Vec3 diffuseLighting = vec3_mul(pointLight->emissionColor, hitMaterial->diffuseWeight * cosAngle * lightStrength);
+
+    Vec3 toView = vec3_norm(vec3_sub(scene->camera->position, hitPoint));
+    Vec3 toLight = vec3_mul(shadowRay->direction, -1);
+    Vec3 reflectionVector = vec3_reflect(toLight, intersectionNormal);
+    cosAngle = vec3_dot(toView, reflectionVector);
+    cosAngle = powf(cosAngle, hitMaterial->specularExponent);
+    Vec3 specularLighting = vec3_mul(pointLight->emissionColor, hitMaterial->specularWeight * cosAngle * lightStrength);
+
+    return vec3_mul(vec3_add(ambientLighting, vec3_add(diffuseLighting, specularLighting)), (1 - hitMaterial->reflectionIndex));
+}
+
+// the lighting of a shadow ray to a random point around the light, black if it's occluded
+static Vec3 raytracer_shadeLight(Scene* scene, Accel* accel, Material* hitMaterial, PointLight* pointLight, Vec3 hitPoint,
+                                 Vec3 intersectionNormal, seed128bit* seed, bool* isLit, TraversalStats* stats) {
+    TRAVERSALSTATS_ADD(stats, shadowRays, 1);
+    Ray shadowRay;
+    float distanceToLight;
+    Vec3 lighting = raytracer_createShadowRay(scene, hitMaterial, pointLight, hitPoint, intersectionNormal, seed, &shadowRay, &distanceToLight);
+    *isLit = !raytracer_isOccluded(scene, accel, &shadowRay, distanceToLight, stats);
+    return *isLit ? lighting : (Vec3) {0};
+}
+
+// a refracted ray, that is traced once the reflected ray of its hit and everything behind it is done
+typedef struct {
+    Ray ray;
+    Vec3 throughput;
+    uint32_t depth;
+} RaytracerPendingRay;
+
+// Russian roulette for rays with a throughput below the threshold, the survivors carry the weight of the dropped rays
+static bool raytracer_playRoulette(Vec3* throughput, float rouletteThreshold, seed128bit* seed) {
+    float maxWeight = MAX(throughput->r, MAX(throughput->g, throughput->b));
+    if (maxWeight >= rouletteThreshold) {
+        return true;
+    }
+    float survivalProbability = maxWeight / rouletteThreshold;
+    if (random_unilateralSeeded(seed) >= survivalProbability) {
+        return false;
+    }
+    *throughput = vec3_div(*throughput, survivalProbability);
+    return true;
+}
+
+// the reflected and refracted rays of a hit, which survive Russian roulette or Fresnel sampling
+uint32_t raytracer_continueRay(RaytracerSampling* sampling, Ray* ray, Material* hitMaterial, Vec3 hitPoint, Vec3 intersectionNormal,
+                               Vec3 hitThroughput, seed128bit* seed, Ray nextRays[2], Vec3 nextThroughputs[2]) {
+    if (hitMaterial->refractionIndex <= 0 && hitMaterial->reflectionIndex <= 0) {
+        return 0;
+    }
+    uint32_t rayCount = 0;
+    Ray reflectedRay;
+    reflectedRay.origin = hitPoint;
+    reflectedRay.direction = vec3_reflect(ray->direction, intersectionNormal);
+    raytracer_moveRayOutOfObject(&reflectedRay);
+    Vec3 reflectedThroughput = vec3_mul(hitThroughput, hitMaterial->reflectionIndex);
+
+    if (hitMaterial->refractionIndex > 0) {
+        float kr = raytracer_fresnel(ray->direction, intersectionNormal, hitMaterial->refractionIndex);
+        // no refraction in the case of total internal reflection
+        if (kr < 1) {
+            Ray refractedRay;
+            refractedRay.origin = hitPoint;
+            refractedRay.direction = raytracer_refract(ray->direction, intersectionNormal, hitMaterial->refractionIndex);
+            raytracer_moveRayOutOfObject(&refractedRay);
+            if (sampling->isFresnelSampling) {
+                // only one of both rays, picked with the fresnel weights, which cancel out
+                reflectedThroughput = hitThroughput;
+                if (random_unilateralSeeded(seed) >= kr) {
+                    reflectedRay = refractedRay;
+                }
+            } else {
+                reflectedThroughput = vec3_mul(hitThroughput, kr);
+                nextThroughputs[rayCount] = vec3_mul(hitThroughput, 1 - kr);
+                if (raytracer_playRoulette(&nextThroughputs[rayCount], sampling->rouletteThreshold, seed)) {
+                    nextRays[rayCount++] = refractedRay;
+                }
+            }
+        } else {
+            reflectedThroughput = hitThroughput;
+        }
+    }
+    nextThroughputs[rayCount] = reflectedThroughput;
+    if (raytracer_playRoulette(&nextThroughputs[rayCount], sampling->rouletteThreshold, seed)) {
+        nextRays[rayCount++] = reflectedRay;
+    }
+    return rayCount;
+}
 
-    if (recursionDepth >= maxRecursionDepth) {
+// the direct lighting of a hit, which isn't filtered by the material color yet
+static Vec3 raytracer_shadeHit(Scene* scene, Accel* accel, RaytracerSampling* sampling, Material* hitMaterial, Vec3 hitPoint,
+                               Vec3 intersectionNormal, seed128bit* seed, TraversalStats* stats) {
+    Vec3 outColor = (Vec3) {0};
+    uint32_t shadowRayCount = sampling->shadowRayCount;
+    uint32_t shadowProbeCount = sampling->shadowProbeCount;
+    if (scene->pointLightCount > LIGHTTREE_MIN_LIGHT_COUNT) {
+        // a fixed number of shadow rays to lights picked by their estimated contribution
+        Vec3 directLighting = {0};
+        for (uint32_t j = 0; j < shadowRayCount; j++) {
+            float lightProbability;
+            uint32_t lightIndex = lighttree_sampleLight(scene->lightTreeNodes, hitPoint, random_unilateralSeeded(seed), &lightProbability);
+            bool isLit;
+            Vec3 lighting = raytracer_shadeLight(scene, accel, hitMaterial, &scene->pointLights[lightIndex], hitPoint, intersectionNormal, seed, &isLit, stats);
+            directLighting = vec3_add(directLighting, vec3_div(lighting, lightProbability));
+            // averaged like the loop over all lights, so the expected color is the same
+            directLighting = vec3_div(directLighting, (float) shadowRayCount);
+            outColor = vec3_add(outColor, directLighting);
+        }
         return outColor;
     }
+    for (uint32_t i = 0; i < scene->pointLightCount; i++) {
+        PointLight* pointLight = &scene->pointLights[i];
+        Vec3 directLighting = {0};
+        Vec3 probeLighting = {0};
+        uint32_t litProbeCount = 0;
+        for (uint32_t j = 0; j < shadowRayCount; j++) {
+            Vec3 lighting;
+            if (j < shadowProbeCount || (litProbeCount > 0 && litProbeCount < shadowProbeCount)) {
+                bool isLit;
+                lighting = raytracer_shadeLight(scene, accel, hitMaterial, pointLight, hitPoint, intersectionNormal, seed, &isLit, stats);
+                if (j < shadowProbeCount) {
+                    litProbeCount += isLit;
+                    probeLighting = vec3_add(probeLighting, lighting);
+                }
+            } else {
+                // the probes agree, so the light is taken as fully visible or fully blocked, which is biased in the
+                // penumbra, see RAYTRACER_SHADOW_PROBE_COUNT
+                lighting = vec3_div(probeLighting, (float) shadowProbeCount);
+            }
+            directLighting = vec3_add(directLighting, lighting);
+            // the kernel averages inside the loop, which has to be repeated for matching colors
+            directLighting = vec3_div(directLighting, (float) shadowRayCount);
+            outColor = vec3_add(outColor, directLighting);
+        }
+    }
+    return outColor;
+}
 
-    float minHitDistance = FLT_MAX;
+// follows raytracer_raycast of the kernel, including the order in which random numbers are drawn
+Vec3 raytracer_raycast(Scene* scene, Accel* accel, Ray* primaryRay, RaytracerSampling* sampling, seed128bit* seed, TraversalStats* stats) {
+    float hitDistance = FLT_MAX;
     uint32_t hitMaterialIndex = 0;
-
     Vec3 intersectionNormal = {0};
+    raytracer_calcClosestPlaneIntersect(scene, primaryRay, &hitDistance, &intersectionNormal, &hitMaterialIndex);
+    raytracer_calcClosestIntersectUsingAccel(scene, accel, primaryRay, &hitDistance, &intersectionNormal, &hitMaterialIndex, stats);
+    return raytracer_raycastFromHit(scene, accel, primaryRay, hitDistance, intersectionNormal, hitMaterialIndex, sampling, seed, stats);
+}
 
-    raytracer_calcClosestPlaneIntersect(scene, primaryRay, &minHitDistance, &intersectionNormal, &hitMaterialIndex);
-    raytracer_calcClosestSphereIntersect(scene, primaryRay, &minHitDistance, &intersectionNormal, &hitMaterialIndex);
-    raytracer_calcClosestTriangleIntersect(scene, primaryRay, &minHitDistance, &intersectionNormal, &hitMaterialIndex);
+Vec3 raytracer_raycastFromHit(Scene* scene, Accel* accel, Ray* primaryRay, float hitDistance, Vec3 intersectionNormal, uint32_t hitMaterialIndex,
+                              RaytracerSampling* sampling, seed128bit* seed, TraversalStats* stats) {
+    assert(sampling->shadowProbeCount > 0);
+    Vec3 outColor = (Vec3) {0};
+    // at most one refracted ray per depth waits for its reflected ray
+    RaytracerPendingRay pendingRays[RAYTRACER_MAX_RAY_DEPTH];
+    uint32_t pendingRayCount = 0;
+    uint32_t maxRayDepth = MIN(sampling->maxRayDepth, RAYTRACER_MAX_RAY_DEPTH);
+
+    Ray ray = *primaryRay;
+    // the weight of the color seen along the ray in the pixel
+    Vec3 throughput = (Vec3) {{1.0f, 1.0f, 1.0f}};
+    uint32_t depth = 0;
+    while (true) {
+        bool hasNextRay = false;
+        Ray nextRay;
+        Vec3 nextThroughput;
+        if (hitMaterialIndex) {
+            Material* hitMaterial = &scene->materials[hitMaterialIndex];
+            Vec3 hitPoint = raytracer_calculateHitpoint(&ray, hitDistance);
+            // everything seen from the hit is filtered by the material color
+            Vec3 hitThroughput = vec3_hadamard(throughput, hitMaterial->color);
+
+            // REFLECTION AND REFRACTION
+            if (depth + 1 < maxRayDepth) {
+                Ray nextRays[2];
+                Vec3 nextThroughputs[2];
+                uint32_t nextRayCount = raytracer_continueRay(sampling, &ray, hitMaterial, hitPoint, intersectionNormal, hitThroughput, seed,
+                                                              nextRays, nextThroughputs);
+                if (nextRayCount == 2) {
+                    pendingRays[pendingRayCount++] = (RaytracerPendingRay) { nextRays[0], nextThroughputs[0], depth + 1 };
+                }
+                if (nextRayCount > 0) {
+                    hasNextRay = true;
+                    nextRay = nextRays[nextRayCount - 1];
+                    nextThroughput = nextThroughputs[nextRayCount - 1];
+                }
+            }
 
-    if (hitMaterialIndex) {
+            // SHADOWS, the direct lighting is scaled by 1 - reflectionIndex, so perfect mirrors skip the shadow rays
+            if (hitMaterial->reflectionIndex < 1) {
+                Vec3 directLighting = raytracer_shadeHit(scene, accel, sampling, hitMaterial, hitPoint, intersectionNormal, seed, stats);
+                outColor = vec3_add(outColor, vec3_hadamard(directLighting, hitThroughput));
+            }
+        }
 
-        Material* hitMaterial = &scene->materials[hitMaterialIndex];
+        if (hasNextRay) {
+            ray = nextRay;
+            throughput = nextThroughput;
+            depth++;
+        } else if (pendingRayCount > 0) {
+            RaytracerPendingRay* pendingRay = &pendingRays[--pendingRayCount];
+            ray = pendingRay->ray;
+            throughput = pendingRay->throughput;
+            depth = pendingRay->depth;
+        } else {
+            return outColor;
+        }
+        hitDistance = FLT_MAX;
+        hitMaterialIndex = 0;
+        intersectionNormal = (Vec3) {0};
+        raytracer_calcClosestPlaneIntersect(scene, &ray, &hitDistance, &intersectionNormal, &hitMaterialIndex);
+        raytracer_calcClosestIntersectUsingAccel(scene, accel, &ray, &hitDistance, &intersectionNormal, &hitMaterialIndex, stats);
+    }
+}
 
-		// if we got a hit, calculate the hitPoint and send a shadow rays to each lightsource
-		Vec3 hitPoint = raytracer_calculateHitpoint(primaryRay, minHitDistance);
+void raytracer_initSampling(RaytracerSampling* sampling, Camera* camera, uint32_t raysPerPixel, uint32_t maxRayDepth, uint32_t shadowRayCount) {
+    sampling->maxRayDepth = maxRayDepth;
+    sampling->shadowRayCount = shadowRayCount;
+    sampling->shadowProbeCount = RAYTRACER_SHADOW_PROBE_COUNT;
+    sampling->rouletteThreshold = 0.0f;
+    sampling->isFresnelSampling = false;
+
+    // this calculates how many rays we have on X and Y, and how much the deltaX/Y for these subpixel samples are
+    assert(raysPerPixel > 0);
+    sampling->rayColorContribution = 1.0f / (float) raysPerPixel;
+
+    float pixelWidth = 1.0f / (float) camera->width;
+    float pixelHeight = 1.0f / (float) camera->height;
+    float rootTerm = sqrtf(pixelWidth / pixelHeight * raysPerPixel + powf(pixelWidth - pixelHeight, 2) / 4 * powf(pixelHeight, 2));
+    sampling->pixelWidth = pixelWidth;
+    sampling->pixelHeight = pixelHeight;
+    sampling->raysPerWidthPixel = 1;
+    sampling->raysPerHeightPixel = 1;
+    sampling->deltaX = pixelWidth;
+    sampling->deltaY = pixelHeight;
+
+    // prevent division by 0
+    if (raysPerPixel > 1) {
+        sampling->raysPerWidthPixel = (uint32_t) (rootTerm - (pixelWidth - pixelHeight / 2 * pixelHeight));
+        sampling->raysPerHeightPixel = (uint32_t) (raysPerPixel / sampling->raysPerWidthPixel);
+        sampling->deltaX = pixelWidth / sampling->raysPerWidthPixel;
+        sampling->deltaY = pixelHeight / sampling->raysPerHeightPixel;
+    }
+}
 
-		// REFLECTION AND REFRACTION
-		if (hitMaterial->refractionIndex > 0) {
-		    float kr = raytracer_fresnel(primaryRay->direction, intersectionNormal, hitMaterial->refractionIndex);
+Ray raytracer_createPinholeSampleRay(Camera* camera, RaytracerSampling* sampling, uint32_t x, uint32_t y, uint32_t i, uint32_t j) {
+    float posX = -1.0f + 2.0f * ((float) x / (float) camera->width);
+    float posY = -1.0f + 2.0f * ((float) y / (float) camera->height);
+    Vec3 offsetY = vec3_mul(camera->y, (posY - sampling->pixelHeight + (float) j * sampling->deltaY) * camera->renderTargetHeight / 2.0f);
+    Vec3 offsetX = vec3_mul(camera->x, (posX - sampling->pixelWidth + (float) i * sampling->deltaX) * camera->renderTargetWidth / 2.0f);
+    // (0, 0) is the top left, so y is flipped
+    Vec3 renderTargetPos = vec3_sub(vec3_add(camera->renderTargetCenter, offsetX), offsetY);
+    Ray ray;
+    ray.origin = camera->position;
+    ray.direction = vec3_norm(vec3_sub(renderTargetPos, camera->position));
+    return ray;
+}
 
-            Vec3 refractionColor = {0};
+Ray raytracer_createSampleRay(Camera* camera, RaytracerSampling* sampling, uint32_t x, uint32_t y, uint32_t i, uint32_t j, seed128bit* seed) {
+    Ray ray = raytracer_createPinholeSampleRay(camera, sampling, x, y, i, j);
+    // depth of field, the kernel draws these numbers even without an aperture
+    Vec3 focalPoint = vec3_add(ray.origin, vec3_mul(ray.direction, camera->focalLength));
+    Vec3 randomOffset;
+    randomOffset.x = random_bilateralSeeded(seed) / 2.0f;
+    randomOffset.y = random_bilateralSeeded(seed) / 2.0f;
+    randomOffset.z = random_bilateralSeeded(seed) / 2.0f;
+    ray.origin = vec3_add(ray.origin, vec3_mul(randomOffset, camera->apertureSize));
+    ray.direction = vec3_norm(vec3_sub(focalPoint, ray.origin));
+    return ray;
+}
 
-            // compute refraction if it is not a case of total internal reflection
-            if (kr < 1) {
-                Ray refractedRay;
-                refractedRay.origin = hitPoint;
-                refractedRay.direction = raytracer_refract(primaryRay->direction, intersectionNormal, hitMaterial->refractionIndex);
-                raytracer_moveRayOutOfObject(&refractedRay);
+Vec3 raytracer_renderPixel(Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y, seed128bit* seed,
+                           TraversalStats* stats) {
+    Vec3 color = {0};
+    // supersampling loops
+    for (uint32_t j = 0; j < sampling->raysPerHeightPixel; j++) {
+        for (uint32_t i = 0; i < sampling->raysPerWidthPixel; i++) {
+            Ray ray = raytracer_createSampleRay(scene->camera, sampling, x, y, i, j, seed);
+            Vec3 rayColor = raytracer_raycast(scene, accel, &ray, sampling, seed, stats);
+            color = vec3_add(color, vec3_mul(rayColor, sampling->rayColorContribution));
+        }
+    }
+    return vec3_clamp(color, 0.0f, 1.0f);
+}
 
-                refractionColor = raytracer_raycast_helper(scene, &refractedRay, recursionDepth + 1, maxRecursionDepth);
-            }
+RaytracerPrimaryMode raytracer_render(Scene* scene, Accel* accel, RaytracerSampling* sampling, RaytracerPrimaryMode mode,
+                                      seed128bit* seeds, Vec3* colors, TraversalStats* stats) {
+    Camera* camera = scene->camera;
+    VisibilityBuffer* buffer = NULL;
+    // with an aperture the primary rays don't start at the camera position
+    if (mode == RAYTRACER_PRIMARY_VISIBILITY && camera->apertureSize == 0.0f) {
+        buffer = visibility_create();
+        if (buffer && !visibility_render(buffer, scene, sampling)) {
+            visibility_destroy(buffer);
+            buffer = NULL;
+        }
+    }
+    for (uint32_t y = 0; y < camera->height; y++) {
+        for (uint32_t x = 0; x < camera->width; x++) {
+            uint32_t index = y * camera->width + x;
+            TraversalStats* pixelStats = stats ? &stats[index] : NULL;
+            colors[index] = buffer ? visibility_renderPixel(buffer, scene, accel, sampling, x, y, &seeds[index], pixelStats)
+                : raytracer_renderPixel(scene, accel, sampling, x, y, &seeds[index], pixelStats);
+        }
+    }
+    if (!buffer) {
+        return RAYTRACER_PRIMARY_TRACE;
+    }
+    visibility_destroy(buffer);
+    return RAYTRACER_PRIMARY_VISIBILITY;
+}
 
-            Ray reflectedRay;
-            reflectedRay.origin = hitPoint;
-            reflectedRay.direction = vec3_reflect(primaryRay->direction, intersectionNormal);
-            raytracer_moveRayOutOfObject(&reflectedRay);
-
-            Vec3 reflectionColor = raytracer_raycast_helper(scene, &reflectedRay, recursionDepth + 1, maxRecursionDepth);
-
-            // mix the two
-            outColor = vec3_add(outColor, vec3_add(vec3_mul(reflectionColor, kr), vec3_mul(refractionColor, (1 - kr))));
-        } else
-		// REFLECTION:
-		if (hitMaterial->reflectionIndex > 0) {
-
-			Ray reflectedRay;
-            reflectedRay.origin = hitPoint;
-            reflectedRay.direction = vec3_reflect(primaryRay->direction, intersectionNormal);
-            raytracer_moveRayOutOfObject(&reflectedRay);
-
-			Vec3 reflectionColor = raytracer_raycast_helper(scene, &reflectedRay, recursionDepth + 1, maxRecursionDepth);
-
-			outColor = vec3_add(outColor, vec3_mul(reflectionColor, hitMaterial->reflectionIndex));
-		}
-
-		// SHADOWS
-        for (uint32_t i = 0; i < scene->pointLightCount; i++) {
-            PointLight* pointLight = &scene->pointLights[i];
-            Ray shadowRay = {0};
-            Vec3 hitToLight = vec3_sub(pointLight->position, hitPoint);
-            Vec3 randomOffset = vec3_norm((Vec3) { random_bilateral(), random_bilateral(), random_bilateral()});
-            hitToLight = vec3_add(hitToLight, randomOffset);
-            float distanceToLight = vec3_length(hitToLight);
-
-            shadowRay.origin = hitPoint;
-            shadowRay.direction = vec3_norm(hitToLight);
-            raytracer_moveRayOutOfObject(&shadowRay);
-
-            uint32_t shadowRayHitMaterialIndex = 0;
-            float closestHitDistance = FLT_MAX;
-            Vec3 shadowRayIntersectionNormal = {0};
-            raytracer_calcClosestPlaneIntersect(scene, &shadowRay, &closestHitDistance, &shadowRayIntersectionNormal, &shadowRayHitMaterialIndex);
-            raytracer_calcClosestSphereIntersect(scene, &shadowRay, &closestHitDistance, &shadowRayIntersectionNormal, &shadowRayHitMaterialIndex);
-            raytracer_calcClosestTriangleIntersect(scene, &shadowRay, &closestHitDistance, &shadowRayIntersectionNormal, &shadowRayHitMaterialIndex);
-            if (distanceToLight < closestHitDistance) {
-                // we hit the light
-                float cosAngle = vec3_dot(shadowRay.direction, intersectionNormal);
-                cosAngle = math_clamp(cosAngle, 0.0f, 1.0f);
-
-                float lightStrength = (pointLight->strength/(4 * PI * distanceToLight * distanceToLight));
-                Vec3 diffuseLighting = vec3_mul(pointLight->emissionColor, cosAngle * lightStrength);
-
-                Vec3 toView = vec3_norm(vec3_sub(scene->camera->position, hitPoint));
-                Vec3 toLight = vec3_mul(shadowRay.direction, -1);
-                Vec3 reflectionVector = vec3_reflect(toLight, intersectionNormal);
-                cosAngle = vec3_dot(toView, reflectionVector);
-                cosAngle = powf(cosAngle, 64);
-
-                Vec3 specularLighting = vec3_mul(pointLight->emissionColor, cosAngle * lightStrength);
-
-                outColor = vec3_add(outColor, vec3_mul(vec3_add(diffuseLighting, specularLighting), (1-hitMaterial->reflectionIndex)));
-            }
+uint32_t raytracer_packColor(Vec3 color) {
+    // write_imagef rounds to the nearest value
+    return 0xFF000000u | ((uint32_t) lrintf(color.b * 255.0f) << 16) | ((uint32_t) lrintf(color.g * 255.0f) << 8)
+        | (uint32_t) lrintf(color.r * 255.0f);
+}
+
+Ray raytracer_createPrimaryRay(Camera* camera, uint32_t x, uint32_t y) {
+    float posX = -1.0f + 2.0f * ((float) x / (float) camera->width);
+    float posY = -1.0f + 2.0f * ((float) y / (float) camera->height);
+    Vec3 offsetX = vec3_mul(camera->x, posX * camera->renderTargetWidth / 2.0f);
+    Vec3 offsetY = vec3_mul(camera->y, posY * camera->renderTargetHeight / 2.0f);
+    // (0, 0) is the top left, so y is flipped
+    Vec3 renderTargetPos = vec3_sub(vec3_add(camera->renderTargetCenter, offsetX), offsetY);
+    Ray ray;
+    ray.origin = camera->position;
+    ray.direction = vec3_norm(vec3_sub(renderTargetPos, camera->position));
+    return ray;
+}
+
+bool raytracer_intersectScene(Scene* scene, Accel* accel, Ray* ray, float* hitDistance, Vec3* intersectionNormal, uint32_t* hitMaterialIndex,
+                              TraversalStats* stats) {
+    *hitDistance = FLT_MAX;
+    *hitMaterialIndex = 0;
+    raytracer_calcClosestPlaneIntersect(scene, ray, hitDistance, intersectionNormal, hitMaterialIndex);
+    raytracer_calcClosestIntersectUsingAccel(scene, accel, ray, hitDistance, intersectionNormal, hitMaterialIndex, stats);
+    return *hitMaterialIndex != 0;
+}
+
+bool raytracer_isOccluded(Scene* scene, Accel* accel, Ray* ray, float maxDistance, TraversalStats* stats) {
+    float hitDistance;
+    Vec3 intersectionNormal;
+    for (uint32_t i = 0; i < scene->planeCount; i++) {
+        if (raytracer_intersectPlane(&scene->planes[i], ray, &hitDistance, &intersectionNormal) && hitDistance < maxDistance) {
+            return true;
         }
-        outColor = vec3_hadamard(outColor, hitMaterial->color);
     }
-    return outColor;
+    return raytracer_isAnyIntersectUsingAccelCloserThan(scene, accel, ray, maxDistance, stats);
 }
 
-Vec3 raytracer_raycast(Scene* scene, Ray* primaryRay, uint32_t maxRecursionDepth) {
-    return raytracer_raycast_helper(scene, primaryRay, 0, maxRecursionDepth);
+uint32_t raytracer_createSecondaryRays(Scene* scene, Ray* ray, float hitDistance, Vec3 intersectionNormal, uint32_t hitMaterialIndex,
+                                       Ray secondaryRays[2]) {
+    Material* hitMaterial = &scene->materials[hitMaterialIndex];
+    Vec3 hitPoint = raytracer_calculateHitpoint(ray, hitDistance);
+    uint32_t rayCount = 0;
+    if (hitMaterial->refractionIndex > 0) {
+        float kr = raytracer_fresnel(ray->direction, intersectionNormal, hitMaterial->refractionIndex);
+        if (kr < 1) {
+            secondaryRays[rayCount].origin = hitPoint;
+            secondaryRays[rayCount].direction = raytracer_refract(ray->direction, intersectionNormal, hitMaterial->refractionIndex);
+            raytracer_moveRayOutOfObject(&secondaryRays[rayCount]);
+            rayCount++;
+        }
+    } else if (hitMaterial->reflectionIndex <= 0) {
+        return 0;
+    }
+    secondaryRays[rayCount].origin = hitPoint;
+    secondaryRays[rayCount].direction = vec3_reflect(ray->direction, intersectionNormal);
+    raytracer_moveRayOutOfObject(&secondaryRays[rayCount]);
+    return rayCount + 1;
 }
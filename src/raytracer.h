@@ -1,12 +1,98 @@
 #ifndef RAYTRACER_RAYTRACER_H
 #define RAYTRACER_RAYTRACER_H
 
+#include <stdbool.h>
+
 #include "utils/vec3.h"
+#include "utils/random.h"
 #include "ray.h"
 #include "scene.h"
+#include "accel.h"
+#include "traversalstats.h"
 
 #define EPSILON 0.00001f
+// the first shadow rays of a light, the others are only traced if these disagree about the visibility of the light.
+// This is biased: where the probes agree by chance in the penumbra, the light counts as fully visible or fully blocked,
+// which sharpens the penumbra, e.g. 2 probes of 4 rays give 0.203 on average for a light, that is 25% visible.
+// A probe count of at least the shadow ray count traces every ray and is unbiased.
+#define RAYTRACER_SHADOW_PROBE_COUNT 2
+// the deepest ray tree the kernel and the CPU tracer can trace
+#define RAYTRACER_MAX_RAY_DEPTH 8
+// with Russian roulette, secondary rays, whose color is weighted less than this in the pixel, are dropped at random.
+// It is off by default, the frames get noisier, in exchange for fewer rays.
+#define RAYTRACER_ROULETTE_THRESHOLD 0.1f
+
+// how raytracer_render finds the primary hits
+typedef enum {
+    // every primary ray searches the acceleration structure
+    RAYTRACER_PRIMARY_TRACE,
+    // the primitives are rasterized into a visibility buffer first (visibility.h), only without an aperture
+    RAYTRACER_PRIMARY_VISIBILITY
+} RaytracerPrimaryMode;
+
+// the samples of a pixel, computed like the kernel arguments
+typedef struct {
+    // 1 to RAYTRACER_MAX_RAY_DEPTH
+    uint32_t maxRayDepth;
+    uint32_t shadowRayCount;
+    // at least 1, shadowRayCount or more traces all shadow rays
+    uint32_t shadowProbeCount;
+    // 0 (the default) traces every secondary ray up to the maximum depth
+    float rouletteThreshold;
+    // refracting materials trace either the reflected or the refracted ray instead of both
+    bool isFresnelSampling;
+    uint32_t raysPerWidthPixel;
+    uint32_t raysPerHeightPixel;
+    float pixelWidth;
+    float pixelHeight;
+    float deltaX;
+    float deltaY;
+    float rayColorContribution;
+} RaytracerSampling;
+
+// spheres and triangles are found with the acceleration structure, the shading and the random numbers follow the kernel, stats may be NULL
+Vec3 raytracer_raycast(Scene *scene, Accel* accel, Ray *primaryRay, RaytracerSampling* sampling, seed128bit* seed, TraversalStats* stats);
+// the same for a primary ray, whose closest hit is already known, a hitMaterialIndex of 0 is a miss
+Vec3 raytracer_raycastFromHit(Scene* scene, Accel* accel, Ray* primaryRay, float hitDistance, Vec3 intersectionNormal, uint32_t hitMaterialIndex,
+                              RaytracerSampling* sampling, seed128bit* seed, TraversalStats* stats);
+
+void raytracer_initSampling(RaytracerSampling* sampling, Camera* camera, uint32_t raysPerPixel, uint32_t maxRayDepth, uint32_t shadowRayCount);
+// the ray from the camera position through the supersample (i, j) of a pixel, without depth of field
+Ray raytracer_createPinholeSampleRay(Camera* camera, RaytracerSampling* sampling, uint32_t x, uint32_t y, uint32_t i, uint32_t j);
+// the primary ray of the supersample (i, j) of a pixel, with the depth of field offset drawn from the seed
+Ray raytracer_createSampleRay(Camera* camera, RaytracerSampling* sampling, uint32_t x, uint32_t y, uint32_t i, uint32_t j, seed128bit* seed);
+// the shadow ray to a random point around the light and the lighting it brings, if the light isn't occluded
+Vec3 raytracer_createShadowRay(Scene* scene, Material* hitMaterial, PointLight* pointLight, Vec3 hitPoint, Vec3 intersectionNormal,
+                               seed128bit* seed, Ray* shadowRay, float* distanceToLight);
+// writes the surviving secondary rays of a hit and their throughputs, the depth first tracer follows the last one first, returns the count (0 to 2)
+uint32_t raytracer_continueRay(RaytracerSampling* sampling, Ray* ray, Material* hitMaterial, Vec3 hitPoint, Vec3 intersectionNormal,
+                               Vec3 hitThroughput, seed128bit* seed, Ray nextRays[2], Vec3 nextThroughputs[2]);
+// the clamped color of a pixel, traced like the kernel does with the same seed. The box tests and the normals use
+// the fast reciprocals of simd.h, so the colors may differ from the kernel in the last bits, rarely by a few 1/255.
+Vec3 raytracer_renderPixel(Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y, seed128bit* seed,
+                           TraversalStats* stats);
+// the clamped colors of all pixels with a seed per pixel like the kernel, stats (may be NULL) are per pixel as well.
+// Returns the mode, that was used, the visibility buffer falls back to tracing with an aperture or without memory.
+RaytracerPrimaryMode raytracer_render(Scene* scene, Accel* accel, RaytracerSampling* sampling, RaytracerPrimaryMode mode,
+                                      seed128bit* seeds, Vec3* colors, TraversalStats* stats);
+// the rgba layout of the images read back from the kernel
+uint32_t raytracer_packColor(Vec3 color);
+
+// the single primitive tests, hitDistance and intersectionNormal are only written on a hit
+bool raytracer_intersectPlane(Plane* plane, Ray* ray, float* hitDistance, Vec3* intersectionNormal);
+bool raytracer_intersectSphere(Sphere* sphere, Ray* ray, float* hitDistance, Vec3* intersectionNormal);
+bool raytracer_intersectTriangle(Triangle* triangle, Ray* ray, float* hitDistance, Vec3* intersectionNormal);
+bool raytracer_intersectBoundingBox(Ray* ray, BoundingBox* boundingBox);
 
-Vec3 raytracer_raycast(Scene *scene, Ray *primaryRay, uint32_t maxRecursionDepth);
+// the ray through the top left corner of the pixel, like the kernel without supersampling
+Ray raytracer_createPrimaryRay(Camera* camera, uint32_t x, uint32_t y);
+// finds the closest hit, returns false if nothing was hit
+bool raytracer_intersectScene(Scene* scene, Accel* accel, Ray* ray, float* hitDistance, Vec3* intersectionNormal, uint32_t* hitMaterialIndex,
+                              TraversalStats* stats);
+// returns true, if anything is hit closer than maxDistance
+bool raytracer_isOccluded(Scene* scene, Accel* accel, Ray* ray, float maxDistance, TraversalStats* stats);
+// writes the reflected and refracted rays of a hit to secondaryRays and returns their count (0 to 2)
+uint32_t raytracer_createSecondaryRays(Scene* scene, Ray* ray, float hitDistance, Vec3 intersectionNormal, uint32_t hitMaterialIndex,
+                                       Ray secondaryRays[2]);
 
 #endif //RAYTRACER_RAYTRACER_H
@@ -1,9 +1,23 @@
 #include "scene.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "memstats.h"
+#include "utils/math.h"
+
 #define DEFAULT_CAPACITY 200
 
+// bytes of the element arrays, the capacities define the allocation sizes
+static size_t scene_getAllocatedBytes(Scene* scene) {
+    return sizeof(Material) * scene->materialCapacity
+        + sizeof(Plane) * scene->planeCapacity
+        + sizeof(Sphere) * scene->sphereCapacity
+        + sizeof(Triangle) * scene->triangleCapacity
+        + sizeof(PointLight) * scene->pointLightCapacity
+        + sizeof(LightTreeNode) * 2 * scene->pointLightCapacity;
+}
+
 Scene* scene_create(void) {
     Scene* scene = malloc(sizeof(Scene));
     scene->materialCapacity = DEFAULT_CAPACITY;
@@ -25,7 +39,10 @@ Scene* scene_create(void) {
     scene->pointLightCapacity = DEFAULT_CAPACITY;
     scene->pointLightCount = 0;
     scene->pointLights = malloc(sizeof(PointLight) * scene->pointLightCapacity);
+    scene->lightTreeNodeCount = 0;
+    scene->lightTreeNodes = malloc(sizeof(LightTreeNode) * 2 * scene->pointLightCapacity);
 
+    memstats_allocate(MEMSTATS_SCENE, scene_getAllocatedBytes(scene));
     return scene;
 }
 
@@ -200,6 +217,7 @@ Scene* scene_init(uint32_t width, uint32_t height) {
 				scene_addObject(scene, *cessna);
 				object_destroy(cessna);
 		*/
+		scene_buildLightTree(scene);
 		scene_shrinkToFit(scene);
 	}
 	return scene;
@@ -207,8 +225,11 @@ Scene* scene_init(uint32_t width, uint32_t height) {
 
 uint32_t scene_addMaterial(Scene* scene, Material material) {
     if (scene->materialCapacity < scene->materialCount + 1) {
-        scene->materialCapacity *= 2;
+        // the capacity may have been shrunk to 0 by scene_shrinkToFit
+        size_t oldBytes = sizeof(Material) * scene->materialCapacity;
+        scene->materialCapacity = scene->materialCapacity ? scene->materialCapacity * 2 : DEFAULT_CAPACITY;
         scene->materials = realloc(scene->materials, sizeof(Material) * scene->materialCapacity);
+        memstats_reallocate(MEMSTATS_SCENE, oldBytes, sizeof(Material) * scene->materialCapacity);
     }
     uint32_t materialId = scene->materialCount++;
     scene->materials[materialId] = material;
@@ -217,24 +238,30 @@ uint32_t scene_addMaterial(Scene* scene, Material material) {
 
 void scene_addPlane(Scene* scene, Plane plane) {
     if (scene->planeCapacity < scene->planeCount + 1) {
-        scene->planeCapacity *= 2;
+        size_t oldBytes = sizeof(Plane) * scene->planeCapacity;
+        scene->planeCapacity = scene->planeCapacity ? scene->planeCapacity * 2 : DEFAULT_CAPACITY;
         scene->planes = realloc(scene->planes, sizeof(Plane) * scene->planeCapacity);
+        memstats_reallocate(MEMSTATS_SCENE, oldBytes, sizeof(Plane) * scene->planeCapacity);
     }
     scene->planes[scene->planeCount++] = plane;
 }
 
 void scene_addSphere(Scene* scene, Sphere sphere) {
     if (scene->sphereCapacity < scene->sphereCount + 1) {
-        scene->sphereCapacity *= 2;
+        size_t oldBytes = sizeof(Sphere) * scene->sphereCapacity;
+        scene->sphereCapacity = scene->sphereCapacity ? scene->sphereCapacity * 2 : DEFAULT_CAPACITY;
         scene->spheres = realloc(scene->spheres, sizeof(Sphere) * scene->sphereCapacity);
+        memstats_reallocate(MEMSTATS_SCENE, oldBytes, sizeof(Sphere) * scene->sphereCapacity);
     }
     scene->spheres[scene->sphereCount++] = sphere;
 }
 
 void scene_addTriangle(Scene* scene, Triangle triangle) {
     if (scene->triangleCapacity < scene->triangleCount + 1) {
-        scene->triangleCapacity *= 2;
+        size_t oldBytes = sizeof(Triangle) * scene->triangleCapacity;
+        scene->triangleCapacity = scene->triangleCapacity ? scene->triangleCapacity * 2 : DEFAULT_CAPACITY;
         scene->triangles = realloc(scene->triangles, sizeof(Triangle) * scene->triangleCapacity);
+        memstats_reallocate(MEMSTATS_SCENE, oldBytes, sizeof(Triangle) * scene->triangleCapacity);
     }
     scene->triangles[scene->triangleCount++] = triangle;
 }
@@ -248,13 +275,29 @@ void scene_addObject(Scene* scene, Object object) {
 
 void scene_addPointLight(Scene* scene, PointLight pointLight) {
     if (scene->pointLightCapacity < scene->pointLightCount + 1) {
-        scene->pointLightCapacity *= 2;
-        scene->pointLights = realloc(scene->pointLights, sizeof(PointLight) * scene->triangleCapacity);
+        size_t oldBytes = (sizeof(PointLight) + 2 * sizeof(LightTreeNode)) * scene->pointLightCapacity;
+        scene->pointLightCapacity = scene->pointLightCapacity ? scene->pointLightCapacity * 2 : DEFAULT_CAPACITY;
+        scene->pointLights = realloc(scene->pointLights, sizeof(PointLight) * scene->pointLightCapacity);
+        scene->lightTreeNodes = realloc(scene->lightTreeNodes, sizeof(LightTreeNode) * 2 * scene->pointLightCapacity);
+        memstats_reallocate(MEMSTATS_SCENE, oldBytes, (sizeof(PointLight) + 2 * sizeof(LightTreeNode)) * scene->pointLightCapacity);
     }
     scene->pointLights[scene->pointLightCount++] = pointLight;
 }
 
+bool scene_buildLightTree(Scene* scene) {
+    if (!lighttree_build(scene->pointLights, scene->pointLightCount, scene->lightTreeNodes)) {
+        // the tracers only sample the tree above LIGHTTREE_MIN_LIGHT_COUNT lights
+        printf("Couldn't build the light tree, only the first %u lights are kept.\n", LIGHTTREE_MIN_LIGHT_COUNT);
+        scene->pointLightCount = MIN(scene->pointLightCount, LIGHTTREE_MIN_LIGHT_COUNT);
+        scene->lightTreeNodeCount = 0;
+        return false;
+    }
+    scene->lightTreeNodeCount = lighttree_getNodeCount(scene->pointLightCount);
+    return true;
+}
+
 void scene_shrinkToFit(Scene *scene) {
+    size_t oldBytes = scene_getAllocatedBytes(scene);
     if (scene->materialCapacity > scene->materialCount) {
         scene->materials = realloc(scene->materials, sizeof(Material) * scene->materialCount);
         scene->materialCapacity = scene->materialCount;
@@ -273,18 +316,22 @@ void scene_shrinkToFit(Scene *scene) {
     }
     if (scene->pointLightCapacity > scene->pointLightCount) {
         scene->pointLights = realloc(scene->pointLights, sizeof(PointLight) * scene->pointLightCount);
+        scene->lightTreeNodes = realloc(scene->lightTreeNodes, sizeof(LightTreeNode) * 2 * scene->pointLightCount);
         scene->pointLightCapacity = scene->pointLightCount;
     }
+    memstats_reallocate(MEMSTATS_SCENE, oldBytes, scene_getAllocatedBytes(scene));
 }
 
 void scene_destroy(Scene* scene) {
     if (scene) {
+        memstats_free(MEMSTATS_SCENE, scene_getAllocatedBytes(scene));
         camera_destroy(scene->camera);
         free(scene->materials);
         free(scene->planes);
         free(scene->spheres);
         free(scene->triangles);
         free(scene->pointLights);
+        free(scene->lightTreeNodes);
         free(scene);
     }
 }
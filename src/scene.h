@@ -1,9 +1,11 @@
 #ifndef RAYTRACER_SCENE_H
 #define RAYTRACER_SCENE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "pointlight.h"
+#include "lighttree.h"
 #include "material.h"
 #include "plane.h"
 #include "sphere.h"
@@ -33,6 +35,10 @@ typedef struct {
     uint32_t pointLightCapacity;
     uint32_t pointLightCount;
     PointLight* pointLights;
+
+    // built by scene_buildLightTree, holds up to 2 * pointLightCapacity nodes
+    uint32_t lightTreeNodeCount;
+    LightTreeNode* lightTreeNodes;
 } Scene;
 
 Scene* scene_create(void);
@@ -43,7 +49,10 @@ void scene_addPlane(Scene* scene, Plane plane);
 void scene_addSphere(Scene* scene, Sphere sphere);
 void scene_addTriangle(Scene* scene, Triangle triangle);
 void scene_addObject(Scene* scene, Object object);
+// the light tree isn't updated, call scene_buildLightTree after the last light
 void scene_addPointLight(Scene* scene, PointLight pointLight);
+// builds the light tree over all point lights in O(n log n), returns false if the memory for it is missing
+bool scene_buildLightTree(Scene* scene);
 void scene_shrinkToFit(Scene *scene);
 void scene_destroy(Scene* scene);
 
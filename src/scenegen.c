@@ -0,0 +1,193 @@
+#include "scenegen.h"
+
+#include <math.h>
+
+#include "utils/math.h"
+#include "utils/random.h"
+
+#define SCENEGEN_LIGHT_STRENGTH 10000.0f
+
+// xorshift128+, the same generator the kernel uses
+static uint64_t scenegen_next(seed128bit* seed) {
+	uint64_t x = seed->x;
+	uint64_t y = seed->y;
+	seed->x = y;
+	x ^= x << 23;
+	seed->y = x ^ y ^ (x >> 17) ^ (y >> 26);
+	return seed->y + y;
+}
+
+static seed128bit scenegen_createSeed(uint64_t seed) {
+	// splitmix64, so that similar seeds don't start with similar states
+	seed128bit state;
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	state.x = z ^ (z >> 31);
+	state.y = state.x ^ 0x2545F4914F6CDD1DULL;
+	if (state.x == 0 && state.y == 0) {
+		state.y = 1;
+	}
+	return state;
+}
+
+// uniform in [0, 1)
+static float scenegen_unilateral(seed128bit* seed) {
+	return (float) (scenegen_next(seed) >> 40) / (float) (1 << 24);
+}
+
+static float scenegen_bilateral(seed128bit* seed) {
+	return -1.0f + 2.0f * scenegen_unilateral(seed);
+}
+
+static Material scenegen_createMaterial(Vec3 color, float reflectionIndex, float refractionIndex) {
+	Material material = { 0 };
+	material.color = color;
+	material.reflectionIndex = reflectionIndex;
+	material.refractionIndex = refractionIndex;
+	material.ambientWeight = 0.2f;
+	material.diffuseWeight = 1.0f;
+	material.specularWeight = 1.0f;
+	material.specularExponent = 64.0f;
+	return material;
+}
+
+Scene* scenegen_createBase(uint32_t width, uint32_t height) {
+	Scene* scene = scene_create();
+	Vec3 position = { { 30.0f, 12.0f, 30.0f } };
+	Vec3 lookAt = { { 0.0f, 2.0f, 0.0f } };
+	scene->camera = camera_create(position, lookAt, width, height, 90.0f, 0.0f);
+
+	// the order has to match SceneGenMaterial
+	Material background = { 0 };
+	background.specularExponent = 1.0f;
+	scene_addMaterial(scene, background);
+	scene_addMaterial(scene, scenegen_createMaterial((Vec3) { { 0.6f, 0.6f, 0.6f } }, 0.0f, 0.0f));
+	scene_addMaterial(scene, scenegen_createMaterial((Vec3) { { 1.0f, 1.0f, 1.0f } }, 1.0f, 0.0f));
+	Material glass = scenegen_createMaterial((Vec3) { { 1.0f, 1.0f, 1.0f } }, 1.0f, 1.4f);
+	glass.ambientWeight = 0.0f;
+	glass.diffuseWeight = 0.0f;
+	glass.specularWeight = 0.0f;
+	scene_addMaterial(scene, glass);
+	scene_addMaterial(scene, scenegen_createMaterial((Vec3) { { 0.81f, 0.83f, 0.84f } }, 0.3f, 0.0f));
+
+	Plane floor = { 0 };
+	floor.materialIndex = SCENEGEN_MATERIAL_DIFFUSE;
+	floor.normal = (Vec3) { { 0.0f, 1.0f, 0.0f } };
+	floor.distanceFromOrigin = 0.0f;
+	scene_addPlane(scene, floor);
+	return scene;
+}
+
+void scenegen_addRandomSpheres(Scene* scene, uint32_t count, float size, uint64_t seed) {
+	seed128bit state = scenegen_createSeed(seed);
+	for (uint32_t i = 0; i < count; i++) {
+		Sphere sphere = { 0 };
+		sphere.radius = 0.2f + scenegen_unilateral(&state) * 0.8f;
+		sphere.position.x = scenegen_bilateral(&state) * size / 2.0f;
+		sphere.position.y = sphere.radius + scenegen_unilateral(&state) * size / 4.0f;
+		sphere.position.z = scenegen_bilateral(&state) * size / 2.0f;
+		sphere.materialIndex = SCENEGEN_MATERIAL_DIFFUSE + (uint32_t) (scenegen_next(&state) % 4);
+		scene_addSphere(scene, sphere);
+	}
+}
+
+static void scenegen_subdivide(Scene* scene, Vec3 center, float radius, Vec3 a, Vec3 b, Vec3 c, uint32_t subdivisions, uint32_t materialIndex) {
+	if (subdivisions == 0) {
+		Triangle triangle = { 0 };
+		triangle.materialIndex = materialIndex;
+		triangle.v0 = vec3_add(center, vec3_mul(a, radius));
+		triangle.v1 = vec3_add(center, vec3_mul(b, radius));
+		triangle.v2 = vec3_add(center, vec3_mul(c, radius));
+		scene_addTriangle(scene, triangle);
+		return;
+	}
+	// the corners are on the unit sphere, so the midpoints only have to be normalized
+	Vec3 ab = vec3_norm(vec3_add(a, b));
+	Vec3 bc = vec3_norm(vec3_add(b, c));
+	Vec3 ca = vec3_norm(vec3_add(c, a));
+	scenegen_subdivide(scene, center, radius, a, ab, ca, subdivisions - 1, materialIndex);
+	scenegen_subdivide(scene, center, radius, ab, b, bc, subdivisions - 1, materialIndex);
+	scenegen_subdivide(scene, center, radius, ca, bc, c, subdivisions - 1, materialIndex);
+	scenegen_subdivide(scene, center, radius, ab, bc, ca, subdivisions - 1, materialIndex);
+}
+
+void scenegen_addIcosphere(Scene* scene, Vec3 center, float radius, uint32_t subdivisions, uint32_t materialIndex) {
+	const float t = (1.0f + sqrtf(5.0f)) / 2.0f;
+	Vec3 vertices[12] = {
+		{ { -1.0f, t, 0.0f } }, { { 1.0f, t, 0.0f } }, { { -1.0f, -t, 0.0f } }, { { 1.0f, -t, 0.0f } },
+		{ { 0.0f, -1.0f, t } }, { { 0.0f, 1.0f, t } }, { { 0.0f, -1.0f, -t } }, { { 0.0f, 1.0f, -t } },
+		{ { t, 0.0f, -1.0f } }, { { t, 0.0f, 1.0f } }, { { -t, 0.0f, -1.0f } }, { { -t, 0.0f, 1.0f } }
+	};
+	const uint32_t faces[20][3] = {
+		{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+		{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+		{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+		{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+	};
+	for (uint32_t i = 0; i < 12; i++) {
+		vertices[i] = vec3_norm(vertices[i]);
+	}
+	for (uint32_t i = 0; i < 20; i++) {
+		scenegen_subdivide(scene, center, radius, vertices[faces[i][0]], vertices[faces[i][1]], vertices[faces[i][2]],
+			subdivisions, materialIndex);
+	}
+}
+
+void scenegen_addTerrain(Scene* scene, uint32_t resolution, float size, float height, uint64_t seed, uint32_t materialIndex) {
+	if (resolution == 0) {
+		return;
+	}
+	seed128bit state = scenegen_createSeed(seed);
+	// a few random waves give smooth hills without a noise implementation
+	float frequencies[4][2];
+	float phases[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		frequencies[i][0] = (1.0f + scenegen_unilateral(&state) * 3.0f) * (float) (i + 1) / size;
+		frequencies[i][1] = (1.0f + scenegen_unilateral(&state) * 3.0f) * (float) (i + 1) / size;
+		phases[i] = scenegen_unilateral(&state) * 2.0f * PI;
+	}
+
+	float cellSize = size / (float) resolution;
+	Vec3 corners[2][2];
+	for (uint32_t z = 0; z < resolution; z++) {
+		for (uint32_t x = 0; x < resolution; x++) {
+			for (uint32_t j = 0; j < 2; j++) {
+				for (uint32_t i = 0; i < 2; i++) {
+					float px = -size / 2.0f + (float) (x + i) * cellSize;
+					float pz = -size / 2.0f + (float) (z + j) * cellSize;
+					float py = 0.0f;
+					for (uint32_t k = 0; k < 4; k++) {
+						py += sinf(px * frequencies[k][0] * 2.0f * PI + pz * frequencies[k][1] * 2.0f * PI + phases[k]) / (float) (k + 1);
+					}
+					// keep the terrain above the floor plane
+					corners[j][i] = (Vec3) { { px, height * (1.0f + py / 2.0f) / 2.0f + 0.01f, pz } };
+				}
+			}
+			Triangle triangle = { 0 };
+			triangle.materialIndex = materialIndex;
+			triangle.v0 = corners[0][0];
+			triangle.v1 = corners[1][0];
+			triangle.v2 = corners[0][1];
+			scene_addTriangle(scene, triangle);
+			triangle.v0 = corners[0][1];
+			triangle.v1 = corners[1][0];
+			triangle.v2 = corners[1][1];
+			scene_addTriangle(scene, triangle);
+		}
+	}
+}
+
+void scenegen_addLights(Scene* scene, uint32_t count, float size, uint64_t seed) {
+	seed128bit state = scenegen_createSeed(seed);
+	for (uint32_t i = 0; i < count; i++) {
+		float angle = 2.0f * PI * ((float) i + scenegen_unilateral(&state) * 0.5f) / (float) count;
+		PointLight light = { 0 };
+		light.position = (Vec3) { { cosf(angle) * size / 2.0f, size / 2.0f + scenegen_unilateral(&state) * size / 4.0f, sinf(angle) * size / 2.0f } };
+		light.emissionColor = (Vec3) { { 0.7f + 0.3f * scenegen_unilateral(&state), 0.7f + 0.3f * scenegen_unilateral(&state), 0.7f + 0.3f * scenegen_unilateral(&state) } };
+		// the total light stays the same, so the images are comparable for different counts
+		light.strength = SCENEGEN_LIGHT_STRENGTH / (float) count;
+		scene_addPointLight(scene, light);
+	}
+	scene_buildLightTree(scene);
+}
@@ -0,0 +1,32 @@
+#ifndef RAYTRACER_SCENEGEN_H
+#define RAYTRACER_SCENEGEN_H
+
+#include <stdint.h>
+
+#include "scene.h"
+
+/*
+ * Procedural scenes for benchmarks.
+ * The same seed always generates the same scene, independent of rand().
+ */
+
+// materials added by scenegen_createBase, 0 is the background
+typedef enum {
+	SCENEGEN_MATERIAL_DIFFUSE = 1,
+	SCENEGEN_MATERIAL_MIRROR = 2,
+	SCENEGEN_MATERIAL_GLASS = 3,
+	SCENEGEN_MATERIAL_METAL = 4
+} SceneGenMaterial;
+
+// a camera looking at the origin, the materials above and a floor plane at y = 0
+Scene* scenegen_createBase(uint32_t width, uint32_t height);
+// spheres with random materials inside a box of the given size above the floor
+void scenegen_addRandomSpheres(Scene* scene, uint32_t count, float size, uint64_t seed);
+// an icosahedron subdivided subdivisions times, which has 20 * 4^subdivisions triangles
+void scenegen_addIcosphere(Scene* scene, Vec3 center, float radius, uint32_t subdivisions, uint32_t materialIndex);
+// a height field of 2 * resolution^2 triangles centered at the origin
+void scenegen_addTerrain(Scene* scene, uint32_t resolution, float size, float height, uint64_t seed, uint32_t materialIndex);
+// lights on a ring above the scene, the light tree is built over all lights of the scene afterwards
+void scenegen_addLights(Scene* scene, uint32_t count, float size, uint64_t seed);
+
+#endif //RAYTRACER_SCENEGEN_H
@@ -0,0 +1,180 @@
+#include "sceneserial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memstats.h"
+#include "utils/math.h"
+
+#define SCENESERIAL_MAGIC "RTSCENE1"
+#define SCENESERIAL_MAGIC_SIZE 8
+#define SCENESERIAL_ARRAY_COUNT 8
+
+/*
+ * Layout:
+ *     char magic[8]
+ *     for the camera, materials, planes, spheres, triangles, pointLights, accel nodes and accel indexes:
+ *         uint32_t elementSize
+ *         uint32_t count
+ *         element[count]
+ */
+
+typedef struct {
+	const void* elements;
+	uint32_t elementSize;
+	uint32_t count;
+} SceneSerialArray;
+
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	size_t offset;
+} SceneSerialReader;
+
+static void sceneserial_getArrays(Scene* scene, Accel* accel, SceneSerialArray* arrays) {
+	arrays[0] = (SceneSerialArray) { scene->camera, sizeof(Camera), 1 };
+	arrays[1] = (SceneSerialArray) { scene->materials, sizeof(Material), scene->materialCount };
+	arrays[2] = (SceneSerialArray) { scene->planes, sizeof(Plane), scene->planeCount };
+	arrays[3] = (SceneSerialArray) { scene->spheres, sizeof(Sphere), scene->sphereCount };
+	arrays[4] = (SceneSerialArray) { scene->triangles, sizeof(Triangle), scene->triangleCount };
+	arrays[5] = (SceneSerialArray) { scene->pointLights, sizeof(PointLight), scene->pointLightCount };
+	arrays[6] = (SceneSerialArray) { accel->nodes, sizeof(AccelNode), accel->nodeCount };
+	arrays[7] = (SceneSerialArray) { accel->indexes, sizeof(uint32_t), accel->indexCount };
+}
+
+uint8_t* sceneserial_write(Scene* scene, Accel* accel, size_t* size) {
+	SceneSerialArray arrays[SCENESERIAL_ARRAY_COUNT];
+	sceneserial_getArrays(scene, accel, arrays);
+
+	size_t totalSize = SCENESERIAL_MAGIC_SIZE;
+	for (uint32_t i = 0; i < SCENESERIAL_ARRAY_COUNT; i++) {
+		totalSize += 2 * sizeof(uint32_t) + (size_t) arrays[i].elementSize * arrays[i].count;
+	}
+	uint8_t* data = malloc(totalSize);
+	if (!data) {
+		return NULL;
+	}
+
+	memcpy(data, SCENESERIAL_MAGIC, SCENESERIAL_MAGIC_SIZE);
+	size_t offset = SCENESERIAL_MAGIC_SIZE;
+	for (uint32_t i = 0; i < SCENESERIAL_ARRAY_COUNT; i++) {
+		size_t bytes = (size_t) arrays[i].elementSize * arrays[i].count;
+		memcpy(data + offset, &arrays[i].elementSize, sizeof(uint32_t));
+		memcpy(data + offset + sizeof(uint32_t), &arrays[i].count, sizeof(uint32_t));
+		offset += 2 * sizeof(uint32_t);
+		if (bytes > 0) {
+			memcpy(data + offset, arrays[i].elements, bytes);
+		}
+		offset += bytes;
+	}
+	*size = totalSize;
+	return data;
+}
+
+// returns the elements of the next array, or NULL if they aren't complete or have another size
+static const uint8_t* sceneserial_readArray(SceneSerialReader* reader, uint32_t elementSize, uint32_t* count) {
+	uint32_t storedElementSize;
+	if (reader->size - reader->offset < 2 * sizeof(uint32_t)) {
+		return NULL;
+	}
+	memcpy(&storedElementSize, reader->data + reader->offset, sizeof(uint32_t));
+	memcpy(count, reader->data + reader->offset + sizeof(uint32_t), sizeof(uint32_t));
+	reader->offset += 2 * sizeof(uint32_t);
+
+	size_t bytes = (size_t) elementSize * *count;
+	if (storedElementSize != elementSize || reader->size - reader->offset < bytes) {
+		return NULL;
+	}
+	const uint8_t* elements = reader->data + reader->offset;
+	reader->offset += bytes;
+	return elements;
+}
+
+bool sceneserial_read(const uint8_t* data, size_t size, Scene** scene, Accel** accel) {
+	if (size < SCENESERIAL_MAGIC_SIZE || memcmp(data, SCENESERIAL_MAGIC, SCENESERIAL_MAGIC_SIZE) != 0) {
+		printf("The scene data has an unknown format.\n");
+		return false;
+	}
+	SceneSerialReader reader = { data, size, SCENESERIAL_MAGIC_SIZE };
+	uint32_t counts[SCENESERIAL_ARRAY_COUNT];
+	const uint8_t* arrays[SCENESERIAL_ARRAY_COUNT];
+	const uint32_t elementSizes[SCENESERIAL_ARRAY_COUNT] = {
+		sizeof(Camera), sizeof(Material), sizeof(Plane), sizeof(Sphere),
+		sizeof(Triangle), sizeof(PointLight), sizeof(AccelNode), sizeof(uint32_t)
+	};
+	for (uint32_t i = 0; i < SCENESERIAL_ARRAY_COUNT; i++) {
+		arrays[i] = sceneserial_readArray(&reader, elementSizes[i], &counts[i]);
+		if (!arrays[i]) {
+			printf("The scene data is incomplete or was written with other struct layouts.\n");
+			return false;
+		}
+	}
+	if (counts[0] != 1) {
+		printf("The scene data has no camera.\n");
+		return false;
+	}
+
+	Scene* newScene = scene_create();
+	newScene->camera = malloc(sizeof(Camera));
+	Accel* newAccel = malloc(sizeof(Accel));
+	if (!newScene->camera || !newAccel) {
+		scene_destroy(newScene);
+		free(newAccel);
+		return false;
+	}
+	memcpy(newScene->camera, arrays[0], sizeof(Camera));
+
+	// the elements may not be aligned inside the buffer, so every one is copied before it's added
+	for (uint32_t i = 0; i < counts[1]; i++) {
+		Material material;
+		memcpy(&material, arrays[1] + i * sizeof(Material), sizeof(Material));
+		scene_addMaterial(newScene, material);
+	}
+	for (uint32_t i = 0; i < counts[2]; i++) {
+		Plane plane;
+		memcpy(&plane, arrays[2] + i * sizeof(Plane), sizeof(Plane));
+		scene_addPlane(newScene, plane);
+	}
+	for (uint32_t i = 0; i < counts[3]; i++) {
+		Sphere sphere;
+		memcpy(&sphere, arrays[3] + i * sizeof(Sphere), sizeof(Sphere));
+		scene_addSphere(newScene, sphere);
+	}
+	for (uint32_t i = 0; i < counts[4]; i++) {
+		Triangle triangle;
+		memcpy(&triangle, arrays[4] + i * sizeof(Triangle), sizeof(Triangle));
+		scene_addTriangle(newScene, triangle);
+	}
+	for (uint32_t i = 0; i < counts[5]; i++) {
+		PointLight pointLight;
+		memcpy(&pointLight, arrays[5] + i * sizeof(PointLight), sizeof(PointLight));
+		scene_addPointLight(newScene, pointLight);
+	}
+	if (!scene_buildLightTree(newScene)) {
+		scene_destroy(newScene);
+		free(newAccel);
+		return false;
+	}
+	scene_shrinkToFit(newScene);
+
+	// the acceleration structure is taken as it is, so the worker doesn't have to build it again
+	newAccel->nodeCount = counts[6];
+	newAccel->nodeCapacity = counts[6];
+	newAccel->nodes = malloc(sizeof(AccelNode) * MAX(counts[6], 1));
+	newAccel->indexCount = counts[7];
+	newAccel->indexCapacity = counts[7];
+	newAccel->indexes = malloc(sizeof(uint32_t) * MAX(counts[7], 1));
+	memstats_allocate(MEMSTATS_ACCEL, sizeof(AccelNode) * newAccel->nodeCapacity + sizeof(uint32_t) * newAccel->indexCapacity);
+	if (!newAccel->nodes || !newAccel->indexes) {
+		accel_destroy(newAccel);
+		scene_destroy(newScene);
+		return false;
+	}
+	memcpy(newAccel->nodes, arrays[6], sizeof(AccelNode) * counts[6]);
+	memcpy(newAccel->indexes, arrays[7], sizeof(uint32_t) * counts[7]);
+
+	*scene = newScene;
+	*accel = newAccel;
+	return true;
+}
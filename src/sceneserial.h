@@ -0,0 +1,22 @@
+#ifndef RAYTRACER_SCENESERIAL_H
+#define RAYTRACER_SCENESERIAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scene.h"
+#include "accel.h"
+
+/*
+ * Copies a scene with its camera and acceleration structure into one buffer and back, e.g. to send it to another process.
+ * The elements are stored as they are in memory, so both sides need the same struct layouts and byte order.
+ * Element sizes are stored as well, a mismatch is reported instead of reading garbage.
+ */
+
+// the caller has to free the returned buffer, returns NULL if it couldn't be allocated
+uint8_t* sceneserial_write(Scene* scene, Accel* accel, size_t* size);
+// creates a new scene and acceleration structure, returns false if the data is incomplete or was written with other struct layouts
+bool sceneserial_read(const uint8_t* data, size_t size, Scene** scene, Accel** accel);
+
+#endif //RAYTRACER_SCENESERIAL_H
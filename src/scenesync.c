@@ -0,0 +1,210 @@
+#include "scenesync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memstats.h"
+#include "utils/math.h"
+
+static const char* scenesync_arrayNames[SCENESYNC_ARRAY_COUNT] = {
+	"materials",
+	"planes",
+	"spheres",
+	"triangles",
+	"pointLights",
+	"lightTreeNodes",
+	"accelNodes",
+	"accelIndexes"
+};
+
+static void scenesync_getHostArray(Scene* scene, Accel* accel, SceneSyncArray array, const void** data, uint32_t* count) {
+	switch (array) {
+	case SCENESYNC_MATERIALS:
+		*data = scene->materials;
+		*count = scene->materialCount;
+		break;
+	case SCENESYNC_PLANES:
+		*data = scene->planes;
+		*count = scene->planeCount;
+		break;
+	case SCENESYNC_SPHERES:
+		*data = scene->spheres;
+		*count = scene->sphereCount;
+		break;
+	case SCENESYNC_TRIANGLES:
+		*data = scene->triangles;
+		*count = scene->triangleCount;
+		break;
+	case SCENESYNC_POINTLIGHTS:
+		*data = scene->pointLights;
+		*count = scene->pointLightCount;
+		break;
+	case SCENESYNC_LIGHTTREENODES:
+		*data = scene->lightTreeNodes;
+		*count = scene->lightTreeNodeCount;
+		break;
+	case SCENESYNC_ACCELNODES:
+		*data = accel->nodes;
+		*count = accel->nodeCount;
+		break;
+	case SCENESYNC_ACCELINDEXES:
+		*data = accel->indexes;
+		*count = accel->indexCount;
+		break;
+	default:
+		*data = NULL;
+		*count = 0;
+		break;
+	}
+}
+
+// reallocates the device buffer, so that it can hold at least minCapacity elements
+static bool scenesync_grow(SceneSync* sync, SceneSyncArray array, uint32_t minCapacity) {
+	DeviceArray* deviceArray = &sync->arrays[array];
+	uint32_t capacity = MAX(deviceArray->capacity * 2, minCapacity);
+	cl_mem buffer = clCreateBuffer(sync->ctx, CL_MEM_READ_ONLY, deviceArray->elementSize * capacity, NULL, &sync->err);
+	if (sync->err != CL_SUCCESS) {
+		printf("Couldn't create dev_%s.\n", scenesync_arrayNames[array]);
+		return false;
+	}
+	memstats_allocate(MEMSTATS_DEVICE_SCENE, deviceArray->elementSize * capacity);
+	if (deviceArray->buffer) {
+		clReleaseMemObject(deviceArray->buffer);
+		memstats_free(MEMSTATS_DEVICE_SCENE, deviceArray->elementSize * deviceArray->capacity);
+	}
+	deviceArray->buffer = buffer;
+	deviceArray->capacity = capacity;
+	// the new buffer has no content yet
+	deviceArray->count = 0;
+	deviceArray->dirtyBegin = 0;
+	deviceArray->dirtyEnd = 0;
+	return true;
+}
+
+SceneSync* scenesync_create(cl_context ctx, cl_device_id deviceId, Scene* scene, Accel* accel) {
+	SceneSync* sync = malloc(sizeof(SceneSync));
+	if (!sync) {
+		return NULL;
+	}
+	sync->ctx = ctx;
+	sync->transferQueue = clCreateCommandQueue(ctx, deviceId, 0, &sync->err);
+	if (sync->err != CL_SUCCESS) {
+		printf("Couldn't create the transfer queue.\n");
+		free(sync);
+		return NULL;
+	}
+
+	sync->arrays[SCENESYNC_MATERIALS].elementSize = sizeof(Material);
+	sync->arrays[SCENESYNC_PLANES].elementSize = sizeof(Plane);
+	sync->arrays[SCENESYNC_SPHERES].elementSize = sizeof(Sphere);
+	sync->arrays[SCENESYNC_TRIANGLES].elementSize = sizeof(Triangle);
+	sync->arrays[SCENESYNC_POINTLIGHTS].elementSize = sizeof(PointLight);
+	sync->arrays[SCENESYNC_LIGHTTREENODES].elementSize = sizeof(LightTreeNode);
+	sync->arrays[SCENESYNC_ACCELNODES].elementSize = sizeof(AccelNode);
+	sync->arrays[SCENESYNC_ACCELINDEXES].elementSize = sizeof(uint32_t);
+
+	for (uint32_t i = 0; i < SCENESYNC_ARRAY_COUNT; i++) {
+		DeviceArray* deviceArray = &sync->arrays[i];
+		deviceArray->buffer = NULL;
+		deviceArray->capacity = 0;
+		deviceArray->count = 0;
+		deviceArray->dirtyBegin = 0;
+		deviceArray->dirtyEnd = 0;
+
+		// allocate exactly what the scene needs, growing is handled by scenesync_upload
+		const void* data;
+		uint32_t count;
+		scenesync_getHostArray(scene, accel, (SceneSyncArray) i, &data, &count);
+		if (count > 0 && !scenesync_grow(sync, (SceneSyncArray) i, count)) {
+			scenesync_destroy(sync);
+			return NULL;
+		}
+	}
+	return sync;
+}
+
+void scenesync_markDirty(SceneSync* sync, SceneSyncArray array, uint32_t first, uint32_t count) {
+	if (count == 0) {
+		return;
+	}
+	DeviceArray* deviceArray = &sync->arrays[array];
+	if (deviceArray->dirtyBegin == deviceArray->dirtyEnd) {
+		deviceArray->dirtyBegin = first;
+		deviceArray->dirtyEnd = first + count;
+	} else {
+		// merge both ranges, uploading a few clean elements in between is cheaper than a second transfer
+		deviceArray->dirtyBegin = MIN(deviceArray->dirtyBegin, first);
+		deviceArray->dirtyEnd = MAX(deviceArray->dirtyEnd, first + count);
+	}
+}
+
+bool scenesync_upload(SceneSync* sync, Scene* scene, Accel* accel, cl_event* uploadDone, bool* layoutChanged) {
+	*uploadDone = NULL;
+	*layoutChanged = false;
+	bool uploaded = false;
+
+	for (uint32_t i = 0; i < SCENESYNC_ARRAY_COUNT; i++) {
+		SceneSyncArray array = (SceneSyncArray) i;
+		DeviceArray* deviceArray = &sync->arrays[i];
+		const void* data;
+		uint32_t count;
+		scenesync_getHostArray(scene, accel, array, &data, &count);
+
+		if (count > deviceArray->capacity) {
+			if (!scenesync_grow(sync, array, count)) {
+				return false;
+			}
+			*layoutChanged = true;
+		}
+		if (count != deviceArray->count) {
+			// only the newly added elements are unknown to the device, but a new light changes the whole tree
+			if (array == SCENESYNC_LIGHTTREENODES) {
+				scenesync_markDirty(sync, array, 0, count);
+			} else if (count > deviceArray->count) {
+				scenesync_markDirty(sync, array, deviceArray->count, count - deviceArray->count);
+			}
+			deviceArray->count = count;
+			*layoutChanged = true;
+		}
+
+		uint32_t dirtyEnd = MIN(deviceArray->dirtyEnd, count);
+		if (deviceArray->dirtyBegin < dirtyEnd) {
+			size_t offset = deviceArray->elementSize * deviceArray->dirtyBegin;
+			size_t size = deviceArray->elementSize * (dirtyEnd - deviceArray->dirtyBegin);
+			sync->err = clEnqueueWriteBuffer(sync->transferQueue, deviceArray->buffer, CL_FALSE, offset, size,
+				(const char*) data + offset, 0, NULL, NULL);
+			if (sync->err != CL_SUCCESS) {
+				printf("Couldn't upload dev_%s.\n", scenesync_arrayNames[i]);
+				return false;
+			}
+			uploaded = true;
+		}
+		deviceArray->dirtyBegin = 0;
+		deviceArray->dirtyEnd = 0;
+	}
+
+	if (uploaded) {
+		// the transfer queue is in order, so the marker completes after all writes above
+		sync->err = clEnqueueMarkerWithWaitList(sync->transferQueue, 0, NULL, uploadDone);
+		if (sync->err != CL_SUCCESS) {
+			printf("Couldn't enqueue the upload marker.\n");
+			return false;
+		}
+		clFlush(sync->transferQueue);
+	}
+	return true;
+}
+
+void scenesync_destroy(SceneSync* sync) {
+	if (sync) {
+		clFinish(sync->transferQueue);
+		for (uint32_t i = 0; i < SCENESYNC_ARRAY_COUNT; i++) {
+			if (sync->arrays[i].buffer) {
+				clReleaseMemObject(sync->arrays[i].buffer);
+				memstats_free(MEMSTATS_DEVICE_SCENE, sync->arrays[i].elementSize * sync->arrays[i].capacity);
+			}
+		}
+		clReleaseCommandQueue(sync->transferQueue);
+		free(sync);
+	}
+}
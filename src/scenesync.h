@@ -0,0 +1,64 @@
+#ifndef RAYTRACER_SCENESYNC_H
+#define RAYTRACER_SCENESYNC_H
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+#include "accel.h"
+
+typedef enum {
+	SCENESYNC_MATERIALS,
+	SCENESYNC_PLANES,
+	SCENESYNC_SPHERES,
+	SCENESYNC_TRIANGLES,
+	SCENESYNC_POINTLIGHTS,
+	SCENESYNC_LIGHTTREENODES,
+	SCENESYNC_ACCELNODES,
+	SCENESYNC_ACCELINDEXES,
+	SCENESYNC_ARRAY_COUNT
+} SceneSyncArray;
+
+typedef struct {
+	cl_mem buffer;
+	size_t elementSize;
+	// number of elements the device buffer can hold
+	uint32_t capacity;
+	// number of elements the kernel currently sees
+	uint32_t count;
+	// the range [dirtyBegin, dirtyEnd) has to be uploaded, empty if dirtyBegin == dirtyEnd
+	uint32_t dirtyBegin;
+	uint32_t dirtyEnd;
+} DeviceArray;
+
+typedef struct {
+	cl_context ctx;
+	cl_command_queue transferQueue;
+	DeviceArray arrays[SCENESYNC_ARRAY_COUNT];
+	cl_int err;
+} SceneSync;
+
+SceneSync* scenesync_create(cl_context ctx, cl_device_id deviceId, Scene* scene, Accel* accel);
+
+// marks the elements [first, first + count) of the given array as modified
+void scenesync_markDirty(SceneSync* sync, SceneSyncArray array, uint32_t first, uint32_t count);
+
+/*
+ * Uploads all dirty ranges asynchronously on the transfer queue and grows the device buffers, if
+ * the scene contains more elements than they can hold.
+ * uploadDone is set to an event that completes after all uploads or to NULL if nothing was uploaded.
+ * The host arrays of the scene and acceleration structure must not be modified until this event has completed.
+ * layoutChanged is set to true if a buffer was reallocated or an element count changed,
+ * in which case the kernel arguments have to be set again.
+ */
+bool scenesync_upload(SceneSync* sync, Scene* scene, Accel* accel, cl_event* uploadDone, bool* layoutChanged);
+
+void scenesync_destroy(SceneSync* sync);
+
+#endif //RAYTRACER_SCENESYNC_H
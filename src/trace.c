@@ -0,0 +1,141 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <SDL2/SDL.h>
+
+#define TRACE_INITIAL_CAPACITY 4096
+#define TRACE_MAX_DEPTH 32
+
+typedef struct {
+	const char* name;
+	TraceThread thread;
+	uint64_t begin;
+	uint64_t end;
+} TraceSpan;
+
+typedef struct {
+	const char* filepath;
+	TraceSpan* spans;
+	uint32_t spanCount;
+	uint32_t spanCapacity;
+	// indexes of the spans, which are not closed yet
+	uint32_t openSpans[TRACE_MAX_DEPTH];
+	uint32_t openSpanCount;
+	// begins, that were dropped above TRACE_MAX_DEPTH or without memory, their ends are dropped as well
+	uint32_t droppedSpanCount;
+	uint64_t startCounter;
+	uint64_t frequency;
+} Trace;
+
+bool trace_enabled = false;
+static Trace trace;
+
+void trace_init(const char* filepath) {
+	if (!filepath) {
+		return;
+	}
+	trace.spans = malloc(sizeof(TraceSpan) * TRACE_INITIAL_CAPACITY);
+	if (!trace.spans) {
+		printf("Couldn't allocate the trace buffer.\n");
+		return;
+	}
+	trace.filepath = filepath;
+	trace.spanCount = 0;
+	trace.spanCapacity = TRACE_INITIAL_CAPACITY;
+	trace.openSpanCount = 0;
+	trace.droppedSpanCount = 0;
+	trace.startCounter = SDL_GetPerformanceCounter();
+	trace.frequency = SDL_GetPerformanceFrequency();
+	trace_enabled = true;
+}
+
+uint64_t trace_now(void) {
+	uint64_t elapsed = SDL_GetPerformanceCounter() - trace.startCounter;
+	return (uint64_t) ((double) elapsed * 1000000.0 / (double) trace.frequency);
+}
+
+static TraceSpan* trace_appendSpan(void) {
+	if (trace.spanCount == trace.spanCapacity) {
+		TraceSpan* spans = realloc(trace.spans, sizeof(TraceSpan) * trace.spanCapacity * 2);
+		if (!spans) {
+			return NULL;
+		}
+		trace.spans = spans;
+		trace.spanCapacity *= 2;
+	}
+	return &trace.spans[trace.spanCount++];
+}
+
+void trace_beginSpan(const char* name) {
+	if (!trace_enabled) {
+		return;
+	}
+	// the spans inside a dropped one are dropped as well, so that the ends still close the begins in reverse order
+	TraceSpan* span = trace.openSpanCount < TRACE_MAX_DEPTH && trace.droppedSpanCount == 0 ? trace_appendSpan() : NULL;
+	if (!span) {
+		trace.droppedSpanCount++;
+		return;
+	}
+	span->name = name;
+	span->thread = TRACE_THREAD_MAIN;
+	span->begin = trace_now();
+	span->end = span->begin;
+	trace.openSpans[trace.openSpanCount++] = trace.spanCount - 1;
+}
+
+void trace_endSpan(void) {
+	if (!trace_enabled) {
+		return;
+	}
+	if (trace.droppedSpanCount > 0) {
+		trace.droppedSpanCount--;
+		return;
+	}
+	if (trace.openSpanCount == 0) {
+		return;
+	}
+	trace.spans[trace.openSpans[--trace.openSpanCount]].end = trace_now();
+}
+
+void trace_addSpan(const char* name, TraceThread thread, uint64_t begin, uint64_t end) {
+	if (!trace_enabled) {
+		return;
+	}
+	TraceSpan* span = trace_appendSpan();
+	if (!span) {
+		return;
+	}
+	span->name = name;
+	span->thread = thread;
+	span->begin = begin;
+	span->end = end;
+}
+
+void trace_shutdown(void) {
+	if (!trace_enabled) {
+		return;
+	}
+	trace_enabled = false;
+
+	FILE* file = fopen(trace.filepath, "w");
+	if (!file) {
+		printf("Couldn't write the trace to %s.\n", trace.filepath);
+		free(trace.spans);
+		return;
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"main\"}},\n", TRACE_THREAD_MAIN);
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"device\"}}", TRACE_THREAD_DEVICE);
+	for (uint32_t i = 0; i < trace.spanCount; i++) {
+		TraceSpan* span = &trace.spans[i];
+		// names are string literals, so they don't need to be escaped
+		fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu}",
+			span->name, span->thread, (unsigned long long) span->begin, (unsigned long long) (span->end - span->begin));
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	free(trace.spans);
+	printf("Wrote %u trace spans to %s.\n", trace.spanCount, trace.filepath);
+}
@@ -0,0 +1,45 @@
+#ifndef RAYTRACER_TRACE_H
+#define RAYTRACER_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Records a timeline of named spans and writes it in the Chrome trace format,
+ * which can be opened with chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Recording is enabled by trace_init with a file path, otherwise every TRACE_* macro is a
+ * single branch. Without ENABLE_TRACING the macros compile to nothing.
+ * Spans may be nested, but must only be opened on the main thread.
+ */
+
+typedef enum {
+	TRACE_THREAD_MAIN = 1,
+	// spans measured by the gpu, e.g. from OpenCL event profiling
+	TRACE_THREAD_DEVICE = 2
+} TraceThread;
+
+extern bool trace_enabled;
+
+// starts the recording, if filepath is not NULL
+void trace_init(const char* filepath);
+// writes the recorded spans to the file passed to trace_init
+void trace_shutdown(void);
+
+// current time in microseconds
+uint64_t trace_now(void);
+
+// the name has to stay valid until trace_shutdown, string literals are expected
+void trace_beginSpan(const char* name);
+void trace_endSpan(void);
+void trace_addSpan(const char* name, TraceThread thread, uint64_t begin, uint64_t end);
+
+#ifdef ENABLE_TRACING
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_beginSpan(name); } while (0)
+#define TRACE_END() do { if (trace_enabled) trace_endSpan(); } while (0)
+#else
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END() do { } while (0)
+#endif
+
+#endif //RAYTRACER_TRACE_H
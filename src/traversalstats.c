@@ -0,0 +1,120 @@
+#include "traversalstats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/image.h"
+#include "utils/math.h"
+
+#define TRAVERSALSTATS_COUNTER_COUNT 5
+// buckets of powers of two, the last one holds everything above
+#define TRAVERSALSTATS_BUCKET_COUNT 20
+#define TRAVERSALSTATS_PATH_SIZE 1024
+// the heatmap is scaled to this percentile, so single expensive pixels don't hide everything else
+#define TRAVERSALSTATS_SCALE_PERCENTILE 0.99
+
+static const char* traversalstats_names[TRAVERSALSTATS_COUNTER_COUNT] = {
+	"nodes", "boxes", "spheres", "triangles", "shadowrays"
+};
+
+static uint32_t traversalstats_get(TraversalStats* stats, uint32_t counter) {
+	switch (counter) {
+	case 0: return stats->nodesVisited;
+	case 1: return stats->boxTests;
+	case 2: return stats->sphereTests;
+	case 3: return stats->triangleTests;
+	default: return stats->shadowRays;
+	}
+}
+
+static int traversalstats_compare(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+// blue for little work over cyan, green and yellow to red for a lot of work
+static uint32_t traversalstats_color(float t) {
+	const float stops[5][3] = {
+		{ 0.0f, 0.0f, 0.5f }, { 0.0f, 0.5f, 1.0f }, { 0.0f, 1.0f, 0.5f }, { 1.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }
+	};
+	t = math_clamp(t, 0.0f, 1.0f) * 4.0f;
+	uint32_t index = MIN((uint32_t) t, 3);
+	float f = t - (float) index;
+	uint32_t color = 0xFF000000u;
+	for (uint32_t i = 0; i < 3; i++) {
+		float channel = stops[index][i] + (stops[index + 1][i] - stops[index][i]) * f;
+		color |= (uint32_t) (channel * 255.0f) << (8 * i);
+	}
+	return color;
+}
+
+bool traversalstats_writeReport(const char* prefix, TraversalStats* stats, uint32_t width, uint32_t height) {
+	uint32_t pixelCount = width * height;
+	uint32_t* values = malloc(sizeof(uint32_t) * pixelCount);
+	Image* image = image_create(width, height);
+	char path[TRAVERSALSTATS_PATH_SIZE];
+	snprintf(path, sizeof(path), "%s_histograms.txt", prefix);
+	FILE* file = fopen(path, "w");
+	if (!values || !image || !file) {
+		printf("Couldn't write the traversal stats to %s.\n", path);
+		free(values);
+		if (image) {
+			image_destroy(image);
+		}
+		if (file) {
+			fclose(file);
+		}
+		return false;
+	}
+
+	bool success = true;
+	for (uint32_t counter = 0; counter < TRAVERSALSTATS_COUNTER_COUNT; counter++) {
+		uint64_t sum = 0;
+		uint32_t buckets[TRAVERSALSTATS_BUCKET_COUNT] = { 0 };
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			values[i] = traversalstats_get(&stats[i], counter);
+			sum += values[i];
+			// bucket 0 holds 0, bucket n holds [2^(n-1), 2^n)
+			uint32_t bucket = 0;
+			for (uint32_t value = values[i]; value > 0 && bucket < TRAVERSALSTATS_BUCKET_COUNT - 1; value >>= 1) {
+				bucket++;
+			}
+			buckets[bucket]++;
+		}
+
+		qsort(values, pixelCount, sizeof(uint32_t), traversalstats_compare);
+		uint32_t scale = MAX(values[(uint32_t) ((double) (pixelCount - 1) * TRAVERSALSTATS_SCALE_PERCENTILE)], 1);
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			image->buffer[i] = traversalstats_color((float) traversalstats_get(&stats[i], counter) / (float) scale);
+		}
+		char imagePath[TRAVERSALSTATS_PATH_SIZE];
+		snprintf(imagePath, sizeof(imagePath), "%s_%s.bmp", prefix, traversalstats_names[counter]);
+		success = bitmap_save_image(imagePath, image) && success;
+
+		fprintf(file, "%s: total %llu, mean %.2f, median %u, p90 %u, p99 %u, max %u (heatmap scaled to %u)\n",
+			traversalstats_names[counter], (unsigned long long) sum, (double) sum / (double) pixelCount,
+			values[pixelCount / 2], values[(uint32_t) ((double) (pixelCount - 1) * 0.9)], values[(uint32_t) ((double) (pixelCount - 1) * 0.99)],
+			values[pixelCount - 1], scale);
+		for (uint32_t i = 0; i < TRAVERSALSTATS_BUCKET_COUNT; i++) {
+			if (buckets[i] == 0) {
+				continue;
+			}
+			if (i == 0) {
+				fprintf(file, "  %10u: %u\n", 0, buckets[i]);
+			} else if (i == TRAVERSALSTATS_BUCKET_COUNT - 1) {
+				fprintf(file, "  %10u+: %u\n", 1u << (i - 1), buckets[i]);
+			} else {
+				fprintf(file, "  %4u-%5u: %u\n", 1u << (i - 1), (1u << i) - 1, buckets[i]);
+			}
+		}
+	}
+	fclose(file);
+	image_destroy(image);
+	free(values);
+	if (success) {
+		printf("Wrote the traversal stats to %s_*.\n", prefix);
+	}
+	return success;
+}
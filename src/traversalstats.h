@@ -0,0 +1,31 @@
+#ifndef RAYTRACER_TRAVERSALSTATS_H
+#define RAYTRACER_TRAVERSALSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Counts the work of the traversal per pixel on the CPU and in the kernel.
+ * The counters are only compiled in with ENABLE_TRAVERSAL_STATS.
+ */
+
+// the layout has to match TraversalStats in kernel.cl
+typedef struct {
+	// nodes, whose bounding box was hit
+	uint32_t nodesVisited;
+	uint32_t boxTests;
+	uint32_t sphereTests;
+	uint32_t triangleTests;
+	uint32_t shadowRays;
+} TraversalStats;
+
+#ifdef ENABLE_TRAVERSAL_STATS
+#define TRAVERSALSTATS_ADD(stats, counter, value) do { if (stats) (stats)->counter += (value); } while (0)
+#else
+#define TRAVERSALSTATS_ADD(stats, counter, value) do { (void) (stats); } while (0)
+#endif
+
+// writes a false color heatmap <prefix>_<counter>.bmp per counter and the histograms to <prefix>_histograms.txt
+bool traversalstats_writeReport(const char* prefix, TraversalStats* stats, uint32_t width, uint32_t height);
+
+#endif //RAYTRACER_TRAVERSALSTATS_H
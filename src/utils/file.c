@@ -1,8 +1,20 @@
 #include "file.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-const char* file_readFile(const char* filepath, size_t* fileSize)
+#ifdef _WIN32
+#include <process.h>
+#define file_getProcessId _getpid
+#else
+#include <unistd.h>
+#define file_getProcessId getpid
+#endif
+
+// a dot, the pid and .tmp
+#define FILE_TMP_SUFFIX_SIZE 32
+
+char* file_readFile(const char* filepath, size_t* fileSize)
 {
     FILE* file;
     char* data;
@@ -30,3 +42,37 @@ const char* file_readFile(const char* filepath, size_t* fileSize)
     *fileSize = size + 1;
     return data;
 }
+
+bool file_writeFile(const char* filepath, const void* data, size_t size)
+{
+    size_t tmpFilepathSize = strlen(filepath) + FILE_TMP_SUFFIX_SIZE;
+    char* tmpFilepath = malloc(tmpFilepathSize);
+    if (tmpFilepath == NULL) {
+        return false;
+    }
+    snprintf(tmpFilepath, tmpFilepathSize, "%s.%ld.tmp", filepath, (long) file_getProcessId());
+
+    FILE* file = fopen(tmpFilepath, "wb");
+    if (file == NULL) {
+        free(tmpFilepath);
+        return false;
+    }
+    size_t written = fwrite(data, 1, size, file);
+    int err = fclose(file);
+    if (written != size || err != 0) {
+        remove(tmpFilepath);
+        free(tmpFilepath);
+        return false;
+    }
+#ifdef _WIN32
+    // rename doesn't replace existing files on windows
+    remove(filepath);
+#endif
+    // on POSIX the target is replaced atomically, readers see either the old or the new file
+    bool success = rename(tmpFilepath, filepath) == 0;
+    if (!success) {
+        remove(tmpFilepath);
+    }
+    free(tmpFilepath);
+    return success;
+}
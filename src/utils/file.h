@@ -3,6 +3,13 @@
 
 #include <stdio.h>
 
-const char* file_readFile(const char* filepath, size_t* fileSize);
+#include <stdbool.h>
+
+// the data has a zero terminator, which fileSize counts, and has to be freed
+char* file_readFile(const char* filepath, size_t* fileSize);
+// writes the data to a temporary file first and renames it afterwards,
+// so that other processes never see a partially written file. The temporary file has the pid in its name,
+// so processes writing the same file at the same time don't write into each other's temporary file.
+bool file_writeFile(const char* filepath, const void* data, size_t size);
 
 #endif //RAYTRACER_FILE_H
@@ -1,6 +1,7 @@
 #include "image.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 Image* image_create(uint32_t width, uint32_t height) {
     Image* image = malloc(sizeof(Image));
@@ -22,7 +23,7 @@ void image_destroy(Image *image) {
     free(image);
 }
 
-bool bitmap_save_image(const char* path, Image* image) {
+static void bitmap_init_headers(Image* image, BitmapFileHeader* fileHeader, BitmapInfoHeader* infoHeader) {
     BitmapFileHeader bitmapFileHeader = {0};
     bitmapFileHeader.bfType = 0x4d42; // ASCII "BM"
     bitmapFileHeader.bfSize = (uint32_t) (sizeof(BitmapFileHeader) + sizeof(BitmapInfoHeader) + image->bufferSize);
@@ -41,6 +42,22 @@ bool bitmap_save_image(const char* path, Image* image) {
     bitmapInfoHeader.biYPelsPerMeter = 0;
     bitmapInfoHeader.biClrUsed = 0;
     bitmapInfoHeader.biClrImportant = 0;
+    *fileHeader = bitmapFileHeader;
+    *infoHeader = bitmapInfoHeader;
+}
+
+// Note: The bitmap format has the following LE byteorder:
+// 0xAARRGGBB <- BGRA
+// OpenGL uses RGBA color channel order:
+// 0xAABBGGRR <- RGBA
+static uint32_t bitmap_convert_color(uint32_t color) {
+    return (color & 0xFF000000) | (color & 0xFF0000) >> 16 | (color & 0x00FF00) | (color & 0xFF) << 16;
+}
+
+bool bitmap_save_image(const char* path, Image* image) {
+    BitmapFileHeader bitmapFileHeader;
+    BitmapInfoHeader bitmapInfoHeader;
+    bitmap_init_headers(image, &bitmapFileHeader, &bitmapInfoHeader);
 
     FILE* file = fopen(path, "wb");
     if (file == NULL) {
@@ -51,12 +68,7 @@ bool bitmap_save_image(const char* path, Image* image) {
     fwrite(&bitmapInfoHeader, sizeof(BitmapInfoHeader), 1, file);
 	for (uint32_t y = image->height; y-- > 0;) {
 		for (uint32_t x = 0; x < image->width; x++) {
-			uint32_t color = image->buffer[y * image->width + x];
-			// Note: The bitmap format has the following LE byteorder:
-			// 0xAARRGGBB <- BGRA
-			// OpenGL uses RGBA color channel order:
-			// 0xAABBGGRR <- RGBA
-			color = (color & 0xFF000000) | (color & 0xFF0000) >> 16 | (color & 0x00FF00) | (color & 0xFF) << 16;
+			uint32_t color = bitmap_convert_color(image->buffer[y * image->width + x]);
 			fwrite(&color, 4, 1, file);
 		}
     }
@@ -64,3 +76,25 @@ bool bitmap_save_image(const char* path, Image* image) {
 
     return true;
 }
+
+uint8_t* bitmap_encode_image(Image* image, size_t* size) {
+    BitmapFileHeader bitmapFileHeader;
+    BitmapInfoHeader bitmapInfoHeader;
+    bitmap_init_headers(image, &bitmapFileHeader, &bitmapInfoHeader);
+    uint8_t* data = malloc(bitmapFileHeader.bfSize);
+    if (data == NULL) {
+        return NULL;
+    }
+    memcpy(data, &bitmapFileHeader, sizeof(BitmapFileHeader));
+    memcpy(data + sizeof(BitmapFileHeader), &bitmapInfoHeader, sizeof(BitmapInfoHeader));
+    uint8_t* pixels = data + bitmapFileHeader.bfOffBits;
+    for (uint32_t y = image->height; y-- > 0;) {
+        for (uint32_t x = 0; x < image->width; x++) {
+            uint32_t color = bitmap_convert_color(image->buffer[y * image->width + x]);
+            memcpy(pixels, &color, 4);
+            pixels += 4;
+        }
+    }
+    *size = bitmapFileHeader.bfSize;
+    return data;
+}
@@ -38,5 +38,7 @@ typedef struct {
 #pragma pack(pop)
 
 bool bitmap_save_image(const char* path, Image* image);
+// the bytes of the bitmap file, which have to be freed, e.g. for file_writeFile
+uint8_t* bitmap_encode_image(Image* image, size_t* size);
 
 #endif //RAYTRACER_IMAGE_H
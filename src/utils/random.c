@@ -8,4 +8,21 @@ float random_unilateral() {
 
 float random_bilateral() {
     return -1.0f + 2.0f * random_unilateral();
-}
\ No newline at end of file
+}
+
+uint64_t random_xorshift128plus(seed128bit* seed) {
+    uint64_t x = seed->x;
+    uint64_t y = seed->y;
+    seed->x = y;
+    x ^= x << 23;
+    seed->y = x ^ y ^ (x >> 17) ^ (y >> 26);
+    return seed->y + y;
+}
+
+float random_unilateralSeeded(seed128bit* seed) {
+    return (float) (random_xorshift128plus(seed) % (1 << 17)) / (float) (1 << 17);
+}
+
+float random_bilateralSeeded(seed128bit* seed) {
+    return -1.0f + 2.0f * random_unilateralSeeded(seed);
+}
@@ -11,4 +11,9 @@ typedef struct {
 float random_unilateral(void);
 float random_bilateral(void);
 
+// the generator of the kernel, so the CPU tracer draws the same numbers from the same seed
+uint64_t random_xorshift128plus(seed128bit* seed);
+float random_unilateralSeeded(seed128bit* seed);
+float random_bilateralSeeded(seed128bit* seed);
+
 #endif //RAYTRACER_RANDOM_H
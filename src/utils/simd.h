@@ -0,0 +1,250 @@
+#ifndef RAYTRACER_SIMD_H
+#define RAYTRACER_SIMD_H
+
+#include "utils/vec3.h"
+
+/*
+ * Vectors of 4 and 8 floats, which map to SSE and AVX registers, if the compiler targets them, and to loops otherwise.
+ * Vec3x8 holds 8 Vec3 as one vector per component, so an operation on all of them is one instruction per component.
+ * The exact operations give the same results as the Vec3 functions, only the Fast variants trade accuracy for speed.
+ * They are used by the triangle box overlap test of accel.c, the traversal and the normals of the CPU tracer
+ * and the SSE box test of intersectbench.c.
+ */
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SIMD_USE_SSE
+#include <xmmintrin.h>
+#endif
+#ifdef __AVX__
+#define SIMD_USE_AVX
+#include <immintrin.h>
+#endif
+
+typedef union {
+#ifdef SIMD_USE_SSE
+    __m128 m;
+#endif
+    _Alignas(16) float v[4];
+    struct {
+        float x, y, z, w;
+    };
+} Vec4;
+
+typedef union {
+#ifdef SIMD_USE_AVX
+    __m256 m;
+#endif
+    Vec4 halves[2];
+    float v[8];
+} Vec8;
+
+typedef struct {
+    Vec8 x;
+    Vec8 y;
+    Vec8 z;
+} Vec3x8;
+
+static inline Vec4 vec4_fromVec3(Vec3 a, float w) {
+    Vec4 result;
+#ifdef SIMD_USE_SSE
+    // filling the register directly, single float stores followed by a vector load stall the store forwarding
+    result.m = _mm_set_ps(w, a.z, a.y, a.x);
+#else
+    result.x = a.x;
+    result.y = a.y;
+    result.z = a.z;
+    result.w = w;
+#endif
+    return result;
+}
+
+static inline Vec4 vec4_set1(float a) {
+    Vec4 result;
+#ifdef SIMD_USE_SSE
+    result.m = _mm_set1_ps(a);
+#else
+    for (int i = 0; i < 4; i++) {
+        result.v[i] = a;
+    }
+#endif
+    return result;
+}
+
+static inline Vec4 vec4_add(Vec4 a, Vec4 b) {
+#ifdef SIMD_USE_SSE
+    a.m = _mm_add_ps(a.m, b.m);
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] += b.v[i];
+    }
+#endif
+    return a;
+}
+
+static inline Vec4 vec4_sub(Vec4 a, Vec4 b) {
+#ifdef SIMD_USE_SSE
+    a.m = _mm_sub_ps(a.m, b.m);
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] -= b.v[i];
+    }
+#endif
+    return a;
+}
+
+static inline Vec4 vec4_mul(Vec4 a, Vec4 b) {
+#ifdef SIMD_USE_SSE
+    a.m = _mm_mul_ps(a.m, b.m);
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] *= b.v[i];
+    }
+#endif
+    return a;
+}
+
+// per component, like the ternaries of the scalar code the second value is returned for NaN
+static inline Vec4 vec4_min(Vec4 a, Vec4 b) {
+#ifdef SIMD_USE_SSE
+    a.m = _mm_min_ps(a.m, b.m);
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    }
+#endif
+    return a;
+}
+
+static inline Vec4 vec4_max(Vec4 a, Vec4 b) {
+#ifdef SIMD_USE_SSE
+    a.m = _mm_max_ps(a.m, b.m);
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    }
+#endif
+    return a;
+}
+
+// 1 / a with about 22 correct bits, the hardware estimate refined by one Newton step
+static inline Vec4 vec4_rcpFast(Vec4 a) {
+#ifdef SIMD_USE_SSE
+    __m128 estimate = _mm_rcp_ps(a.m);
+    a.m = _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(2.0f), _mm_mul_ps(a.m, estimate)));
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = 1.0f / a.v[i];
+    }
+#endif
+    return a;
+}
+
+// 1 / sqrt(a) with about 22 correct bits
+static inline Vec4 vec4_rsqrtFast(Vec4 a) {
+#ifdef SIMD_USE_SSE
+    __m128 estimate = _mm_rsqrt_ps(a.m);
+    __m128 halfA = _mm_mul_ps(a.m, _mm_set1_ps(0.5f));
+    a.m = _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfA, _mm_mul_ps(estimate, estimate))));
+#else
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = 1.0f / sqrtf(a.v[i]);
+    }
+#endif
+    return a;
+}
+
+// vec3_norm with vec4_rsqrtFast, the length of the result is 1 within a few units in the last place
+static inline Vec3 vec3_normFast(Vec3 a) {
+    float lengthSquared = a.x * a.x + a.y * a.y + a.z * a.z;
+    if (lengthSquared == 0.0f) {
+        return a;
+    }
+    return vec3_mul(a, vec4_rsqrtFast(vec4_set1(lengthSquared)).x);
+}
+
+// the smallest and largest of x, y and z
+static inline float vec4_minXYZ(Vec4 a) {
+    float xy = a.x < a.y ? a.x : a.y;
+    return xy < a.z ? xy : a.z;
+}
+
+static inline float vec4_maxXYZ(Vec4 a) {
+    float xy = a.x > a.y ? a.x : a.y;
+    return xy > a.z ? xy : a.z;
+}
+
+static inline Vec8 vec8_set1(float a) {
+    Vec8 result;
+#ifdef SIMD_USE_AVX
+    result.m = _mm256_set1_ps(a);
+#else
+    result.halves[0] = vec4_set1(a);
+    result.halves[1] = result.halves[0];
+#endif
+    return result;
+}
+
+static inline Vec8 vec8_add(Vec8 a, Vec8 b) {
+#ifdef SIMD_USE_AVX
+    a.m = _mm256_add_ps(a.m, b.m);
+#else
+    a.halves[0] = vec4_add(a.halves[0], b.halves[0]);
+    a.halves[1] = vec4_add(a.halves[1], b.halves[1]);
+#endif
+    return a;
+}
+
+static inline Vec8 vec8_mul(Vec8 a, Vec8 b) {
+#ifdef SIMD_USE_AVX
+    a.m = _mm256_mul_ps(a.m, b.m);
+#else
+    a.halves[0] = vec4_mul(a.halves[0], b.halves[0]);
+    a.halves[1] = vec4_mul(a.halves[1], b.halves[1]);
+#endif
+    return a;
+}
+
+// the smallest and largest of the 8 values, NaN are skipped
+static inline void vec8_getRange(Vec8 a, float* min, float* max) {
+    *min = INFINITY;
+    *max = -INFINITY;
+    for (int i = 0; i < 8; i++) {
+        if (a.v[i] < *min) {
+            *min = a.v[i];
+        }
+        if (a.v[i] > *max) {
+            *max = a.v[i];
+        }
+    }
+}
+
+static inline Vec3x8 vec3x8_fromVec3(const Vec3 points[8]) {
+    Vec3x8 result;
+#ifdef SIMD_USE_AVX
+    result.x.m = _mm256_set_ps(points[7].x, points[6].x, points[5].x, points[4].x, points[3].x, points[2].x, points[1].x, points[0].x);
+    result.y.m = _mm256_set_ps(points[7].y, points[6].y, points[5].y, points[4].y, points[3].y, points[2].y, points[1].y, points[0].y);
+    result.z.m = _mm256_set_ps(points[7].z, points[6].z, points[5].z, points[4].z, points[3].z, points[2].z, points[1].z, points[0].z);
+#elif defined(SIMD_USE_SSE)
+    for (int i = 0; i < 2; i++) {
+        const Vec3* p = &points[4 * i];
+        result.x.halves[i].m = _mm_set_ps(p[3].x, p[2].x, p[1].x, p[0].x);
+        result.y.halves[i].m = _mm_set_ps(p[3].y, p[2].y, p[1].y, p[0].y);
+        result.z.halves[i].m = _mm_set_ps(p[3].z, p[2].z, p[1].z, p[0].z);
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        result.x.v[i] = points[i].x;
+        result.y.v[i] = points[i].y;
+        result.z.v[i] = points[i].z;
+    }
+#endif
+    return result;
+}
+
+// the dot products of the 8 vectors with b, summed in the order of vec3_dot
+static inline Vec8 vec3x8_dot(const Vec3x8* a, Vec3 b) {
+    Vec8 xy = vec8_add(vec8_mul(a->x, vec8_set1(b.x)), vec8_mul(a->y, vec8_set1(b.y)));
+    return vec8_add(xy, vec8_mul(a->z, vec8_set1(b.z)));
+}
+
+#endif //RAYTRACER_SIMD_H
@@ -0,0 +1,227 @@
+#ifndef _WIN32
+// for getaddrinfo
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "socket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+// the coordinator waits for up to 64 workers and the listener, winsock counts sockets and not their values
+#define FD_SETSIZE 128
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int SocketLength;
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef socklen_t SocketLength;
+#endif
+
+// a closed connection raises SIGPIPE on send otherwise
+#ifdef MSG_NOSIGNAL
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SOCKET_SEND_FLAGS 0
+#endif
+
+#define SOCKET_BACKLOG 16
+// send and recv take an int on windows
+#define SOCKET_MAX_CHUNK ((size_t) 1 << 30)
+
+// the tiles are small messages, which shouldn't wait for more data
+static void socket_disableDelay(SocketHandle handle) {
+	int enable = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*) &enable, sizeof(enable));
+#ifdef SO_NOSIGPIPE
+	setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, (const char*) &enable, sizeof(enable));
+#endif
+}
+
+bool socket_init(void) {
+#ifdef _WIN32
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+	return true;
+#endif
+}
+
+void socket_cleanup(void) {
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+SocketHandle socket_listen(uint16_t port) {
+	SocketHandle listener = (SocketHandle) socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == SOCKET_INVALID) {
+		return SOCKET_INVALID;
+	}
+	// a restarted coordinator can use the port again right away
+	int enable = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*) &enable, sizeof(enable));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, SOCKET_BACKLOG) != 0) {
+		printf("Couldn't listen on port %u.\n", port);
+		socket_close(listener);
+		return SOCKET_INVALID;
+	}
+	return listener;
+}
+
+SocketHandle socket_accept(SocketHandle listener) {
+	SocketHandle handle = (SocketHandle) accept(listener, NULL, NULL);
+	if (handle != SOCKET_INVALID) {
+		socket_disableDelay(handle);
+	}
+	return handle;
+}
+
+SocketHandle socket_connect(const char* host, uint16_t port) {
+	char service[16];
+	snprintf(service, sizeof(service), "%u", port);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* addresses = NULL;
+	if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+		printf("Couldn't resolve %s.\n", host);
+		return SOCKET_INVALID;
+	}
+
+	SocketHandle result = SOCKET_INVALID;
+	for (struct addrinfo* address = addresses; address && result == SOCKET_INVALID; address = address->ai_next) {
+		SocketHandle candidate = (SocketHandle) socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (candidate == SOCKET_INVALID) {
+			continue;
+		}
+		if (connect(candidate, address->ai_addr, (SocketLength) address->ai_addrlen) == 0) {
+			result = candidate;
+		} else {
+			socket_close(candidate);
+		}
+	}
+	freeaddrinfo(addresses);
+	if (result != SOCKET_INVALID) {
+		socket_disableDelay(result);
+	}
+	return result;
+}
+
+bool socket_setTimeout(SocketHandle handle, uint32_t timeoutMs) {
+#ifdef _WIN32
+	DWORD timeout = timeoutMs;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = (time_t) (timeoutMs / 1000);
+	timeout.tv_usec = (suseconds_t) ((timeoutMs % 1000) * 1000);
+#endif
+	return setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout, sizeof(timeout)) == 0
+		&& setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, (const char*) &timeout, sizeof(timeout)) == 0;
+}
+
+bool socket_sendAll(SocketHandle handle, const void* data, size_t size) {
+	const char* bytes = data;
+	while (size > 0) {
+		size_t chunk = size < SOCKET_MAX_CHUNK ? size : SOCKET_MAX_CHUNK;
+		int sent = (int) send(handle, bytes, (SocketLength) chunk, SOCKET_SEND_FLAGS);
+		if (sent <= 0) {
+			return false;
+		}
+		bytes += sent;
+		size -= (size_t) sent;
+	}
+	return true;
+}
+
+bool socket_receiveAll(SocketHandle handle, void* data, size_t size) {
+	char* bytes = data;
+	while (size > 0) {
+		size_t chunk = size < SOCKET_MAX_CHUNK ? size : SOCKET_MAX_CHUNK;
+		int received = (int) recv(handle, bytes, (SocketLength) chunk, 0);
+		if (received <= 0) {
+			return false;
+		}
+		bytes += received;
+		size -= (size_t) received;
+	}
+	return true;
+}
+
+bool socket_receive(SocketHandle handle, void* data, size_t size, size_t* received) {
+	size_t chunk = size < SOCKET_MAX_CHUNK ? size : SOCKET_MAX_CHUNK;
+	int result = (int) recv(handle, data, (SocketLength) chunk, 0);
+	if (result <= 0) {
+		return false;
+	}
+	*received = (size_t) result;
+	return true;
+}
+
+#ifdef _WIN32
+bool socket_waitReadable(const SocketHandle* sockets, uint32_t count, uint32_t timeoutMs, bool* isReadable) {
+	if (count > FD_SETSIZE) {
+		printf("Can't wait for more than %u sockets.\n", FD_SETSIZE);
+		return false;
+	}
+	fd_set readable;
+	FD_ZERO(&readable);
+	for (uint32_t i = 0; i < count; i++) {
+		FD_SET(sockets[i], &readable);
+	}
+	struct timeval timeout;
+	timeout.tv_sec = (long) (timeoutMs / 1000);
+	timeout.tv_usec = (long) ((timeoutMs % 1000) * 1000);
+	// winsock ignores the first argument
+	if (select(0, &readable, NULL, NULL, &timeout) < 0) {
+		return false;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		isReadable[i] = FD_ISSET(sockets[i], &readable) != 0;
+	}
+	return true;
+}
+#else
+// poll instead of select, which can't take descriptors from FD_SETSIZE on
+bool socket_waitReadable(const SocketHandle* sockets, uint32_t count, uint32_t timeoutMs, bool* isReadable) {
+	struct pollfd* descriptors = malloc(sizeof(struct pollfd) * count);
+	if (!descriptors) {
+		return false;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		descriptors[i].fd = sockets[i];
+		descriptors[i].events = POLLIN;
+		descriptors[i].revents = 0;
+	}
+	bool success = poll(descriptors, (nfds_t) count, (int) timeoutMs) >= 0;
+	for (uint32_t i = 0; success && i < count; i++) {
+		// a closed or failed connection is readable as well, the next receive reports it
+		isReadable[i] = (descriptors[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) != 0;
+	}
+	free(descriptors);
+	return success;
+}
+#endif
+
+void socket_close(SocketHandle handle) {
+#ifdef _WIN32
+	closesocket(handle);
+#else
+	close(handle);
+#endif
+}
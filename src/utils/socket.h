@@ -0,0 +1,38 @@
+#ifndef RAYTRACER_SOCKET_H
+#define RAYTRACER_SOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// blocking TCP sockets on top of winsock or the BSD sockets
+#ifdef _WIN32
+typedef uintptr_t SocketHandle;
+#else
+typedef int SocketHandle;
+#endif
+
+#define SOCKET_INVALID ((SocketHandle) -1)
+
+// has to be called before any other socket function
+bool socket_init(void);
+void socket_cleanup(void);
+
+// listens on all interfaces
+SocketHandle socket_listen(uint16_t port);
+SocketHandle socket_accept(SocketHandle listener);
+SocketHandle socket_connect(const char* host, uint16_t port);
+// send and receive time out after timeoutMs, 0 waits forever
+bool socket_setTimeout(SocketHandle handle, uint32_t timeoutMs);
+bool socket_sendAll(SocketHandle handle, const void* data, size_t size);
+// returns false, if the connection was closed or timed out before size bytes arrived
+bool socket_receiveAll(SocketHandle handle, void* data, size_t size);
+// receives at most size bytes with a single call, which doesn't block after socket_waitReadable,
+// returns false, if the connection was closed
+bool socket_receive(SocketHandle handle, void* data, size_t size, size_t* received);
+// waits up to timeoutMs until one of the sockets can be read without blocking,
+// sets isReadable for every socket and returns false on errors
+bool socket_waitReadable(const SocketHandle* sockets, uint32_t count, uint32_t timeoutMs, bool* isReadable);
+void socket_close(SocketHandle handle);
+
+#endif //RAYTRACER_SOCKET_H
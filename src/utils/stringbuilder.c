@@ -32,7 +32,7 @@ void stringbuilder_append(StringBuilder* builder, const char* str) {
 	builder->length += addedLength;
 }
 
-const char* stringbuilder_cstr(StringBuilder* builder) {
+char* stringbuilder_cstr(StringBuilder* builder) {
 	char* retStr = malloc(sizeof(char) * builder->length);
 	memcpy(retStr, builder->buffer, builder->length);
 	return retStr;
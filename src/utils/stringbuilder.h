@@ -16,7 +16,7 @@ void stringbuilder_append(StringBuilder* builder, const char* str);
 
 // creates a copy of the internal buffer and returns it
 // caller has to cleanup the memory of the returned cstr
-const char* stringbuilder_cstr(StringBuilder* builder);
+char* stringbuilder_cstr(StringBuilder* builder);
 
 void stringbuilder_destroy(StringBuilder* builder);
 
@@ -1,10 +1,13 @@
 #include "vertextable.h"
 
+#include "memstats.h"
+
 VertexTable* vertextable_create() {
     VertexTable* vertexTable = malloc(sizeof(VertexTable));
     vertexTable->size = 0;
     vertexTable->capacity = 200;
     vertexTable->vertices = malloc(sizeof(Vec3) * vertexTable->capacity);
+    memstats_allocate(MEMSTATS_OBJECT_LOAD, sizeof(Vec3) * vertexTable->capacity);
     return vertexTable;
 }
 
@@ -12,6 +15,7 @@ void vertextable_addVertex(VertexTable *vertexTable, Vec3 vertex) {
     if (vertexTable->capacity < vertexTable->size + 1) {
         vertexTable->capacity *= 2;
         vertexTable->vertices = realloc(vertexTable->vertices, sizeof(Vec3) * vertexTable->capacity);
+        memstats_reallocate(MEMSTATS_OBJECT_LOAD, sizeof(Vec3) * vertexTable->capacity / 2, sizeof(Vec3) * vertexTable->capacity);
     }
     vertexTable->vertices[vertexTable->size++] = vertex;
 }
@@ -23,6 +27,7 @@ Vec3 vertextable_getVertexById(VertexTable *vertexTable, uint32_t id) {
 
 void vertextable_destroy(VertexTable *vertexTable) {
     if (vertexTable != NULL) {
+        memstats_free(MEMSTATS_OBJECT_LOAD, sizeof(Vec3) * vertexTable->capacity);
         free(vertexTable->vertices);
         free(vertexTable);
     }
@@ -0,0 +1,204 @@
+#include "visibility.h"
+
+#include <float.h>
+#include <stdlib.h>
+
+#include "utils/math.h"
+
+// primitives with a point closer to the plane of the camera than this may cover any sample
+#define VISIBILITY_NEAR_DEPTH 0.0001f
+
+// the pixels, whose samples may see a primitive, both corners are inside
+typedef struct {
+	uint32_t minX;
+	uint32_t minY;
+	uint32_t maxX;
+	uint32_t maxY;
+} VisibilityRect;
+
+VisibilityBuffer* visibility_create(void) {
+	return calloc(1, sizeof(VisibilityBuffer));
+}
+
+void visibility_destroy(VisibilityBuffer* buffer) {
+	free(buffer->primitives);
+	free(buffer->depths);
+	free(buffer->directions);
+	free(buffer);
+}
+
+static bool visibility_intersect(Scene* scene, uint32_t primitive, Ray* ray, float* hitDistance, Vec3* intersectionNormal,
+	uint32_t* hitMaterialIndex) {
+	uint32_t index = primitive & VISIBILITY_INDEX_MASK;
+	switch (primitive & VISIBILITY_TYPE_MASK) {
+		case VISIBILITY_PLANE:
+			*hitMaterialIndex = scene->planes[index].materialIndex;
+			return raytracer_intersectPlane(&scene->planes[index], ray, hitDistance, intersectionNormal);
+		case VISIBILITY_SPHERE:
+			*hitMaterialIndex = scene->spheres[index].materialIndex;
+			return raytracer_intersectSphere(&scene->spheres[index], ray, hitDistance, intersectionNormal);
+		case VISIBILITY_TRIANGLE:
+			*hitMaterialIndex = scene->triangles[index].materialIndex;
+			return raytracer_intersectTriangle(&scene->triangles[index], ray, hitDistance, intersectionNormal);
+		default:
+			return false;
+	}
+}
+
+static VisibilityRect visibility_getScreen(Camera* camera) {
+	return (VisibilityRect) { 0, 0, camera->width - 1, camera->height - 1 };
+}
+
+// projects the points onto the render target like raytracer_createPinholeSampleRay in reverse
+static VisibilityRect visibility_getBounds(Camera* camera, const Vec3* points, uint32_t pointCount) {
+	float minX = FLT_MAX;
+	float minY = FLT_MAX;
+	float maxX = -FLT_MAX;
+	float maxY = -FLT_MAX;
+	for (uint32_t i = 0; i < pointCount; i++) {
+		Vec3 relative = vec3_sub(points[i], camera->position);
+		// the camera looks along -z
+		float depth = -vec3_dot(relative, camera->z);
+		if (depth < VISIBILITY_NEAR_DEPTH) {
+			return visibility_getScreen(camera);
+		}
+		float scale = camera->renderTargetDistance / depth;
+		// -1 to 1 on the render target, y is flipped
+		float screenX = vec3_dot(relative, camera->x) * scale / (camera->renderTargetWidth / 2.0f);
+		float screenY = -vec3_dot(relative, camera->y) * scale / (camera->renderTargetHeight / 2.0f);
+		minX = MIN(minX, screenX);
+		minY = MIN(minY, screenY);
+		maxX = MAX(maxX, screenX);
+		maxY = MAX(maxY, screenY);
+	}
+	// the samples of pixel x are between -1 + (2x - 1) / width and -1 + 2x / width,
+	// one more pixel on every side absorbs the rounding of the projection
+	float width = (float) camera->width;
+	float height = (float) camera->height;
+	float firstX = floorf((minX + 1.0f) * width / 2.0f) - 1.0f;
+	float firstY = floorf((minY + 1.0f) * height / 2.0f) - 1.0f;
+	float lastX = ceilf((maxX + 1.0f) * width / 2.0f + 0.5f) + 1.0f;
+	float lastY = ceilf((maxY + 1.0f) * height / 2.0f + 0.5f) + 1.0f;
+	if (lastX < 0.0f || lastY < 0.0f || firstX > width - 1.0f || firstY > height - 1.0f) {
+		// off screen, an empty rect
+		return (VisibilityRect) { 1, 1, 0, 0 };
+	}
+	return (VisibilityRect) {
+		(uint32_t) MAX(firstX, 0.0f),
+		(uint32_t) MAX(firstY, 0.0f),
+		(uint32_t) MIN(lastX, width - 1.0f),
+		(uint32_t) MIN(lastY, height - 1.0f)
+	};
+}
+
+// the depth test of the primitive against every sample of the pixels in rect
+static void visibility_rasterize(VisibilityBuffer* buffer, Scene* scene, uint32_t primitive, VisibilityRect rect) {
+	Ray ray;
+	ray.origin = scene->camera->position;
+	for (uint32_t y = rect.minY * buffer->raysPerHeightPixel; y < (rect.maxY + 1) * buffer->raysPerHeightPixel && rect.minY <= rect.maxY; y++) {
+		for (uint32_t x = rect.minX * buffer->raysPerWidthPixel; x < (rect.maxX + 1) * buffer->raysPerWidthPixel && rect.minX <= rect.maxX; x++) {
+			uint32_t index = y * buffer->width + x;
+			ray.direction = buffer->directions[index];
+			float hitDistance;
+			Vec3 intersectionNormal;
+			uint32_t hitMaterialIndex;
+			if (visibility_intersect(scene, primitive, &ray, &hitDistance, &intersectionNormal, &hitMaterialIndex)
+				&& hitDistance < buffer->depths[index]) {
+				buffer->depths[index] = hitDistance;
+				buffer->primitives[index] = primitive;
+			}
+		}
+	}
+}
+
+bool visibility_render(VisibilityBuffer* buffer, Scene* scene, RaytracerSampling* sampling) {
+	Camera* camera = scene->camera;
+	if (camera->apertureSize != 0.0f) {
+		return false;
+	}
+	buffer->raysPerWidthPixel = sampling->raysPerWidthPixel;
+	buffer->raysPerHeightPixel = sampling->raysPerHeightPixel;
+	buffer->width = camera->width * sampling->raysPerWidthPixel;
+	buffer->height = camera->height * sampling->raysPerHeightPixel;
+	uint32_t sampleCount = buffer->width * buffer->height;
+	if (sampleCount > buffer->capacity) {
+		uint32_t* primitives = realloc(buffer->primitives, sizeof(uint32_t) * sampleCount);
+		if (primitives) {
+			buffer->primitives = primitives;
+		}
+		float* depths = realloc(buffer->depths, sizeof(float) * sampleCount);
+		if (depths) {
+			buffer->depths = depths;
+		}
+		Vec3* directions = realloc(buffer->directions, sizeof(Vec3) * sampleCount);
+		if (directions) {
+			buffer->directions = directions;
+		}
+		if (!primitives || !depths || !directions) {
+			return false;
+		}
+		buffer->capacity = sampleCount;
+	}
+
+	for (uint32_t y = 0; y < camera->height; y++) {
+		for (uint32_t x = 0; x < camera->width; x++) {
+			for (uint32_t j = 0; j < sampling->raysPerHeightPixel; j++) {
+				for (uint32_t i = 0; i < sampling->raysPerWidthPixel; i++) {
+					uint32_t index = (y * sampling->raysPerHeightPixel + j) * buffer->width + x * sampling->raysPerWidthPixel + i;
+					Ray ray = raytracer_createPinholeSampleRay(camera, sampling, x, y, i, j);
+					// the direction raytracer_createSampleRay ends up with without an aperture, so the depth test sees the shaded ray
+					Vec3 focalPoint = vec3_add(ray.origin, vec3_mul(ray.direction, camera->focalLength));
+					buffer->directions[index] = vec3_norm(vec3_sub(focalPoint, ray.origin));
+					buffer->primitives[index] = VISIBILITY_NONE;
+					buffer->depths[index] = FLT_MAX;
+				}
+			}
+		}
+	}
+
+	// in the order of raytracer_intersectScene, so that equal depths keep the same primitive
+	for (uint32_t i = 0; i < scene->planeCount; i++) {
+		visibility_rasterize(buffer, scene, VISIBILITY_PLANE | i, visibility_getScreen(camera));
+	}
+	for (uint32_t i = 0; i < scene->sphereCount; i++) {
+		Sphere* sphere = &scene->spheres[i];
+		// the corners of the bounding box, whose projection contains the one of the sphere
+		Vec3 corners[8];
+		for (uint32_t j = 0; j < 8; j++) {
+			corners[j] = vec3_add(sphere->position, (Vec3) { {
+				j & 1 ? sphere->radius : -sphere->radius,
+				j & 2 ? sphere->radius : -sphere->radius,
+				j & 4 ? sphere->radius : -sphere->radius
+			} });
+		}
+		visibility_rasterize(buffer, scene, VISIBILITY_SPHERE | i, visibility_getBounds(camera, corners, 8));
+	}
+	for (uint32_t i = 0; i < scene->triangleCount; i++) {
+		Triangle* triangle = &scene->triangles[i];
+		Vec3 vertices[3] = { triangle->v0, triangle->v1, triangle->v2 };
+		visibility_rasterize(buffer, scene, VISIBILITY_TRIANGLE | i, visibility_getBounds(camera, vertices, 3));
+	}
+	return true;
+}
+
+Vec3 visibility_renderPixel(VisibilityBuffer* buffer, Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y,
+	seed128bit* seed, TraversalStats* stats) {
+	assert(buffer->raysPerWidthPixel == sampling->raysPerWidthPixel && buffer->raysPerHeightPixel == sampling->raysPerHeightPixel);
+	Vec3 color = { 0 };
+	for (uint32_t j = 0; j < sampling->raysPerHeightPixel; j++) {
+		for (uint32_t i = 0; i < sampling->raysPerWidthPixel; i++) {
+			// draws the same random numbers as raytracer_renderPixel
+			Ray ray = raytracer_createSampleRay(scene->camera, sampling, x, y, i, j, seed);
+			uint32_t primitive = buffer->primitives[(y * sampling->raysPerHeightPixel + j) * buffer->width + x * sampling->raysPerWidthPixel + i];
+			float hitDistance = FLT_MAX;
+			Vec3 intersectionNormal = { 0 };
+			uint32_t hitMaterialIndex = 0;
+			if (primitive != VISIBILITY_NONE) {
+				visibility_intersect(scene, primitive, &ray, &hitDistance, &intersectionNormal, &hitMaterialIndex);
+			}
+			Vec3 rayColor = raytracer_raycastFromHit(scene, accel, &ray, hitDistance, intersectionNormal, hitMaterialIndex, sampling, seed, stats);
+			color = vec3_add(color, vec3_mul(rayColor, sampling->rayColorContribution));
+		}
+	}
+	return vec3_clamp(color, 0.0f, 1.0f);
+}
@@ -0,0 +1,53 @@
+#ifndef RAYTRACER_VISIBILITY_H
+#define RAYTRACER_VISIBILITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/random.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "accel.h"
+#include "traversalstats.h"
+
+/*
+ * Visibility buffer for the primary rays of the CPU tracer. Instead of searching the acceleration structure for every primary ray,
+ * the primitives are rasterized one after another: every triangle and sphere is projected onto the render target and
+ * only the samples inside its screen bounds are tested against it, planes cover every sample. The closest primitive
+ * and its depth are kept per sample. The shading intersects the ray of the sample with its primitive alone and traces
+ * the reflections, refractions and shadows as before, so the colors match raytracer_renderPixel.
+ * This needs a pinhole camera, with an aperture the primary rays don't start at the camera position.
+ */
+
+// the type of a primitive in the upper 2 bits of its id, the index in its scene array in the others
+#define VISIBILITY_NONE 0u
+#define VISIBILITY_PLANE (1u << 30)
+#define VISIBILITY_SPHERE (2u << 30)
+#define VISIBILITY_TRIANGLE (3u << 30)
+#define VISIBILITY_TYPE_MASK (3u << 30)
+#define VISIBILITY_INDEX_MASK (~VISIBILITY_TYPE_MASK)
+
+typedef struct {
+	// the supersamples, raysPerWidthPixel * camera width by raysPerHeightPixel * camera height
+	uint32_t width;
+	uint32_t height;
+	uint32_t raysPerWidthPixel;
+	uint32_t raysPerHeightPixel;
+	uint32_t* primitives;
+	// the distance to the primitive along the primary ray of the sample
+	float* depths;
+	// the normalized directions of the primary rays
+	Vec3* directions;
+	uint32_t capacity;
+} VisibilityBuffer;
+
+VisibilityBuffer* visibility_create(void);
+void visibility_destroy(VisibilityBuffer* buffer);
+// rasterizes the primitives of the scene with the camera and the supersampling, returns false, if the camera has an aperture
+// or the memory for the buffer is missing
+bool visibility_render(VisibilityBuffer* buffer, Scene* scene, RaytracerSampling* sampling);
+// the clamped color of a pixel like raytracer_renderPixel, with the primary hits from the buffer
+Vec3 visibility_renderPixel(VisibilityBuffer* buffer, Scene* scene, Accel* accel, RaytracerSampling* sampling, uint32_t x, uint32_t y,
+	seed128bit* seed, TraversalStats* stats);
+
+#endif //RAYTRACER_VISIBILITY_H